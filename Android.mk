@@ -8,8 +8,14 @@ LOCAL_CFLAGS += -DANDROID_BUILD
 LOCAL_CFLAGS += -Wall
 
 LOCAL_SRC_FILES += host/main.c
+LOCAL_SRC_FILES += host/lua_ta_client.c
+LOCAL_SRC_FILES += host/lua_ta_trace.c
+LOCAL_SRC_FILES += host/lua_ta_stats.c
+LOCAL_SRC_FILES += host/lua_ta_app.c
+LOCAL_SRC_FILES += host/sha256.c
 
 LOCAL_C_INCLUDES := $(LOCAL_PATH)/ta/include \
+		$(LOCAL_PATH)/host/include \
 		$(OPTEE_CLIENT_EXPORT)/include \
 
 LOCAL_SHARED_LIBRARIES := libteec
@@ -0,0 +1,22 @@
+-- Benchmark function on the trusted side: calls of small Lua functions and closures, to measure instruction dispatch
+x=...
+
+local function add(a, b)
+    return a + b
+end
+
+local function counter()
+    local n = 0
+    return function()
+        n = n + 1
+        return n
+    end
+end
+
+local c = counter()
+local sum = 0
+for i = 1, 50000 do
+    sum = add(sum, c())
+end
+
+return sum
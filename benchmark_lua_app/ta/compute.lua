@@ -0,0 +1,10 @@
+-- Benchmark function on the trusted side: a numeric loop to measure interpreter throughput
+x=...
+
+local sum = 0
+for i = 1, 100000 do
+    local sq = i * i
+    sum = sum + (sq - (sq // 7) * 7)  -- sq % 7, as OP_MOD is not supported in the TA
+end
+
+return sum
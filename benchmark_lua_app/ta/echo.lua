@@ -0,0 +1,4 @@
+-- Benchmark function on the trusted side: returns its argument unchanged to measure call and marshalling overhead
+x=...
+
+return x
@@ -0,0 +1,10 @@
+-- Benchmark function on the trusted side: field and global accesses with constant keys, to measure the inline caches
+x=...
+
+local o = {a=1,b=2,c=3,d=4,e=5,f=6,g=7,h=8,i=9,j=10,k=11,l=12,m=13,n=14}
+local s = 0
+for r = 1, 20000 do
+  s = s + o.a + o.d + o.g + o.k + o.n + math.pi // 1 + string.len("x")
+  o.b = s; o.m = r
+end
+return s
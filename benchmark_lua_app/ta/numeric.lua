@@ -0,0 +1,24 @@
+-- Benchmark function on the trusted side: integer and float arithmetic and comparisons in tight loops
+x=...
+
+local acc, seed = 0, 12345
+for i = 1, 20000 do
+    seed = seed * 1103515245 + 12345
+    seed = seed & 0x7fffffff
+    if seed < 1073741824 then acc = acc + 1 else acc = acc - 1 end
+end
+
+local c, a, b = 0, 0, 0
+for i = 1, 50000 do
+    if i < 25000 then c = c + 1 end
+    if i <= 35000 then a = a + 1.5 end
+    b = b * 0.5 + 1.0
+end
+
+local y, h = 1.0, 0.0001
+for i = 1, 20000 do
+    local t = i * h
+    y = y + h * (t * t - y * 0.5)
+end
+
+return acc + c + a + b + y
@@ -0,0 +1,17 @@
+-- Benchmark function on the trusted side: table reads and writes, fields and array parts, to measure instruction dispatch
+x=...
+
+local t = {}
+for i = 1, 1000 do
+    t[i] = i
+end
+
+local p = {x = 0, y = 0}
+for n = 1, 100 do
+    for i = 1, #t do
+        p.x = p.x + t[i]
+        p.y = p.x - p.y
+    end
+end
+
+return p.x + p.y
@@ -1,16 +1,37 @@
 """
-Takes a lua script or a directory of lua files and generates ".luata" files, which have the following format:
+Takes a lua script or a directory of lua files and generates ".luata" files in one of the following formats:
 
-[salt (16 Bytes)][mac (64 Bytes)][nonce (8 Byte)][aes encrypted lua script]
+v1 (default): [salt (16 Bytes)][mac (64 Bytes)][nonce (8 Byte)][aes encrypted lua script]
+    AES-256-CTR, then HMAC-SHA512 over nonce + encrypted script
 
-These files are used to savely transmit scripts to the lua runtime inside the OP_TEE TA.
+v2 (--v2):    [magic "LTA\\x02" (4 Bytes)][salt (16 Bytes)][nonce (12 Bytes)][tag (16 Bytes)][aes encrypted lua script]
+    AES-256-GCM with magic + salt + nonce as additional authenticated data, verified and decrypted in a single pass
+
+v3 (--chunked [chunk size]): [magic "LTA\\x03" (4 Bytes)][salt (16 Bytes)][nonce (8 Bytes)][chunk size (4 Bytes)]
+                             [script length (4 Bytes)] followed by [aes encrypted chunk][tag (16 Bytes)] per chunk
+    AES-256-GCM per chunk with nonce + chunk index as the nonce and the header as additional authenticated data, so the
+    TA can parse each chunk as soon as it is verified. The chunk size defaults to 4096 bytes.
+
+bundle (--bundle):           [magic "LTB\\x01" (4 Bytes)][salt (16 Bytes)][nonce (12 Bytes)][script count (4 Bytes)]
+                             [index, per script: [name (48 Bytes)][offset (4 Bytes)][size (4 Bytes)]][tag (16 Bytes)]
+                             [aes encrypted scripts]
+    All scripts of a directory in a single "app.luatb", sealed as one AES-256-GCM message with header and index as
+    additional authenticated data. The TA verifies the bundle once when it is saved and then runs the scripts in it
+    by name without any further cryptography.
+
+With --compile luac_ta the scripts are compiled to stripped Lua bytecode for the TA first (see host/luac_ta.c), which
+saves the TA from parsing them on every load. The TA only loads bytecode out of these authenticated containers.
+
+These files are used to savely transmit scripts to the lua runtime inside the OP_TEE TA. The TA accepts all formats,
+see ta/include/cryptoutils.h.
 """
 
-import sys
+import argparse
 import os
+import struct
+import subprocess
 
 from Crypto.Cipher import AES
-from Crypto.Util import Counter
 from Crypto.Protocol.KDF import HKDF
 from Crypto.Hash import SHA512, HMAC
 from Crypto.Random import get_random_bytes
@@ -19,15 +40,27 @@ from Crypto.Random import get_random_bytes
 # For testing purposes only, non critical key 
 master_hex = '432A462D4A614E645267556A586E3272357538782F413F4428472B4B62506553'
 
-nonce = get_random_bytes(8)
-salt = get_random_bytes(16)
-
-# generate two keys from the masterkey, one used for encryption, one for generating a mac over the encryped
-key_aes, key_hmac = HKDF(bytes.fromhex(master_hex), 32, salt, SHA512, 2)
+V2_MAGIC = b'LTA\x02'
+V2_INFO = b'luata v2'
+V3_MAGIC = b'LTA\x03'
+V3_INFO = b'luata v3'
+V3_DEFAULT_CHUNK_SIZE = 4096
+V3_MAX_CHUNK_SIZE = 64 * 1024
+BUNDLE_MAGIC = b'LTB\x01'
+BUNDLE_INFO = b'luata bundle'
+BUNDLE_FILE = 'app.luatb'
+BUNDLE_NAME_MAX = 48
 
 
 def encrypt_and_mac_file_content(data):
 
+    # every file gets its own salt (and therefore keys) and nonce
+    nonce = get_random_bytes(8)
+    salt = get_random_bytes(16)
+
+    # generate two keys from the masterkey, one used for encryption, one for generating a mac over the encryped
+    key_aes, key_hmac = HKDF(bytes.fromhex(master_hex), 32, salt, SHA512, 2)
+
     # encrypt the lua plaintext
     cipher = AES.new(key_aes, AES.MODE_CTR, nonce=nonce)
     encrypted_lua = cipher.encrypt(data)
@@ -44,14 +77,105 @@ def encrypt_and_mac_file_content(data):
     return payload
 
 
+def encrypt_aead_file_content(data):
+
+    nonce = get_random_bytes(12)
+    salt = get_random_bytes(16)
+
+    key_aes = HKDF(bytes.fromhex(master_hex), 32, salt, SHA512, 1, context=V2_INFO)
 
-if len(sys.argv) != 2:
-    print("Invalid arguments")
-    sys.exit(0)
+    # the header in front of the tag is authenticated along with the script
+    header = V2_MAGIC + salt + nonce
+    cipher = AES.new(key_aes, AES.MODE_GCM, nonce=nonce, mac_len=16)
+    cipher.update(header)
+    encrypted_lua, tag = cipher.encrypt_and_digest(data)
+
+    return header + tag + encrypted_lua
+
+
+def encrypt_chunked_file_content(data, chunk_size):
+
+    nonce = get_random_bytes(8)
+    salt = get_random_bytes(16)
+
+    key_aes = HKDF(bytes.fromhex(master_hex), 32, salt, SHA512, 1, context=V3_INFO)
+
+    # the header, and with it the total length, is authenticated with every chunk
+    header = V3_MAGIC + salt + nonce + struct.pack('>II', chunk_size, len(data))
+    payload = header
+
+    # an empty script still gets one (empty) chunk, so the header is always authenticated
+    for index, offset in enumerate(range(0, max(len(data), 1), chunk_size)):
+        cipher = AES.new(key_aes, AES.MODE_GCM, nonce=nonce + struct.pack('>I', index), mac_len=16)
+        cipher.update(header)
+        encrypted_chunk, tag = cipher.encrypt_and_digest(data[offset:offset + chunk_size])
+        payload += encrypted_chunk + tag
+
+    return payload
 
-path = sys.argv[1]
+
+def encrypt_bundle(scripts):
+
+    nonce = get_random_bytes(12)
+    salt = get_random_bytes(16)
+
+    key_aes = HKDF(bytes.fromhex(master_hex), 32, salt, SHA512, 1, context=BUNDLE_INFO)
+
+    # the index is sorted by name, so the TA can look scripts up by bisection
+    header = BUNDLE_MAGIC + salt + nonce + struct.pack('>I', len(scripts))
+    names = sorted(scripts, key=lambda name: name.encode())
+    index = b''
+    offset = 0
+    for name in names:
+        index += name.encode().ljust(BUNDLE_NAME_MAX, b'\0') + struct.pack('>II', offset, len(scripts[name]))
+        offset += len(scripts[name])
+    data = b''.join(scripts[name] for name in names)
+
+    # header and index are authenticated along with the scripts
+    cipher = AES.new(key_aes, AES.MODE_GCM, nonce=nonce, mac_len=16)
+    cipher.update(header + index)
+    encrypted_scripts, tag = cipher.encrypt_and_digest(data)
+
+    return header + index + tag + encrypted_scripts
+
+
+def compile_script(path, luac, bits):
+
+    # luac_ta is built from the lua/ sources of this repo, so the bytecode matches the Lua of the TA
+    cmd = [luac, path]
+    if bits:
+        cmd[1:1] = ['-m', str(bits)]
+    return subprocess.run(cmd, stdout=subprocess.PIPE, check=True).stdout
+
+
+parser = argparse.ArgumentParser(description="Encrypts Lua scripts for the TA (see the formats above)")
+fmt = parser.add_mutually_exclusive_group()
+fmt.add_argument("--v2", action="store_true", help="use the AES-GCM format v2")
+fmt.add_argument("--bundle", action="store_true",
+                 help="pack all scripts of the directory into a single " + BUNDLE_FILE)
+fmt.add_argument("--chunked", nargs="?", type=int, const=V3_DEFAULT_CHUNK_SIZE, metavar="chunk size",
+                 help="use the chunked AES-GCM format v3 (default chunk size: %d)" % V3_DEFAULT_CHUNK_SIZE)
+parser.add_argument("--compile", metavar="luac_ta",
+                    help="compile the scripts to stripped bytecode with the given luac_ta before encrypting them")
+parser.add_argument("--bits", type=int, choices=(32, 64),
+                    help="word size of the TA for --compile (default: the one of the build machine)")
+parser.add_argument("path", metavar="script.lua|directory")
+args = parser.parse_args()
+
+encrypt = encrypt_and_mac_file_content
+if args.v2:
+    encrypt = encrypt_aead_file_content
+elif args.chunked is not None:
+    if not 0 < args.chunked <= V3_MAX_CHUNK_SIZE:
+        parser.error("the chunk size has to be between 1 and %d" % V3_MAX_CHUNK_SIZE)
+    encrypt = lambda data: encrypt_chunked_file_content(data, args.chunked)
+
+path = args.path
 lua_files = []
 
+if args.bundle and not os.path.isdir(path):
+    parser.error("--bundle needs a directory")
+
 if os.path.isfile(path):
     lua_files.append(path.split(".")[0])
 
@@ -61,12 +185,28 @@ elif os.path.isdir(path):
             lua_files.append(path+"/"+script.split(".")[0])
 
 
+bundle = {}
+
 for filename in lua_files:
     
-    with open(filename+'.lua', 'rb') as file:
+    if args.compile:
+        data = compile_script(filename+'.lua', args.compile, args.bits)
+    else:
+        with open(filename+'.lua', 'rb') as file:
             data = file.read()
 
-    payload = encrypt_and_mac_file_content(data)
+    if args.bundle:
+        name = os.path.basename(filename)
+        if len(name.encode()) >= BUNDLE_NAME_MAX:
+            parser.error("script name too long for a bundle: " + name)
+        bundle[name] = data
+        continue
+
+    payload = encrypt(data)
 
     with open(filename+'.luata', 'wb') as file:
-            file.write(payload)
\ No newline at end of file
+            file.write(payload)
+
+if args.bundle:
+    with open(os.path.join(path, BUNDLE_FILE), 'wb') as file:
+        file.write(encrypt_bundle(bundle))
@@ -0,0 +1,457 @@
+/**
+ * Benchmark harness for end-to-end calls into the Lua runtime TA.
+ *
+ * Runs every given TA script of a Lua app for a configurable number of iterations in each of the call modes
+ * (script passed in vs. saved in the TA storage, plaintext vs. encrypted) and with each of the given payload sizes.
+ * Per configuration, min/median/p99/max latency and throughput are reported as a table, JSON and/or CSV.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lua.h"
+#include "lprefix.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+/* To the the UUID (found the the TA's h-file(s)) */
+#include <lua_runtime_ta.h>
+
+#include "lua_arguments.h"
+#include "lua_ta_client.h"
+#include "lua_ta_trace.h"
+#include "lua_ta_stats.h"
+
+#define DEFAULT_ITERATIONS	100
+#define DEFAULT_WARMUP		10
+#define MAX_PAYLOAD_SIZES	16
+
+enum bench_mode {
+	MODE_PASS_PLAIN,
+	MODE_PASS_ENC,
+	MODE_SAVED_PLAIN,
+	MODE_SAVED_ENC,
+	MODE_NATIVE,
+	MODE_COUNT
+};
+
+static const char *mode_names[MODE_COUNT] = {
+	"pass-plain", "pass-enc", "saved-plain", "saved-enc", "native"
+};
+
+struct bench_result {
+	const char *script;
+	int mode;
+	size_t payload;
+	size_t script_bytes;
+	unsigned iterations;
+	unsigned errors;
+	uint64_t min_ns, median_ns, p99_ns, max_ns;
+	double mean_ns;
+	double total_s;
+	struct lua_ta_histograms phases;
+};
+
+struct bench_config {
+	char *app_name;
+	unsigned iterations;
+	unsigned warmup;
+	int modes[MODE_COUNT];
+	size_t payloads[MAX_PAYLOAD_SIZES];
+	int payload_count;
+	char *json_path;
+	char *csv_path;
+	int phase_stats;
+};
+
+static TEEC_Session sess;
+
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b){
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of an already sorted sample */
+static uint64_t percentile(const uint64_t *sorted, unsigned n, double p){
+	unsigned rank = (unsigned)(p / 100.0 * n + 0.999999);
+	if (rank < 1)
+		rank = 1;
+	if (rank > n)
+		rank = n;
+	return sorted[rank - 1];
+}
+
+static char* script_path(const char *app_name, const char *script, int encrypted){
+	const char *file_ending = encrypted ? ".luata" : ".lua";
+	size_t len = strlen(app_name) + strlen("/ta/") + strlen(script) + strlen(file_ending) + 1;
+	char *path = malloc(len);
+	if (path)
+		snprintf(path, len, "%s/ta/%s%s", app_name, script, file_ending);
+	return path;
+}
+
+
+/**
+ * Does a single timed call in the given mode. The payload is passed as a string of payload bytes, or as an integer if payload is 0.
+ * Returns 0 if the call succeeded, -1 if it failed or the script raised an error. The elapsed time is written to elapsed_ns.
+ */
+static int bench_call(int mode, const char *script, unsigned char *buffer, size_t bufferlen, char *payload_str, int number_arg, uint64_t *elapsed_ns){
+
+	TEEC_Result res;
+	void *lua_arg;
+	int lua_arg_type;
+	void *lua_ret = NULL;
+	int lua_ret_type = LUA_TYPE_NUMBER;
+	uint64_t start, end;
+
+	if (payload_str){
+		lua_arg = &payload_str;
+		lua_arg_type = LUA_TYPE_STRING;
+	} else {
+		lua_arg = &number_arg;
+		lua_arg_type = LUA_TYPE_NUMBER;
+	}
+
+	start = now_ns();
+	switch (mode){
+	case MODE_PASS_PLAIN:
+	case MODE_PASS_ENC:
+		res = invoke_script(&sess, script, buffer, bufferlen, CALL_MODE_PASS, mode == MODE_PASS_ENC,
+				lua_arg, lua_arg_type, &lua_ret, &lua_ret_type, NULL);
+		break;
+	case MODE_SAVED_PLAIN:
+	case MODE_SAVED_ENC:
+		res = invoke_script(&sess, script, (unsigned char *)script, strlen(script), CALL_MODE_SAVED, 0,
+				lua_arg, lua_arg_type, &lua_ret, &lua_ret_type, NULL);
+		break;
+	default:
+		res = invoke_native_loop(&sess, 0, NULL, NULL);
+		break;
+	}
+	end = now_ns();
+
+	/* String return values (and error messages) are handed over in a buffer owned by the caller */
+	if (res == TEEC_SUCCESS && lua_ret_type != LUA_TYPE_NUMBER && mode != MODE_NATIVE)
+		free(lua_ret);
+
+	*elapsed_ns = end - start;
+	return res == TEEC_SUCCESS && (mode == MODE_NATIVE || lua_ret_type != LUA_TYPE_ERROR) ? 0 : -1;
+}
+
+
+/**
+ * Runs warmup and measured iterations of one configuration and fills in the result.
+ * Returns -1 if the configuration could not be set up (e.g. a missing script file), 0 otherwise.
+ */
+static int run_config(struct bench_config *cfg, const char *script, int mode, size_t payload, struct bench_result *result){
+
+	unsigned char *buffer = NULL;
+	long bufferlen = 0;
+	char *payload_str = NULL;
+	uint64_t *samples;
+	uint64_t elapsed, start;
+	unsigned i, n = 0;
+	double sum = 0;
+
+	memset(result, 0, sizeof(*result));
+	result->script = script;
+	result->mode = mode;
+	result->payload = payload;
+
+	if (mode != MODE_NATIVE){
+		int encrypted = (mode == MODE_PASS_ENC || mode == MODE_SAVED_ENC);
+		char *path = script_path(cfg->app_name, script, encrypted);
+
+		if (!path || read_in_file(path, &buffer, &bufferlen)){
+			fprintf(stderr, "skipping %s/%s: cannot read %s\n", script, mode_names[mode], path ? path : "");
+			free(path);
+			return -1;
+		}
+		free(path);
+		result->script_bytes = bufferlen;
+
+		if ((mode == MODE_SAVED_PLAIN || mode == MODE_SAVED_ENC) &&
+		    save_script(&sess, buffer, bufferlen, encrypted, (char *)script) != TEEC_SUCCESS){
+			free(buffer);
+			return -1;
+		}
+	}
+
+	if (payload){
+		payload_str = malloc(payload + 1);
+		if (!payload_str)
+			errx(1, "out of memory");
+		memset(payload_str, 'a', payload);
+		payload_str[payload] = '\0';
+	}
+
+	samples = calloc(cfg->iterations ? cfg->iterations : 1, sizeof(*samples));
+	if (!samples)
+		errx(1, "out of memory");
+
+	for (i = 0; i < cfg->warmup; i++)
+		bench_call(mode, script, buffer, bufferlen, payload_str, i, &elapsed);
+
+	/* The phase breakdown is only requested for the measured calls, it is not available for the native baseline */
+	lua_ta_histograms_init(&result->phases);
+	if (cfg->phase_stats && mode != MODE_NATIVE)
+		lua_ta_client_collect_stats(&result->phases);
+
+	start = now_ns();
+	for (i = 0; i < cfg->iterations; i++){
+		if (bench_call(mode, script, buffer, bufferlen, payload_str, i, &elapsed)){
+			result->errors++;
+			continue;
+		}
+		samples[n++] = elapsed;
+		sum += elapsed;
+	}
+	result->total_s = (now_ns() - start) / 1e9;
+	result->iterations = n;
+	lua_ta_client_collect_stats(NULL);
+
+	if (n){
+		qsort(samples, n, sizeof(*samples), cmp_u64);
+		result->min_ns = samples[0];
+		result->median_ns = percentile(samples, n, 50);
+		result->p99_ns = percentile(samples, n, 99);
+		result->max_ns = samples[n - 1];
+		result->mean_ns = sum / n;
+	}
+
+	free(samples);
+	free(payload_str);
+	free(buffer);
+	return 0;
+}
+
+static double calls_per_sec(const struct bench_result *r){
+	return r->total_s > 0 ? r->iterations / r->total_s : 0;
+}
+
+static double bytes_per_sec(const struct bench_result *r){
+	return r->total_s > 0 ? (double)(r->script_bytes + r->payload) * r->iterations / r->total_s : 0;
+}
+
+static void print_table(const struct bench_result *results, int count){
+	int i;
+
+	printf("%-16s %-12s %8s %8s %12s %12s %12s %12s %12s\n",
+		"script", "mode", "payload", "errors", "min(us)", "median(us)", "p99(us)", "max(us)", "calls/s");
+	for (i = 0; i < count; i++){
+		const struct bench_result *r = &results[i];
+		printf("%-16s %-12s %8zu %8u %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+			r->script, mode_names[r->mode], r->payload, r->errors,
+			r->min_ns / 1e3, r->median_ns / 1e3, r->p99_ns / 1e3, r->max_ns / 1e3, calls_per_sec(r));
+	}
+
+	for (i = 0; i < count; i++){
+		const struct bench_result *r = &results[i];
+		if (!r->phases.calls)
+			continue;
+		printf("\n%s %s payload %zu: ", r->script, mode_names[r->mode], r->payload);
+		lua_ta_histograms_print(stdout, &r->phases);
+	}
+}
+
+static void write_json(const char *path, const struct bench_config *cfg, const struct bench_result *results, int count){
+	FILE *f = fopen(path, "w");
+	int i;
+
+	if (!f){
+		warn("cannot open %s", path);
+		return;
+	}
+
+	fprintf(f, "{\n  \"iterations\": %u,\n  \"warmup\": %u,\n  \"results\": [\n", cfg->iterations, cfg->warmup);
+	for (i = 0; i < count; i++){
+		const struct bench_result *r = &results[i];
+		fprintf(f, "    {\"script\": \"%s\", \"mode\": \"%s\", \"payload_bytes\": %zu, \"script_bytes\": %zu, "
+			"\"iterations\": %u, \"errors\": %u, \"min_us\": %.3f, \"median_us\": %.3f, \"p99_us\": %.3f, "
+			"\"max_us\": %.3f, \"mean_us\": %.3f, \"calls_per_sec\": %.3f, \"bytes_per_sec\": %.3f",
+			r->script, mode_names[r->mode], r->payload, r->script_bytes, r->iterations, r->errors,
+			r->min_ns / 1e3, r->median_ns / 1e3, r->p99_ns / 1e3, r->max_ns / 1e3, r->mean_ns / 1e3,
+			calls_per_sec(r), bytes_per_sec(r));
+		if (r->phases.calls){
+			fprintf(f, ", \"phases\": ");
+			lua_ta_histograms_write_json(f, &r->phases);
+		}
+		fprintf(f, "}%s\n", i + 1 < count ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	fclose(f);
+}
+
+static void write_csv(const char *path, const struct bench_config *cfg, const struct bench_result *results, int count){
+	FILE *f = fopen(path, "w");
+	int i, p;
+
+	if (!f){
+		warn("cannot open %s", path);
+		return;
+	}
+
+	fprintf(f, "script,mode,payload_bytes,script_bytes,iterations,errors,min_us,median_us,p99_us,max_us,mean_us,calls_per_sec,bytes_per_sec");
+	for (p = 0; cfg->phase_stats && p < LUA_TA_PHASE_COUNT; p++)
+		fprintf(f, ",%s_mean_us", lua_ta_phase_name(p));
+	fprintf(f, "\n");
+	for (i = 0; i < count; i++){
+		const struct bench_result *r = &results[i];
+		fprintf(f, "%s,%s,%zu,%zu,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f",
+			r->script, mode_names[r->mode], r->payload, r->script_bytes, r->iterations, r->errors,
+			r->min_ns / 1e3, r->median_ns / 1e3, r->p99_ns / 1e3, r->max_ns / 1e3, r->mean_ns / 1e3,
+			calls_per_sec(r), bytes_per_sec(r));
+		for (p = 0; cfg->phase_stats && p < LUA_TA_PHASE_COUNT; p++){
+			const struct lua_ta_phase_histogram *ph = &r->phases.phases[p];
+			fprintf(f, ",%.3f", ph->count ? ph->sum_ns / 1e3 / ph->count : 0.0);
+		}
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
+
+
+static void parse_modes(char *arg, int modes[MODE_COUNT]){
+	char *tok;
+	int m;
+
+	memset(modes, 0, sizeof(int) * MODE_COUNT);
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")){
+		for (m = 0; m < MODE_COUNT; m++){
+			if (!strcmp(tok, mode_names[m]))
+				break;
+		}
+		if (m == MODE_COUNT)
+			errx(1, "unknown mode '%s'", tok);
+		modes[m] = 1;
+	}
+}
+
+static void parse_payloads(char *arg, struct bench_config *cfg){
+	char *tok;
+
+	cfg->payload_count = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")){
+		size_t size = strtoul(tok, NULL, 10);
+		if (size >= BYTE_BUFFER_SIZE)
+			errx(1, "payload size %zu exceeds the shared buffer (%d bytes)", size, BYTE_BUFFER_SIZE);
+		if (cfg->payload_count == MAX_PAYLOAD_SIZES)
+			errx(1, "too many payload sizes (max %d)", MAX_PAYLOAD_SIZES);
+		cfg->payloads[cfg->payload_count++] = size;
+	}
+}
+
+static void usage(const char *prog){
+	fprintf(stderr,
+		"Usage: %s [-n iterations] [-w warmup] [-m modes] [-p sizes] [-j out.json] [-c out.csv] [-t trace file] [-b] [-g us] [lua app] [script...]\n"
+		"  -n  measured iterations per configuration (default: %d)\n"
+		"  -w  warmup iterations per configuration (default: %d)\n"
+		"  -m  comma separated modes out of pass-plain,pass-enc,saved-plain,saved-enc,native (default: all)\n"
+		"  -p  comma separated payload sizes in bytes, 0 passes an integer (default: 0)\n"
+		"  -j  write the results as JSON\n"
+		"  -c  write the results as CSV\n"
+		"  -t  record every call into a trace file (Chrome trace JSON if it ends in .json)\n"
+		"  -b  request the per phase latency breakdown from the TA and report it per configuration\n"
+		"  -g  latency target in microseconds the TA paces the garbage collector of every call against\n",
+		prog, DEFAULT_ITERATIONS, DEFAULT_WARMUP);
+	exit(EXIT_FAILURE);
+}
+
+
+int main(int argc, char *argv[])
+{
+	TEEC_Result res;
+	TEEC_Context ctx;
+	TEEC_UUID uuid = TA_LUA_RUNTIME_UUID;
+	uint32_t err_origin;
+	struct bench_config cfg;
+	struct bench_result *results;
+	int opt, m, s, p, count = 0, max_results;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.iterations = DEFAULT_ITERATIONS;
+	cfg.warmup = DEFAULT_WARMUP;
+	cfg.payload_count = 1;
+	for (m = 0; m < MODE_COUNT; m++)
+		cfg.modes[m] = 1;
+
+	while ((opt = getopt(argc, argv, "n:w:m:p:j:c:t:bg:")) != -1) {
+		switch (opt) {
+		case 'n': cfg.iterations = strtoul(optarg, NULL, 10); break;
+		case 'w': cfg.warmup = strtoul(optarg, NULL, 10); break;
+		case 'm': parse_modes(optarg, cfg.modes); break;
+		case 'p': parse_payloads(optarg, &cfg); break;
+		case 'j': cfg.json_path = optarg; break;
+		case 'c': cfg.csv_path = optarg; break;
+		case 'b': cfg.phase_stats = 1; break;
+		case 'g': lua_ta_client_gc_target(strtoul(optarg, NULL, 10)); break;
+		case 't':
+			if (lua_ta_trace_init(optarg))
+				errx(1, "cannot enable tracing to %s", optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind < argc)
+		cfg.app_name = argv[optind++];
+	if (optind == argc && !cfg.modes[MODE_NATIVE])
+		usage(argv[0]);
+
+	/* Initialize a context connecting us to the TEE */
+	res = TEEC_InitializeContext(NULL, &ctx);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InitializeContext failed with code 0x%x", res);
+
+	res = TEEC_OpenSession(&ctx, &sess, &uuid,
+			       TEEC_LOGIN_PUBLIC, NULL, NULL, &err_origin);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_Opensession failed with code 0x%x origin 0x%x",
+			res, err_origin);
+
+	max_results = (argc - optind) * MODE_COUNT * cfg.payload_count + 1;
+	results = calloc(max_results, sizeof(*results));
+	if (!results)
+		errx(1, "out of memory");
+
+	for (s = optind; s < argc; s++){
+		for (m = 0; m < MODE_NATIVE; m++){
+			if (!cfg.modes[m])
+				continue;
+			for (p = 0; p < cfg.payload_count; p++){
+				if (!run_config(&cfg, argv[s], m, cfg.payloads[p], &results[count]))
+					count++;
+			}
+		}
+	}
+
+	/* The native baseline does not depend on the script or payload */
+	if (cfg.modes[MODE_NATIVE] && !run_config(&cfg, "native", MODE_NATIVE, 0, &results[count]))
+		count++;
+
+	print_table(results, count);
+	if (cfg.json_path)
+		write_json(cfg.json_path, &cfg, results, count);
+	if (cfg.csv_path)
+		write_csv(cfg.csv_path, &cfg, results, count);
+
+	free(results);
+
+	TEEC_CloseSession(&sess);
+	TEEC_FinalizeContext(&ctx);
+
+	return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * Thin client for the daemon (invoke_lua_client). Sends a single request (see lua_ta_daemon.h), prints the returned
+ * payload to stdout and the latency reported by the daemon to stderr.
+ *
+ *   invoke_lua_client [-l socket path] [-q] main | call <script> <arg> | reload | stats
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lua_ta_daemon.h"
+
+
+static int connect_daemon(const char *path){
+
+	struct sockaddr_un addr;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		errx(1, "socket path too long: %s", path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		err(1, "socket");
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)))
+		err(1, "cannot connect to %s", path);
+
+	return fd;
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *socket_path = LUA_TA_DAEMON_SOCKET;
+	char request[LUA_TA_DAEMON_MAX_LINE];
+	char status[8];
+	unsigned long long latency_us;
+	size_t len = 0, payload_len;
+	int quiet = 0;
+	int opt, i, fd;
+	FILE *f;
+
+	while ((opt = getopt(argc, argv, "ql:")) != -1) {
+		switch (opt) {
+		case 'q': quiet = 1; break;
+		case 'l': socket_path = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-q] [-l socket path] main | call <script> <arg> | reload | stats\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind >= argc){
+		fprintf(stderr, "Usage: %s [-q] [-l socket path] main | call <script> <arg> | reload | stats\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	/* The request is the remaining arguments joined by spaces */
+	for (i = optind; i < argc; i++){
+		int n = snprintf(request + len, sizeof(request) - len, "%s%s", i > optind ? " " : "", argv[i]);
+
+		if (n < 0 || (size_t)n >= sizeof(request) - len - 1)
+			errx(1, "request too long");
+		len += n;
+	}
+	request[len++] = '\n';
+
+	fd = connect_daemon(socket_path);
+	f = fdopen(fd, "r+");
+	if (!f)
+		err(1, "fdopen");
+
+	if (fwrite(request, 1, len, f) != len || fflush(f))
+		err(1, "cannot send the request");
+
+	if (fscanf(f, "%7s %llu %zu", status, &latency_us, &payload_len) != 3 || fgetc(f) != '\n')
+		errx(1, "malformed reply");
+
+	/* Copy the payload through */
+	while (payload_len > 0){
+		char buf[4096];
+		size_t n = fread(buf, 1, payload_len < sizeof(buf) ? payload_len : sizeof(buf), f);
+
+		if (n == 0)
+			errx(1, "truncated reply");
+		fwrite(buf, 1, n, stdout);
+		payload_len -= n;
+	}
+	fflush(stdout);
+	fclose(f);
+
+	if (!quiet)
+		fprintf(stderr, "\n%s in %llu us\n", status, latency_us);
+
+	return strcmp(status, "ok") ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,466 @@
+/**
+ * Long-running frontend for Lua applications (invoke_lua_daemon).
+ *
+ * Initializes the TEE context, opens a pool of sessions and provisions the TA scripts of an application once,
+ * then serves requests over a Unix domain socket (see lua_ta_daemon.h for the protocol). Each worker thread owns
+ * one session of the pool and serves one connection at a time, so up to as many clients as there are sessions are
+ * handled concurrently.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lua.h"
+#include "lprefix.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+/* To the the UUID (found the the TA's h-file(s)) */
+#include <lua_runtime_ta.h>
+
+#include "lua_arguments.h"
+#include "lua_ta_app.h"
+#include "lua_ta_client.h"
+#include "lua_ta_daemon.h"
+#include "lua_ta_trace.h"
+#include "lua_ta_stats.h"
+
+struct worker {
+	pthread_t thread;
+	TEEC_Session sess;
+	int sess_open;
+};
+
+/* flag to indicate wether the encrypted lua scripts should be used */
+static int encrypted_mode = LUA_MODE_ENCRYPTED;
+
+/* flag to indicate wether called lua ta scripts should be passed in for each or loaded from the secure storage */
+static int call_mode = CALL_MODE_PASS;
+
+/* per phase latency breakdown of the TA calls, only collected if requested */
+static int collect_phase_stats = 0;
+static struct lua_ta_histograms phase_histograms;
+
+/* Requests take the lock for reading, a reload takes it for writing */
+static pthread_rwlock_t app_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct lua_ta_app app;
+static char *app_dir;
+
+static int listen_fd = -1;
+static volatile sig_atomic_t stopping = 0;
+
+/* Request latency summary, updated atomically by the workers */
+static uint64_t requests_total;
+static uint64_t requests_failed;
+static uint64_t request_sum_ns;
+static uint64_t request_max_ns;
+
+
+static uint64_t now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void record_request(uint64_t ns, int failed){
+
+	uint64_t max = __atomic_load_n(&request_max_ns, __ATOMIC_RELAXED);
+
+	__atomic_add_fetch(&requests_total, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&request_sum_ns, ns, __ATOMIC_RELAXED);
+	if (failed)
+		__atomic_add_fetch(&requests_failed, 1, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&request_max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void on_stop_signal(int sig){
+	(void)sig;
+	stopping = 1;
+	/* wakes up all workers blocked in accept() */
+	shutdown(listen_fd, SHUT_RDWR);
+}
+
+
+static int write_all(int fd, const char *buf, size_t len){
+
+	while (len > 0){
+		ssize_t n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Sends the header line and the payload of a reply */
+static int reply(int fd, int ok, uint64_t latency_ns, const char *payload, size_t len){
+
+	char header[64];
+	int n = snprintf(header, sizeof(header), "%s %llu %zu\n", ok ? "ok" : "err",
+			(unsigned long long)(latency_ns / 1000), len);
+
+	if (write_all(fd, header, n))
+		return -1;
+	return write_all(fd, payload, len);
+}
+
+
+/**
+ * Calls a TA script with a single argument, formatting the return value as text.
+ *
+ * @param sess           [in] The session of the worker
+ * @param line           [in] "<script> <arg>"
+ * @param output         [out] Newly allocated return value or error message
+ * @param outlen         [out] The length of output
+ * @return 0 on success, -1 on failure
+ */
+static int handle_call(TEEC_Session *sess, char *line, char **output, size_t *outlen){
+
+	const struct lua_ta_script *script = NULL;
+	union { int number; char *string; } in, out;
+	int in_type, out_type;
+	char *name, *arg, *end;
+	uint32_t err_origin;
+	TEEC_Result res;
+	long number;
+
+	name = line;
+	arg = strchr(line, ' ');
+	if (arg)
+		*arg++ = '\0';
+	else
+		arg = "";
+
+	if (!*name){
+		*output = strdup("usage: call <script> <arg>");
+		*outlen = *output ? strlen(*output) : 0;
+		return -1;
+	}
+
+	number = strtol(arg, &end, 10);
+	if (*arg && !*end){
+		in.number = (int)number;
+		in_type = LUA_TYPE_NUMBER;
+	} else {
+		in.string = arg;
+		in_type = LUA_TYPE_STRING;
+	}
+
+	if (app.call_mode == CALL_MODE_PASS)
+		script = lua_ta_app_find(&app, name);
+
+	if (script)
+		res = invoke_script(sess, name, script->data, script->len, CALL_MODE_PASS, app.encrypted_mode,
+				&in, in_type, &out, &out_type, &err_origin);
+	else
+		res = invoke_script(sess, name, (unsigned char*)name, strlen(name), CALL_MODE_SAVED, 0,
+				&in, in_type, &out, &out_type, &err_origin);
+
+	if (res != TEEC_SUCCESS){
+		*output = malloc(64);
+		if (*output)
+			snprintf(*output, 64, "TEEC_InvokeCommand failed with code 0x%x origin 0x%x", res, err_origin);
+		*outlen = *output ? strlen(*output) : 0;
+		return -1;
+	}
+
+	if (out_type == LUA_TYPE_NUMBER){
+		*output = malloc(16);
+		if (*output)
+			snprintf(*output, 16, "%d", out.number);
+	} else {
+		/* the returned buffer (or error message) is owned by us and NUL terminated by the TA */
+		*output = out.string;
+	}
+	*outlen = *output ? strlen(*output) : 0;
+
+	return out_type == LUA_TYPE_ERROR ? -1 : 0;
+}
+
+/* Re-reads the application from disk and provisions it through the session of the calling worker */
+static int handle_reload(TEEC_Session *sess, char **output, size_t *outlen){
+
+	struct lua_ta_app fresh;
+	TEEC_Result res;
+	int status = 0;
+
+	if (lua_ta_app_load(&fresh, app_dir, encrypted_mode, call_mode)){
+		*output = strdup("cannot read the application");
+		*outlen = *output ? strlen(*output) : 0;
+		return -1;
+	}
+
+	pthread_rwlock_wrlock(&app_lock);
+	res = lua_ta_app_provision(&fresh, sess);
+	if (res == TEEC_SUCCESS){
+		lua_ta_app_free(&app);
+		app = fresh;
+	} else {
+		lua_ta_app_free(&fresh);
+		status = -1;
+	}
+	pthread_rwlock_unlock(&app_lock);
+
+	*output = malloc(64);
+	if (*output){
+		if (status)
+			snprintf(*output, 64, "provisioning failed with code 0x%x", res);
+		else
+			snprintf(*output, 64, "%d scripts", app.script_count);
+	}
+	*outlen = *output ? strlen(*output) : 0;
+	return status;
+}
+
+/* Formats the request latency summary and, if collected, the TA phase breakdown */
+static int handle_stats(char **output, size_t *outlen){
+
+	uint64_t total = __atomic_load_n(&requests_total, __ATOMIC_RELAXED);
+	uint64_t sum = __atomic_load_n(&request_sum_ns, __ATOMIC_RELAXED);
+	FILE *f = open_memstream(output, outlen);
+
+	if (!f){
+		*output = NULL;
+		*outlen = 0;
+		return -1;
+	}
+
+	fprintf(f, "requests %llu failed %llu mean_us %.1f max_us %.1f\n",
+		(unsigned long long)total,
+		(unsigned long long)__atomic_load_n(&requests_failed, __ATOMIC_RELAXED),
+		total ? sum / 1000.0 / total : 0.0,
+		__atomic_load_n(&request_max_ns, __ATOMIC_RELAXED) / 1000.0);
+	if (collect_phase_stats)
+		lua_ta_histograms_print(f, &phase_histograms);
+	fclose(f);
+
+	return 0;
+}
+
+/* Serves the requests of a connection until the client closes it */
+static void serve(struct worker *w, int fd){
+
+	char line[LUA_TA_DAEMON_MAX_LINE];
+	FILE *in = fdopen(fd, "r");
+
+	if (!in){
+		close(fd);
+		return;
+	}
+
+	while (!stopping && fgets(line, sizeof(line), in)){
+
+		char *output = NULL;
+		size_t outlen = 0;
+		size_t len = strlen(line);
+		uint64_t start = now_ns();
+		int status;
+
+		if (len == 0 || line[len-1] != '\n'){
+			/* too long (or not terminated), the rest of the connection cannot be parsed */
+			reply(fd, 0, 0, "request too long", 16);
+			break;
+		}
+		line[--len] = '\0';
+
+		if (!strcmp(line, "main")){
+			pthread_rwlock_rdlock(&app_lock);
+			status = lua_ta_app_run_main(&app, &w->sess, &output, &outlen);
+			pthread_rwlock_unlock(&app_lock);
+		} else if (!strncmp(line, "call ", 5)){
+			pthread_rwlock_rdlock(&app_lock);
+			status = handle_call(&w->sess, line + 5, &output, &outlen);
+			pthread_rwlock_unlock(&app_lock);
+		} else if (!strcmp(line, "reload")){
+			status = handle_reload(&w->sess, &output, &outlen);
+		} else if (!strcmp(line, "stats")){
+			status = handle_stats(&output, &outlen);
+		} else {
+			output = strdup("unknown request");
+			outlen = output ? strlen(output) : 0;
+			status = -1;
+		}
+
+		uint64_t latency = now_ns() - start;
+		record_request(latency, status);
+
+		if (reply(fd, status == 0, latency, output ? output : "", output ? outlen : 0)){
+			free(output);
+			break;
+		}
+		free(output);
+	}
+
+	fclose(in);
+}
+
+static void* worker_main(void *arg){
+
+	struct worker *w = arg;
+
+	if (collect_phase_stats)
+		lua_ta_client_collect_stats(&phase_histograms);
+
+	while (!stopping){
+		int fd = accept(listen_fd, NULL, NULL);
+
+		if (fd < 0){
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		serve(w, fd);
+	}
+
+	return NULL;
+}
+
+
+static int open_socket(const char *path){
+
+	struct sockaddr_un addr;
+	mode_t old_mask;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		errx(1, "socket path too long: %s", path);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		err(1, "socket");
+
+	/* Replace a stale socket of an earlier run, only the owner may connect */
+	unlink(path);
+	old_mask = umask(0077);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)))
+		err(1, "bind %s", path);
+	umask(old_mask);
+
+	if (listen(fd, 64))
+		err(1, "listen %s", path);
+
+	return fd;
+}
+
+
+int main(int argc, char *argv[])
+{
+	TEEC_Result res;
+	TEEC_Context ctx;
+	TEEC_UUID uuid = TA_LUA_RUNTIME_UUID;
+	const char *socket_path = LUA_TA_DAEMON_SOCKET;
+	int session_count = LUA_TA_DAEMON_DEFAULT_SESSIONS;
+	struct worker *workers;
+	struct sigaction sa;
+	uint32_t err_origin;
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "usbn:t:l:")) != -1) {
+		switch (opt) {
+		case 'u': encrypted_mode = LUA_MODE_PLAINTEXT; break;
+		case 's': call_mode = CALL_MODE_SAVED; break;
+		case 'b': collect_phase_stats = 1; break;
+		case 'n': session_count = atoi(optarg); break;
+		case 'l': socket_path = optarg; break;
+		case 't':
+			if (lua_ta_trace_init(optarg))
+				errx(1, "cannot enable tracing to %s", optarg);
+			break;
+
+		default:
+			fprintf(stderr, "Usage: %s [-usb] [-n sessions] [-t trace file] [-l socket path] lua_app\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind >= argc || session_count < 1){
+		fprintf(stderr, "Usage: %s [-usb] [-n sessions] [-t trace file] [-l socket path] lua_app\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	app_dir = argv[optind];
+
+	if (collect_phase_stats)
+		lua_ta_histograms_init(&phase_histograms);
+
+	if (lua_ta_app_load(&app, app_dir, encrypted_mode, call_mode))
+		return EXIT_FAILURE;
+
+	/* Initialize a context connecting us to the TEE */
+	res = TEEC_InitializeContext(NULL, &ctx);
+	if (res != TEEC_SUCCESS)
+		errx(1, "TEEC_InitializeContext failed with code 0x%x", res);
+
+	workers = calloc(session_count, sizeof(*workers));
+	if (!workers)
+		errx(1, "out of memory");
+
+	/* Open the session pool, every worker keeps its session for the lifetime of the daemon */
+	for (i = 0; i < session_count; i++){
+		res = TEEC_OpenSession(&ctx, &workers[i].sess, &uuid,
+				       TEEC_LOGIN_PUBLIC, NULL, NULL, &err_origin);
+		if (res != TEEC_SUCCESS)
+			errx(1, "TEEC_Opensession failed with code 0x%x origin 0x%x",
+				res, err_origin);
+		workers[i].sess_open = 1;
+	}
+
+	/* The secure storage is shared by all sessions, so provisioning once is enough */
+	res = lua_ta_app_provision(&app, &workers[0].sess);
+	if (res != TEEC_SUCCESS)
+		errx(1, "provisioning %s failed with code 0x%x", app_dir, res);
+
+	listen_fd = open_socket(socket_path);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_stop_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < session_count; i++){
+		if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]))
+			errx(1, "cannot start worker %d", i);
+	}
+
+	fprintf(stderr, "serving %s on %s with %d sessions\n", app_dir, socket_path, session_count);
+
+	for (i = 0; i < session_count; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	close(listen_fd);
+	unlink(socket_path);
+
+	if (collect_phase_stats)
+		lua_ta_histograms_print(stderr, &phase_histograms);
+
+	/* Cleanup sessions and context */
+	for (i = 0; i < session_count; i++){
+		if (workers[i].sess_open)
+			TEEC_CloseSession(&workers[i].sess);
+	}
+	TEEC_FinalizeContext(&ctx);
+
+	free(workers);
+	lua_ta_app_free(&app);
+
+	return 0;
+}
@@ -0,0 +1,93 @@
+/**
+ * A Lua application (see README.md for the layout) loaded into memory on the rich OS side.
+ *
+ * All TA scripts and the host entrypoint are read once, so calls from the host script do not touch the file system.
+ * Shared by the one-shot interpreter frontend and the daemon.
+ */
+
+#ifndef LUA_TA_APP_H
+#define LUA_TA_APP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lua.h"
+
+#include <lua_runtime_ta.h>
+
+#include "lua_ta_client.h"
+
+/* A script of the /ta/ folder of an application */
+struct lua_ta_script {
+	char *name;		/* file name up to the first '.' */
+	unsigned char *data;	/* the .lua or .luata file content, depending on the encrypted mode of the app */
+	long len;
+	uint8_t digest[LUA_TA_DIGEST_SIZE];	/* SHA-256 of data, compared against the manifest of the TA */
+};
+
+/* The app bundle in the /ta/ folder of an application, see encrypt_lua.py --bundle */
+#define LUA_TA_APP_BUNDLE_FILE	"app.luatb"
+
+struct lua_ta_app {
+	char *dir;			/* the application directory */
+	int encrypted_mode;		/* LUA_MODE_PLAINTEXT or LUA_MODE_ENCRYPTED */
+	int call_mode;			/* CALL_MODE_PASS or CALL_MODE_SAVED */
+	struct lua_ta_script *scripts;
+	int script_count;
+	unsigned char *bundle;		/* /ta/app.luatb in the encrypted mode, NULL if the app has none */
+	long bundlelen;
+	uint8_t bundle_digest[LUA_TA_DIGEST_SIZE];
+	unsigned char *host_script;	/* /host/main.lua, NULL if the app has none */
+	long host_scriptlen;
+};
+
+/**
+ * Reads all TA scripts and the host entrypoint of an application into memory.
+ *
+ * @param app            [out] The application
+ * @param dir            [in] The application directory
+ * @param encrypted_mode [in] LUA_MODE_ENCRYPTED to use the .luata files, LUA_MODE_PLAINTEXT to use the .lua files
+ * @param call_mode      [in] CALL_MODE_PASS to send in the scripts on every call, CALL_MODE_SAVED to call the saved ones
+ * @return 0 on success, -1 if the /ta/ folder cannot be read
+ */
+int lua_ta_app_load(struct lua_ta_app *app, const char *dir, int encrypted_mode, int call_mode);
+
+/* Frees everything held by the application */
+void lua_ta_app_free(struct lua_ta_app *app);
+
+/**
+ * Saves all TA scripts of the application in the TA secure storage, so they can call each other with internal_TA_call.
+ * Only scripts that differ from the manifest kept by the TA are sent, all in one command. If nothing changed this
+ * costs a single round trip. An app bundle, if there is one, is saved instead of the single scripts.
+ *
+ * @param app            [in] The application
+ * @param sess           [in] The session to the Lua runtime TA
+ * @return TEEC_SUCCESS, or the result of the first failing save
+ */
+TEEC_Result lua_ta_app_provision(const struct lua_ta_app *app, TEEC_Session *sess);
+
+/* Returns the TA script with the given name, or NULL */
+const struct lua_ta_script* lua_ta_app_find(const struct lua_ta_app *app, const char *name);
+
+/**
+ * Registers TA_call with a Lua state, making calls to the TA scripts of the application over the given session.
+ * A failing call raises a Lua error.
+ *
+ * @param L              [in/out] The Lua state
+ * @param app            [in] The application, has to outlive the state
+ * @param sess           [in] The session to the Lua runtime TA, has to outlive the state
+ */
+void lua_ta_app_register(lua_State *L, const struct lua_ta_app *app, TEEC_Session *sess);
+
+/**
+ * Runs /host/main.lua of the application in a fresh Lua state.
+ *
+ * @param app            [in] The application
+ * @param sess           [in] The session to the Lua runtime TA
+ * @param output         [out] Newly allocated copy of the string the script returned, or of the error message
+ * @param outlen         [out] The length of output
+ * @return 0 on success, -1 if the script could not be run
+ */
+int lua_ta_app_run_main(const struct lua_ta_app *app, TEEC_Session *sess, char **output, size_t *outlen);
+
+#endif /* LUA_TA_APP_H */
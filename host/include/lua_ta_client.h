@@ -0,0 +1,120 @@
+/**
+ * Rich OS side wrappers around the commands implemented by the Lua runtime TA (see lua_runtime_ta.h).
+ * Shared by the interpreter frontend and the benchmark harness.
+ */
+
+#ifndef LUA_TA_CLIENT_H
+#define LUA_TA_CLIENT_H
+
+#include <stddef.h>
+
+/* OP-TEE TEE client API (built by optee_client) */
+#include <tee_client_api.h>
+
+#define CALL_MODE_PASS 	0
+#define CALL_MODE_SAVED	 1
+
+struct lua_ta_histograms;
+struct lua_ta_manifest_entry;
+
+
+/**
+ * Reads a whole file into a newly allocated buffer.
+ *
+ * @param filename       [in] The path of the file
+ * @param out            [out] Will point to the allocated buffer containing the file content
+ * @param outlen         [out] The length of the file content
+ * @return 0 on success, -1 if the file could not be read
+ */
+int read_in_file(char* filename, unsigned char** out, long* outlen);
+
+/**
+ * Saves a Lua script to the TA storage. It can later be called without needing to resend the script from the rich OS side.
+ *
+ * @param sess           [in] The session to the Lua runtime TA
+ * @param script         [in] The Lua script to be saved
+ * @param scriptlen      [in] The length of the Lua script
+ * @param b_encrypted    [in] An integer flag indicating wether the lua script is encrypted or plaintext.
+ * @param script_name    [in] The name that the Lua script will be invoked with once saved
+ */
+TEEC_Result save_script(TEEC_Session *sess, unsigned char* script, size_t scriptlen, int b_encrypted, char* script_name);
+
+/**
+ * Gets the manifest of the scripts saved with save_scripts() from the TA.
+ *
+ * @param sess           [in] The session to the Lua runtime TA
+ * @param entries        [out] Newly allocated array of the manifest entries, NULL if there is no manifest
+ * @param count          [out] The number of entries
+ */
+TEEC_Result get_manifest(TEEC_Session *sess, struct lua_ta_manifest_entry **entries, uint32_t *count);
+
+/**
+ * Saves changed Lua scripts to the TA storage together with the new manifest, in a single command.
+ * Saved scripts missing from the manifest are deleted.
+ *
+ * @param sess           [in] The session to the Lua runtime TA
+ * @param bundle         [in] The changed scripts, each a struct lua_ta_manifest_entry followed by the script
+ * @param bundlelen      [in] The length of the bundle, may be 0
+ * @param manifest       [in] The complete new manifest
+ * @param count          [in] The number of manifest entries
+ */
+TEEC_Result save_scripts(TEEC_Session *sess, const void* bundle, size_t bundlelen,
+		const struct lua_ta_manifest_entry *manifest, uint32_t count);
+
+/**
+ * Saves the app bundle of an application to the TA storage, replacing the scripts saved before.
+ *
+ * @param sess           [in] The session to the Lua runtime TA
+ * @param bundle         [in] The app bundle (.luatb file content)
+ * @param bundlelen      [in] The length of the app bundle
+ */
+TEEC_Result save_app_bundle(TEEC_Session *sess, const void* bundle, size_t bundlelen);
+
+/**
+ * Runs a Lua script in the TA interpreter with the given argument and gets the return value from the returning params.
+ *
+ * @param sess           [in] The session to the Lua runtime TA
+ * @param script_name    [in] The name of the Lua script, used for tracing (may be NULL)
+ * @param script         [in] The Lua script OR the name of the Lua script to be run
+ * @param scriptlen      [in] The length of the Lua script OR the length of the name of the Lua script
+ * @param b_script_saved [in] An integer flag indicating wether to send in the Lua script or call one already saved in the secure TA storage.
+ * 							  script and scriptlen are interpreted accordingly.
+ * @param b_encrypted    [in] An integer flag indicating wether the lua script is encrypted or plaintext. (unused if b_script_saved == TRUE)
+ * @param input          [in] A pointer to the input argument
+ * @param input_type     [in] An integer flag indicating the type of the input argument
+ * @param output  		 [out] A pointer which will point to the return value
+ * @param output_type  	 [out] An integer flag indicating the type of the return value, LUA_TYPE_ERROR with the message
+ * 							  as the return value if the script raised an error
+ * @param err_origin     [out] (Optional) The origin of the returned error code
+ */
+TEEC_Result invoke_script(TEEC_Session *sess, const char* script_name, unsigned char* script, size_t scriptlen, int b_script_saved, int b_encrypted,
+		void* input, int input_type, void* output, int *output_type, uint32_t *err_origin);
+
+/**
+ * Runs a native loop inside the TA without involving the Lua interpreter. Used as a baseline for benchmarks,
+ * with iterations == 0 measuring the bare cost of a round trip to the TA.
+ *
+ * @param sess           [in] The session to the Lua runtime TA
+ * @param iterations     [in] The number of loop iterations to run inside the TA
+ * @param output         [out] The result of the loop
+ * @param err_origin     [out] (Optional) The origin of the returned error code
+ */
+TEEC_Result invoke_native_loop(TEEC_Session *sess, uint32_t iterations, uint32_t *output, uint32_t *err_origin);
+
+/**
+ * Requests the per phase latency breakdown from the TA for all following invoke_script() calls of the calling thread
+ * and aggregates it into the given histograms.
+ *
+ * @param h              [in] The histograms to add to, or NULL to stop requesting the breakdown
+ */
+void lua_ta_client_collect_stats(struct lua_ta_histograms *h);
+
+/**
+ * Passes a latency target to the TA with all following invoke_script() calls of the calling thread, which paces the
+ * garbage collector of the called script against it (see LUA_TA_GC_TARGET in lua_runtime_ta.h).
+ *
+ * @param us             [in] The target in microseconds, 0 for none
+ */
+void lua_ta_client_gc_target(uint32_t us);
+
+#endif /* LUA_TA_CLIENT_H */
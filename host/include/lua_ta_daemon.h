@@ -0,0 +1,28 @@
+/**
+ * Protocol between the long-running daemon (invoke_lua_daemon) and its thin client (invoke_lua_client).
+ *
+ * The daemon listens on a Unix domain stream socket. A connection carries any number of requests, each a single
+ * line terminated by '\n':
+ *
+ *   main                    runs /host/main.lua of the served application
+ *   call <script> <arg>     calls a TA script directly, <arg> is passed as a number if it is an integer,
+ *                           otherwise as a string (the rest of the line)
+ *   reload                  re-reads the application from disk and provisions its TA scripts again
+ *   stats                   returns request latency and (if enabled) TA phase breakdown summaries
+ *
+ * Every request is answered with a header line followed by <length> bytes of payload:
+ *
+ *   ok <latency_us> <length>\n<payload>
+ *   err <latency_us> <length>\n<payload>
+ *
+ * where latency_us is the time the daemon spent handling the request.
+ */
+
+#ifndef LUA_TA_DAEMON_H
+#define LUA_TA_DAEMON_H
+
+#define LUA_TA_DAEMON_SOCKET		"/tmp/invoke_lua_daemon.sock"
+#define LUA_TA_DAEMON_MAX_LINE		8192
+#define LUA_TA_DAEMON_DEFAULT_SESSIONS	4
+
+#endif /* LUA_TA_DAEMON_H */
@@ -0,0 +1,58 @@
+/**
+ * Aggregation of the per phase latency breakdown reported by the TA (see LUA_TA_FLAG_STATS in lua_runtime_ta.h)
+ * into log2 histograms. Updates are atomic, so a set of histograms can be shared between threads.
+ */
+
+#ifndef LUA_TA_STATS_H
+#define LUA_TA_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <lua_runtime_ta.h>
+
+/* Bucket i counts durations in [2^i, 2^(i+1)) ns, bucket 0 also counts 0 ns */
+#define LUA_TA_HIST_BUCKETS	48
+
+struct lua_ta_phase_histogram {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t min_ns;
+	uint64_t max_ns;
+	uint64_t buckets[LUA_TA_HIST_BUCKETS];
+};
+
+struct lua_ta_histograms {
+	uint64_t calls;
+	struct lua_ta_phase_histogram phases[LUA_TA_PHASE_COUNT];
+};
+
+/* Returns the short name of a LUA_TA_PHASE_* value */
+const char* lua_ta_phase_name(int phase);
+
+/* Resets all histograms */
+void lua_ta_histograms_init(struct lua_ta_histograms *h);
+
+/**
+ * Adds the phase durations of one call.
+ *
+ * @param h              [in/out] The histograms
+ * @param stats          [in] The statistics returned by the TA
+ */
+void lua_ta_histograms_add(struct lua_ta_histograms *h, const struct lua_ta_phase_stats *stats);
+
+/**
+ * Estimates a percentile of a phase from its histogram, interpolating inside the matching bucket.
+ *
+ * @param h              [in] The histogram of a single phase
+ * @param p              [in] The percentile (0-100)
+ */
+uint64_t lua_ta_histogram_percentile(const struct lua_ta_phase_histogram *h, double p);
+
+/* Prints count, mean, p50, p99 and max of every phase */
+void lua_ta_histograms_print(FILE *f, const struct lua_ta_histograms *h);
+
+/* Writes the same summary as a JSON object */
+void lua_ta_histograms_write_json(FILE *f, const struct lua_ta_histograms *h);
+
+#endif /* LUA_TA_STATS_H */
@@ -0,0 +1,95 @@
+/**
+ * Low overhead tracing of the calls into the Lua runtime TA.
+ *
+ * Every thread records its events into its own ring buffer without taking locks. The buffers are drained into a
+ * file on exit or when the process receives SIGUSR1, either in a compact binary format or as a Chrome trace
+ * (chrome://tracing, Perfetto) if the file name ends in ".json".
+ * While tracing is disabled, recording an event costs a single predictable branch.
+ */
+
+#ifndef LUA_TA_TRACE_H
+#define LUA_TA_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LUA_TA_TRACE_MAGIC		"LTATRACE"
+#define LUA_TA_TRACE_VERSION		1
+#define LUA_TA_TRACE_SCRIPT_LEN		32
+
+/* Default number of events kept per thread, can be overridden with the LUA_TA_TRACE_EVENTS environment variable */
+#define LUA_TA_TRACE_DEFAULT_EVENTS	4096
+
+#define LUA_TA_TRACE_FORMAT_BINARY	0
+#define LUA_TA_TRACE_FORMAT_CHROME	1
+
+/*
+ * A single traced call. The binary trace format is a struct lua_ta_trace_header followed by the raw events
+ * in host byte order.
+ */
+struct lua_ta_trace_event {
+	uint64_t start_ns;		/* CLOCK_MONOTONIC timestamp before the call */
+	uint64_t end_ns;		/* CLOCK_MONOTONIC timestamp after the call */
+	uint32_t call_id;		/* process wide sequence number of the call */
+	uint32_t tid;			/* id of the calling thread */
+	uint32_t command;		/* the TA command (see lua_runtime_ta.h) */
+	uint32_t result;		/* the TEEC_Result of the call */
+	uint32_t bytes_in;		/* bytes sent to the TA (script and argument) */
+	uint32_t bytes_out;		/* bytes received from the TA */
+	char script[LUA_TA_TRACE_SCRIPT_LEN];	/* name of the called script, NUL terminated if shorter */
+};
+
+struct lua_ta_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t event_size;
+};
+
+/* Set while tracing is enabled, only checked through lua_ta_trace_enabled() */
+extern int lua_ta_trace_on;
+
+static inline int lua_ta_trace_enabled(void){
+	return __builtin_expect(lua_ta_trace_on, 0);
+}
+
+/* Returns a CLOCK_MONOTONIC timestamp in ns if tracing is enabled, 0 otherwise */
+static inline uint64_t lua_ta_trace_now(void){
+	struct timespec ts;
+
+	if (!lua_ta_trace_enabled())
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Enables tracing. The recorded events are written to path when the process exits or receives SIGUSR1.
+ *
+ * @param path           [in] The file the trace is written to. Chrome trace JSON is written if it ends in ".json".
+ * @return 0 on success, -1 on failure
+ */
+int lua_ta_trace_init(const char *path);
+
+/**
+ * Records a call into the calling thread's ring buffer, overwriting the oldest event if it is full.
+ * Does nothing if tracing is disabled. start_ns is expected to come from lua_ta_trace_now().
+ *
+ * @param command        [in] The TA command that was invoked
+ * @param script         [in] The name of the called script (may be NULL)
+ * @param bytes_in       [in] Bytes sent to the TA
+ * @param bytes_out      [in] Bytes received from the TA
+ * @param result         [in] The TEEC_Result of the call
+ * @param start_ns       [in] Timestamp taken before the call
+ */
+void lua_ta_trace_call(uint32_t command, const char *script, size_t bytes_in, size_t bytes_out, uint32_t result, uint64_t start_ns);
+
+/**
+ * Writes all events currently held in the ring buffers to the trace file.
+ * Only uses async-signal-safe functions, so it can be called from a signal handler.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int lua_ta_trace_dump(void);
+
+#endif /* LUA_TA_TRACE_H */
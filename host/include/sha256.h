@@ -0,0 +1,28 @@
+/**
+ * Minimal SHA-256 (FIPS 180-4), used to compute the script digests of the provisioning manifest without
+ * depending on a crypto library on the rich OS side.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE	32
+
+struct sha256_ctx {
+	uint32_t state[8];
+	uint64_t length;		/* bytes hashed so far */
+	uint8_t block[64];
+	size_t block_len;
+};
+
+void sha256_init(struct sha256_ctx *ctx);
+void sha256_update(struct sha256_ctx *ctx, const void *data, size_t len);
+void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+/* Hashes a single buffer */
+void sha256(const void *data, size_t len, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif /* SHA256_H */
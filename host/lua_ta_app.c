@@ -0,0 +1,385 @@
+/**
+ * Implementations of the functions declared in lua_ta_app.h
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lprefix.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+/* To the the UUID (found the the TA's h-file(s)) */
+#include <lua_runtime_ta.h>
+
+#include "lua_arguments.h"
+#include "lua_ta_app.h"
+#include "sha256.h"
+
+
+static char* path_join(const char *dir, const char *sub, const char *file){
+	size_t len = strlen(dir) + strlen(sub) + strlen(file) + 1;
+	char *path = malloc(len);
+
+	if (path)
+		snprintf(path, len, "%s%s%s", dir, sub, file);
+	return path;
+}
+
+static int add_script(struct lua_ta_app *app, const char *name, const char *path){
+
+	struct lua_ta_script *scripts;
+	struct lua_ta_script *script;
+
+	scripts = realloc(app->scripts, (app->script_count + 1) * sizeof(*scripts));
+	if (!scripts)
+		return -1;
+	app->scripts = scripts;
+
+	script = &app->scripts[app->script_count];
+	script->name = strdup(name);
+	if (!script->name || read_in_file((char*)path, &script->data, &script->len)){
+		free(script->name);
+		return -1;
+	}
+	sha256(script->data, script->len, script->digest);
+
+	app->script_count++;
+	return 0;
+}
+
+
+int lua_ta_app_load(struct lua_ta_app *app, const char *dir, int encrypted_mode, int call_mode){
+
+	DIR *ta_dir;
+	struct dirent *ent;
+	char *path;
+	const char *wanted_ext = encrypted_mode ? "luata" : "lua";
+
+	memset(app, 0, sizeof(*app));
+	app->dir = strdup(dir);
+	app->encrypted_mode = encrypted_mode;
+	app->call_mode = call_mode;
+
+	path = path_join(dir, "/ta", "");
+	ta_dir = path ? opendir(path) : NULL;
+	free(path);
+	if (!ta_dir){
+		perror(dir);
+		return -1;
+	}
+
+	while ((ent = readdir(ta_dir)) != NULL){
+
+		/* Split the file name into script name and extension */
+		char *file_name = strdup(ent->d_name);
+		char *script_name = strtok(file_name, ".");
+		char *ext = strtok(NULL, ".");
+
+		if (script_name && ext && !strcmp(ext, wanted_ext)){
+			path = path_join(dir, "/ta/", ent->d_name);
+			if (!path || add_script(app, script_name, path))
+				fprintf(stderr, "cannot read %s/ta/%s\n", dir, ent->d_name);
+			free(path);
+		}
+
+		free(file_name);
+	}
+	closedir(ta_dir);
+
+	/* The app bundle holds all TA scripts, it is only used encrypted */
+	if (encrypted_mode){
+		path = path_join(dir, "/ta/", LUA_TA_APP_BUNDLE_FILE);
+		if (!path || read_in_file(path, &app->bundle, &app->bundlelen))
+			app->bundle = NULL;
+		else
+			sha256(app->bundle, app->bundlelen, app->bundle_digest);
+		free(path);
+	}
+
+	/* Load /host/main.lua, the entrypoint for the rich OS Lua script */
+	path = path_join(dir, "/host/main.lua", "");
+	if (!path || read_in_file(path, &app->host_script, &app->host_scriptlen))
+		app->host_script = NULL;
+	free(path);
+
+	return 0;
+}
+
+
+void lua_ta_app_free(struct lua_ta_app *app){
+
+	int i;
+
+	for (i = 0; i < app->script_count; i++){
+		free(app->scripts[i].name);
+		free(app->scripts[i].data);
+	}
+	free(app->scripts);
+	free(app->bundle);
+	free(app->host_script);
+	free(app->dir);
+	memset(app, 0, sizeof(*app));
+}
+
+
+/* Saves every script with its own command, for TAs without manifest support */
+static TEEC_Result provision_each(const struct lua_ta_app *app, TEEC_Session *sess){
+
+	TEEC_Result res;
+	int i;
+
+	for (i = 0; i < app->script_count; i++){
+		const struct lua_ta_script *script = &app->scripts[i];
+
+		res = save_script(sess, script->data, script->len, app->encrypted_mode, script->name);
+		if (res != TEEC_SUCCESS)
+			return res;
+	}
+
+	return TEEC_SUCCESS;
+}
+
+/* Returns the index of the entry with the given name, or -1 */
+static int find_entry(const struct lua_ta_manifest_entry *entries, uint32_t count, const char *name){
+
+	uint32_t i;
+
+	for (i = 0; i < count; i++){
+		if (!strncmp(entries[i].name, name, LUA_TA_SCRIPT_NAME_MAX))
+			return i;
+	}
+	return -1;
+}
+
+
+/* Saves the app bundle, unless the manifest says the TA has this very bundle already */
+static TEEC_Result provision_bundle(const struct lua_ta_app *app, TEEC_Session *sess){
+
+	struct lua_ta_manifest_entry *old = NULL, entry;
+	uint32_t old_count = 0;
+	TEEC_Result res;
+
+	memset(&entry, 0, sizeof(entry));
+	strcpy(entry.name, LUA_TA_APP_BUNDLE_ID);
+	entry.encrypted = LUA_MODE_ENCRYPTED;
+	entry.size = app->bundlelen;
+	memcpy(entry.digest, app->bundle_digest, LUA_TA_DIGEST_SIZE);
+
+	if (get_manifest(sess, &old, &old_count) == TEEC_SUCCESS && old_count == 1 && !memcmp(old, &entry, sizeof(entry)))
+		res = TEEC_SUCCESS;
+	else
+		res = save_app_bundle(sess, app->bundle, app->bundlelen);
+
+	free(old);
+	return res;
+}
+
+
+TEEC_Result lua_ta_app_provision(const struct lua_ta_app *app, TEEC_Session *sess){
+
+	struct lua_ta_manifest_entry *old = NULL, *manifest = NULL;
+	uint32_t old_count, i;
+	unsigned char *bundle = NULL, *p;
+	size_t bundlelen = 0;
+	int changed = 0;
+	TEEC_Result res;
+
+	if (app->bundle)
+		return provision_bundle(app, sess);
+
+	res = get_manifest(sess, &old, &old_count);
+	if (res == TEEC_ERROR_BAD_PARAMETERS || res == TEEC_ERROR_NOT_SUPPORTED)
+		return provision_each(app, sess);
+	if (res != TEEC_SUCCESS)
+		return res;
+
+	manifest = calloc(app->script_count ? app->script_count : 1, sizeof(*manifest));
+	if (!manifest){
+		res = TEEC_ERROR_OUT_OF_MEMORY;
+		goto exit;
+	}
+
+	/* Describe the scripts as they are sent and find the ones the TA does not have yet */
+	for (i = 0; i < (uint32_t)app->script_count; i++){
+		const struct lua_ta_script *script = &app->scripts[i];
+		int index;
+
+		if (strlen(script->name) >= LUA_TA_SCRIPT_NAME_MAX){
+			fprintf(stderr, "script name too long: %s\n", script->name);
+			res = TEEC_ERROR_BAD_PARAMETERS;
+			goto exit;
+		}
+		strcpy(manifest[i].name, script->name);
+		manifest[i].encrypted = app->encrypted_mode;
+		manifest[i].size = script->len;
+		memcpy(manifest[i].digest, script->digest, LUA_TA_DIGEST_SIZE);
+
+		index = find_entry(old, old_count, script->name);
+		if (index < 0 || memcmp(&old[index], &manifest[i], sizeof(*manifest))){
+			bundlelen += sizeof(*manifest) + script->len;
+			changed++;
+		}
+	}
+
+	/* Nothing to do if no script changed and none were removed */
+	if (!changed && old_count == (uint32_t)app->script_count)
+		goto exit;
+
+	bundle = malloc(bundlelen ? bundlelen : 1);
+	if (!bundle){
+		res = TEEC_ERROR_OUT_OF_MEMORY;
+		goto exit;
+	}
+
+	p = bundle;
+	for (i = 0; i < (uint32_t)app->script_count; i++){
+		int index = find_entry(old, old_count, manifest[i].name);
+
+		if (index >= 0 && !memcmp(&old[index], &manifest[i], sizeof(*manifest)))
+			continue;
+		memcpy(p, &manifest[i], sizeof(*manifest));
+		memcpy(p + sizeof(*manifest), app->scripts[i].data, app->scripts[i].len);
+		p += sizeof(*manifest) + app->scripts[i].len;
+	}
+
+	res = save_scripts(sess, bundle, bundlelen, manifest, app->script_count);
+
+exit:
+	free(bundle);
+	free(manifest);
+	free(old);
+	return res;
+}
+
+
+const struct lua_ta_script* lua_ta_app_find(const struct lua_ta_app *app, const char *name){
+
+	int i;
+
+	for (i = 0; i < app->script_count; i++){
+		if (!strcmp(app->scripts[i].name, name))
+			return &app->scripts[i];
+	}
+	return NULL;
+}
+
+
+/**
+ * Invokes a Lua TA from inside a Lua script on the rich OS side. Only called by Lua scripts.
+ * The application and the session are the upvalues of the closure.
+ *
+ * @param L   [in/out] The Lua stack passed from the Lua script
+ */
+static int TA_call(lua_State *L) {
+
+	const struct lua_ta_app *app = lua_touserdata(L, lua_upvalueindex(1));
+	TEEC_Session *sess = lua_touserdata(L, lua_upvalueindex(2));
+	const struct lua_ta_script *script = NULL;
+	void* lua_arg;
+	int lua_arg_type;
+	void* lua_ret = NULL;
+	int lua_ret_type;
+	uint32_t err_origin;
+	TEEC_Result res;
+
+	const char* script_name = luaL_checkstring(L, 1);
+
+	args_from_stack(L, 2, &lua_arg, &lua_arg_type);
+
+	/* For a performance increase, send in Lua TA scripts that are called instead of invoking scripts saved in the internal TA storage */
+	if (app->call_mode == CALL_MODE_PASS)
+		script = lua_ta_app_find(app, script_name);
+
+	if (script){
+		res = invoke_script(sess, script_name, script->data, script->len, CALL_MODE_PASS, app->encrypted_mode,
+				lua_arg, lua_arg_type, &lua_ret, &lua_ret_type, &err_origin);
+	} else {
+		/* If no file with the name was found, fall back on the TA secure storage*/
+		res = invoke_script(sess, script_name, (unsigned char*)script_name, strlen(script_name), CALL_MODE_SAVED, 0,
+				lua_arg, lua_arg_type, &lua_ret, &lua_ret_type, &err_origin);
+	}
+	free(lua_arg);
+
+	if (res != TEEC_SUCCESS)
+		return luaL_error(L, "TEEC_InvokeCommand failed with code %I origin %I", (lua_Integer)res, (lua_Integer)err_origin);
+
+	/* An error of the TA script is raised again in the calling script */
+	if (lua_ret_type == LUA_TYPE_ERROR){
+		lua_pushstring(L, lua_ret);
+		free(lua_ret);
+		return lua_error(L);
+	}
+
+	stack_from_args(L, &lua_ret, lua_ret_type);
+
+	/* String return values are handed over in a buffer owned by the caller */
+	if (lua_ret_type != LUA_TYPE_NUMBER)
+		free(lua_ret);
+
+	return 1;  /* number of results */
+}
+
+
+void lua_ta_app_register(lua_State *L, const struct lua_ta_app *app, TEEC_Session *sess){
+
+	lua_pushlightuserdata(L, (void*)app);
+	lua_pushlightuserdata(L, sess);
+	lua_pushcclosure(L, TA_call, 2);
+	lua_setglobal(L, "TA_call");
+}
+
+
+int lua_ta_app_run_main(const struct lua_ta_app *app, TEEC_Session *sess, char **output, size_t *outlen){
+
+	const char *result;
+	size_t len = 0;
+	int status;
+
+	*output = NULL;
+	*outlen = 0;
+
+	if (!app->host_script){
+		*output = strdup("no host/main.lua found");
+		*outlen = *output ? strlen(*output) : 0;
+		return -1;
+	}
+
+	lua_State *L = luaL_newstate();  /* create Lua state */
+	if (L == NULL) {
+		*output = strdup("cannot create state: not enough memory");
+		*outlen = *output ? strlen(*output) : 0;
+		return -1;
+	}
+
+	luaL_openlibs(L);
+
+	/* Register the function for calling TA Lua scripts with the state */
+	lua_ta_app_register(L, app, sess);
+
+	/* Load the lua script from the buffer and run it */
+	status = luaL_loadbuffer(L, (const char*)app->host_script, app->host_scriptlen, "lua_script");
+	if (status == LUA_OK)
+		status = lua_pcall(L, 0, 1, 0);
+
+	/* Return value of operation (or the error message) */
+	result = lua_tolstring(L, -1, &len);
+	if (!result){
+		result = "";
+		len = 0;
+	}
+
+	*output = malloc(len + 1);
+	if (*output){
+		memcpy(*output, result, len);
+		(*output)[len] = '\0';
+		*outlen = len;
+	}
+
+	lua_close(L);
+
+	return status == LUA_OK ? 0 : -1;
+}
@@ -0,0 +1,308 @@
+/**
+ * Implementations of the functions declared in lua_ta_client.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lprefix.h"
+#include "lauxlib.h"
+#include "lualib.h"
+
+/* To the the UUID and command IDs (found the the TA's h-file(s)) */
+#include <lua_runtime_ta.h>
+
+#include "lua_arguments.h"
+#include "lua_ta_client.h"
+#include "lua_ta_trace.h"
+#include "lua_ta_stats.h"
+
+/* Histograms the phase breakdown of the calls of this thread are added to, NULL if it is not requested */
+static __thread struct lua_ta_histograms *thread_stats = NULL;
+
+
+void lua_ta_client_collect_stats(struct lua_ta_histograms *h){
+	thread_stats = h;
+}
+
+/* Latency target passed with the calls of this thread, 0 for none */
+static __thread uint32_t thread_gc_target = 0;
+
+void lua_ta_client_gc_target(uint32_t us){
+	thread_gc_target = us < LUA_TA_GC_TARGET_MAX ? us : LUA_TA_GC_TARGET_MAX;
+}
+
+/* Picks up the phase statistics the TA appended to the returned data in params[3] */
+static void collect_phase_stats(TEEC_Parameter params[4]){
+
+	struct lua_ta_phase_stats stats;
+	size_t size = params[3].tmpref.size;
+
+	if (size < sizeof(stats) || size > BYTE_BUFFER_SIZE)
+		return;
+
+	memcpy(&stats, (char*)params[3].tmpref.buffer + size - sizeof(stats), sizeof(stats));
+	if (stats.magic == LUA_TA_STATS_MAGIC)
+		lua_ta_histograms_add(thread_stats, &stats);
+}
+
+
+int read_in_file(char* filename, unsigned char** out, long* outlen){
+
+	FILE* f = fopen (filename, "rb");
+	if (!f)
+		return -1;
+
+	fseek(f, 0, SEEK_END);
+	*outlen = ftell (f);
+	fseek(f, 0, SEEK_SET);
+	*out = malloc(*outlen);
+	if (!*out || fread (*out, 1, *outlen, f) != (size_t)*outlen){
+		free(*out);
+		*out = NULL;
+		fclose (f);
+		return -1;
+	}
+	fclose (f);
+
+	return 0;
+}
+
+
+TEEC_Result save_script(TEEC_Session *sess, unsigned char* script, size_t scriptlen, int b_encrypted, char* script_name){
+
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	uint64_t start;
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_VALUE_INPUT,
+					 TEEC_NONE);
+
+	op.params[0].tmpref.buffer = script_name;
+	op.params[0].tmpref.size = strlen(script_name);
+
+	op.params[1].tmpref.buffer = script;
+	op.params[1].tmpref.size = scriptlen;
+
+	op.params[2].value.a = b_encrypted;
+
+	start = lua_ta_trace_now();
+	res = TEEC_InvokeCommand(sess,
+				 TA_SAVE_LUA_SCRIPT,
+				 &op, &origin);
+	lua_ta_trace_call(TA_SAVE_LUA_SCRIPT, script_name, scriptlen, 0, res, start);
+
+	switch (res) {
+	case TEEC_SUCCESS:
+		break;
+	default:
+		printf("Command WRITE_RAW failed: 0x%x / %u\n", res, origin);
+	}
+
+	return res;
+
+}
+
+
+TEEC_Result get_manifest(TEEC_Session *sess, struct lua_ta_manifest_entry **entries, uint32_t *count){
+
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	uint64_t start;
+	size_t size = 64 * sizeof(**entries);
+
+	*entries = NULL;
+	*count = 0;
+
+	/* Retry once with the size reported by the TA if the manifest is larger than the guess */
+	for (;;){
+		void *buffer = malloc(size);
+		if (!buffer)
+			return TEEC_ERROR_OUT_OF_MEMORY;
+
+		memset(&op, 0, sizeof(op));
+		op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_OUTPUT,
+						 TEEC_NONE,
+						 TEEC_NONE,
+						 TEEC_NONE);
+		op.params[0].tmpref.buffer = buffer;
+		op.params[0].tmpref.size = size;
+
+		start = lua_ta_trace_now();
+		res = TEEC_InvokeCommand(sess, TA_GET_MANIFEST, &op, &origin);
+		lua_ta_trace_call(TA_GET_MANIFEST, NULL, 0, op.params[0].tmpref.size, res, start);
+
+		if (res == TEEC_ERROR_SHORT_BUFFER && op.params[0].tmpref.size > size){
+			free(buffer);
+			size = op.params[0].tmpref.size;
+			continue;
+		}
+		if (res != TEEC_SUCCESS || !op.params[0].tmpref.size){
+			free(buffer);
+			return res;
+		}
+
+		*entries = buffer;
+		*count = op.params[0].tmpref.size / sizeof(**entries);
+		return TEEC_SUCCESS;
+	}
+}
+
+
+TEEC_Result save_scripts(TEEC_Session *sess, const void* bundle, size_t bundlelen,
+		const struct lua_ta_manifest_entry *manifest, uint32_t count){
+
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	uint64_t start;
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE,
+					 TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void*)bundle;
+	op.params[0].tmpref.size = bundlelen;
+
+	op.params[1].tmpref.buffer = (void*)manifest;
+	op.params[1].tmpref.size = count * sizeof(*manifest);
+
+	start = lua_ta_trace_now();
+	res = TEEC_InvokeCommand(sess, TA_SAVE_LUA_SCRIPTS, &op, &origin);
+	lua_ta_trace_call(TA_SAVE_LUA_SCRIPTS, NULL, bundlelen + op.params[1].tmpref.size, 0, res, start);
+
+	if (res != TEEC_SUCCESS)
+		printf("Command SAVE_LUA_SCRIPTS failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+
+TEEC_Result save_app_bundle(TEEC_Session *sess, const void* bundle, size_t bundlelen){
+
+	TEEC_Operation op;
+	uint32_t origin;
+	TEEC_Result res;
+	uint64_t start;
+	memset(&op, 0, sizeof(op));
+	op.paramTypes = TEEC_PARAM_TYPES(TEEC_MEMREF_TEMP_INPUT,
+					 TEEC_NONE,
+					 TEEC_NONE,
+					 TEEC_NONE);
+
+	op.params[0].tmpref.buffer = (void*)bundle;
+	op.params[0].tmpref.size = bundlelen;
+
+	start = lua_ta_trace_now();
+	res = TEEC_InvokeCommand(sess, TA_SAVE_APP_BUNDLE, &op, &origin);
+	lua_ta_trace_call(TA_SAVE_APP_BUNDLE, NULL, bundlelen, 0, res, start);
+
+	if (res != TEEC_SUCCESS)
+		printf("Command SAVE_APP_BUNDLE failed: 0x%x / %u\n", res, origin);
+
+	return res;
+}
+
+
+TEEC_Result invoke_script(TEEC_Session *sess, const char* script_name, unsigned char* script, size_t scriptlen, int b_script_saved, int b_encrypted,
+		void* input, int input_type, void* output, int *output_type, uint32_t *err_origin){
+
+	uint32_t origin;
+	TEEC_Operation op = {0};
+	TEEC_Result res;
+	int ta_command;
+	uint64_t start;
+	size_t bytes_in = 0, bytes_out;
+
+	op.paramTypes = TEEC_PARAM_TYPES(
+		TEEC_MEMREF_TEMP_INPUT,
+		TEEC_VALUE_INOUT,
+		TEEC_VALUE_INPUT,
+		TEEC_MEMREF_TEMP_INOUT /* memory buffer used for string values and lua code used as an argument */
+	);
+
+	ta_command = b_script_saved ? TA_RUN_SAVED_LUA_SCRIPT : TA_RUN_LUA_SCRIPT;
+
+	op.params[0].tmpref.buffer = script;
+	op.params[0].tmpref.size = scriptlen;
+
+	op.params[1].value.a = input_type; // will get replaced by output type
+
+	op.params[2].value.a = b_encrypted;
+	op.params[2].value.b = (thread_stats ? LUA_TA_FLAG_STATS : 0) | LUA_TA_GC_TARGET(thread_gc_target);
+
+	op.params[3].tmpref.buffer = malloc(BYTE_BUFFER_SIZE);
+	op.params[3].tmpref.size = BYTE_BUFFER_SIZE;
+	if (!op.params[3].tmpref.buffer)
+		return TEEC_ERROR_OUT_OF_MEMORY;
+
+	params_from_args_rich(input, input_type, op.params);
+
+	if (lua_ta_trace_enabled())
+		bytes_in = scriptlen + (input_type == LUA_TYPE_NUMBER ? sizeof(uint32_t) : strnlen(op.params[3].tmpref.buffer, BYTE_BUFFER_SIZE));
+
+	start = lua_ta_trace_now();
+	res = TEEC_InvokeCommand(sess, ta_command, &op, &origin);
+	if (lua_ta_trace_enabled()){
+		bytes_out = op.params[1].value.a == LUA_TYPE_NUMBER ? sizeof(uint32_t) : op.params[3].tmpref.size;
+		lua_ta_trace_call(ta_command, script_name, bytes_in, res == TEEC_SUCCESS ? bytes_out : 0, res, start);
+	}
+	if (err_origin)
+		*err_origin = origin;
+
+	if (res != TEEC_SUCCESS){
+		free(op.params[3].tmpref.buffer);
+		return res;
+	}
+
+	*output_type = op.params[1].value.a;
+
+	if (thread_stats)
+		collect_phase_stats(op.params);
+
+	args_from_params_rich(output, op.params);
+
+	/* String and code return values point into the buffer, which is then owned by the caller */
+	if (*output_type == LUA_TYPE_NUMBER)
+		free(op.params[3].tmpref.buffer);
+
+	return TEEC_SUCCESS;
+
+}
+
+
+TEEC_Result invoke_native_loop(TEEC_Session *sess, uint32_t iterations, uint32_t *output, uint32_t *err_origin){
+
+	uint32_t origin;
+	TEEC_Operation op = {0};
+	TEEC_Result res;
+	uint64_t start;
+
+	op.paramTypes = TEEC_PARAM_TYPES(
+		TEEC_NONE,
+		TEEC_VALUE_INOUT,
+		TEEC_NONE,
+		TEEC_NONE
+	);
+
+	op.params[1].value.a = iterations;
+
+	start = lua_ta_trace_now();
+	res = TEEC_InvokeCommand(sess, TA_RUN_NATIVE_LOOP, &op, &origin);
+	lua_ta_trace_call(TA_RUN_NATIVE_LOOP, NULL, sizeof(uint32_t), sizeof(uint32_t), res, start);
+	if (err_origin)
+		*err_origin = origin;
+
+	if (res == TEEC_SUCCESS && output)
+		*output = op.params[1].value.b;
+
+	return res;
+
+}
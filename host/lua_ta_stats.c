@@ -0,0 +1,125 @@
+/**
+ * Implementations of the functions declared in lua_ta_stats.h
+ */
+
+#include <string.h>
+
+#include "lua_ta_stats.h"
+
+static const char *phase_names[LUA_TA_PHASE_COUNT] = {
+	"copy_in", "storage_read", "decrypt", "state_create", "openlibs",
+	"load", "args_in", "pcall", "args_out", "close", "gc"
+};
+
+
+const char* lua_ta_phase_name(int phase){
+	if (phase < 0 || phase >= LUA_TA_PHASE_COUNT)
+		return "unknown";
+	return phase_names[phase];
+}
+
+void lua_ta_histograms_init(struct lua_ta_histograms *h){
+	int i;
+
+	memset(h, 0, sizeof(*h));
+	for (i = 0; i < LUA_TA_PHASE_COUNT; i++)
+		h->phases[i].min_ns = UINT64_MAX;
+}
+
+static int bucket_of(uint64_t ns){
+	int b = ns ? 63 - __builtin_clzll(ns) : 0;
+	return b < LUA_TA_HIST_BUCKETS ? b : LUA_TA_HIST_BUCKETS - 1;
+}
+
+static void atomic_min(uint64_t *target, uint64_t v){
+	uint64_t cur = __atomic_load_n(target, __ATOMIC_RELAXED);
+	while (v < cur && !__atomic_compare_exchange_n(target, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+static void atomic_max(uint64_t *target, uint64_t v){
+	uint64_t cur = __atomic_load_n(target, __ATOMIC_RELAXED);
+	while (v > cur && !__atomic_compare_exchange_n(target, &cur, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void lua_ta_histograms_add(struct lua_ta_histograms *h, const struct lua_ta_phase_stats *stats){
+	uint32_t i, count = stats->phase_count;
+
+	if (count > LUA_TA_PHASE_COUNT)
+		count = LUA_TA_PHASE_COUNT;
+
+	__atomic_fetch_add(&h->calls, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < count; i++){
+		struct lua_ta_phase_histogram *ph = &h->phases[i];
+		uint64_t ns = stats->phase_ns[i];
+
+		__atomic_fetch_add(&ph->count, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&ph->sum_ns, ns, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&ph->buckets[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+		atomic_min(&ph->min_ns, ns);
+		atomic_max(&ph->max_ns, ns);
+	}
+}
+
+uint64_t lua_ta_histogram_percentile(const struct lua_ta_phase_histogram *h, double p){
+	uint64_t rank, seen = 0;
+	int b;
+
+	if (!h->count)
+		return 0;
+
+	rank = (uint64_t)(p / 100.0 * h->count + 0.999999);
+	if (rank < 1)
+		rank = 1;
+
+	for (b = 0; b < LUA_TA_HIST_BUCKETS; b++){
+		if (seen + h->buckets[b] >= rank){
+			uint64_t lo = b ? 1ull << b : 0;
+			uint64_t hi = 1ull << (b + 1);
+			uint64_t v = lo + (hi - lo) * (rank - seen) / h->buckets[b];
+
+			/* the exact extremes are known, never report beyond them */
+			if (v < h->min_ns)
+				v = h->min_ns;
+			if (v > h->max_ns)
+				v = h->max_ns;
+			return v;
+		}
+		seen += h->buckets[b];
+	}
+	return h->max_ns;
+}
+
+void lua_ta_histograms_print(FILE *f, const struct lua_ta_histograms *h){
+	int i;
+
+	fprintf(f, "TA phase breakdown over %llu calls (us)\n", (unsigned long long)h->calls);
+	fprintf(f, "%-14s %10s %12s %12s %12s %12s\n", "phase", "count", "mean", "p50", "p99", "max");
+	for (i = 0; i < LUA_TA_PHASE_COUNT; i++){
+		const struct lua_ta_phase_histogram *ph = &h->phases[i];
+
+		if (!ph->count || !ph->max_ns)
+			continue;
+		fprintf(f, "%-14s %10llu %12.1f %12.1f %12.1f %12.1f\n", phase_names[i], (unsigned long long)ph->count,
+			ph->sum_ns / 1e3 / ph->count, lua_ta_histogram_percentile(ph, 50) / 1e3,
+			lua_ta_histogram_percentile(ph, 99) / 1e3, ph->max_ns / 1e3);
+	}
+}
+
+void lua_ta_histograms_write_json(FILE *f, const struct lua_ta_histograms *h){
+	int i, first = 1;
+
+	fprintf(f, "{");
+	for (i = 0; i < LUA_TA_PHASE_COUNT; i++){
+		const struct lua_ta_phase_histogram *ph = &h->phases[i];
+
+		if (!ph->count)
+			continue;
+		fprintf(f, "%s\"%s\": {\"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f}",
+			first ? "" : ", ", phase_names[i], ph->sum_ns / 1e3 / ph->count,
+			lua_ta_histogram_percentile(ph, 50) / 1e3, lua_ta_histogram_percentile(ph, 99) / 1e3, ph->max_ns / 1e3);
+		first = 0;
+	}
+	fprintf(f, "}");
+}
@@ -0,0 +1,313 @@
+/**
+ * Implementations of the functions declared in lua_ta_trace.h
+ *
+ * Each thread owns a single producer ring buffer. The writer publishes an event by storing the incremented head
+ * with release semantics. The reader copies the slots below the head and afterwards drops every slot that the
+ * writer might have overwritten in the meantime, so neither side ever waits for the other.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "lua_ta_trace.h"
+
+struct trace_ring {
+	struct trace_ring *next;	/* list of all rings, only ever prepended to */
+	uint32_t tid;
+	uint32_t capacity;		/* power of two */
+	uint64_t head;			/* number of events ever written */
+	struct lua_ta_trace_event events[];
+};
+
+int lua_ta_trace_on = 0;
+
+static char trace_path[4096];
+static int trace_format = LUA_TA_TRACE_FORMAT_BINARY;
+static uint32_t ring_capacity = LUA_TA_TRACE_DEFAULT_EVENTS;
+
+static struct trace_ring *rings = NULL;
+static uint32_t next_call_id = 0;
+static int dumping = 0;
+
+static __thread struct trace_ring *thread_ring = NULL;
+
+
+static struct trace_ring* ring_for_thread(void){
+
+	struct trace_ring *ring = thread_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(*ring) + ring_capacity * sizeof(struct lua_ta_trace_event));
+	if (!ring)
+		return NULL;
+	ring->tid = (uint32_t)syscall(SYS_gettid);
+	ring->capacity = ring_capacity;
+
+	/* Publish the ring, rings are kept until the process exits so their events can still be drained */
+	ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	thread_ring = ring;
+	return ring;
+}
+
+
+void lua_ta_trace_call(uint32_t command, const char *script, size_t bytes_in, size_t bytes_out, uint32_t result, uint64_t start_ns){
+
+	struct trace_ring *ring;
+	struct lua_ta_trace_event *ev;
+	uint64_t head;
+
+	if (!lua_ta_trace_enabled())
+		return;
+
+	ring = ring_for_thread();
+	if (!ring)
+		return;
+
+	head = ring->head;
+	ev = &ring->events[head & (ring->capacity - 1)];
+
+	ev->start_ns = start_ns;
+	ev->end_ns = lua_ta_trace_now();
+	ev->call_id = __atomic_fetch_add(&next_call_id, 1, __ATOMIC_RELAXED);
+	ev->tid = ring->tid;
+	ev->command = command;
+	ev->result = result;
+	ev->bytes_in = (uint32_t)bytes_in;
+	ev->bytes_out = (uint32_t)bytes_out;
+	if (script)
+		strncpy(ev->script, script, LUA_TA_TRACE_SCRIPT_LEN);
+	else
+		ev->script[0] = '\0';
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Minimal buffered writer for the dump. snprintf and stdio are not async-signal-safe, so numbers are formatted by hand.
+ */
+struct out_buf {
+	int fd;
+	size_t len;
+	int failed;
+	char data[4096];
+};
+
+static void out_flush(struct out_buf *out){
+	size_t done = 0;
+
+	while (done < out->len && !out->failed){
+		ssize_t n = write(out->fd, out->data + done, out->len - done);
+		if (n <= 0)
+			out->failed = 1;
+		else
+			done += n;
+	}
+	out->len = 0;
+}
+
+static void out_mem(struct out_buf *out, const void *data, size_t len){
+	const char *p = data;
+
+	while (len){
+		size_t n = sizeof(out->data) - out->len;
+		if (n > len)
+			n = len;
+		memcpy(out->data + out->len, p, n);
+		out->len += n;
+		p += n;
+		len -= n;
+		if (out->len == sizeof(out->data))
+			out_flush(out);
+	}
+}
+
+static void out_str(struct out_buf *out, const char *s){
+	out_mem(out, s, strlen(s));
+}
+
+static void out_u64(struct out_buf *out, uint64_t v){
+	char digits[20];
+	int n = 0;
+
+	do {
+		digits[sizeof(digits) - ++n] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	out_mem(out, digits + sizeof(digits) - n, n);
+}
+
+/* Writes ns as microseconds with three decimals, the unit used by the Chrome trace format */
+static void out_us(struct out_buf *out, uint64_t ns){
+	char frac[3];
+
+	out_u64(out, ns / 1000);
+	frac[0] = '0' + (ns / 100) % 10;
+	frac[1] = '0' + (ns / 10) % 10;
+	frac[2] = '0' + ns % 10;
+	out_mem(out, ".", 1);
+	out_mem(out, frac, 3);
+}
+
+/* Script names come from Lua code, so everything that is not plainly printable is replaced */
+static void out_json_name(struct out_buf *out, const char *s){
+	int i;
+
+	for (i = 0; i < LUA_TA_TRACE_SCRIPT_LEN && s[i]; i++){
+		char c = s[i];
+		if (c < 0x20 || c > 0x7e || c == '"' || c == '\\')
+			c = '?';
+		out_mem(out, &c, 1);
+	}
+}
+
+static void out_chrome_event(struct out_buf *out, const struct lua_ta_trace_event *ev, int first){
+
+	out_str(out, first ? "\n" : ",\n");
+	out_str(out, "{\"name\":\"");
+	if (ev->script[0])
+		out_json_name(out, ev->script);
+	else
+		out_str(out, "call");
+	out_str(out, "\",\"cat\":\"cmd");
+	out_u64(out, ev->command);
+	out_str(out, "\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+	out_u64(out, ev->tid);
+	out_str(out, ",\"ts\":");
+	out_us(out, ev->start_ns);
+	out_str(out, ",\"dur\":");
+	out_us(out, ev->end_ns - ev->start_ns);
+	out_str(out, ",\"args\":{\"call_id\":");
+	out_u64(out, ev->call_id);
+	out_str(out, ",\"bytes_in\":");
+	out_u64(out, ev->bytes_in);
+	out_str(out, ",\"bytes_out\":");
+	out_u64(out, ev->bytes_out);
+	out_str(out, ",\"result\":");
+	out_u64(out, ev->result);
+	out_str(out, "}}");
+}
+
+
+int lua_ta_trace_dump(void){
+
+	struct out_buf out;
+	struct trace_ring *ring;
+	struct lua_ta_trace_header header;
+	int first = 1;
+
+	if (!trace_path[0])
+		return -1;
+
+	/* A dump triggered by a signal while another one is running is dropped */
+	if (__atomic_exchange_n(&dumping, 1, __ATOMIC_ACQUIRE))
+		return -1;
+
+	out.len = 0;
+	out.failed = 0;
+	out.fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out.fd < 0){
+		__atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	if (trace_format == LUA_TA_TRACE_FORMAT_CHROME){
+		out_str(&out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	} else {
+		memcpy(header.magic, LUA_TA_TRACE_MAGIC, sizeof(header.magic));
+		header.version = LUA_TA_TRACE_VERSION;
+		header.event_size = sizeof(struct lua_ta_trace_event);
+		out_mem(&out, &header, sizeof(header));
+	}
+
+	for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring; ring = ring->next){
+		uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		uint64_t i = head > ring->capacity ? head - ring->capacity : 0;
+
+		for (; i < head; i++){
+			struct lua_ta_trace_event ev = ring->events[i & (ring->capacity - 1)];
+			uint64_t now;
+
+			/* The copy is done before head is read again */
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			now = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+
+			/* The writer is at or past this slot again, the copy may be torn */
+			if (i + ring->capacity <= now)
+				continue;
+
+			if (trace_format == LUA_TA_TRACE_FORMAT_CHROME){
+				out_chrome_event(&out, &ev, first);
+				first = 0;
+			} else {
+				out_mem(&out, &ev, sizeof(ev));
+			}
+		}
+	}
+
+	if (trace_format == LUA_TA_TRACE_FORMAT_CHROME)
+		out_str(&out, "\n]}\n");
+
+	out_flush(&out);
+	close(out.fd);
+
+	__atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+	return out.failed ? -1 : 0;
+}
+
+
+static void dump_on_exit(void){
+	lua_ta_trace_dump();
+}
+
+static void dump_on_signal(int sig){
+	(void)sig;
+	lua_ta_trace_dump();
+}
+
+
+int lua_ta_trace_init(const char *path){
+
+	size_t len = strlen(path);
+	const char *events = getenv("LUA_TA_TRACE_EVENTS");
+	struct sigaction sa;
+
+	if (!len || len >= sizeof(trace_path))
+		return -1;
+
+	memcpy(trace_path, path, len + 1);
+	trace_format = (len >= 5 && !strcmp(path + len - 5, ".json")) ?
+		LUA_TA_TRACE_FORMAT_CHROME : LUA_TA_TRACE_FORMAT_BINARY;
+
+	/* Round the requested capacity up to a power of two so the ring index is a mask */
+	if (events && strtoul(events, NULL, 10) > 0){
+		unsigned long requested = strtoul(events, NULL, 10);
+		ring_capacity = 1;
+		while (ring_capacity < requested && ring_capacity < (1u << 24))
+			ring_capacity <<= 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = dump_on_signal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR1, &sa, NULL))
+		return -1;
+
+	if (atexit(dump_on_exit))
+		return -1;
+
+	lua_ta_trace_on = 1;
+	return 0;
+}
@@ -0,0 +1,503 @@
+/**
+ * Offline compiler for TA scripts (luac_ta). Compiles a Lua script with this repo's Lua sources and writes it as a
+ * stripped Lua 5.3 binary chunk for the ABI of the TA, so the TA can skip lexing and parsing. Runs on the build
+ * machine, encrypt_lua.py --compile calls it before encrypting.
+ *
+ *   luac_ta [-m 32|64] [-o output] script.lua
+ *   luac_ta -c [-m 32|64] [-o output.c] script.lua...
+ *
+ * The sizes of int, Instruction, lua_Integer and lua_Number are those of the luaconf.h this tool is built with,
+ * which is the one the TA is built with (so it must be built with LUA_NANBOX when the TA is, which makes lua_Integer
+ * an int). The word size of the TA (the size of size_t) is given with -m and defaults
+ * to the one of the build machine. Chunks are little endian like all OP-TEE targets.
+ *
+ * The TA only loads binary chunks out of authenticated (encrypted) containers, see call_lua().
+ *
+ * With -c the scripts are compiled ahead of time to C, to be built into the TA with LUA_USE_AOT (CFG_LUA_AOT in
+ * ta/sub.mk, LUA_TA_AOT_SCRIPTS with CMake). Every function of a script becomes a C function that runs its
+ * instructions with the helpers of the JIT (see lua/lnative.h), next to the binary chunk of the script. The output
+ * also holds the table of the scripts, by file name without .lua, which run_saved_lua_script() looks up first.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lundump.h"
+
+
+/* Mirrors the DumpState of ldump.c, with the word size of the target instead of the one of the build machine */
+typedef struct {
+	FILE *out;
+	int sizeof_size_t;
+} DumpState;
+
+
+static void dump_block(const void *b, size_t size, DumpState *D){
+	if (size && fwrite(b, size, 1, D->out) != 1)
+		err(1, "write");
+}
+
+#define dump_var(x, D)		dump_block(&(x), sizeof(x), D)
+#define dump_vector(v, n, D)	dump_block(v, (n) * sizeof((v)[0]), D)
+#define dump_literal(s, D)	dump_block(s, sizeof(s) - sizeof(char), D)
+
+static void dump_byte(int y, DumpState *D){
+	lu_byte x = (lu_byte)y;
+	dump_var(x, D);
+}
+
+static void dump_int(int x, DumpState *D){
+	dump_var(x, D);
+}
+
+/* size_t in the width of the target, little endian */
+static void dump_size(size_t x, DumpState *D){
+	int i;
+
+	if (D->sizeof_size_t < (int)sizeof(size_t) && x >> (D->sizeof_size_t * 8))
+		errx(1, "string of %zu bytes does not fit the %d bit target", x, D->sizeof_size_t * 8);
+	for (i = 0; i < D->sizeof_size_t; i++)
+		dump_byte(i < (int)sizeof(size_t) ? (int)((x >> (i * 8)) & 0xFF) : 0, D);
+}
+
+static void dump_string(const TString *s, DumpState *D){
+	size_t size;
+
+	if (s == NULL){
+		dump_byte(0, D);
+		return;
+	}
+
+	size = tsslen(s) + 1;  /* include trailing '\0' */
+	if (size < 0xFF)
+		dump_byte((int)size, D);
+	else {
+		dump_byte(0xFF, D);
+		dump_size(size, D);
+	}
+	dump_vector(getstr(s), size - 1, D);  /* no need to save '\0' */
+}
+
+static void dump_function(const Proto *f, DumpState *D){
+	int i;
+
+	dump_string(NULL, D);	/* stripped, no source name */
+	dump_int(f->linedefined, D);
+	dump_int(f->lastlinedefined, D);
+	dump_byte(f->numparams, D);
+	dump_byte(f->is_vararg, D);
+	dump_byte(f->maxstacksize, D);
+
+	dump_int(f->sizecode, D);
+	dump_vector(f->code, f->sizecode, D);
+
+	dump_int(f->sizek, D);
+	for (i = 0; i < f->sizek; i++){
+		const TValue *o = &f->k[i];
+		dump_byte(ttype(o), D);
+		switch (ttype(o)){
+		case LUA_TNIL:
+			break;
+		case LUA_TBOOLEAN:
+			dump_byte(bvalue(o), D);
+			break;
+		case LUA_TNUMFLT: {
+			lua_Number n = fltvalue(o);
+			dump_var(n, D);
+			break;
+		}
+		case LUA_TNUMINT: {
+			lua_Integer n = ivalue(o);
+			dump_var(n, D);
+			break;
+		}
+		case LUA_TSHRSTR:
+		case LUA_TLNGSTR:
+			dump_string(tsvalue(o), D);
+			break;
+		default:
+			errx(1, "unexpected constant type %d", ttype(o));
+		}
+	}
+
+	dump_int(f->sizeupvalues, D);
+	for (i = 0; i < f->sizeupvalues; i++){
+		dump_byte(f->upvalues[i].instack, D);
+		dump_byte(f->upvalues[i].idx, D);
+	}
+
+	dump_int(f->sizep, D);
+	for (i = 0; i < f->sizep; i++)
+		dump_function(f->p[i], D);
+
+	/* No line info, local or upvalue names */
+	dump_int(0, D);
+	dump_int(0, D);
+	dump_int(0, D);
+}
+
+static void dump_header(DumpState *D){
+	lua_Integer luac_int = LUAC_INT;
+	lua_Number luac_num = LUAC_NUM;
+
+	dump_literal(LUA_SIGNATURE, D);
+	dump_byte(LUAC_VERSION, D);
+	dump_byte(LUAC_FORMAT, D);
+	dump_literal(LUAC_DATA, D);
+	dump_byte(sizeof(int), D);
+	dump_byte(D->sizeof_size_t, D);
+	dump_byte(sizeof(Instruction), D);
+	dump_byte(sizeof(lua_Integer), D);
+	dump_byte(sizeof(lua_Number), D);
+	dump_var(luac_int, D);
+	dump_var(luac_num, D);
+}
+
+
+/* This Lua is built without file loading, so read the script first */
+static const Proto *load_script(lua_State *L, const char *path){
+	FILE *in;
+	static char buffer[16 * 1024 * 1024];
+	size_t len = 0, n;
+
+	in = fopen(path, "rb");
+	if (!in)
+		err(1, "%s", path);
+	while ((n = fread(buffer + len, 1, sizeof(buffer) - len, in)) > 0)
+		len += n;
+	if (ferror(in) || !feof(in))
+		errx(1, "%s: cannot read or larger than %zu bytes", path, sizeof(buffer));
+	fclose(in);
+
+	if (luaL_loadbufferx(L, buffer, len, path, "t") != LUA_OK)
+		errx(1, "%s", lua_tostring(L, -1));
+	return clLvalue(L->top - 1)->p;
+}
+
+static void dump_chunk(const Proto *f, DumpState *D){
+	dump_header(D);
+	dump_byte(f->sizeupvalues, D);
+	dump_function(f, D);
+}
+
+
+/*
+ * Compilation to C (-c). The code of a function has a label per instruction and starts at the one the frame is at,
+ * see the aot_* macros in lua/lnative.h.
+ */
+
+typedef struct {
+	FILE *out;
+	int script;	/* index of the script */
+	int nfunctions;	/* functions written so far */
+	int constants;	/* whether the function uses its constants */
+	int icache;	/* and its inline caches */
+	int dispatch;	/* whether it goes back to the switch on its pc, for OP_SWITCH */
+} CState;
+
+/* an RK operand */
+static const char *rk(CState *C, int x){
+	static char buf[2][32];
+	static int n;
+
+	n = !n;
+	if (ISK(x)){
+		C->constants = 1;
+		snprintf(buf[n], sizeof(buf[n]), "aot_K(%d)", INDEXK(x));
+	} else
+		snprintf(buf[n], sizeof(buf[n]), "aot_R(%d)", x);
+	return buf[n];
+}
+
+/* whether an RK key goes through the inline cache of its instruction: a constant short string, see lfunc.c */
+static int field(CState *C, const Proto *f, int x){
+	if (!ISK(x) || !ttisshrstring(f->k + INDEXK(x)))
+		return 0;
+	C->constants = C->icache = 1;
+	return 1;
+}
+
+static void write_instruction(CState *C, const Proto *f, int pc){
+	FILE *out = C->out;
+	Instruction i = f->code[pc];
+	OpCode op = getBaseOp(GET_OPCODE(i));
+	int a = GETARG_A(i), b = GETARG_B(i), c = GETARG_C(i);
+	int target = pc + 1 + GETARG_sBx(i);
+	const char *helper = NULL;
+
+	if (op == OP_EXTRAARG)	/* part of the instruction before */
+		return;
+	fprintf(out, " i%d: ", pc);
+	switch (op){
+	case OP_MOVE: fprintf(out, "aot_move(%d, %d)\n", a, b); break;
+	case OP_LOADK:
+		C->constants = 1;
+		fprintf(out, "aot_loadk(%d, %d)\n", a, GETARG_Bx(i));
+		break;
+	case OP_LOADBOOL:
+		fprintf(out, "aot_do(luaN_loadbool, %d)\n", pc);
+		if (c)
+			fprintf(out, "  goto i%d;\n", pc + 2);
+		break;
+	case OP_GETUPVAL: fprintf(out, "aot_getupval(%d, %d)\n", a, b); break;
+	case OP_ADD: case OP_SUB: case OP_MUL: {
+		const char *iop = op == OP_ADD ? "+" : op == OP_SUB ? "-" : "*";
+		const char *fop = op == OP_ADD ? "luai_numadd" : op == OP_SUB ? "luai_numsub" : "luai_nummul";
+
+		fprintf(out, "aot_arith(%d, %s, %s, %d, ", pc, iop, fop, a);
+		fprintf(out, "%s, ", rk(C, b));
+		fprintf(out, "%s)\n", rk(C, c));
+		break;
+	}
+	case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+	case OP_UNM: case OP_BNOT:
+		fprintf(out, "aot_do(luaN_arith, %d)\n", pc);
+		break;
+	case OP_JMP:
+		if (a != 0)
+			fprintf(out, "aot_do(luaN_jmp, %d)\n  ", pc);
+		fprintf(out, "goto i%d;\n", target);
+		break;
+	case OP_EQ: case OP_LT: case OP_LE: {
+		const char *h = op == OP_EQ ? "luaN_eq" : op == OP_LT ? "luaN_lt" : "luaN_le";
+		const char *iop = op == OP_EQ ? "==" : op == OP_LT ? "<" : "<=";
+		const char *fop = op == OP_EQ ? "luai_numeq" : op == OP_LT ? "luai_numlt" : "luai_numle";
+
+		fprintf(out, "aot_compare(%d, %s, %s, %s, %d, ", pc, h, iop, fop, a);
+		fprintf(out, "%s, ", rk(C, b));
+		fprintf(out, "%s, i%d)\n", rk(C, c), pc + 2);
+		break;
+	}
+	case OP_TEST: fprintf(out, "aot_test(%d, %d, i%d)\n", a, c, pc + 2); break;
+	case OP_TESTSET: fprintf(out, "aot_branch(luaN_testset, %d, 0, i%d)\n", pc, pc + 2); break;
+	case OP_SWITCH:
+		C->dispatch = 1;
+		fprintf(out, "aot_switch(%d)\n", pc);
+		break;
+	case OP_CALL: fprintf(out, "aot_call(%d)\n", pc); break;
+	case OP_RETURN: fprintf(out, "aot_exit(luaN_return, %d)\n", pc); break;
+	case OP_FORLOOP: fprintf(out, "aot_forloop(%d, %d, i%d)\n", pc, a, target); break;
+	case OP_FORPREP: fprintf(out, "aot_do(luaN_forprep, %d)\n  goto i%d;\n", pc, target); break;
+	case OP_TFORLOOP: fprintf(out, "aot_branch(luaN_tforloop, %d, 1, i%d)\n", pc, target); break;
+	case OP_LOADKX: helper = "loadkx"; break;
+	case OP_LOADNIL: helper = "loadnil"; break;
+	case OP_GETTABUP:
+		if (field(C, f, c))
+			fprintf(out, "aot_getfield(%d, luaN_gettabup, %d, aot_U(%d), %d)\n", pc, a, b, INDEXK(c));
+		else
+			helper = "gettabup";
+		break;
+	case OP_GETTABLE:
+		if (field(C, f, c))
+			fprintf(out, "aot_getfield(%d, luaN_gettable, %d, aot_R(%d), %d)\n", pc, a, b, INDEXK(c));
+		else if (!ISK(c))
+			fprintf(out, "aot_gettable(%d, %d, %d, %d)\n", pc, a, b, c);
+		else
+			helper = "gettable";
+		break;
+	case OP_SETTABUP:
+		if (field(C, f, b))
+			fprintf(out, "aot_setfield(%d, luaN_settabup, aot_U(%d), %d, %s)\n", pc, a, INDEXK(b), rk(C, c));
+		else
+			helper = "settabup";
+		break;
+	case OP_SETUPVAL: helper = "setupval"; break;
+	case OP_SETTABLE:
+		if (field(C, f, b))
+			fprintf(out, "aot_setfield(%d, luaN_settable, aot_R(%d), %d, %s)\n", pc, a, INDEXK(b), rk(C, c));
+		else if (!ISK(b))
+			fprintf(out, "aot_settable(%d, %d, %d, %s)\n", pc, a, b, rk(C, c));
+		else
+			helper = "settable";
+		break;
+	case OP_NEWTABLE: helper = "newtable"; break;
+	case OP_SELF: helper = "self"; break;
+	case OP_NOT: helper = "not"; break;
+	case OP_LEN: helper = "len"; break;
+	case OP_CONCAT: helper = "concat"; break;
+	case OP_TFORCALL: helper = "tforcall"; break;	/* goes on with its TFORLOOP */
+	case OP_SETLIST: helper = "setlist"; break;
+	case OP_CLOSURE: helper = "closure"; break;
+	case OP_VARARG: helper = "vararg"; break;
+	default:	/* TAILCALL, MOD and POW are left to the interpreter */
+		fprintf(out, "aot_exit(luaN_exit, %d)\n", pc);
+		break;
+	}
+	if (helper)	/* the whole instruction in its helper */
+		fprintf(out, "aot_do(luaN_%s, %d)\n", helper, pc);
+}
+
+/* the function and the ones nested in it, in preorder; the code of each function goes to a temporary file first */
+static void write_function(CState *C, const Proto *f){
+	FILE *out = C->out;
+	FILE *body = tmpfile();
+	int pc, ch, n = C->nfunctions++;
+
+	if (!body)
+		err(1, "tmpfile");
+	C->out = body;
+	C->constants = C->icache = C->dispatch = 0;
+	for (pc = 0; pc < f->sizecode; pc++)
+		write_instruction(C, f, pc);
+	C->out = out;
+
+	fprintf(out, "static void s%d_f%d (lua_State *L, CallInfo *ci) {\n", C->script, n);
+	fprintf(out, "  aot_frame;\n");
+	if (C->constants)
+		fprintf(out, "  aot_constants;\n");
+	if (C->icache)
+		fprintf(out, "  aot_icache;\n");
+	if (C->dispatch)
+		fprintf(out, " dispatch:\n");
+	fprintf(out, "  switch (aot_pc) {\n");
+	for (pc = 0; pc < f->sizecode; pc++)
+		if (getBaseOp(GET_OPCODE(f->code[pc])) != OP_EXTRAARG)
+			fprintf(out, "    case %d: goto i%d;\n", pc, pc);
+	fprintf(out, "    default: (void)base; return;  /* not the start of an instruction */\n  }\n");
+	rewind(body);
+	while ((ch = getc(body)) != EOF)
+		putc(ch, out);
+	fclose(body);
+	fprintf(out, "}\n\n");
+
+	for (pc = 0; pc < f->sizep; pc++)
+		write_function(C, f->p[pc]);
+}
+
+static void write_script(FILE *out, int script, const char *path, const Proto *f, int bits){
+	CState C = { out, script, 0, 0, 0, 0 };
+	DumpState D;
+	char *chunk;
+	size_t size, i;
+	int n;
+
+	D.sizeof_size_t = bits / 8;
+	D.out = open_memstream(&chunk, &size);
+	if (!D.out)
+		err(1, "open_memstream");
+	dump_chunk(f, &D);
+	if (fclose(D.out))
+		err(1, "open_memstream");
+
+	fprintf(out, "/* %s */\n\n", path);
+	write_function(&C, f);
+
+	fprintf(out, "static void (*const s%d_functions[]) (lua_State *L, CallInfo *ci) = {\n", script);
+	for (n = 0; n < C.nfunctions; n++)
+		fprintf(out, "  s%d_f%d,\n", script, n);
+	fprintf(out, "};\n\nstatic const unsigned char s%d_chunk[] = {", script);
+	for (i = 0; i < size; i++)
+		fprintf(out, "%s0x%02x,", i % 16 ? " " : "\n  ", (unsigned char)chunk[i]);
+	fprintf(out, "\n};\n\n");
+	free(chunk);
+}
+
+/* the name of a script in the table of run_saved_lua_script(), its file name without .lua */
+static char *script_name(const char *path){
+	const char *base = strrchr(path, '/');
+	char *name = strdup(base ? base + 1 : path);
+	size_t len;
+
+	if (!name)
+		err(1, "strdup");
+	len = strlen(name);
+	if (len > 4 && strcmp(name + len - 4, ".lua") == 0)
+		name[len - 4] = '\0';
+	return name;
+}
+
+static void write_c(FILE *out, char **paths, int npaths, int bits){
+	char **names = calloc(npaths, sizeof(*names));
+	int i, j;
+
+	if (!names)
+		err(1, "calloc");
+	fprintf(out, "/* Lua scripts compiled to C by luac_ta -c, do not edit */\n\n"
+		     "#define LUA_CORE\n\n"
+		     "#include \"lprefix.h\"\n\n"
+		     "#include \"lua.h\"\n\n"
+		     "#include \"laot.h\"\n"
+		     "#include \"lnative.h\"\n"
+		     "#include \"lvm.h\"\n\n"
+		     "#if !LUA_USE_AOT\n"
+		     "#error \"build with LUA_USE_AOT\"\n"
+		     "#endif\n\n\n");
+
+	for (i = 0; i < npaths; i++){
+		lua_State *L = luaL_newstate();
+
+		if (!L)
+			errx(1, "cannot create state: not enough memory");
+		names[i] = script_name(paths[i]);
+		for (j = 0; j < i; j++)
+			if (strcmp(names[i], names[j]) == 0)
+				errx(1, "%s: a script called %s comes before", paths[i], names[i]);
+		write_script(out, i, paths[i], load_script(L, paths[i]), bits);
+		lua_close(L);
+	}
+
+	fprintf(out, "const lua_AotScript lua_aotscripts[] = {\n");
+	for (i = 0; i < npaths; i++){
+		fprintf(out, "  {\"%s\", s%d_chunk, sizeof(s%d_chunk), s%d_functions,\n", names[i], i, i, i);
+		fprintf(out, "   sizeof(s%d_functions) / sizeof(s%d_functions[0])},\n", i, i);
+		free(names[i]);
+	}
+	fprintf(out, "};\n\nconst int lua_naotscripts = %d;\n", npaths);
+	free(names);
+}
+
+
+static void usage(const char *prog){
+	fprintf(stderr, "Usage: %s [-m 32|64] [-o output] script.lua\n"
+			"       %s -c [-m 32|64] [-o output.c] script.lua...\n", prog, prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = NULL;
+	DumpState D;
+	lua_State *L;
+	FILE *out;
+	int opt, bits = sizeof(size_t) * 8, to_c = 0;
+
+	while ((opt = getopt(argc, argv, "cm:o:")) != -1) {
+		switch (opt) {
+		case 'c': to_c = 1; break;
+		case 'm': bits = atoi(optarg); break;
+		case 'o': output = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind == argc || (!to_c && optind != argc - 1) || (bits != 32 && bits != 64))
+		usage(argv[0]);
+
+	out = output ? fopen(output, "wb") : stdout;
+	if (!out)
+		err(1, "%s", output);
+
+	if (to_c)
+		write_c(out, argv + optind, argc - optind, bits);
+	else {
+		L = luaL_newstate();
+		if (!L)
+			errx(1, "cannot create state: not enough memory");
+		D.sizeof_size_t = bits / 8;
+		D.out = out;
+		dump_chunk(load_script(L, argv[optind]), &D);
+		lua_close(L);
+	}
+
+	if (fclose(out))
+		err(1, "%s", output ? output : "stdout");
+	return 0;
+}
@@ -282,8 +282,8 @@ void stack_from_args(lua_State *L, void* lua_arg, int lua_arg_type){
 			/* The lua data fits no datatype that can be directly represented in c, so deserialization is required*/
 
 			/* lua_arg points to a string containing a lua script, which is to be executed to load the contained data onto the stack*/
-			/* load the lua arg script */
-			luaL_loadbuffer(L, *(char**)lua_arg, strlen(*(char**)lua_arg), "lua_arg_script"); 
+			/* load the lua arg script, as source only since it does not come out of an authenticated container */
+			luaL_loadbufferx(L, *(char**)lua_arg, strlen(*(char**)lua_arg), "lua_arg_script", "t"); 
 
 			/* execute the passed script, the lua argument now rests on top of the stack */					
 			if (lua_pcall(L, 0, 1, 0))                  
@@ -350,6 +350,7 @@ void params_from_args_ta(void* lua_arg, int lua_arg_type, TEE_Param params[4]){
 			break;
 		case LUA_TYPE_STRING:
 		case LUA_TYPE_CODE:
+		case LUA_TYPE_ERROR:
 			/* copy the string into the preallocated buffer (rich side)*/
 			strncpy(params[3].memref.buffer, *(char**)lua_arg, BYTE_BUFFER_SIZE);
 			params[3].memref.size = strlen(params[3].memref.buffer)+1;
@@ -364,11 +365,11 @@ void args_from_params_ta(void* lua_arg, TEE_Param params[4]){
 
 	switch(params[1].value.a){
 		case LUA_TYPE_NUMBER:
-			*(int*)lua_arg = &params[1].value.b;
+			*(void**)lua_arg = &params[1].value.b;
 			break;
 		case LUA_TYPE_STRING:
 		case LUA_TYPE_CODE:
-			*(char**)lua_arg = &params[3].memref.buffer;
+			*(void**)lua_arg = &params[3].memref.buffer;
 			break;
 		default:
 			break;
@@ -403,6 +404,7 @@ void args_from_params_rich(void* lua_arg, TEEC_Parameter params[4]){
 			break;
 		case LUA_TYPE_STRING:
 		case LUA_TYPE_CODE:
+		case LUA_TYPE_ERROR:
 			*(char**)lua_arg = params[3].tmpref.buffer;
 			break;
 		default:
@@ -19,6 +19,7 @@
 #define LUA_TYPE_NUMBER 0   // A integer value
 #define LUA_TYPE_STRING 1   // A string value
 #define LUA_TYPE_CODE 2     // Any other arbitrary lua element, represented as lua code that return the element
+#define LUA_TYPE_ERROR 3    // Only returned: the script raised an error, the value is its message as a string
 
 #ifdef TRUSTED_APP_BUILD
 #include <tee_internal_api.h>
@@ -0,0 +1,38 @@
+/*
+** Lua scripts compiled to C ahead of time by 'luac_ta -c'
+** See Copyright Notice in lua.h
+*/
+
+#ifndef laot_h
+#define laot_h
+
+#include <stddef.h>
+
+#include "lua.h"
+
+
+struct CallInfo;
+
+/* a script compiled into the program */
+typedef struct lua_AotScript {
+  const char *name;
+  const unsigned char *chunk;  /* its binary chunk */
+  size_t size;
+  /* the code of each of its functions, the main one first (preorder) */
+  void (*const *functions) (lua_State *L, struct CallInfo *ci);
+  int nfunctions;
+} lua_AotScript;
+
+
+/* the table written by 'luac_ta -c' */
+extern const lua_AotScript lua_aotscripts[];
+extern const int lua_naotscripts;
+
+
+/* the compiled script called 'name', or NULL */
+LUA_API const lua_AotScript *(lua_aotfind) (const char *name, size_t len);
+
+/* load a compiled script like 'lua_load' does its source */
+LUA_API int (lua_aotload) (lua_State *L, const lua_AotScript *s);
+
+#endif
@@ -1066,7 +1066,9 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
     case LUA_GCSTEP: {
       l_mem debt = 1;  /* =1 to signal that it did an actual step */
       lu_byte oldrunning = g->gcrunning;
+      lua_Integer olddeadline = g->gcdeadline;
       g->gcrunning = 1;  /* allow GC to run */
+      g->gcdeadline = 0;  /* asked for: run it now */
       if (data == 0) {
         luaE_setdebt(g, -GCSTEPSIZE);  /* to do a "small" step */
         luaC_step(L);
@@ -1077,8 +1079,9 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
-        res = 1;  /* signal it */
+      g->gcdeadline = olddeadline;
+      if (debt > 0 && (g->gcstate == GCSpause || isgenerational(g)))
+        res = 1;  /* signal end of cycle (a generational one is whole) */
       break;
     }
     case LUA_GCSETPAUSE: {
@@ -1092,10 +1095,27 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCSETMAJORINC: {
+      res = g->genmajormul;
+      g->genmajormul = data;
+      break;
+    }
     case LUA_GCISRUNNING: {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: case LUA_GCINC: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* previous mode */
+      if (what == LUA_GCGEN && data != 0)
+        g->genminormul = data;
+      luaC_changemode(L, (what == LUA_GCGEN) ? KGC_GEN : KGC_NORMAL);
+      break;
+    }
+    case LUA_GCSETLIMIT: {
+      res = cast_int(g->gclimit >> 10);
+      g->gclimit = (data > 0) ? cast(lu_mem, data) << 10 : 0;
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1103,6 +1123,37 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
 }
 
 
+/*
+** Time the collector with 'clock' and pace it against 'deadline', a
+** time of that clock: a step that would end after the deadline is
+** skipped, unless memory is over the limit set with LUA_GCSETLIMIT.
+** A 'deadline' of 0 only times the collector, a NULL 'clock' stops both.
+*/
+LUA_API void lua_gcdeadline (lua_State *L, lua_Clock clock,
+                             lua_Integer deadline) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  if (clock != g->gcclock)
+    g->gcsteptime = 0;  /* measured with another clock */
+  g->gcclock = clock;
+  g->gcdeadline = (clock != NULL) ? deadline : 0;
+  lua_unlock(L);
+}
+
+
+/*
+** Time the collector has run while it was timed (see 'lua_gcdeadline')
+*/
+LUA_API lua_Integer lua_gctime (lua_State *L) {
+  lua_Integer t;
+  lua_lock(L);
+  t = G(L)->gctime;
+  lua_unlock(L);
+  return t;
+}
+
+
 
 /*
 ** miscellaneous functions
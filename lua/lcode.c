@@ -43,7 +43,7 @@
 ** If expression is a numeric constant, fills 'v' with its value
 ** and returns 1. Otherwise, returns 0.
 */
-static int tonumeral(expdesc *e, TValue *v) {
+static int tonumeral(const expdesc *e, TValue *v) {
   if (hasjumps(e))
     return 0;  /* not a numeral */
   switch (e->k) {
@@ -258,6 +258,30 @@ void luaK_patchtohere (FuncState *fs, int list) {
 }
 
 
+/*
+** Start code that 'luaK_dropcode' may remove: jumps pending to this
+** position are fixed first, so that they stay out of it. Return the
+** position.
+*/
+int luaK_markcode (FuncState *fs) {
+  int pc = luaK_getlabel(fs);  /* mark "here" as a jump target */
+  dischargejpc(fs);
+  return pc;
+}
+
+
+/*
+** Remove the code from position 'pc' on. Nothing before it may jump
+** into it, so pending jumps all come from the removed code.
+*/
+void luaK_dropcode (FuncState *fs, int pc) {
+  lua_assert(pc <= fs->pc);
+  fs->pc = pc;
+  fs->jpc = NO_JUMP;
+  fs->lasttarget = pc;
+}
+
+
 /*
 ** Path all jumps in 'list' to jump to 'target'.
 ** (The assert means that we cannot fix a jump to a forward address
@@ -469,11 +493,13 @@ int luaK_stringK (FuncState *fs, TString *s) {
 ** Add an integer to list of constants and return its index.
 ** Integers use userdata as keys to avoid collision with floats with
 ** same value; conversion to 'void*' is used only for hashing, so there
-** are no "precision" problems.
+** are no "precision" problems. (The integer goes through 'lua_Unsigned'
+** so that a negative one does not fill the high bits of the pointer,
+** which a NaN-boxed light userdata cannot hold.)
 */
 int luaK_intK (FuncState *fs, lua_Integer n) {
   TValue k, o;
-  setpvalue(&k, cast(void*, cast(size_t, n)));
+  setpvalue(&k, cast(void*, cast(size_t, l_castS2U(n))));
   setivalue(&o, n);
   return addk(fs, &k, &o);
 }
@@ -553,11 +579,61 @@ void luaK_setoneret (FuncState *fs, expdesc *e) {
 }
 
 
+/*
+** Change the value of a compile-time constant 'v' into expression 'e'.
+*/
+static void const2exp (FuncState *fs, TValue *v, expdesc *e) {
+  if (ttisinteger(v)) {
+    e->k = VKINT;
+    e->u.ival = ivalue(v);
+  }
+  else if (ttisfloat(v)) {
+    e->k = VKFLT;
+    e->u.nval = fltvalue(v);
+  }
+  else if (ttisstring(v)) {
+    e->k = VK;
+    e->u.info = luaK_stringK(fs, tsvalue(v));
+  }
+  else if (ttisboolean(v))
+    e->k = bvalue(v) ? VTRUE : VFALSE;
+  else {
+    lua_assert(ttisnil(v));
+    e->k = VNIL;
+  }
+}
+
+
+/*
+** If expression 'e' has a value known at compile time (a constant
+** without jumps), fills 'v' with it and returns 1. Otherwise, returns 0.
+*/
+int luaK_exp2const (FuncState *fs, const expdesc *e, TValue *v) {
+  if (hasjumps(e))
+    return 0;
+  switch (e->k) {
+    case VNIL: setnilvalue(v); return 1;
+    case VTRUE: setbvalue(v, 1); return 1;
+    case VFALSE: setbvalue(v, 0); return 1;
+    case VK: setobj(fs->ls->L, v, &fs->f->k[e->u.info]); return 1;
+    case VCONST: {
+      setobj(fs->ls->L, v, &fs->ls->dyd->actvar.arr[e->u.info].k);
+      return 1;
+    }
+    default: return tonumeral(e, v);
+  }
+}
+
+
 /*
 ** Ensure that expression 'e' is not a variable.
 */
 void luaK_dischargevars (FuncState *fs, expdesc *e) {
   switch (e->k) {
+    case VCONST: {  /* its value is known */
+      const2exp(fs, &fs->ls->dyd->actvar.arr[e->u.info].k, e);
+      break;
+    }
     case VLOCAL: {  /* already in a register */
       e->k = VNONRELOC;  /* becomes a non-relocatable value */
       break;
@@ -711,6 +787,17 @@ void luaK_exp2nextreg (FuncState *fs, expdesc *e) {
 }
 
 
+/*
+** Ensures final expression result (including results from its jump
+** lists) is in register 'reg'.
+*/
+void luaK_exp2reg (FuncState *fs, expdesc *e, int reg) {
+  luaK_dischargevars(fs, e);
+  freeexp(fs, e);
+  exp2reg(fs, e, reg);
+}
+
+
 /*
 ** Ensures final expression result (including results from its jump
 ** lists) is in some (any) register and return that register.
@@ -955,10 +1042,34 @@ void luaK_indexed (FuncState *fs, expdesc *t, expdesc *k) {
 }
 
 
+/*
+** With LUA_NANBOX, return false if the integer result of 'op' does not
+** fit into the 32 bits of integers (see 'checkedintop').
+*/
+static int fitsint (int op, TValue *v1, TValue *v2) {
+#if LUA_NANBOX
+  if (ttisinteger(v1) && ttisinteger(v2)) {
+    lua_Integer i1 = ivalue(v1), i2 = ivalue(v2);
+    switch (op) {
+      case LUA_OPADD: return intfits(+, i1, i2);
+      case LUA_OPSUB: return intfits(-, i1, i2);
+      case LUA_OPMUL: return intfits(*, i1, i2);
+      case LUA_OPUNM: return intfits(-, 0, i1);
+      case LUA_OPIDIV: return (i2 != -1 || intfits(-, 0, i1));
+      default: break;
+    }
+  }
+#else
+  UNUSED(op); UNUSED(v1); UNUSED(v2);
+#endif
+  return 1;
+}
+
+
 /*
 ** Return false if folding can raise an error.
 ** Bitwise operations need operands convertible to integers; division
-** operations cannot have 0 as divisor.
+** operations cannot have 0 as divisor; integer results have to fit.
 */
 static int validop (int op, TValue *v1, TValue *v2) {
   switch (op) {
@@ -968,8 +1079,8 @@ static int validop (int op, TValue *v1, TValue *v2) {
       return (tointeger(v1, &i) && tointeger(v2, &i));
     }
     case LUA_OPDIV: case LUA_OPIDIV: case LUA_OPMOD:  /* division by 0 */
-      return (nvalue(v2) != 0);
-    default: return 1;  /* everything else is valid */
+      return (nvalue(v2) != 0 && fitsint(op, v1, v2));
+    default: return fitsint(op, v1, v2);  /* overflows */
   }
 }
 
@@ -998,6 +1109,38 @@ static int constfolding (FuncState *fs, int op, expdesc *e1, expdesc *e2) {
 }
 
 
+/*
+** Try to "constant-fold" a comparison of two numerals or, for
+** equality, of two string constants; return 1 iff successful.
+** (In this case, 'e1' has the final result.)
+*/
+static int compfolding (FuncState *fs, BinOpr opr, expdesc *e1,
+                                                   expdesc *e2) {
+  TValue v1, v2;
+  int res;
+  if (tonumeral(e1, &v1) && tonumeral(e2, &v2)) {
+    lua_State *L = fs->ls->L;  /* numbers have no metamethods */
+    switch (opr) {
+      case OPR_EQ: case OPR_NE: res = luaV_equalobj(NULL, &v1, &v2); break;
+      case OPR_LT: res = luaV_lessthan(L, &v1, &v2); break;
+      case OPR_LE: res = luaV_lessequal(L, &v1, &v2); break;
+      case OPR_GT: res = luaV_lessthan(L, &v2, &v1); break;
+      default: res = luaV_lessequal(L, &v2, &v1); break;  /* OPR_GE */
+    }
+  }
+  else if ((opr == OPR_EQ || opr == OPR_NE) &&
+           e1->k == VK && !hasjumps(e1) && ttisstring(&fs->f->k[e1->u.info]) &&
+           e2->k == VK && !hasjumps(e2) && ttisstring(&fs->f->k[e2->u.info]))
+    res = (e1->u.info == e2->u.info);  /* 'addk' keeps one entry per value */
+  else
+    return 0;
+  if (opr == OPR_NE)
+    res = !res;
+  e1->k = res ? VTRUE : VFALSE;
+  return 1;
+}
+
+
 /*
 ** Emit code for unary expressions that "produce values"
 ** (everything but 'not').
@@ -1064,6 +1207,7 @@ static void codecomp (FuncState *fs, BinOpr opr, expdesc *e1, expdesc *e2) {
 */
 void luaK_prefix (FuncState *fs, UnOpr op, expdesc *e, int line) {
   static expdesc ef = {VKINT, {0}, NO_JUMP, NO_JUMP};  /* fake 2nd operand */
+  luaK_dischargevars(fs, e);
   switch (op) {
     case OPR_MINUS: case OPR_BNOT:
       if (constfolding(fs, op + LUA_OPUNM, e, &ef))
@@ -1083,6 +1227,7 @@ void luaK_prefix (FuncState *fs, UnOpr op, expdesc *e, int line) {
 ** 2nd operand.
 */
 void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
+  luaK_dischargevars(fs, v);
   switch (op) {
     case OPR_AND: {
       luaK_goiftrue(fs, v);  /* go ahead only if 'v' is true */
@@ -1100,7 +1245,9 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
     case OPR_MUL: case OPR_DIV: case OPR_IDIV:
     case OPR_MOD: case OPR_POW:
     case OPR_BAND: case OPR_BOR: case OPR_BXOR:
-    case OPR_SHL: case OPR_SHR: {
+    case OPR_SHL: case OPR_SHR:
+    case OPR_EQ: case OPR_LT: case OPR_LE:
+    case OPR_NE: case OPR_GT: case OPR_GE: {
       if (!tonumeral(v, NULL))
         luaK_exp2RK(fs, v);
       /* else keep numeral, which may be folded with 2nd operand */
@@ -1122,6 +1269,7 @@ void luaK_infix (FuncState *fs, BinOpr op, expdesc *v) {
 */
 void luaK_posfix (FuncState *fs, BinOpr op,
                   expdesc *e1, expdesc *e2, int line) {
+  luaK_dischargevars(fs, e2);
   switch (op) {
     case OPR_AND: {
       lua_assert(e1->t == NO_JUMP);  /* list closed by 'luK_infix' */
@@ -1162,7 +1310,10 @@ void luaK_posfix (FuncState *fs, BinOpr op,
     }
     case OPR_EQ: case OPR_LT: case OPR_LE:
     case OPR_NE: case OPR_GT: case OPR_GE: {
-      codecomp(fs, op, e1, e2);
+      if (!compfolding(fs, op, e1, e2)) {
+        luaK_exp2RK(fs, e1);  /* numeral kept by 'luaK_infix' */
+        codecomp(fs, op, e1, e2);
+      }
       break;
     }
     default: lua_assert(0);
@@ -1200,3 +1351,29 @@ void luaK_setlist (FuncState *fs, int base, int nelems, int tostore) {
   fs->freereg = base + 1;  /* free registers with list values */
 }
 
+
+
+/*
+** Turn pairs of instructions that often run one after the other into
+** superinstructions, by giving the first one the opcode of the pair
+** (see 'luaP_fusedops', chosen from an opcode pair profile of TA scripts).
+** The second instruction stays in place, so jumps to it, line information
+** and debug information are not affected. Called on the finished code of
+** a function, as code generation still looks at and changes the opcodes
+** of instructions it has emitted.
+*/
+void luaK_fuse (FuncState *fs) {
+  Instruction *code = fs->f->code;
+  int pc;
+  for (pc = 0; pc + 1 < fs->pc; pc++) {
+    OpCode op = GET_OPCODE(code[pc]);
+    OpCode next = GET_OPCODE(code[pc + 1]);
+    int f;
+    for (f = FIRST_FUSED; f < FIRST_FUSED + NUM_FUSED; f++) {
+      if (getBaseOp(f) == op && getFusedNext(f) == next) {
+        SET_OPCODE(code[pc], f);
+        break;
+      }
+    }
+  }
+}
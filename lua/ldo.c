@@ -788,12 +788,18 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
   p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
   p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
   p.dyd.label.arr = NULL; p.dyd.label.size = 0;
+  p.dyd.tok.arr = NULL; p.dyd.tok.size = 0;
+  p.dyd.inl.arr = NULL; p.dyd.inl.size = 0;
+  p.dyd.freevar.arr = NULL; p.dyd.freevar.size = 0;
   luaZ_initbuffer(L, &p.buff);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top), L->errfunc);
   luaZ_freebuffer(L, &p.buff);
   luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
   luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
   luaM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
+  luaM_freearray(L, p.dyd.tok.arr, p.dyd.tok.size);
+  luaM_freearray(L, p.dyd.inl.arr, p.dyd.inl.size);
+  luaM_freearray(L, p.dyd.freevar.arr, p.dyd.freevar.size);
   L->nny--;
   return status;
 }
@@ -15,6 +15,7 @@
 #include "lua.h"
 
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lundump.h"
 
@@ -87,9 +88,16 @@ static void DumpString (const TString *s, DumpState *D) {
 }
 
 
+/* quickened instructions are dumped with their generic opcode */
 static void DumpCode (const Proto *f, DumpState *D) {
+  int i;
   DumpInt(f->sizecode, D);
-  DumpVector(f->code, f->sizecode, D);
+  for (i = 0; i < f->sizecode; i++) {
+    Instruction ins = f->code[i];
+    if (isQuick(GET_OPCODE(ins)))
+      SET_OPCODE(ins, getBaseOp(GET_OPCODE(ins)));
+    DumpVar(ins, D);
+  }
 }
 
 
@@ -11,14 +11,18 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
+#include "ltable.h"
 
 
 
@@ -96,6 +100,121 @@ void luaF_close (lua_State *L, StkId level) {
 }
 
 
+/*
+** table accesses with a constant short string key, which go through an
+** inline cache (see 'luaH_getcached')
+*/
+static int cachedaccess (const Proto *f, Instruction i) {
+  int key;
+  switch (getBaseOp(GET_OPCODE(i))) {
+    case OP_GETTABUP: case OP_GETTABLE:
+      key = GETARG_C(i);
+      break;
+    case OP_SETTABUP: case OP_SETTABLE:
+      key = GETARG_B(i);
+      break;
+    default:
+      return 0;
+  }
+  return ISK(key) && ttisshrstring(f->k + INDEXK(key));
+}
+
+
+/*
+** Give the finished function 'f' its inline caches, if it has cached
+** table accesses. There is one per instruction so that the VM finds the
+** cache of an instruction by its index; they start out as misses.
+*/
+void luaF_newicache (lua_State *L, Proto *f) {
+  int pc;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    if (cachedaccess(f, f->code[pc])) {
+      f->icache = luaM_newvector(L, f->sizecode, unsigned short);
+      memset(f->icache, 0, f->sizecode * sizeof(unsigned short));
+      return;
+    }
+  }
+}
+
+
+/*
+** If instruction 'pc' of 'f' is a test of a chain of OP_SWITCH 'head',
+** the constant it compares R(A) with; NULL otherwise
+*/
+static const TValue *switchkey (const Proto *f, int head, int pc) {
+  Instruction i;
+  int key;
+  if (pc + 1 >= f->sizecode || GET_OPCODE(f->code[pc + 1]) != OP_JMP ||
+      GETARG_A(f->code[pc + 1]) != 0)
+    return NULL;
+  i = f->code[pc];
+  if (pc == head)
+    key = GETARG_C(i);
+  else if (GET_OPCODE(i) == OP_EQ && GETARG_A(i) == 0) {
+    if (ISK(GETARG_B(i)) && GETARG_C(i) == GETARG_A(f->code[head]))
+      key = GETARG_B(i);
+    else if (GETARG_B(i) == GETARG_A(f->code[head]))
+      key = GETARG_C(i);
+    else
+      return NULL;
+  }
+  else
+    return NULL;
+  if (!ISK(key) || !(ttisinteger(f->k + INDEXK(key)) ||
+                     ttisstring(f->k + INDEXK(key))))
+    return NULL;
+  return f->k + INDEXK(key);
+}
+
+
+/*
+** Build the dispatch table of the OP_SWITCH at 'head', following its
+** chain of tests: each constant goes to the code after the first test
+** of it, the pc after the chain to where the jump of the last test goes.
+*/
+static void newswitch (lua_State *L, Proto *f, int head, Switchdesc *s) {
+  int pc = head;
+  const TValue *key;
+  s->t = luaH_new(L);
+  luaC_objbarrier(L, f, s->t);
+  while ((key = switchkey(f, head, pc)) != NULL) {
+    int next = pc + 2 + GETARG_sBx(f->code[pc + 1]);
+    if (ttisnil(luaH_get(s->t, key)))
+      setivalue(luaH_set(L, s->t, key), pc + 2);
+    if (next <= pc) {  /* jumps back: the chain goes no further */
+      s->miss = next;
+      return;
+    }
+    pc = next;
+  }
+  s->miss = pc;  /* not a test: where the last one goes when it fails */
+}
+
+
+/*
+** Give the finished function 'f' the dispatch tables of its OP_SWITCHes
+** (see 'ifstat'), numbering them in their argument B. Tables and chains
+** are checked against the code, so this is fine after the verifier too.
+*/
+void luaF_newswitches (lua_State *L, Proto *f) {
+  int pc, n = 0;
+  for (pc = 0; pc < f->sizecode; pc++)
+    if (GET_OPCODE(f->code[pc]) == OP_SWITCH) n++;
+  if (n == 0)
+    return;
+  f->switches = luaM_newvector(L, n, Switchdesc);
+  for (pc = 0; pc < n; pc++)
+    f->switches[pc].t = NULL;
+  f->sizeswitches = n;
+  for (pc = 0, n = 0; pc < f->sizecode; pc++) {
+    if (GET_OPCODE(f->code[pc]) == OP_SWITCH) {
+      SETARG_B(f->code[pc], n);
+      newswitch(L, f, pc, &f->switches[n++]);
+    }
+  }
+}
+
+
 Proto *luaF_newproto (lua_State *L) {
   GCObject *o = luaC_newobj(L, LUA_TPROTO, sizeof(Proto));
   Proto *f = gco2p(o);
@@ -104,7 +223,17 @@ Proto *luaF_newproto (lua_State *L) {
   f->p = NULL;
   f->sizep = 0;
   f->code = NULL;
+  f->icache = NULL;
+  f->switches = NULL;
+  f->sizeswitches = 0;
   f->cache = NULL;
+#if LUA_USE_NATIVE
+  f->native = NULL;
+#endif
+#if LUA_USE_JIT
+  f->jit = NULL;
+  f->jitcount = LUAI_JITHOT;
+#endif
   f->sizecode = 0;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
@@ -124,6 +253,13 @@ Proto *luaF_newproto (lua_State *L) {
 
 void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->code, f->sizecode);
+  if (f->icache)
+    luaM_freearray(L, f->icache, f->sizecode);
+  luaM_freearray(L, f->switches, f->sizeswitches);
+#if LUA_USE_JIT
+  if (f->jit)
+    luaJ_free(L, f);
+#endif
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
   luaM_freearray(L, f->lineinfo, f->sizelineinfo);
@@ -62,10 +62,10 @@
 
 
 /*
-** 'makewhite' erases all color bits then sets only the current white
-** bit
+** 'makewhite' erases all color bits (and the old bit) then sets only
+** the current white bit
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#define maskcolors	(~(bit2mask(BLACKBIT, OLDBIT) | WHITEBITS))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
@@ -74,8 +74,13 @@
 
 
 #define valiswhite(x)   (iscollectable(x) && iswhite(gcvalue(x)))
+#define keyiswhite(n)   (keyiscollectable(n) && iswhite(gckey(n)))
 
-#define checkdeadkey(n)	lua_assert(!ttisdeadkey(gkey(n)) || ttisnil(gval(n)))
+#define checkdeadkey(n)	lua_assert(!keyisdead(n) || ttisnil(gval(n)))
+
+/* the object of a value or a key, NULL if it has none */
+#define gcvalueN(o)     (iscollectable(o) ? gcvalue(o) : NULL)
+#define gckeyN(n)	(keyiscollectable(n) ? gckey(n) : NULL)
 
 
 #define checkconsistency(obj)  \
@@ -85,6 +90,8 @@
 #define markvalue(g,o) { checkconsistency(o); \
   if (valiswhite(o)) reallymarkobject(g,gcvalue(o)); }
 
+#define markkey(g,n)	{ if (keyiswhite(n)) reallymarkobject(g,gckey(n)); }
+
 #define markobject(g,t)	{ if (iswhite(t)) reallymarkobject(g, obj2gco(t)); }
 
 /*
@@ -126,8 +133,8 @@ static void reallymarkobject (global_State *g, GCObject *o);
 */
 static void removeentry (Node *n) {
   lua_assert(ttisnil(gval(n)));
-  if (valiswhite(gkey(n)))
-    setdeadvalue(wgkey(n));  /* unused and unmarked key; remove it */
+  if (keyiswhite(n))
+    setdeadkey(n);  /* unused and unmarked key; remove it */
 }
 
 
@@ -138,13 +145,13 @@ static void removeentry (Node *n) {
 ** other objects: if really collected, cannot keep them; for objects
 ** being finalized, keep them in keys, but not in values
 */
-static int iscleared (global_State *g, const TValue *o) {
-  if (!iscollectable(o)) return 0;
-  else if (ttisstring(o)) {
-    markobject(g, tsvalue(o));  /* strings are 'values', so are never weak */
+static int iscleared (global_State *g, GCObject *o) {
+  if (o == NULL) return 0;  /* non-collectable value */
+  else if (novariant(o->tt) == LUA_TSTRING) {
+    markobject(g, o);  /* strings are 'values', so are never weak */
     return 0;
   }
-  else return iswhite(gcvalue(o));
+  else return iswhite(o);
 }
 
 
@@ -309,7 +316,8 @@ static void markbeingfnz (global_State *g) {
 ** Mark all values stored in marked open upvalues from non-marked threads.
 ** (Values from marked threads were already marked when traversing the
 ** thread.) Remove from the list threads that no longer have upvalues and
-** not-marked threads.
+** not-marked threads. A minor collection does not traverse old closures,
+** so it cannot know which upvalues are used: it marks them all.
 */
 static void remarkupvals (global_State *g) {
   lua_State *thread;
@@ -323,7 +331,7 @@ static void remarkupvals (global_State *g) {
       *p = thread->twups;  /* remove thread from the list */
       thread->twups = thread;  /* mark that it is out of list */
       for (uv = thread->openupval; uv != NULL; uv = uv->u.open.next) {
-        if (uv->u.open.touched) {
+        if (uv->u.open.touched || isgenerational(g)) {
           markvalue(g, uv->v);  /* remark upvalue's value */
           uv->u.open.touched = 0;
         }
@@ -370,9 +378,9 @@ static void traverseweakvalue (global_State *g, Table *h) {
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
     else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
-      if (!hasclears && iscleared(g, gval(n)))  /* is there a white value? */
+      lua_assert(!keyisnil(n));
+      markkey(g, n);  /* mark key */
+      if (!hasclears && iscleared(g, gcvalueN(gval(n))))  /* is there a white value? */
         hasclears = 1;  /* table will have to be cleared */
     }
   }
@@ -380,6 +388,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* see 'youngcollection' */
 }
 
 
@@ -411,7 +421,7 @@ static int traverseephemeron (global_State *g, Table *h) {
     checkdeadkey(n);
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
-    else if (iscleared(g, gkey(n))) {  /* key is not marked (yet)? */
+    else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
       hasclears = 1;  /* table must be cleared */
       if (valiswhite(gval(n)))  /* value not marked yet? */
         hasww = 1;  /* white-white entry */
@@ -428,6 +438,8 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else if (isgenerational(g))
+    linkgclist(h, g->grayagain);  /* see 'youngcollection' */
   return marked;
 }
 
@@ -442,8 +454,8 @@ static void traversestrongtable (global_State *g, Table *h) {
     if (ttisnil(gval(n)))  /* entry is empty? */
       removeentry(n);  /* remove it */
     else {
-      lua_assert(!ttisnil(gkey(n)));
-      markvalue(g, gkey(n));  /* mark key */
+      lua_assert(!keyisnil(n));
+      markkey(g, n);  /* mark key */
       markvalue(g, gval(n));  /* mark value */
     }
   }
@@ -491,12 +503,16 @@ static int traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
+  for (i = 0; i < f->sizeswitches; i++)  /* mark dispatch tables */
+    markobjectN(g, f->switches[i].t);
   return sizeof(Proto) + sizeof(Instruction) * f->sizecode +
                          sizeof(Proto *) * f->sizep +
                          sizeof(TValue) * f->sizek +
                          sizeof(int) * f->sizelineinfo +
                          sizeof(LocVar) * f->sizelocvars +
-                         sizeof(Upvaldesc) * f->sizeupvalues;
+                         sizeof(Upvaldesc) * f->sizeupvalues +
+                         sizeof(Switchdesc) * f->sizeswitches +
+                         (f->icache ? sizeof(unsigned short) * f->sizecode : 0);
 }
 
 
@@ -643,7 +659,7 @@ static void clearkeys (global_State *g, GCObject *l, GCObject *f) {
     Table *h = gco2t(l);
     Node *n, *limit = gnodelast(h);
     for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && (iscleared(g, gkey(n)))) {
+      if (!ttisnil(gval(n)) && (iscleared(g, gckeyN(n)))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
       }
@@ -663,11 +679,11 @@ static void clearvalues (global_State *g, GCObject *l, GCObject *f) {
     unsigned int i;
     for (i = 0; i < h->sizearray; i++) {
       TValue *o = &h->array[i];
-      if (iscleared(g, o))  /* value was collected? */
+      if (iscleared(g, gcvalueN(o)))  /* value was collected? */
         setnilvalue(o);  /* remove value */
     }
     for (n = gnode(h, 0); n < limit; n++) {
-      if (!ttisnil(gval(n)) && iscleared(g, gval(n))) {
+      if (!ttisnil(gval(n)) && iscleared(g, gcvalueN(gval(n)))) {
         setnilvalue(gval(n));  /* remove value ... */
         removeentry(n);  /* and remove entry from table */
       }
@@ -764,6 +780,46 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
   return p;
 }
 
+
+/*
+** sweep a list in generational mode: erase dead objects and make the
+** others old, keeping their marks. New objects are always added to the
+** front of 'allgc', so there all objects after an old one are old too
+** and 'stopatold' ends the sweep at the first one.
+*/
+static void sweepgen (lua_State *L, GCObject **p, int stopatold) {
+  global_State *g = G(L);
+  int ow = otherwhite(g);
+  GCObject *curr;
+  while ((curr = *p) != NULL) {
+    int marked = curr->marked;
+    if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
+      *p = curr->next;  /* remove 'curr' from list */
+      freeobj(L, curr);  /* erase 'curr' */
+    }
+    else if (stopatold && isold(curr))
+      return;  /* the rest of the list is old */
+    else {
+      lua_assert(!iswhite(curr));  /* collection was atomic */
+      l_setbit(curr->marked, OLDBIT);
+      p = &curr->next;  /* go to next element */
+    }
+  }
+}
+
+
+/*
+** make all objects in a list white and young again, for a collection
+** that marks them all (there are no dead objects between generational
+** collections)
+*/
+static void whitelist (global_State *g, GCObject *o) {
+  for (; o != NULL; o = o->next) {
+    lua_assert(!isdead(g, o));
+    makewhite(g, o);
+  }
+}
+
 /* }====================================================== */
 
 
@@ -793,6 +849,7 @@ static GCObject *udata2finalize (global_State *g) {
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  resetbit(o->marked, OLDBIT);  /* 'allgc' starts with young objects */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -984,6 +1041,7 @@ static l_mem atomic (lua_State *L) {
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
+  g->grayagain = NULL;  /* gets the threads again (kept by 'youngcollection') */
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
   g->GCmemtrav = 0;  /* start counting work */
@@ -1123,15 +1181,108 @@ static l_mem getdebt (global_State *g) {
 }
 
 /*
-** performs a basic GC step when collector is running
+** {======================================================
+** Generational mode
+** =======================================================
 */
-void luaC_step (lua_State *L) {
-  global_State *g = G(L);
-  l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
-  if (!g->gcrunning) {  /* not running? */
-    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
-    return;
+
+
+/*
+** move the weak tables of list 'l' to 'grayagain'
+*/
+static void keepweak (global_State *g, GCObject *l) {
+  while (l != NULL) {
+    Table *h = gco2t(l);
+    l = h->gclist;
+    linkgclist(h, g->grayagain);
   }
+}
+
+
+/*
+** Collect the objects created since the last collection. It runs at
+** once: old objects are not traversed, but the roots and everything
+** the barriers added to 'gray' and 'grayagain' are. After 'atomic',
+** 'grayagain' has all marked threads, which stay there, as stacks
+** change without barriers. Weak tables stay there too: they are never
+** black, so barriers do not see what goes into them, and each
+** collection has to clear them again.
+*/
+static void youngcollection (lua_State *L, global_State *g) {
+  lua_assert(g->gcstate == GCSpropagate);
+  propagateall(g);
+  atomic(L);
+  g->gcstate = GCSswpallgc;
+  sweepgen(L, &g->allgc, 1);
+  sweepgen(L, &g->finobj, 0);  /* may have old objects anywhere */
+  sweepgen(L, &g->tobefnz, 0);
+  checkSizes(L, g);
+  keepweak(g, g->weak);
+  keepweak(g, g->allweak);
+  keepweak(g, g->ephemeron);
+  g->weak = g->allweak = g->ephemeron = NULL;
+  g->gcstate = GCSpropagate;  /* wait here for the next collection */
+}
+
+
+/*
+** Collect everything: all objects become young again, so the roots are
+** traversed as in a new incremental cycle.
+*/
+static void fullgen (lua_State *L, global_State *g) {
+  whitelist(g, g->allgc);
+  whitelist(g, g->finobj);
+  whitelist(g, g->tobefnz);
+  makewhite(g, g->mainthread);
+  restartcollection(g);
+  youngcollection(L, g);
+  g->GCestimate = gettotalbytes(g);  /* base for the next major collection */
+}
+
+
+/*
+** The next minor collection runs after the program allocates
+** 'genminormul'% of the memory in use after the last major one.
+*/
+static void setminordebt (global_State *g) {
+  luaE_setdebt(g, -(cast(l_mem, g->GCestimate / 100) * g->genminormul));
+}
+
+
+/*
+** Call the finalizers of what a generational collection found dead.
+** (They come before 'setminordebt', as they run with the collector
+** stopped, which resets the debt.)
+*/
+static void finishgen (lua_State *L, global_State *g) {
+  while (g->tobefnz)
+    GCTM(L, 1);
+  setminordebt(g);
+}
+
+
+/*
+** A minor collection, or a major one when memory has grown over
+** 'genmajormul'% of its size after the last major collection (old
+** objects are only collected then)
+*/
+static void genstep (lua_State *L, global_State *g) {
+  lu_mem majorbase = g->GCestimate;
+  if (gettotalbytes(g) > majorbase + (majorbase / 100) * g->genmajormul)
+    fullgen(L, g);
+  else
+    youngcollection(L, g);
+  finishgen(L, g);
+}
+
+/* }====================================================== */
+
+
+/*
+** performs a basic incremental step
+*/
+static void incstep (lua_State *L, global_State *g) {
+  l_mem debt = getdebt(g);  /* GC deficit (be paid now) */
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
     debt -= work;
@@ -1146,6 +1297,54 @@ void luaC_step (lua_State *L) {
 }
 
 
+/*
+** With a deadline, a step that would end after it (judging by how long
+** the last one took) is skipped, unless memory is over the limit. This
+** only caps the work done before the deadline: the cycle stays where it
+** is, and only later steps of the same state can finish it. Each time a
+** step is put off, the guess of its time is halved, so that one long
+** step (such as 'atomic') does not hold off the others.
+** Clock values are compared through their difference, which stays
+** right when a 32-bit 'lua_Integer' wraps around.
+*/
+static int postpone (global_State *g, lua_Integer now) {
+  lua_Integer late = l_castU2S(l_castS2U(now) + l_castS2U(g->gcsteptime) -
+                               l_castS2U(g->gcdeadline));
+  if (g->gcdeadline == 0 || late <= 0 ||
+      (g->gclimit != 0 && gettotalbytes(g) >= g->gclimit))
+    return 0;
+  g->gcsteptime /= 2;
+  return 1;
+}
+
+
+/*
+** performs a basic GC step when collector is running
+*/
+void luaC_step (lua_State *L) {
+  global_State *g = G(L);
+  lua_Integer start;
+  if (!g->gcrunning) {  /* not running? */
+    luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
+    return;
+  }
+  if (g->gcclock == NULL)
+    start = 0;
+  else if (postpone(g, start = g->gcclock())) {
+    luaE_setdebt(g, -GCSTEPSIZE);  /* look again a little later */
+    return;
+  }
+  if (isgenerational(g))
+    genstep(L, g);
+  else
+    incstep(L, g);
+  if (g->gcclock != NULL) {
+    g->gcsteptime = l_castU2S(l_castS2U(g->gcclock()) - l_castS2U(start));
+    g->gctime = l_castU2S(l_castS2U(g->gctime) + l_castS2U(g->gcsteptime));
+  }
+}
+
+
 /*
 ** Performs a full GC cycle; if 'isemergency', set a flag to avoid
 ** some operations which could change the interpreter state in some
@@ -1154,11 +1353,19 @@ void luaC_step (lua_State *L) {
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
 ** changed, nothing will be collected).
+** An emergency collection in generational mode is such a cycle too, as
+** an allocation may happen where new objects are assumed to be white:
+** it leaves all objects young and the next minor collection complete.
 */
-void luaC_fullgc (lua_State *L, int isemergency) {
-  global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
-  if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+static void fullcollection (lua_State *L, global_State *g, int isemergency) {
+  int origkind = g->gckind;
+  if (origkind == KGC_GEN && !isemergency) {
+    fullgen(L, g);
+    finishgen(L, g);
+    return;
+  }
+  lua_assert(g->gckind != KGC_EMERGENCY);
+  g->gckind = isemergency ? KGC_EMERGENCY : KGC_NORMAL;
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
@@ -1169,8 +1376,56 @@ void luaC_fullgc (lua_State *L, int isemergency) {
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
-  setpause(g);
+  g->gckind = origkind;
+  if (origkind == KGC_GEN) {
+    luaC_runtilstate(L, bitmask(GCSpropagate));  /* mark the roots */
+    setminordebt(g);
+  }
+  else
+    setpause(g);
+}
+
+
+/*
+** Full collections ignore any deadline, but their time is counted
+*/
+void luaC_fullgc (lua_State *L, int isemergency) {
+  global_State *g = G(L);
+  if (g->gcclock == NULL)
+    fullcollection(L, g, isemergency);
+  else {
+    lua_Integer start = g->gcclock();
+    fullcollection(L, g, isemergency);
+    g->gctime = l_castU2S(l_castS2U(g->gctime) + l_castS2U(g->gcclock()) -
+                          l_castS2U(start));
+  }
+}
+
+
+/*
+** Change the collector to incremental ('KGC_NORMAL') or generational
+** ('KGC_GEN') mode. Generational mode starts with a complete collection,
+** which makes all live objects old; incremental mode sweeps all objects
+** back to white (as white has not changed, nothing is collected).
+*/
+void luaC_changemode (lua_State *L, int mode) {
+  global_State *g = G(L);
+  if (mode == g->gckind)
+    return;  /* nothing to change */
+  if (mode == KGC_GEN) {
+    luaC_runtilstate(L, bitmask(GCSpause));  /* finish any cycle */
+    luaC_runtilstate(L, bitmask(GCSpropagate));  /* mark the roots */
+    g->gckind = KGC_GEN;
+    youngcollection(L, g);  /* all objects are new: a complete collection */
+    g->GCestimate = gettotalbytes(g);
+    finishgen(L, g);
+  }
+  else {
+    g->gckind = KGC_NORMAL;
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCSpause));
+    setpause(g);
+  }
 }
 
 /* }====================================================== */
@@ -55,12 +55,23 @@
 ** ones) must be kept. During a collection, the sweep
 ** phase may break the invariant, as objects turned white may point to
 ** still-black objects. The invariant is restored when sweep ends and
-** all objects are white again.
+** all objects are white again. (Generational mode stays in
+** 'GCSpropagate' between collections, so it always keeps it.)
 */
 
 #define keepinvariant(g)	((g)->gcstate <= GCSatomic)
 
 
+/*
+** In generational mode, objects that survived a collection are old:
+** they keep their black mark (threads stay gray) and get OLDBIT, so
+** that a minor collection traverses and sweeps only new (white)
+** objects. The barriers mark new objects stored into old ones (or put
+** an old table back in 'grayagain'), as they do during propagation.
+*/
+#define isgenerational(g)	((g)->gckind == KGC_GEN)
+
+
 /*
 ** some useful bit tricks
 */
@@ -79,6 +90,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define OLDBIT		4  /* object survived a generational collection */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +103,8 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define isold(x)	testbit((x)->marked, OLDBIT)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
@@ -136,6 +150,7 @@ LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC void luaC_changemode (lua_State *L, int mode);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
@@ -0,0 +1,985 @@
+/*
+** Baseline compiler of Lua functions to native code
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#define _DEFAULT_SOURCE  /* MAP_ANONYMOUS with _XOPEN_SOURCE */
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#if LUA_USE_JIT
+
+#include <stddef.h>
+#include <string.h>
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lnative.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** A hot function is translated once into native code stitched together
+** from a template per instruction. Most templates call the helper of
+** the instruction (see lnative.c); the templates for moves, constants,
+** upvalues, integer and float arithmetic, comparisons, tests, array
+** reads, field accesses and numeric loops do the common case inline (on
+** x86-64) and call the helper otherwise. Jumps and loops become native
+** branches, so no instruction is dispatched.
+*/
+
+
+/*
+** {======================================================
+** Executable memory
+** =======================================================
+*/
+
+/*
+** 'l_jitalloc' gets 'sz' bytes of writable memory, which 'l_jitseal'
+** makes executable (and read only) once the code is in place. These
+** use mmap, a system without it has to define its own.
+*/
+#if !defined(l_jitalloc)
+
+#include <sys/mman.h>
+
+static void *l_jitalloc (size_t sz) {
+  void *p = mmap(NULL, sz, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+#define l_jitseal(p,sz)	(mprotect(p, sz, PROT_READ | PROT_EXEC) == 0)
+#define l_jitfree(p,sz)	munmap(p, sz)
+
+#endif
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Code generation
+** =======================================================
+*/
+
+/* native code of a function */
+typedef struct JitCode {
+  lu_byte *mcode;
+  size_t size;
+  unsigned int *offs;  /* offset of the code of each instruction */
+} JitCode;
+
+
+typedef void (*JitEntry) (lua_State *L, CallInfo *ci, const void *target);
+
+
+/* a branch to the code of an instruction, patched at the end */
+typedef struct Fixup {
+  size_t at;
+  int target;
+} Fixup;
+
+
+typedef struct JitState {
+  Proto *p;
+  lu_byte *buf;
+  size_t n;  /* bytes emitted */
+  unsigned int *offs;
+  Fixup *fix;
+  int nfix;
+  size_t exit;  /* offset of the code leaving native code */
+} JitState;
+
+
+/* upper bound of the code of an instruction */
+#define MAXTEMPLATE	320
+
+/* upper bound of the branches to other instructions in a template */
+#define MAXFIXUPS	4
+
+/* upper bound of the code before the first instruction */
+#define MAXPROLOGUE	64
+
+
+static void put1 (JitState *J, int b) {
+  J->buf[J->n++] = cast(lu_byte, b);
+}
+
+
+static void put4 (JitState *J, unsigned int w) {
+  memcpy(J->buf + J->n, &w, 4);  /* both targets are little endian */
+  J->n += 4;
+}
+
+
+static void put8 (JitState *J, size_t w) {
+  memcpy(J->buf + J->n, &w, 8);
+  J->n += 8;
+}
+
+
+static void addfixup (JitState *J, size_t at, int target) {
+  J->fix[J->nfix].at = at;
+  J->fix[J->nfix].target = target;
+  J->nfix++;
+}
+
+
+#define addr(x)	cast(size_t, x)
+
+
+/* the native code of the instruction that OP_SWITCH 'pc' goes to */
+static const lu_byte *jitswitch (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = L->ci;
+  Proto *p = clLvalue(ci->func)->p;
+  (void)luaN_switch(L, pc);
+  return p->jit->mcode + p->jit->offs[ci->u.l.savedpc - p->code];
+}
+
+#if !LUA_NANBOX
+
+/* the TValue layout the inline templates rely on */
+#define inlinable	(sizeof(TValue) == 16 && offsetof(TValue, tt_) == 8)
+
+/* offsets of the tag byte of a value and of the key of a node */
+#define TAG	cast_int(offsetof(TValue, tt_))
+#define KEYTT	cast_int(offsetof(Node, u.key_tt))
+#define KEYVAL	cast_int(offsetof(Node, u.key_val))
+
+#else
+
+/* the templates need a tag next to the value */
+#define inlinable	0
+#define TAG	0
+#define KEYTT	0
+#define KEYVAL	0
+
+#endif
+
+/* offset of register 'r' from base */
+#define reg(r)	(cast_int(sizeof(TValue)) * (r))
+
+
+
+#if defined(__x86_64__)
+
+/*
+** x86-64: rbx holds L, r12 the CallInfo and r13 the base of the frame,
+** which is reloaded after every helper call, as the stack may move.
+*/
+
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RSI = 6, RDI = 7,
+       R12 = 12, R13 = 13 };
+
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc,
+       CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf };
+
+
+/*
+** instruction 'opc' (one or two bytes, after the prefix 'pfx' if not 0)
+** with operands 'reg' and [base + disp]
+*/
+static void xmem (JitState *J, int pfx, int w, int opc, int reg, int base,
+                  int disp) {
+  int rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+  if (pfx) put1(J, pfx);
+  if (rex != 0x40) put1(J, rex);
+  if (opc > 0xff) put1(J, opc >> 8);
+  put1(J, opc & 0xff);
+  put1(J, 0x80 | ((reg & 7) << 3) | (base & 7));  /* [base + disp32] */
+  if ((base & 7) == RSP) put1(J, 0x24);  /* SIB for rsp and r12 */
+  put4(J, cast(unsigned int, disp));
+}
+
+
+/* mov r64, imm64 */
+static void xmovimm (JitState *J, int reg, size_t imm) {
+  put1(J, 0x48 | ((reg & 8) >> 3));
+  put1(J, 0xb8 | (reg & 7));
+  put8(J, imm);
+}
+
+
+/* jcc/jmp rel32 to be patched, returns the position of the offset */
+static size_t xjump (JitState *J, int cc) {
+  if (cc < 0) put1(J, 0xe9);
+  else { put1(J, 0x0f); put1(J, 0x80 | cc); }
+  put4(J, 0);
+  return J->n - 4;
+}
+
+
+static void patch (JitState *J, size_t at, size_t to) {
+  unsigned int rel = cast(unsigned int, cast(int, to - (at + 4)));
+  memcpy(J->buf + at, &rel, 4);
+}
+
+
+#define jumpto(J,cc,pc)	addfixup(J, xjump(J, cc), pc)
+
+#define here(J,at)	patch(J, at, (J)->n)
+
+
+static void emitprologue (JitState *J) {
+  put1(J, 0x53);  /* push rbx */
+  put1(J, 0x41); put1(J, 0x54);  /* push r12 */
+  put1(J, 0x41); put1(J, 0x55);  /* push r13 */
+  put1(J, 0x48); put1(J, 0x89); put1(J, 0xfb);  /* mov rbx, rdi */
+  put1(J, 0x49); put1(J, 0x89); put1(J, 0xf4);  /* mov r12, rsi */
+  xmem(J, 0, 1, 0x8b, R13, R12, offsetof(CallInfo, u.l.base));
+  put1(J, 0xff); put1(J, 0xe2);  /* jmp rdx */
+  J->exit = J->n;
+  put1(J, 0x41); put1(J, 0x5d);  /* pop r13 */
+  put1(J, 0x41); put1(J, 0x5c);  /* pop r12 */
+  put1(J, 0x5b);  /* pop rbx */
+  put1(J, 0xc3);  /* ret */
+}
+
+
+/* call 'h' for the instruction at 'pc' */
+static void emitcall (JitState *J, luaN_Helper h, const Instruction *pc) {
+  put1(J, 0x48); put1(J, 0x89); put1(J, 0xdf);  /* mov rdi, rbx */
+  xmovimm(J, RSI, addr(pc));
+  xmovimm(J, RAX, addr(h));
+  put1(J, 0xff); put1(J, 0xd0);  /* call rax */
+  xmem(J, 0, 1, 0x8b, R13, R12, offsetof(CallInfo, u.l.base));
+}
+
+
+/* branch to instruction 'target' if the helper returned 'cond' */
+static void emitbranch (JitState *J, int cond, int target) {
+  put1(J, 0x85); put1(J, 0xc0);  /* test eax, eax */
+  jumpto(J, cond ? CC_NE : CC_E, target);
+}
+
+
+static void emitexitif (JitState *J) {
+  put1(J, 0x85); put1(J, 0xc0);  /* test eax, eax */
+  patch(J, xjump(J, CC_NE), J->exit);
+}
+
+
+static void emitexit (JitState *J) {
+  patch(J, xjump(J, -1), J->exit);
+}
+
+
+static void emitjump (JitState *J, int target) {
+  jumpto(J, -1, target);
+}
+
+
+/* OP_SWITCH at 'pc', which does not move the stack */
+static void emitswitch (JitState *J, const Instruction *pc) {
+  put1(J, 0x48); put1(J, 0x89); put1(J, 0xdf);  /* mov rdi, rbx */
+  xmovimm(J, RSI, addr(pc));
+  xmovimm(J, RAX, addr(jitswitch));
+  put1(J, 0xff); put1(J, 0xd0);  /* call rax */
+  put1(J, 0xff); put1(J, 0xe0);  /* jmp rax */
+}
+
+
+/* copy the value at [src + disp] to register 'a'; 'src' may be rax */
+static void xcopy (JitState *J, int src, int disp, int a) {
+  xmem(J, 0, 1, 0x8b, RCX, src, disp + 8);
+  xmem(J, 0, 1, 0x8b, RAX, src, disp);
+  xmem(J, 0, 1, 0x89, RAX, R13, reg(a));
+  xmem(J, 0, 1, 0x89, RCX, R13, reg(a) + 8);
+}
+
+
+/* jump to 'slow' unless the tag of register 'r' is 'tt' */
+static size_t xguard (JitState *J, int r, int tt) {
+  xmem(J, 0, 0, 0x80, 7, R13, reg(r) + TAG);  /* cmp byte [r], imm8 */
+  put1(J, tt);
+  return xjump(J, CC_NE);
+}
+
+
+static int inl_move (JitState *J, Instruction i) {
+  xcopy(J, R13, reg(GETARG_B(i)), GETARG_A(i));
+  return 1;
+}
+
+
+static int inl_loadk (JitState *J, Instruction i) {
+  xmovimm(J, RDX, addr(J->p->k + GETARG_Bx(i)));
+  xcopy(J, RDX, 0, GETARG_A(i));
+  return 1;
+}
+
+
+static int inl_getupval (JitState *J, Instruction i) {
+  xmem(J, 0, 1, 0x8b, RDX, R12, offsetof(CallInfo, func));
+  xmem(J, 0, 1, 0x8b, RDX, RDX, 0);  /* the closure */
+  xmem(J, 0, 1, 0x8b, RDX, RDX, cast_int(offsetof(LClosure, upvals) +
+                                         sizeof(UpVal *) * GETARG_B(i)));
+  xmem(J, 0, 1, 0x8b, RDX, RDX, offsetof(UpVal, v));
+  xcopy(J, RDX, 0, GETARG_A(i));
+  return 1;
+}
+
+
+/*
+** An operand of an inline template: a register or a constant of the
+** expected type.
+*/
+typedef struct Operand {
+  int r;  /* register, or -1 for a constant */
+  const TValue *k;
+} Operand;
+
+
+static int operand (JitState *J, int arg, int tt, Operand *o) {
+  if (ISK(arg)) {
+    o->r = -1;
+    o->k = J->p->k + INDEXK(arg);
+    return rttype(o->k) == tt;
+  }
+  o->r = arg;
+  return 1;
+}
+
+
+static int guards (JitState *J, const Operand *b, const Operand *c, int tt,
+                   size_t *slow) {
+  int n = 0;
+  if (b->r >= 0) slow[n++] = xguard(J, b->r, tt);
+  if (c->r >= 0) slow[n++] = xguard(J, c->r, tt);
+  return n;
+}
+
+
+/* rax := integer operand; 'rcx' for the second one */
+static void xloadint (JitState *J, int reg, const Operand *o) {
+  if (o->r >= 0) xmem(J, 0, 1, 0x8b, reg, R13, reg(o->r));
+  else xmovimm(J, reg, cast(size_t, ivalue(o->k)));
+}
+
+
+/* xmm0 := float operand, 'sse' is the opcode that takes it */
+static void xfloatop (JitState *J, int sse, const Operand *o) {
+  if (o->r >= 0) xmem(J, 0xf2, 0, sse, 0, R13, reg(o->r));
+  else {
+    xmovimm(J, RDX, addr(o->k));
+    xmem(J, 0xf2, 0, sse, 0, RDX, 0);
+  }
+}
+
+
+/* the integer or the float operation of an arithmetic template */
+static void xarith (JitState *J, OpCode op, int tt, int a, const Operand *b,
+                    const Operand *c) {
+  if (tt == LUA_TNUMFLT) {
+    xfloatop(J, 0x0f10, b);  /* movsd xmm0, b */
+    xfloatop(J, op == OP_ADD ? 0x0f58 : op == OP_SUB ? 0x0f5c : 0x0f59, c);
+    xmem(J, 0xf2, 0, 0x0f11, 0, R13, reg(a));  /* movsd [a], xmm0 */
+  }
+  else {
+    xloadint(J, RAX, b);
+    if (c->r >= 0)
+      xmem(J, 0, 1, op == OP_ADD ? 0x03 : op == OP_SUB ? 0x2b : 0x0faf,
+           RAX, R13, reg(c->r));
+    else {
+      xloadint(J, RCX, c);
+      put1(J, 0x48);
+      if (op == OP_ADD) { put1(J, 0x01); put1(J, 0xc8); }  /* add rax, rcx */
+      else if (op == OP_SUB) { put1(J, 0x29); put1(J, 0xc8); }
+      else { put1(J, 0x0f); put1(J, 0xaf); put1(J, 0xc1); }  /* imul */
+    }
+    xmem(J, 0, 1, 0x89, RAX, R13, reg(a));
+  }
+  xmem(J, 0, 0, 0xc6, 0, R13, reg(a) + TAG);  /* mov byte [a], tt */
+  put1(J, tt);
+}
+
+
+/*
+** ADD, SUB and MUL of two integers and of two floats; an instruction
+** quickened for one of them gets only that case. The helper does the
+** rest, like mixed operands and metamethods.
+*/
+static int inl_arith (JitState *J, Instruction i, const Instruction *pc) {
+  static const int types[2] = {LUA_TNUMINT, LUA_TNUMFLT};
+  OpCode q = GET_OPCODE(i);
+  OpCode op = getBaseOp(q);
+  size_t slow[2], done[2];
+  int ndone = 0, t, j;
+  for (t = 0; t < 2; t++) {
+    int tt = types[t];
+    Operand b, c;
+    int nslow;
+    if ((tt == LUA_TNUMINT && (q == OP_ADD_FF || q == OP_SUB_FF ||
+                               q == OP_MUL_FF)) ||
+        (tt == LUA_TNUMFLT && (q == OP_ADD_II || q == OP_SUB_II ||
+                               q == OP_MUL_II)))
+      continue;  /* quickened for the other type */
+    if (!operand(J, GETARG_B(i), tt, &b) || !operand(J, GETARG_C(i), tt, &c) ||
+        (b.r < 0 && c.r < 0))
+      continue;
+    nslow = guards(J, &b, &c, tt, slow);
+    xarith(J, op, tt, GETARG_A(i), &b, &c);
+    done[ndone++] = xjump(J, -1);
+    for (j = 0; j < nslow; j++) here(J, slow[j]);
+  }
+  if (ndone == 0)
+    return 0;
+  emitcall(J, luaN_arith, pc);
+  for (j = 0; j < ndone; j++) here(J, done[j]);
+  return 1;
+}
+
+
+/*
+** EQ, LT and LE of two integers: go on with the jump that follows if
+** the comparison gives A, skip it otherwise
+*/
+static int inl_compare (JitState *J, Instruction i, const Instruction *pc,
+                        int npc) {
+  static const int skipcc[3][2] = {  /* [op][A] */
+    {CC_E, CC_NE}, {CC_L, CC_GE}, {CC_LE, CC_G}
+  };
+  OpCode op = getBaseOp(GET_OPCODE(i));
+  Operand b, c;
+  size_t slow[2];
+  int nslow, j;
+  if (!operand(J, GETARG_B(i), LUA_TNUMINT, &b) ||
+      !operand(J, GETARG_C(i), LUA_TNUMINT, &c) || (b.r < 0 && c.r < 0))
+    return 0;
+  nslow = guards(J, &b, &c, LUA_TNUMINT, slow);
+  xloadint(J, RAX, &b);
+  if (c.r >= 0) xmem(J, 0, 1, 0x3b, RAX, R13, reg(c.r));  /* cmp rax, c */
+  else {
+    xloadint(J, RCX, &c);
+    put1(J, 0x48); put1(J, 0x39); put1(J, 0xc8);  /* cmp rax, rcx */
+  }
+  jumpto(J, skipcc[op - OP_EQ][GETARG_A(i) != 0], npc + 2);
+  jumpto(J, -1, npc + 1);
+  for (j = 0; j < nslow; j++) here(J, slow[j]);
+  emitcall(J, op == OP_EQ ? luaN_eq : op == OP_LT ? luaN_lt : luaN_le, pc);
+  emitbranch(J, 0, npc + 2);
+  return 1;
+}
+
+
+static int inl_test (JitState *J, Instruction i, int npc) {
+  int a = GETARG_A(i);
+  int truthy = GETARG_C(i) ? npc + 1 : npc + 2;
+  int falsy = GETARG_C(i) ? npc + 2 : npc + 1;
+  xmem(J, 0, 0, 0x0fb6, RAX, R13, reg(a) + TAG);  /* movzx eax, tag */
+  put1(J, 0x85); put1(J, 0xc0);  /* test eax, eax */
+  jumpto(J, CC_E, falsy);  /* nil */
+  put1(J, 0x83); put1(J, 0xf8); put1(J, LUA_TBOOLEAN);  /* cmp eax, bool */
+  jumpto(J, CC_NE, truthy);
+  xmem(J, 0, 0, 0x83, 7, R13, reg(a));  /* cmp dword [a], 0 */
+  put1(J, 0);
+  jumpto(J, CC_E, falsy);  /* false */
+  jumpto(J, -1, truthy);
+  return 1;
+}
+
+
+/* t[k] for an integer k in the array part of t */
+static int inl_gettable (JitState *J, Instruction i, const Instruction *pc) {
+  Operand c;
+  size_t slow[5], done;
+  int nslow = 0, j;
+  if (!operand(J, GETARG_C(i), LUA_TNUMINT, &c))
+    return 0;
+  slow[nslow++] = xguard(J, GETARG_B(i), ctb(LUA_TTABLE));
+  if (c.r >= 0) slow[nslow++] = xguard(J, c.r, LUA_TNUMINT);
+  xloadint(J, RCX, &c);
+  xmem(J, 0, 1, 0x8b, RAX, R13, reg(GETARG_B(i)));  /* the table */
+  put1(J, 0x48); put1(J, 0x83); put1(J, 0xe9); put1(J, 1);  /* sub rcx, 1 */
+  xmem(J, 0, 0, 0x8b, RDX, RAX, offsetof(Table, sizearray));
+  put1(J, 0x48); put1(J, 0x39); put1(J, 0xd1);  /* cmp rcx, rdx */
+  slow[nslow++] = xjump(J, CC_AE);  /* also for k < 1 */
+  xmem(J, 0, 1, 0x8b, RAX, RAX, offsetof(Table, array));
+  put1(J, 0x48); put1(J, 0xc1); put1(J, 0xe1); put1(J, 4);  /* shl rcx, 4 */
+  put1(J, 0x48); put1(J, 0x01); put1(J, 0xc8);  /* add rax, rcx */
+  xmem(J, 0, 0, 0x80, 7, RAX, TAG);  /* cmp byte [tag], nil */
+  put1(J, LUA_TNIL);
+  slow[nslow++] = xjump(J, CC_E);
+  xcopy(J, RAX, 0, GETARG_A(i));
+  done = xjump(J, -1);
+  for (j = 0; j < nslow; j++) here(J, slow[j]);
+  emitcall(J, luaN_gettable, pc);
+  here(J, done);
+  return 1;
+}
+
+
+/* rax := the table in upvalue or register 'x' */
+static int xtable (JitState *J, int up, int x, size_t *slow) {
+  if (!up) {
+    slow[0] = xguard(J, x, ctb(LUA_TTABLE));
+    xmem(J, 0, 1, 0x8b, RAX, R13, reg(x));
+    return 1;
+  }
+  xmem(J, 0, 1, 0x8b, RDX, R12, offsetof(CallInfo, func));
+  xmem(J, 0, 1, 0x8b, RDX, RDX, 0);  /* the closure */
+  xmem(J, 0, 1, 0x8b, RDX, RDX, cast_int(offsetof(LClosure, upvals) +
+                                         sizeof(UpVal *) * x));
+  xmem(J, 0, 1, 0x8b, RDX, RDX, offsetof(UpVal, v));
+  xmem(J, 0, 0, 0x80, 7, RDX, TAG);  /* cmp byte [v], imm8 */
+  put1(J, ctb(LUA_TTABLE));
+  slow[0] = xjump(J, CC_NE);
+  xmem(J, 0, 1, 0x8b, RAX, RDX, 0);
+  return 1;
+}
+
+
+/*
+** rax := the node of 'key' in the table in rax, as cached for the
+** instruction at 'pc' (see 'icacheget' in lvm.c); a miss, or a nil
+** value, takes the slow path
+*/
+static int xfield (JitState *J, const Instruction *pc, const TValue *key,
+                   size_t *slow) {
+  int n = 0;
+  xmem(J, 0, 0, 0x0fb6, RCX, RAX, offsetof(Table, lsizenode));
+  put1(J, 0xba); put4(J, 1);  /* mov edx, 1 */
+  put1(J, 0xd3); put1(J, 0xe2);  /* shl edx, cl */
+  xmovimm(J, RSI, addr(J->p->icache + (pc - J->p->code)));
+  xmem(J, 0, 0, 0x0fb7, RCX, RSI, 0);  /* movzx ecx, word [cache] */
+  put1(J, 0x39); put1(J, 0xd1);  /* cmp ecx, edx */
+  slow[n++] = xjump(J, CC_AE);
+  xmem(J, 0, 1, 0x8b, RAX, RAX, offsetof(Table, node));
+  put1(J, 0x48); put1(J, 0x69); put1(J, 0xc9);  /* imul rcx, rcx, imm */
+  put4(J, sizeof(Node));
+  put1(J, 0x48); put1(J, 0x01); put1(J, 0xc8);  /* add rax, rcx */
+  xmem(J, 0, 0, 0x80, 7, RAX, KEYTT);  /* cmp byte [key tag], imm8 */
+  put1(J, ctb(LUA_TSHRSTR));
+  slow[n++] = xjump(J, CC_NE);
+  xmovimm(J, RDX, addr(tsvalue(key)));
+  xmem(J, 0, 1, 0x39, RDX, RAX, KEYVAL);  /* cmp key, rdx */
+  slow[n++] = xjump(J, CC_NE);
+  xmem(J, 0, 0, 0x80, 7, RAX, TAG);  /* cmp byte [tag], nil */
+  put1(J, LUA_TNIL);
+  slow[n++] = xjump(J, CC_E);
+  return n;
+}
+
+
+/* GETTABUP and GETTABLE of a constant short string */
+static int inl_getfield (JitState *J, Instruction i, const Instruction *pc,
+                         int up) {
+  const TValue *key = J->p->k + INDEXK(GETARG_C(i));
+  size_t slow[5], done;
+  int nslow, j;
+  if (!ISK(GETARG_C(i)) || !ttisshrstring(key))
+    return 0;
+  nslow = xtable(J, up, GETARG_B(i), slow);
+  nslow += xfield(J, pc, key, slow + nslow);
+  xcopy(J, RAX, 0, GETARG_A(i));
+  done = xjump(J, -1);
+  for (j = 0; j < nslow; j++) here(J, slow[j]);
+  emitcall(J, up ? luaN_gettabup : luaN_gettable, pc);
+  here(J, done);
+  return 1;
+}
+
+
+/*
+** SETTABUP and SETTABLE of a constant short string, for a table that
+** needs no barrier (not black)
+*/
+static int inl_setfield (JitState *J, Instruction i, const Instruction *pc,
+                         int up) {
+  const TValue *key = J->p->k + INDEXK(GETARG_B(i));
+  int c = GETARG_C(i);
+  size_t slow[6], done;
+  int nslow, j;
+  if (!ISK(GETARG_B(i)) || !ttisshrstring(key))
+    return 0;
+  nslow = xtable(J, up, GETARG_A(i), slow);
+  xmem(J, 0, 0, 0xf6, 0, RAX, offsetof(Table, marked));  /* test byte */
+  put1(J, bitmask(BLACKBIT));
+  slow[nslow++] = xjump(J, CC_NE);
+  nslow += xfield(J, pc, key, slow + nslow);
+  if (ISK(c)) {
+    xmovimm(J, RDX, addr(J->p->k + INDEXK(c)));
+    xmem(J, 0, 1, 0x8b, RCX, RDX, 8);
+    xmem(J, 0, 1, 0x8b, RDX, RDX, 0);
+  }
+  else {
+    xmem(J, 0, 1, 0x8b, RCX, R13, reg(c) + 8);
+    xmem(J, 0, 1, 0x8b, RDX, R13, reg(c));
+  }
+  xmem(J, 0, 1, 0x89, RDX, RAX, 0);
+  xmem(J, 0, 0, 0x88, RCX, RAX, TAG);  /* mov byte [tag], cl: the key follows */
+  done = xjump(J, -1);
+  for (j = 0; j < nslow; j++) here(J, slow[j]);
+  emitcall(J, up ? luaN_settabup : luaN_settable, pc);
+  here(J, done);
+  return 1;
+}
+
+
+/* the integer loop, the helper does the float one */
+static int inl_forloop (JitState *J, Instruction i, const Instruction *pc,
+                        int target) {
+  int a = GETARG_A(i);
+  size_t slow, neg, store;
+  slow = xguard(J, a, LUA_TNUMINT);
+  xmem(J, 0, 1, 0x8b, RAX, R13, reg(a));  /* index */
+  xmem(J, 0, 1, 0x8b, RDX, R13, reg(a + 2));  /* step */
+  put1(J, 0x48); put1(J, 0x01); put1(J, 0xd0);  /* add rax, rdx */
+  xmem(J, 0, 1, 0x8b, RCX, R13, reg(a + 1));  /* limit */
+  put1(J, 0x48); put1(J, 0x85); put1(J, 0xd2);  /* test rdx, rdx */
+  neg = xjump(J, CC_LE);
+  put1(J, 0x48); put1(J, 0x39); put1(J, 0xc8);  /* cmp rax, rcx */
+  jumpto(J, CC_G, pc - J->p->code + 1);
+  store = xjump(J, -1);
+  here(J, neg);
+  put1(J, 0x48); put1(J, 0x39); put1(J, 0xc8);  /* cmp rax, rcx */
+  jumpto(J, CC_L, pc - J->p->code + 1);
+  here(J, store);
+  xmem(J, 0, 1, 0x89, RAX, R13, reg(a));
+  xmem(J, 0, 1, 0x89, RAX, R13, reg(a + 3));
+  xmem(J, 0, 0, 0xc6, 0, R13, reg(a + 3) + TAG);
+  put1(J, LUA_TNUMINT);
+  jumpto(J, -1, target);
+  here(J, slow);
+  emitcall(J, luaN_forloop, pc);
+  emitbranch(J, 1, target);
+  return 1;
+}
+
+
+#define patchfixup(J,at,to)	patch(J, at, to)
+
+#define flushcode(m,sz)	((void)0)
+
+#elif defined(__aarch64__)
+
+/*
+** AArch64: x19 holds L and x20 the CallInfo. The templates only call
+** helpers, there are no inline ones yet. They have never been run, so
+** they are only built when asked for with LUAI_JITAARCH64, to be tried.
+*/
+#if !defined(LUAI_JITAARCH64)
+#error "the AArch64 JIT has not been run yet, define LUAI_JITAARCH64 to try it"
+#endif
+
+static void put32 (JitState *J, unsigned int ins) {
+  put4(J, ins);
+}
+
+
+/* movz/movk of a 64-bit immediate */
+static void amovimm (JitState *J, int rd, size_t imm) {
+  int hw;
+  put32(J, 0xd2800000u | (cast(unsigned int, imm & 0xffff) << 5) | rd);
+  for (hw = 1; hw < 4; hw++)
+    put32(J, 0xf2800000u | (cast(unsigned int, hw) << 21) |
+             (cast(unsigned int, (imm >> (16 * hw)) & 0xffff) << 5) | rd);
+}
+
+
+enum { A_B, A_CBZ, A_CBNZ };
+
+
+/* branch to be patched, returns its position */
+static size_t abranch (JitState *J, int kind) {
+  put32(J, kind == A_B ? 0x14000000u : kind == A_CBZ ? 0x34000000u
+                                                     : 0x35000000u);
+  return J->n - 4;
+}
+
+
+static void patch (JitState *J, size_t at, size_t to) {
+  unsigned int ins;
+  int off = cast_int(cast(ptrdiff_t, to - at) / 4);
+  memcpy(&ins, J->buf + at, 4);
+  if ((ins & 0xfc000000u) == 0x14000000u)  /* b */
+    ins |= cast(unsigned int, off) & 0x3ffffff;
+  else  /* cbz/cbnz */
+    ins |= (cast(unsigned int, off) & 0x7ffff) << 5;
+  memcpy(J->buf + at, &ins, 4);
+}
+
+
+static void emitprologue (JitState *J) {
+  put32(J, 0xa9be7bfd);  /* stp x29, x30, [sp, #-32]! */
+  put32(J, 0xa90153f3);  /* stp x19, x20, [sp, #16] */
+  put32(J, 0x910003fd);  /* mov x29, sp */
+  put32(J, 0xaa0003f3);  /* mov x19, x0 */
+  put32(J, 0xaa0103f4);  /* mov x20, x1 */
+  put32(J, 0xd61f0040);  /* br x2 */
+  J->exit = J->n;
+  put32(J, 0xa94153f3);  /* ldp x19, x20, [sp, #16] */
+  put32(J, 0xa8c27bfd);  /* ldp x29, x30, [sp], #32 */
+  put32(J, 0xd65f03c0);  /* ret */
+}
+
+
+static void emitcall (JitState *J, luaN_Helper h, const Instruction *pc) {
+  put32(J, 0xaa1303e0);  /* mov x0, x19 */
+  amovimm(J, 1, addr(pc));
+  amovimm(J, 16, addr(h));
+  put32(J, 0xd63f0200);  /* blr x16 */
+}
+
+
+static void emitbranch (JitState *J, int cond, int target) {
+  addfixup(J, abranch(J, cond ? A_CBNZ : A_CBZ), target);
+}
+
+
+static void emitexitif (JitState *J) {
+  patch(J, abranch(J, A_CBNZ), J->exit);
+}
+
+
+static void emitexit (JitState *J) {
+  patch(J, abranch(J, A_B), J->exit);
+}
+
+
+static void emitjump (JitState *J, int target) {
+  addfixup(J, abranch(J, A_B), target);
+}
+
+
+static void emitswitch (JitState *J, const Instruction *pc) {
+  put32(J, 0xaa1303e0);  /* mov x0, x19 */
+  amovimm(J, 1, addr(pc));
+  amovimm(J, 16, addr(jitswitch));
+  put32(J, 0xd63f0200);  /* blr x16 */
+  put32(J, 0xd61f0000);  /* br x0 */
+}
+
+
+#define inl_move(J,i)			0
+#define inl_loadk(J,i)			0
+#define inl_getupval(J,i)		0
+#define inl_arith(J,i,pc)		0
+#define inl_compare(J,i,pc,npc)		0
+#define inl_test(J,i,npc)		0
+#define inl_gettable(J,i,pc)		0
+#define inl_getfield(J,i,pc,up)		0
+#define inl_setfield(J,i,pc,up)		0
+#define inl_forloop(J,i,pc,target)	0
+
+#define patchfixup(J,at,to)	patch(J, at, to)
+
+#define flushcode(m,sz)	__builtin___clear_cache(cast(char *, m), \
+                                                cast(char *, m) + (sz))
+
+#else
+
+#error "LUA_USE_JIT needs x86-64 or AArch64"
+
+#endif
+
+
+/* the template of the instruction at 'npc' */
+static void emitinstruction (JitState *J, int npc) {
+  const Instruction *pc = J->p->code + npc;
+  Instruction i = *pc;
+  OpCode op = getBaseOp(GET_OPCODE(i));
+  switch (op) {
+    case OP_MOVE:
+      if (!(inlinable && inl_move(J, i))) emitcall(J, luaN_move, pc);
+      break;
+    case OP_LOADK:
+      if (!(inlinable && inl_loadk(J, i))) emitcall(J, luaN_loadk, pc);
+      break;
+    case OP_LOADKX: emitcall(J, luaN_loadkx, pc); break;
+    case OP_LOADBOOL:
+      emitcall(J, luaN_loadbool, pc);
+      if (GETARG_C(i)) emitjump(J, npc + 2);  /* skip next instruction */
+      break;
+    case OP_LOADNIL: emitcall(J, luaN_loadnil, pc); break;
+    case OP_GETUPVAL:
+      if (!(inlinable && inl_getupval(J, i))) emitcall(J, luaN_getupval, pc);
+      break;
+    case OP_GETTABUP:
+      if (!(inlinable && inl_getfield(J, i, pc, 1)))
+        emitcall(J, luaN_gettabup, pc);
+      break;
+    case OP_GETTABLE:
+      if (!(inlinable && (inl_gettable(J, i, pc) ||
+                          inl_getfield(J, i, pc, 0))))
+        emitcall(J, luaN_gettable, pc);
+      break;
+    case OP_SETTABUP:
+      if (!(inlinable && inl_setfield(J, i, pc, 1)))
+        emitcall(J, luaN_settabup, pc);
+      break;
+    case OP_SETUPVAL: emitcall(J, luaN_setupval, pc); break;
+    case OP_SETTABLE:
+      if (!(inlinable && inl_setfield(J, i, pc, 0)))
+        emitcall(J, luaN_settable, pc);
+      break;
+    case OP_NEWTABLE: emitcall(J, luaN_newtable, pc); break;
+    case OP_SELF: emitcall(J, luaN_self, pc); break;
+    case OP_ADD: case OP_SUB: case OP_MUL:
+      if (!(inlinable && inl_arith(J, i, pc))) emitcall(J, luaN_arith, pc);
+      break;
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_UNM: case OP_BNOT:
+      emitcall(J, luaN_arith, pc);
+      break;
+    case OP_NOT: emitcall(J, luaN_not, pc); break;
+    case OP_LEN: emitcall(J, luaN_len, pc); break;
+    case OP_CONCAT: emitcall(J, luaN_concat, pc); break;
+    case OP_JMP:
+      if (GETARG_A(i) != 0) emitcall(J, luaN_jmp, pc);
+      emitjump(J, npc + 1 + GETARG_sBx(i));
+      break;
+    case OP_EQ: case OP_LT: case OP_LE:
+      if (!(inlinable && inl_compare(J, i, pc, npc))) {
+        emitcall(J, op == OP_EQ ? luaN_eq : op == OP_LT ? luaN_lt : luaN_le, pc);
+        emitbranch(J, 0, npc + 2);  /* skip the jump */
+      }
+      break;
+    case OP_TEST:
+      if (!(inlinable && inl_test(J, i, npc))) {
+        emitcall(J, luaN_test, pc);
+        emitbranch(J, 0, npc + 2);
+      }
+      break;
+    case OP_TESTSET:
+      emitcall(J, luaN_testset, pc);
+      emitbranch(J, 0, npc + 2);
+      break;
+    case OP_CALL:
+      emitcall(J, luaN_call, pc);
+      emitexitif(J);
+      break;
+    case OP_RETURN:
+      emitcall(J, luaN_return, pc);
+      emitexit(J);
+      break;
+    case OP_FORPREP:
+      emitcall(J, luaN_forprep, pc);
+      emitjump(J, npc + 1 + GETARG_sBx(i));
+      break;
+    case OP_FORLOOP: {
+      int target = npc + 1 + GETARG_sBx(i);
+      if (!(inlinable && inl_forloop(J, i, pc, target))) {
+        emitcall(J, luaN_forloop, pc);
+        emitbranch(J, 1, target);
+      }
+      break;
+    }
+    case OP_TFORCALL:  /* goes on with its TFORLOOP */
+      emitcall(J, luaN_tforcall, pc);
+      break;
+    case OP_TFORLOOP:
+      emitcall(J, luaN_tforloop, pc);
+      emitbranch(J, 1, npc + 1 + GETARG_sBx(i));
+      break;
+    case OP_SETLIST: emitcall(J, luaN_setlist, pc); break;
+    case OP_CLOSURE: emitcall(J, luaN_closure, pc); break;
+    case OP_VARARG: emitcall(J, luaN_vararg, pc); break;
+    case OP_EXTRAARG:  /* no code, native code goes on past it */
+      break;
+    case OP_SWITCH: emitswitch(J, pc); break;
+    default:  /* left to the interpreter */
+      emitcall(J, luaN_exit, pc);
+      emitexit(J);
+      break;
+  }
+}
+
+
+static void freecode (lua_State *L, JitState *J, Proto *p) {
+  luaM_freearray(L, J->buf, MAXPROLOGUE + cast(size_t, p->sizecode) * MAXTEMPLATE);
+  luaM_freearray(L, J->fix, p->sizecode * MAXFIXUPS);
+}
+
+
+/* the native code of compiled functions, entered at 'savedpc' */
+static void jitrun (lua_State *L, CallInfo *ci) {
+  Proto *p = clLvalue(ci->func)->p;
+  JitCode *jc = p->jit;
+  JitEntry entry = (JitEntry)(void *)jc->mcode;
+  entry(L, ci, jc->mcode + jc->offs[ci->u.l.savedpc - p->code]);
+}
+
+
+/*
+** Translate 'p'; true if it has native code now. Functions whose code
+** cannot be made executable stay interpreted.
+*/
+int luaJ_compile (lua_State *L, Proto *p) {
+  JitState J;
+  JitCode *jc;
+  size_t size = MAXPROLOGUE + cast(size_t, p->sizecode) * MAXTEMPLATE;
+  lu_byte *mcode;
+  int pc;
+  if (p->sizecode > MAX_INT / MAXTEMPLATE)
+    return 0;
+  J.p = p;
+  J.n = 0;
+  J.nfix = 0;
+  J.buf = luaM_newvector(L, size, lu_byte);
+  J.fix = luaM_newvector(L, p->sizecode * MAXFIXUPS, Fixup);
+  J.offs = luaM_newvector(L, p->sizecode, unsigned int);
+  emitprologue(&J);
+  lua_assert(J.n <= MAXPROLOGUE);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    size_t start = J.n;
+    int nfix = J.nfix;
+    J.offs[pc] = cast(unsigned int, J.n);
+    emitinstruction(&J, pc);
+    lua_assert(J.n - start <= MAXTEMPLATE && J.nfix - nfix <= MAXFIXUPS);
+    (void)start; (void)nfix;
+  }
+  for (pc = 0; pc < J.nfix; pc++)
+    patchfixup(&J, J.fix[pc].at, J.offs[J.fix[pc].target]);
+  mcode = cast(lu_byte *, l_jitalloc(J.n));
+  if (mcode != NULL) {
+    memcpy(mcode, J.buf, J.n);
+    if (!l_jitseal(mcode, J.n)) {
+      l_jitfree(mcode, J.n);
+      mcode = NULL;
+    }
+  }
+  freecode(L, &J, p);
+  if (mcode == NULL) {
+    luaM_freearray(L, J.offs, p->sizecode);
+    return 0;
+  }
+  flushcode(mcode, J.n);
+  jc = luaM_new(L, JitCode);
+  jc->mcode = mcode;
+  jc->size = J.n;
+  jc->offs = J.offs;
+  p->jit = jc;
+  p->native = jitrun;
+  return 1;
+}
+
+
+void luaJ_free (lua_State *L, Proto *p) {
+  JitCode *jc = p->jit;
+  l_jitfree(jc->mcode, jc->size);
+  luaM_freearray(L, jc->offs, p->sizecode);
+  luaM_free(L, jc);
+}
+
+/* }====================================================== */
+
+#endif
@@ -0,0 +1,41 @@
+/*
+** Baseline compiler of Lua functions to native code
+** See Copyright Notice in lua.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+#if LUA_USE_JIT
+
+/*
+** number of calls and loop iterations after which a function is
+** compiled
+*/
+#if !defined(LUAI_JITHOT)
+#define LUAI_JITHOT	64
+#endif
+
+
+/*
+** count a call or a loop iteration of 'p' and compile it when it gets
+** hot; true if it has native code now
+*/
+#define luaJ_hot(L,p)	((p)->jitcount > 0 && --(p)->jitcount == 0 && \
+                         luaJ_compile(L, p))
+
+
+LUAI_FUNC int luaJ_compile (lua_State *L, Proto *p);
+LUAI_FUNC void luaJ_free (lua_State *L, Proto *p);
+
+#else
+
+#define luaJ_hot(L,p)	0
+
+#endif
+
+#endif
@@ -20,6 +20,7 @@
 #include "ldo.h"
 #include "lgc.h"
 #include "llex.h"
+#include "lmem.h"
 #include "lobject.h"
 #include "lparser.h"
 #include "lstate.h"
@@ -137,7 +138,7 @@ TString *luaX_newstring (LexState *ls, const char *str, size_t l) {
     luaC_checkGC(L);
   }
   else {  /* string already present */
-    ts = tsvalue(keyfromval(o));  /* re-use value previously stored */
+    ts = keystrval(nodefromval(o));  /* re-use value previously stored */
   }
   L->top--;  /* remove string from stack */
   return ts;
@@ -171,6 +172,7 @@ void luaX_setinput (lua_State *L, LexState *ls, ZIO *z, TString *source,
   ls->lastline = 1;
   ls->source = source;
   ls->envn = luaS_newliteral(L, LUA_ENV);  /* get env name */
+  ls->replay = NULL;
   luaZ_resizebuffer(ls->L, ls->buff, LUA_MINBUFFER);  /* initialize buffer */
 }
 
@@ -546,6 +548,34 @@ static int llex (LexState *ls, SemInfo *seminfo) {
 }
 
 
+/*
+** The parser compiles the expression of an inlinable function again at
+** each call by giving its tokens back (see 'inlinecall' in lparser.c)
+*/
+static int nexttoken (LexState *ls, SemInfo *seminfo) {
+  if (ls->replay != NULL) {
+    if (ls->replay->token == TK_EOS)  /* stays at the end */
+      return TK_EOS;
+    *seminfo = ls->replay->seminfo;
+    return (ls->replay++)->token;
+  }
+  return llex(ls, seminfo);
+}
+
+
+/* keep a token of a function that may be inlinable (see 'localstat') */
+static void savetoken (LexState *ls) {
+  Dyndata *dyd = ls->dyd;
+  if (dyd->tok.n - dyd->tok.first >= MAXINLINETOKENS) {
+    dyd->tok.fs = NULL;  /* too long to be inlined */
+    return;
+  }
+  luaM_growvector(ls->L, dyd->tok.arr, dyd->tok.n, dyd->tok.size,
+                  Token, MAX_INT, "tokens");
+  dyd->tok.arr[dyd->tok.n++] = ls->t;
+}
+
+
 void luaX_next (LexState *ls) {
   ls->lastline = ls->linenumber;
   if (ls->lookahead.token != TK_EOS) {  /* is there a look-ahead token? */
@@ -553,13 +583,15 @@ void luaX_next (LexState *ls) {
     ls->lookahead.token = TK_EOS;  /* and discharge it */
   }
   else
-    ls->t.token = llex(ls, &ls->t.seminfo);  /* read next token */
+    ls->t.token = nexttoken(ls, &ls->t.seminfo);  /* read next token */
+  if (ls->dyd->tok.fs != NULL && ls->replay == NULL)
+    savetoken(ls);
 }
 
 
 int luaX_lookahead (LexState *ls) {
   lua_assert(ls->lookahead.token == TK_EOS);
-  ls->lookahead.token = llex(ls, &ls->lookahead.seminfo);
+  ls->lookahead.token = nexttoken(ls, &ls->lookahead.seminfo);
   return ls->lookahead.token;
 }
 
@@ -69,6 +69,7 @@ typedef struct LexState {
   struct Dyndata *dyd;  /* dynamic structures used by the parser */
   TString *source;  /* current source name */
   TString *envn;  /* environment variable name */
+  const Token *replay;  /* tokens read before the input, up to a TK_EOS */
 } LexState;
 
 
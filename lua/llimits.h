@@ -35,6 +35,10 @@ typedef long l_mem;
 typedef unsigned char lu_byte;
 
 
+/* whether Lua functions can have native code (see lnative.c) */
+#define LUA_USE_NATIVE	(LUA_USE_JIT || LUA_USE_AOT)
+
+
 /* maximum value for size_t */
 #define MAX_SIZET	((size_t)(~(size_t)0))
 
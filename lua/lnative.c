@@ -0,0 +1,618 @@
+/*
+** Native code of Lua functions, compiled by the JIT or ahead of time
+** See Copyright Notice in lua.h
+*/
+
+#define lnative_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "laot.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lnative.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+#if LUA_USE_NATIVE
+
+
+/*
+** A function with native code has a pointer to it in its prototype,
+** which runs its frame from 'savedpc'. The JIT compiles hot functions
+** (see ljit.c); 'luac_ta -c' writes C code for all functions of a
+** script, which is compiled into the program (see 'lua_aotload').
+**
+** Native code does what 'luaV_execute' would with the frame, keeping it
+** the way the interpreter expects it: the helpers below keep 'savedpc'
+** up to date, so errors, metamethods, yields and the debug interface
+** see an interpreted frame, and the interpreter can take over after any
+** instruction. Calls and returns between functions with native code
+** stay in native code (see 'luaN_execute'); native code leaves the
+** frame to the interpreter for the rest (tail calls, MOD and POW,
+** functions without native code). The interpreter enters it again from
+** 'savedpc' when it starts or comes back to the frame and at loop back
+** edges. Native code does not run while line or count hooks are set.
+*/
+
+
+/*
+** {======================================================
+** Helpers
+** =======================================================
+*/
+
+#define RA(i)	(base+GETARG_A(i))
+#define RB(i)	(base+GETARG_B(i))
+#define RKB(i)	(ISK(GETARG_B(i)) ? k+INDEXK(GETARG_B(i)) : base+GETARG_B(i))
+#define RKC(i)	(ISK(GETARG_C(i)) ? k+INDEXK(GETARG_C(i)) : base+GETARG_C(i))
+
+
+/* the running frame, continuing after the instruction at 'pc' */
+#define enterhelper(L,pc)	(L->ci->u.l.savedpc = (pc) + 1, L->ci)
+
+#define closureof(ci)	clLvalue((ci)->func)
+
+
+int luaN_move (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  setobjs2s(L, RA(*pc), RB(*pc));
+  return 0;
+}
+
+
+int luaN_loadk (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  setobj2s(L, RA(*pc), closureof(ci)->p->k + GETARG_Bx(*pc));
+  return 0;
+}
+
+
+int luaN_loadkx (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc + 1);  /* skips its EXTRAARG */
+  StkId base = ci->u.l.base;
+  setobj2s(L, RA(*pc), closureof(ci)->p->k + GETARG_Ax(pc[1]));
+  return 0;
+}
+
+
+int luaN_loadbool (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  setbvalue(RA(*pc), GETARG_B(*pc));
+  return 0;
+}
+
+
+int luaN_loadnil (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  StkId ra = RA(*pc);
+  int b = GETARG_B(*pc);
+  do {
+    setnilvalue(ra++);
+  } while (b--);
+  return 0;
+}
+
+
+int luaN_getupval (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  setobj2s(L, RA(*pc), closureof(ci)->upvals[GETARG_B(*pc)]->v);
+  return 0;
+}
+
+
+int luaN_setupval (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  UpVal *uv = closureof(ci)->upvals[GETARG_B(*pc)];
+  setobj(L, uv->v, RA(*pc));
+  luaC_upvalbarrier(L, uv);
+  return 0;
+}
+
+
+/*
+** raw access to 't[key]' as the interpreter does it, through the inline
+** cache of the instruction for constant short string keys
+*/
+static const TValue *rawget (const Proto *p, const Instruction *pc, int arg,
+                             Table *t, TValue *key) {
+  if (ISK(arg) && ttisshrstring(key))
+    return luaH_getcached(t, tsvalue(key), p->icache + (pc - p->code));
+  return luaH_get(t, key);
+}
+
+
+static void gettable (lua_State *L, const Instruction *pc, int arg,
+                      const TValue *t, TValue *key, StkId val) {
+  const TValue *slot = NULL;
+  if (ttistable(t)) {
+    slot = rawget(closureof(L->ci)->p, pc, arg, hvalue(t), key);
+    if (!ttisnil(slot)) {
+      setobj2s(L, val, slot);
+      return;
+    }
+  }
+  luaV_finishget(L, t, key, val, slot);
+}
+
+
+static void settable (lua_State *L, const Instruction *pc, int arg,
+                      const TValue *t, TValue *key, TValue *val) {
+  const TValue *slot = NULL;
+  if (ttistable(t)) {
+    slot = rawget(closureof(L->ci)->p, pc, arg, hvalue(t), key);
+    if (!ttisnil(slot)) {
+      luaC_barrierback(L, hvalue(t), val);
+      setobj2t(L, cast(TValue *, slot), val);
+      return;
+    }
+  }
+  luaV_finishset(L, t, key, val, slot);
+}
+
+
+int luaN_gettabup (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  LClosure *cl = closureof(ci);
+  StkId base = ci->u.l.base;
+  TValue *k = cl->p->k;
+  Instruction i = *pc;
+  gettable(L, pc, GETARG_C(i), cl->upvals[GETARG_B(i)]->v, RKC(i), RA(i));
+  return 0;
+}
+
+
+int luaN_gettable (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  TValue *k = closureof(ci)->p->k;
+  Instruction i = *pc;
+  gettable(L, pc, GETARG_C(i), RB(i), RKC(i), RA(i));
+  return 0;
+}
+
+
+int luaN_settabup (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  LClosure *cl = closureof(ci);
+  StkId base = ci->u.l.base;
+  TValue *k = cl->p->k;
+  Instruction i = *pc;
+  settable(L, pc, GETARG_B(i), cl->upvals[GETARG_A(i)]->v, RKB(i), RKC(i));
+  return 0;
+}
+
+
+int luaN_settable (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  TValue *k = closureof(ci)->p->k;
+  Instruction i = *pc;
+  settable(L, pc, GETARG_B(i), RA(i), RKB(i), RKC(i));
+  return 0;
+}
+
+
+int luaN_newtable (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  int b = GETARG_B(*pc);
+  int c = GETARG_C(*pc);
+  Table *t = luaH_new(L);
+  sethvalue(L, ra, t);
+  if (b != 0 || c != 0)
+    luaH_resize(L, t, luaO_fb2int(b), luaO_fb2int(c));
+  luaC_condGC(L, L->top = ra + 1, L->top = ci->top);
+  return 0;
+}
+
+
+int luaN_self (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  TValue *k = closureof(ci)->p->k;
+  Instruction i = *pc;
+  StkId ra = RA(i);
+  StkId rb = RB(i);
+  TValue *rc = RKC(i);
+  const TValue *aux;
+  if (!ttisstring(rc))  /* not statically checked for binary chunks */
+    luaG_runerror(L, "string expected in SELF");
+  setobjs2s(L, ra + 1, rb);
+  if (luaV_fastget(L, rb, tsvalue(rc), aux, luaH_getstr)) {
+    setobj2s(L, ra, aux);
+  }
+  else luaV_finishget(L, rb, rc, ra, aux);
+  return 0;
+}
+
+
+/* ADD to SHR, UNM and BNOT; MOD and POW are left to the interpreter */
+int luaN_arith (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  TValue *k = closureof(ci)->p->k;
+  Instruction i = *pc;
+  OpCode op = getBaseOp(GET_OPCODE(i));  /* the opcode may be quickened */
+  int aop = cast_int(op - OP_ADD) + LUA_OPADD;  /* ORDER OP */
+  if (op == OP_UNM || op == OP_BNOT)
+    luaO_arith(L, aop, RB(i), RB(i), RA(i));
+  else
+    luaO_arith(L, aop, RKB(i), RKC(i), RA(i));
+  return 0;
+}
+
+
+int luaN_not (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  int res = l_isfalse(RB(*pc));
+  setbvalue(RA(*pc), res);
+  return 0;
+}
+
+
+int luaN_len (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  luaV_objlen(L, RA(*pc), RB(*pc));
+  return 0;
+}
+
+
+int luaN_concat (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  int b = GETARG_B(*pc);
+  int c = GETARG_C(*pc);
+  StkId ra, rb;
+  L->top = ci->u.l.base + c + 1;  /* mark the end of concat operands */
+  luaV_concat(L, c - b + 1);
+  ra = ci->u.l.base + GETARG_A(*pc);  /* the stack may have moved */
+  rb = ci->u.l.base + b;
+  setobjs2s(L, ra, rb);
+  luaC_condGC(L, L->top = (ra >= rb ? ra + 1 : rb), L->top = ci->top);
+  L->top = ci->top;  /* restore top */
+  return 0;
+}
+
+
+/* the upvalues a jump closes */
+int luaN_jmp (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  luaF_close(L, ci->u.l.base + GETARG_A(*pc) - 1);
+  return 0;
+}
+
+
+/* comparisons and tests branch to the jump that follows them */
+int luaN_eq (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  TValue *k = closureof(ci)->p->k;
+  return luaV_equalobj(L, RKB(*pc), RKC(*pc)) == GETARG_A(*pc);
+}
+
+
+int luaN_lt (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  TValue *k = closureof(ci)->p->k;
+  return luaV_lessthan(L, RKB(*pc), RKC(*pc)) == GETARG_A(*pc);
+}
+
+
+int luaN_le (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  TValue *k = closureof(ci)->p->k;
+  return luaV_lessequal(L, RKB(*pc), RKC(*pc)) == GETARG_A(*pc);
+}
+
+
+int luaN_test (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  return GETARG_C(*pc) ? !l_isfalse(RA(*pc)) : l_isfalse(RA(*pc));
+}
+
+
+int luaN_testset (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  StkId rb = RB(*pc);
+  if (GETARG_C(*pc) ? l_isfalse(rb) : !l_isfalse(rb))
+    return 0;
+  setobjs2s(L, RA(*pc), rb);
+  return 1;
+}
+
+
+/* leaves 'savedpc' at the instruction to go on with */
+int luaN_switch (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = L->ci;
+  Proto *p = closureof(ci)->p;
+  ci->u.l.savedpc = p->code + luaV_switch(p, *pc, ci->u.l.base + GETARG_A(*pc));
+  return 0;
+}
+
+
+/*
+** A C function is called here; a Lua function gets its frame, which
+** native code leaves for the interpreter to run (see 'luaN_execute').
+** Also leaves native code if the function set a hook.
+*/
+int luaN_call (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  int b = GETARG_B(*pc);
+  int nresults = GETARG_C(*pc) - 1;
+  if (b != 0) L->top = ra+b;  /* else previous instruction set top */
+  if (!luaD_precall(L, ra, nresults))
+    return 1;  /* Lua function */
+  if (nresults >= 0)
+    L->top = ci->top;  /* adjust results */
+  return (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) != 0;
+}
+
+
+/*
+** Returns to a frame of this invocation of the interpreter, which goes
+** on with the caller; the interpreter returns from the others.
+*/
+int luaN_return (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = L->ci;
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  int b = GETARG_B(*pc);
+  if (ci->callstatus & CIST_FRESH) {
+    ci->u.l.savedpc = pc;
+    return 1;
+  }
+  ci->u.l.savedpc = pc + 1;
+  if (closureof(ci)->p->sizep > 0) luaF_close(L, ci->u.l.base);
+  b = luaD_poscall(L, ci, ra, (b != 0 ? b - 1 : cast_int(L->top - ra)));
+  if (b) L->top = L->ci->top;
+  lua_assert(isLua(L->ci));
+  return 1;
+}
+
+
+/* native code branches to the FORLOOP itself */
+int luaN_forprep (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  luaV_forprep(L, ci->u.l.base + GETARG_A(*pc));
+  return 0;
+}
+
+
+int luaN_forloop (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  if (ttisinteger(ra)) {  /* integer loop? */
+    lua_Integer step = ivalue(ra + 2);
+    lua_Integer idx = intop(+, ivalue(ra), step); /* increment index */
+    lua_Integer limit = ivalue(ra + 1);
+    if ((0 < step) ? (idx <= limit) : (limit <= idx)) {
+      chgivalue(ra, idx);  /* update internal index... */
+      setivalue(ra + 3, idx);  /* ...and external index */
+      return 1;
+    }
+  }
+  else {  /* floating loop */
+    lua_Number step = fltvalue(ra + 2);
+    lua_Number idx = luai_numadd(L, fltvalue(ra), step); /* inc. index */
+    lua_Number limit = fltvalue(ra + 1);
+    if (luai_numlt(0, step) ? luai_numle(idx, limit)
+                            : luai_numle(limit, idx)) {
+      chgfltvalue(ra, idx);  /* update internal index... */
+      setfltvalue(ra + 3, idx);  /* ...and external index */
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+int luaN_tforcall (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  StkId cb = ra + 3;  /* call base */
+  setobjs2s(L, cb+2, ra+2);
+  setobjs2s(L, cb+1, ra+1);
+  setobjs2s(L, cb, ra);
+  L->top = cb + 3;  /* func. + 2 args (state and index) */
+  luaD_call(L, cb, GETARG_C(*pc));
+  L->top = ci->top;
+  return 0;
+}
+
+
+int luaN_tforloop (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  if (!ttisnil(ra + 1)) {  /* continue loop? */
+    setobjs2s(L, ra, ra + 1);  /* save control variable */
+    return 1;
+  }
+  return 0;
+}
+
+
+int luaN_setlist (lua_State *L, const Instruction *pc) {
+  int c = GETARG_C(*pc);
+  CallInfo *ci = enterhelper(L, c == 0 ? pc + 1 : pc);  /* EXTRAARG? */
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  int n = GETARG_B(*pc);
+  unsigned int last;
+  Table *h;
+  if (n == 0) n = cast_int(L->top - ra) - 1;
+  if (c == 0) c = GETARG_Ax(pc[1]);
+  if (!ttistable(ra))  /* not statically checked for binary chunks */
+    luaG_runerror(L, "table expected in SETLIST");
+  h = hvalue(ra);
+  last = ((c-1)*LFIELDS_PER_FLUSH) + n;
+  if (last > h->sizearray)  /* needs more space? */
+    luaH_resizearray(L, h, last);  /* preallocate it at once */
+  for (; n > 0; n--) {
+    TValue *val = ra+n;
+    luaH_setint(L, h, last--, val);
+    luaC_barrierback(L, h, val);
+  }
+  L->top = ci->top;  /* correct top (in case of previous open call) */
+  return 0;
+}
+
+
+int luaN_closure (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  LClosure *cl = closureof(ci);
+  StkId ra = ci->u.l.base + GETARG_A(*pc);
+  luaV_closure(L, cl->p->p[GETARG_Bx(*pc)], cl->upvals, ci->u.l.base, ra);
+  luaC_condGC(L, L->top = ra + 1, L->top = ci->top);
+  return 0;
+}
+
+
+int luaN_vararg (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = enterhelper(L, pc);
+  StkId base = ci->u.l.base;
+  StkId ra = RA(*pc);
+  int b = GETARG_B(*pc) - 1;  /* required results */
+  int j;
+  int n = cast_int(base - ci->func) - closureof(ci)->p->numparams - 1;
+  if (n < 0)  /* less arguments than parameters? */
+    n = 0;  /* no vararg arguments */
+  if (b < 0) {  /* B == 0? */
+    b = n;  /* get all var. arguments */
+    luaD_checkstack(L, n);
+    base = ci->u.l.base;  /* previous call may change the stack */
+    ra = RA(*pc);
+    L->top = ra + n;
+  }
+  for (j = 0; j < b && j < n; j++)
+    setobjs2s(L, ra + j, base - n + j);
+  for (; j < b; j++)  /* complete required results with nil */
+    setnilvalue(ra + j);
+  return 0;
+}
+
+
+/* leave native code before the instruction */
+int luaN_exit (lua_State *L, const Instruction *pc) {
+  L->ci->u.l.savedpc = pc;
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** Run the frame 'ci' in native code from 'savedpc', and the frames it
+** calls or returns to as long as they have native code. True if it left
+** with another frame running, 'L->ci', where the interpreter goes on.
+*/
+int luaN_execute (lua_State *L, CallInfo *ci) {
+  int moved = 0;  /* a frame may reuse the CallInfo of an earlier one */
+  for (;;) {
+    Proto *p = clLvalue(ci->func)->p;
+    if (p->native == NULL || (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)))
+      break;  /* hooks see every instruction in the interpreter */
+    p->native(L, ci);
+    if (L->ci == ci)
+      break;  /* left for the interpreter */
+    ci = L->ci;
+    moved = 1;
+  }
+  return moved;
+}
+
+
+#if LUA_USE_AOT
+
+/*
+** {======================================================
+** Scripts compiled ahead of time
+** =======================================================
+*/
+
+LUA_API const lua_AotScript *lua_aotfind (const char *name, size_t len) {
+  int i;
+  for (i = 0; i < lua_naotscripts; i++) {
+    const lua_AotScript *s = &lua_aotscripts[i];
+    if (strlen(s->name) == len && memcmp(s->name, name, len) == 0)
+      return s;
+  }
+  return NULL;
+}
+
+
+static int countfunctions (const Proto *p) {
+  int n = 1;
+  int i;
+  for (i = 0; i < p->sizep; i++)
+    n += countfunctions(p->p[i]);
+  return n;
+}
+
+
+/* give the functions of 'p' their code, in the order 'luac_ta' wrote it */
+static int attach (Proto *p, const lua_AotScript *s, int n) {
+  int i;
+  p->native = s->functions[n++];
+  for (i = 0; i < p->sizep; i++)
+    n = attach(p->p[i], s, n);
+  return n;
+}
+
+
+static const char *getchunk (lua_State *L, void *ud, size_t *size) {
+  const lua_AotScript **s = cast(const lua_AotScript **, ud);
+  const unsigned char *chunk;
+  UNUSED(L);
+  if (*s == NULL) return NULL;  /* all of it was read */
+  chunk = (*s)->chunk;
+  *size = (*s)->size;
+  *s = NULL;
+  return cast(const char *, chunk);
+}
+
+
+/*
+** The chunk is part of the program, so it is loaded as binary. Should
+** it not have the functions the code was written for, it only runs in
+** the interpreter.
+*/
+LUA_API int lua_aotload (lua_State *L, const lua_AotScript *s) {
+  const lua_AotScript *ud = s;
+  int status = lua_load(L, getchunk, &ud, s->name, "b");
+  if (status == LUA_OK) {
+    Proto *p = clLvalue(L->top - 1)->p;
+    if (countfunctions(p) == s->nfunctions)
+      attach(p, s, 0);
+  }
+  return status;
+}
+
+/* }====================================================== */
+
+#endif
+
+#endif
@@ -0,0 +1,200 @@
+/*
+** Native code of Lua functions, compiled by the JIT or ahead of time
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lnative_h
+#define lnative_h
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "ltable.h"
+
+
+#if LUA_USE_NATIVE
+
+/*
+** All helpers take the instruction at 'pc' of the running frame. They
+** return 0 to go on with the next instruction; a branching helper
+** returns 1 to take its branch and an exiting one returns 1 to leave
+** native code, with 'savedpc' at the instruction the interpreter has to
+** run next.
+*/
+typedef int (*luaN_Helper) (lua_State *L, const Instruction *pc);
+
+LUAI_FUNC int luaN_move (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_loadk (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_loadkx (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_loadbool (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_loadnil (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_getupval (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_setupval (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_gettabup (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_gettable (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_settabup (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_settable (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_newtable (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_self (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_arith (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_not (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_len (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_concat (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_jmp (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_eq (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_lt (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_le (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_test (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_testset (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_switch (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_call (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_return (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_forprep (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_forloop (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_tforcall (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_tforloop (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_setlist (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_closure (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_vararg (lua_State *L, const Instruction *pc);
+LUAI_FUNC int luaN_exit (lua_State *L, const Instruction *pc);
+
+LUAI_FUNC int luaN_execute (lua_State *L, CallInfo *ci);
+
+#endif
+
+
+#if LUA_USE_AOT
+
+/*
+** {======================================================
+** Building blocks of the C code written by 'luac_ta -c'
+** =======================================================
+*/
+
+/*
+** A compiled function has a label 'iN' for the code of each instruction
+** N and starts at the one of 'savedpc'. 'n' below is the instruction,
+** 't' a label to branch to, registers and constants are 'aot_R(x)' and
+** 'aot_K(x)'. Anything the fast paths here do not cover is left to the
+** helper of the instruction.
+*/
+#define aot_frame	const Instruction *code = clLvalue(ci->func)->p->code; \
+  StkId base = ci->u.l.base
+
+#define aot_constants	TValue *k = clLvalue(ci->func)->p->k
+
+#define aot_icache	unsigned short *icache = clLvalue(ci->func)->p->icache
+
+#define aot_pc		(ci->u.l.savedpc - code)
+
+#define aot_R(x)	(base+(x))
+#define aot_K(x)	(k+(x))
+#define aot_U(x)	(clLvalue(ci->func)->upvals[x]->v)
+
+
+/* the instruction done by a helper, which may move the stack */
+#define aot_do(h,n)	{ (void)h(L, code+(n)); base = ci->u.l.base; }
+
+/* a helper that branches to 't' when it returns 'c' */
+#define aot_branch(h,n,c,t)	{ int b_ = h(L, code+(n)); \
+  base = ci->u.l.base; if (b_ == (c)) goto t; }
+
+/* a call: Lua functions are run from 'luaN_execute' */
+#define aot_call(n)	{ if (luaN_call(L, code+(n))) return; \
+  base = ci->u.l.base; }
+
+/* OP_SWITCH, which goes on at the instruction it leaves in 'savedpc' */
+#define aot_switch(n)	{ (void)luaN_switch(L, code+(n)); goto dispatch; }
+
+/* an instruction that leaves the frame */
+#define aot_exit(h,n)	{ (void)h(L, code+(n)); return; }
+
+
+#define aot_move(a,b)	{ setobjs2s(L, aot_R(a), aot_R(b)); }
+
+#define aot_loadk(a,x)	{ setobj2s(L, aot_R(a), aot_K(x)); }
+
+#define aot_getupval(a,b)	{ setobj2s(L, aot_R(a), aot_U(b)); }
+
+
+/* the slot of the constant short string 'x' in 't', through the cache */
+#define aot_field(n,t,x)	(icache[n] < sizenode(t) && \
+  keyisshrstr(gnode(t, icache[n])) && \
+  keystrval(gnode(t, icache[n])) == tsvalue(aot_K(x)) \
+  ? gval(gnode(t, icache[n])) : luaH_getcached(t, tsvalue(aot_K(x)), icache+(n)))
+
+/* the slot of integer 'i' in the array part of 't', or NULL */
+#define aot_slot(t,i)	(l_castS2U(i) - 1u < (t)->sizearray ? \
+  &(t)->array[(i) - 1] : NULL)
+
+/* GETTABLE and GETTABUP of a constant short string, 'h' the helper */
+#define aot_getfield(n,h,a,t,x)	{ const TValue *t_ = (t), *s_; \
+  if (ttistable(t_) && (s_ = aot_field(n, hvalue(t_), x), !ttisnil(s_))) { \
+    setobj2s(L, aot_R(a), s_); } \
+  else aot_do(h, n) }
+
+/* SETTABLE and SETTABUP of a constant short string, 'h' the helper */
+#define aot_setfield(n,h,t,x,rc)	{ const TValue *t_ = (t); TValue *s_; \
+  if (ttistable(t_) && \
+      (s_ = cast(TValue *, aot_field(n, hvalue(t_), x)), !ttisnil(s_))) { \
+    TValue *v_ = (rc); \
+    luaC_barrierback(L, hvalue(t_), v_); setobj2t(L, s_, v_); } \
+  else aot_do(h, n) }
+
+/* GETTABLE of a register, the array part for integers */
+#define aot_gettable(n,a,b,c)	{ const TValue *t_ = aot_R(b); \
+  const TValue *k_ = aot_R(c); const TValue *s_; \
+  if (ttistable(t_) && ttisinteger(k_) && \
+      (s_ = aot_slot(hvalue(t_), ivalue(k_))) != NULL && !ttisnil(s_)) { \
+    setobj2s(L, aot_R(a), s_); } \
+  else aot_do(luaN_gettable, n) }
+
+/* SETTABLE to a register, the array part for integers */
+#define aot_settable(n,a,b,rc)	{ const TValue *t_ = aot_R(a); \
+  const TValue *k_ = aot_R(b); TValue *s_; \
+  if (ttistable(t_) && ttisinteger(k_) && \
+      (s_ = aot_slot(hvalue(t_), ivalue(k_))) != NULL && !ttisnil(s_)) { \
+    TValue *v_ = (rc); \
+    luaC_barrierback(L, hvalue(t_), v_); setobj2t(L, s_, v_); } \
+  else aot_do(luaN_settable, n) }
+
+/* ADD, SUB and MUL: 'iop' on integers, 'fop' on floats */
+#define aot_arith(n,iop,fop,a,rb,rc)	{ TValue *rb_ = (rb), *rc_ = (rc); \
+  if (ttisinteger(rb_) && ttisinteger(rc_) && \
+      intfits(iop, ivalue(rb_), ivalue(rc_))) { \
+    setivalue(aot_R(a), intop(iop, ivalue(rb_), ivalue(rc_))); } \
+  else if (ttisfloat(rb_) && ttisfloat(rc_)) { \
+    setfltvalue(aot_R(a), fop(L, fltvalue(rb_), fltvalue(rc_))); } \
+  else aot_do(luaN_arith, n) }
+
+/*
+** EQ, LT and LE: 'iop' on integers, 'fop' on floats; skips the jump
+** that follows, to 't', unless the result is 'a'
+*/
+#define aot_compare(n,h,iop,fop,a,rb,rc,t)	{ \
+  TValue *rb_ = (rb), *rc_ = (rc); int r_; \
+  if (ttisinteger(rb_) && ttisinteger(rc_)) \
+    r_ = ((ivalue(rb_) iop ivalue(rc_)) == (a)); \
+  else if (ttisfloat(rb_) && ttisfloat(rc_)) \
+    r_ = (fop(fltvalue(rb_), fltvalue(rc_)) == (a)); \
+  else { r_ = h(L, code+(n)); base = ci->u.l.base; } \
+  if (!r_) goto t; }
+
+#define aot_test(a,c,t)	\
+  { if ((c) ? l_isfalse(aot_R(a)) : !l_isfalse(aot_R(a))) goto t; }
+
+#define aot_forloop(n,a,t)	{ StkId ra_ = aot_R(a); \
+  if (ttisinteger(ra_)) { \
+    lua_Integer step_ = ivalue(ra_ + 2); \
+    lua_Integer idx_ = intop(+, ivalue(ra_), step_); \
+    lua_Integer limit_ = ivalue(ra_ + 1); \
+    if ((0 < step_) ? (idx_ <= limit_) : (limit_ <= idx_)) { \
+      chgivalue(ra_, idx_); setivalue(ra_ + 3, idx_); goto t; } } \
+  else if (luaN_forloop(L, code+(n))) goto t; }
+
+/* }====================================================== */
+
+#endif
+
+#endif
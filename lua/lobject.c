@@ -36,6 +36,16 @@
 LUAI_DDEF const TValue luaO_nilobject_ = {NILCONSTANT};
 
 
+#if LUA_NANBOX
+LUAI_DDEF const lu_byte luaO_nbtag[16] = {
+  LUA_TNUMFLT, LUA_TNIL, LUA_TBOOLEAN, LUA_TLIGHTUSERDATA,
+  LUA_TNUMINT, LUA_TLCF, LUA_TDEADKEY, LUA_TNUMFLT /* not used */,
+  ctb(LUA_TSHRSTR), ctb(LUA_TLNGSTR), ctb(LUA_TTABLE), ctb(LUA_TUSERDATA),
+  ctb(LUA_TLCL), ctb(LUA_TTHREAD), ctb(LUA_TCCL), ctb(LUA_TPROTO)
+};
+#endif
+
+
 /*
 ** converts an integer to a "floating point byte", represented as
 ** (eeeeexxx), where the real value is (1xxx) * 2^(eeeee - 1) if
@@ -86,9 +96,9 @@ int luaO_ceillog2 (unsigned int x) {
 static lua_Integer intarith (lua_State *L, int op, lua_Integer v1,
                                                    lua_Integer v2) {
   switch (op) {
-    case LUA_OPADD: return intop(+, v1, v2);
-    case LUA_OPSUB:return intop(-, v1, v2);
-    case LUA_OPMUL:return intop(*, v1, v2);
+    case LUA_OPADD: return checkedintop(L, +, v1, v2);
+    case LUA_OPSUB:return checkedintop(L, -, v1, v2);
+    case LUA_OPMUL:return checkedintop(L, *, v1, v2);
     case LUA_OPMOD: return luaV_mod(L, v1, v2);
     case LUA_OPIDIV: return luaV_div(L, v1, v2);
     case LUA_OPBAND: return intop(&, v1, v2);
@@ -96,7 +106,7 @@ static lua_Integer intarith (lua_State *L, int op, lua_Integer v1,
     case LUA_OPBXOR: return intop(^, v1, v2);
     case LUA_OPSHL: return luaV_shiftl(v1, v2);
     case LUA_OPSHR: return luaV_shiftl(v1, -v2);
-    case LUA_OPUNM: return intop(-, 0, v1);
+    case LUA_OPUNM: return checkedintop(L, -, 0, v1);
     case LUA_OPBNOT: return intop(^, ~l_castS2U(0), v1);
     default: lua_assert(0); return 0;
   }
@@ -94,6 +94,8 @@ struct GCObject {
 ** an actual value plus a tag with its type.
 */
 
+#if !LUA_NANBOX
+
 /*
 ** Union of all Lua values
 */
@@ -107,7 +109,27 @@ typedef union Value {
 } Value;
 
 
-#define TValuefields	Value value_; int tt_
+/* a byte, so that a table node can keep its key next to it (see Node) */
+#define TValuefields	Value value_; lu_byte tt_
+
+#else
+
+/* the bits of a NaN-boxed value */
+typedef unsigned long long lu_nbox;
+
+/*
+** A value with its tag, as a float or as a NaN that carries both (see
+** "NaN boxing" below)
+*/
+typedef union Value {
+  lu_nbox nb;      /* all values but floats */
+  lua_Number n;    /* float numbers */
+} Value;
+
+
+#define TValuefields	Value value_
+
+#endif
 
 
 typedef struct lua_TValue {
@@ -256,8 +278,10 @@ typedef struct lua_TValue {
 
 
 
+/* field by field, so as not to overwrite the key of a table node */
 #define setobj(L,obj1,obj2) \
-	{ TValue *io1=(obj1); *io1 = *(obj2); \
+	{ TValue *io1=(obj1); const TValue *io2=(obj2); \
+	  io1->value_ = io2->value_; settt_(io1, io2->tt_); \
 	  (void)L; checkliveness(L,io1); }
 
 
@@ -279,8 +303,217 @@ typedef struct lua_TValue {
 #define setsvalue2n	setsvalue
 
 /* to table (define it as an expression to be used in macros) */
+#define setobj2t(L,o1,o2)  ((void)L, (o1)->value_ = (o2)->value_, \
+	settt_(o1, (o2)->tt_), checkliveness(L,(o1)))
+
+
+
+/*
+** {======================================================
+** NaN boxing
+** =======================================================
+*/
+
+#if LUA_NANBOX
+
+/*
+** With LUA_NANBOX a value takes 8 bytes: the bits of a double. Floats
+** are kept as they are. Any other value is a negative NaN whose top 16
+** bits are 0xFFF0 plus the index of its tag (1-15, see 'nbindex') and
+** whose low 48 bits hold the value: the 32 bits of an integer or a
+** boolean, or a pointer. A float that is a NaN is stored as the one
+** positive NaN, so that no float looks like a boxed value. Pointers must
+** fit into 48 bits, as user space addresses on x86-64 and AArch64 do.
+** The collectable types have the indices from 8 up, and the two string
+** and the two closure variants differ in a single bit, so that the
+** common tests are a single comparison.
+*/
+
+#if LUA_FLOAT_TYPE != LUA_FLOAT_DOUBLE || LUA_INT_TYPE != LUA_INT_INT
+#error "LUA_NANBOX needs 'double' floats and 'int' integers"
+#endif
+
+#define NBSHIFT		48
+#define NBPAYLOAD	((cast(lu_nbox, 1) << NBSHIFT) - 1)
+#define NBNAN		(cast(lu_nbox, 0x7FF8) << NBSHIFT)  /* canonical NaN */
+
+/* index of (non-float) tag 't'; a constant for a constant 't' */
+#define nbindex(t) \
+  ((t) == LUA_TNIL ? 1 : (t) == LUA_TBOOLEAN ? 2 : \
+   (t) == LUA_TLIGHTUSERDATA ? 3 : (t) == LUA_TNUMINT ? 4 : \
+   (t) == LUA_TLCF ? 5 : (t) == LUA_TDEADKEY ? 6 : \
+   (t) == ctb(LUA_TSHRSTR) ? 8 : (t) == ctb(LUA_TLNGSTR) ? 9 : \
+   (t) == ctb(LUA_TTABLE) ? 10 : (t) == ctb(LUA_TUSERDATA) ? 11 : \
+   (t) == ctb(LUA_TLCL) ? 12 : (t) == ctb(LUA_TTHREAD) ? 13 : \
+   (t) == ctb(LUA_TCCL) ? 14 : 15)  /* 15: prototypes */
+
+/* top 16 bits of the values with index 'x' */
+#define nbtop(x)	(0xFFF0 | (x))
+
+/* top 16 bits of 'o' */
+#define nbhigh(o)	cast_int(val_(o).nb >> NBSHIFT)
+
+/* the bits of a value with index 'x' (or tag 't') and payload 'p' */
+#define nbboxi(x,p)	((cast(lu_nbox, nbtop(x)) << NBSHIFT) | (p))
+#define nbbox(t,p)	nbboxi(nbindex(t), p)
+
+/* payload of a pointer */
+#define nbaddr(p) \
+  check_exp((cast(lu_nbox, cast(size_t, p)) & ~NBPAYLOAD) == 0, \
+            cast(lu_nbox, cast(size_t, p)))
+
+/* pointer in the payload of 'o' */
+#define nbptr(o)	cast(void *, cast(size_t, val_(o).nb & NBPAYLOAD))
+
+/* tag of each index; 0 is taken by floats */
+LUAI_DDEC const lu_byte luaO_nbtag[16];
+
+
+#undef NILCONSTANT
+#define NILCONSTANT	{nbbox(LUA_TNIL, 0)}
+
+#undef rttype
+#define rttype(o) \
+  cast_int(luaO_nbtag[nbhigh(o) > nbtop(0) ? nbhigh(o) & 0xF : 0])
+
+#undef checktag
+#define checktag(o,t)	((t) == LUA_TNUMFLT ? ttisfloat(o) : \
+                                      nbhigh(o) == nbtop(nbindex(t)))
+#undef ttisnumber
+#define ttisnumber(o)	(ttisfloat(o) || ttisinteger(o))
+#undef ttisfloat
+#define ttisfloat(o)	(val_(o).nb < nbboxi(1, 0))
+#undef ttisstring
+#define ttisstring(o)	((nbhigh(o) | 1) == nbtop(9))
+#undef ttisfunction
+#define ttisfunction(o)	(ttisclosure(o) || ttislcf(o))
+#undef ttisclosure
+#define ttisclosure(o)	((nbhigh(o) | 2) == nbtop(14))
+#undef iscollectable
+#define iscollectable(o)	(val_(o).nb >= nbboxi(8, 0))
+
+#undef ivalue
+#define ivalue(o)	check_exp(ttisinteger(o), \
+                                  l_castU2S(cast(lua_Unsigned, val_(o).nb)))
+#undef gcvalue
+#define gcvalue(o)	check_exp(iscollectable(o), cast(GCObject *, nbptr(o)))
+#undef pvalue
+#define pvalue(o)	check_exp(ttislightuserdata(o), nbptr(o))
+#undef tsvalue
+#define tsvalue(o)	check_exp(ttisstring(o), gco2ts(nbptr(o)))
+#undef uvalue
+#define uvalue(o)	check_exp(ttisfulluserdata(o), gco2u(nbptr(o)))
+#undef clvalue
+#define clvalue(o)	check_exp(ttisclosure(o), gco2cl(nbptr(o)))
+#undef clLvalue
+#define clLvalue(o)	check_exp(ttisLclosure(o), gco2lcl(nbptr(o)))
+#undef clCvalue
+#define clCvalue(o)	check_exp(ttisCclosure(o), gco2ccl(nbptr(o)))
+#undef fvalue
+#define fvalue(o)	check_exp(ttislcf(o), \
+                  cast(lua_CFunction, cast(size_t, val_(o).nb & NBPAYLOAD)))
+#undef hvalue
+#define hvalue(o)	check_exp(ttistable(o), gco2t(nbptr(o)))
+#undef bvalue
+#define bvalue(o)	check_exp(ttisboolean(o), \
+                                  cast_int(cast(unsigned int, val_(o).nb)))
+#undef thvalue
+#define thvalue(o)	check_exp(ttisthread(o), gco2th(nbptr(o)))
+#undef deadvalue
+#define deadvalue(o)	check_exp(ttisdeadkey(o), nbptr(o))
+
+/* changes the tag of a non-float value, keeping its payload */
+#undef settt_
+#define settt_(o,t)	(val_(o).nb = (val_(o).nb & NBPAYLOAD) | nbbox(t, 0))
+
+#undef setfltvalue
+#define setfltvalue(obj,x) \
+  { TValue *io=(obj); lua_Number n_=(x); \
+    if (luai_numisnan(n_)) val_(io).nb = NBNAN; else val_(io).n = n_; }
+
+#undef chgfltvalue
+#define chgfltvalue(obj,x) \
+  { lua_assert(ttisfloat(obj)); setfltvalue(obj, x); }
+
+#undef setivalue
+#define setivalue(obj,x) \
+  { TValue *io=(obj); \
+    val_(io).nb = nbbox(LUA_TNUMINT, cast(lu_nbox, l_castS2U(x))); }
+
+#undef chgivalue
+#define chgivalue(obj,x) \
+  { lua_assert(ttisinteger(obj)); setivalue(obj, x); }
+
+#undef setnilvalue
+#define setnilvalue(obj)	(val_(obj).nb = nbbox(LUA_TNIL, 0))
+
+#undef setfvalue
+#define setfvalue(obj,x) \
+  { TValue *io=(obj); val_(io).nb = nbbox(LUA_TLCF, nbaddr(x)); }
+
+#undef setpvalue
+#define setpvalue(obj,x) \
+  { TValue *io=(obj); val_(io).nb = nbbox(LUA_TLIGHTUSERDATA, nbaddr(x)); }
+
+#undef setbvalue
+#define setbvalue(obj,x) \
+  { TValue *io=(obj); \
+    val_(io).nb = nbbox(LUA_TBOOLEAN, cast(lu_nbox, cast(unsigned int, x))); }
+
+#undef setgcovalue
+#define setgcovalue(L,obj,x) \
+  { TValue *io = (obj); GCObject *i_g=(x); \
+    val_(io).nb = nbbox(ctb(i_g->tt), nbaddr(i_g)); }
+
+/* short strings have index 8 and long ones 9 */
+#undef setsvalue
+#define setsvalue(L,obj,x) \
+  { TValue *io = (obj); TString *x_ = (x); \
+    val_(io).nb = nbboxi(8 | (x_->tt >> 4), nbaddr(x_)); \
+    checkliveness(L,io); }
+
+#undef setuvalue
+#define setuvalue(L,obj,x) \
+  { TValue *io = (obj); Udata *x_ = (x); \
+    val_(io).nb = nbbox(ctb(LUA_TUSERDATA), nbaddr(x_)); \
+    checkliveness(L,io); }
+
+#undef setthvalue
+#define setthvalue(L,obj,x) \
+  { TValue *io = (obj); lua_State *x_ = (x); \
+    val_(io).nb = nbbox(ctb(LUA_TTHREAD), nbaddr(x_)); \
+    checkliveness(L,io); }
+
+#undef setclLvalue
+#define setclLvalue(L,obj,x) \
+  { TValue *io = (obj); LClosure *x_ = (x); \
+    val_(io).nb = nbbox(ctb(LUA_TLCL), nbaddr(x_)); \
+    checkliveness(L,io); }
+
+#undef setclCvalue
+#define setclCvalue(L,obj,x) \
+  { TValue *io = (obj); CClosure *x_ = (x); \
+    val_(io).nb = nbbox(ctb(LUA_TCCL), nbaddr(x_)); \
+    checkliveness(L,io); }
+
+#undef sethvalue
+#define sethvalue(L,obj,x) \
+  { TValue *io = (obj); Table *x_ = (x); \
+    val_(io).nb = nbbox(ctb(LUA_TTABLE), nbaddr(x_)); \
+    checkliveness(L,io); }
+
+#undef setobj
+#define setobj(L,obj1,obj2) \
+	{ TValue *io1=(obj1); *io1 = *(obj2); \
+	  (void)L; checkliveness(L,io1); }
+
+#undef setobj2t
 #define setobj2t(L,o1,o2)  ((void)L, *(o1)=*(o2), checkliveness(L,(o1)))
 
+#endif
+
+/* }====================================================== */
+
 
 
 
@@ -368,6 +601,8 @@ typedef union UUdata {
 #define getudatamem(u)  \
   check_exp(sizeof((u)->ttuv_), (cast(char*, (u)) + sizeof(UUdata)))
 
+#if !LUA_NANBOX
+
 #define setuservalue(L,u,o) \
 	{ const TValue *io=(o); Udata *iu = (u); \
 	  iu->user_ = io->value_; iu->ttuv_ = rttype(io); \
@@ -379,6 +614,20 @@ typedef union UUdata {
 	  io->value_ = iu->user_; settt_(io, iu->ttuv_); \
 	  checkliveness(L,io); }
 
+#else
+
+/* a boxed value carries its tag, so 'ttuv_' is not used */
+#define setuservalue(L,u,o) \
+	{ const TValue *io=(o); Udata *iu = (u); \
+	  iu->user_ = io->value_; checkliveness(L,io); }
+
+
+#define getuservalue(L,u,o) \
+	{ TValue *io=(o); const Udata *iu = (u); \
+	  io->value_ = iu->user_; checkliveness(L,io); }
+
+#endif
+
 
 /*
 ** Description of an upvalue for function prototypes
@@ -387,9 +636,20 @@ typedef struct Upvaldesc {
   TString *name;  /* upvalue name (for debug information) */
   lu_byte instack;  /* whether it is in stack (register) */
   lu_byte idx;  /* index of upvalue (in stack or in outer function's list) */
+  lu_byte kind;  /* kind of corresponding variable (while parsing) */
 } Upvaldesc;
 
 
+/*
+** Dispatch table of an OP_SWITCH: the pc to go to for each constant of
+** its chain of tests, and the one when no test succeeds
+*/
+typedef struct Switchdesc {
+  struct Table *t;
+  int miss;
+} Switchdesc;
+
+
 /*
 ** Description of a local variable for function prototypes
 ** (used for debug information)
@@ -415,6 +675,7 @@ typedef struct Proto {
   int sizelineinfo;
   int sizep;  /* size of 'p' */
   int sizelocvars;
+  int sizeswitches;
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
@@ -423,7 +684,17 @@ typedef struct Proto {
   int *lineinfo;  /* map from opcodes to source lines (debug information) */
   LocVar *locvars;  /* information about local variables (debug information) */
   Upvaldesc *upvalues;  /* upvalue information */
+  unsigned short *icache;  /* inline caches of table accesses, see luaF_newicache */
+  Switchdesc *switches;  /* dispatch tables of OP_SWITCH */
   struct LClosure *cache;  /* last-created closure with this prototype */
+#if LUA_USE_NATIVE
+  /* native code of the function, run from 'savedpc' (see lnative.c) */
+  void (*native) (struct lua_State *L, struct CallInfo *ci);
+#endif
+#if LUA_USE_JIT
+  struct JitCode *jit;  /* native code, see ljit.c */
+  int jitcount;  /* calls and loop iterations left until it is compiled */
+#endif
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
@@ -472,28 +743,61 @@ typedef union Closure {
 ** Tables
 */
 
-typedef union TKey {
-  struct {
-    TValuefields;
+/*
+** Nodes of the hash part of a table: the value, and the key packed into
+** the space the value leaves, so that a node takes 24 bytes instead of
+** 32 on 64-bit machines (see ltable.h for the access to the key)
+*/
+#if !LUA_NANBOX
+
+typedef union Node {
+  struct NodeKey {
+    TValuefields;  /* fields for value */
+    lu_byte key_tt;  /* key type */
     int next;  /* for chaining (offset for next node) */
-  } nk;
-  TValue tvk;
-} TKey;
+    Value key_val;  /* key value */
+  } u;
+  TValue i_val;  /* direct access to node's value as a proper 'TValue' */
+} Node;
 
 
-/* copy a value into a key without messing up field 'next' */
-#define setnodekey(L,key,obj) \
-	{ TKey *k_=(key); const TValue *io_=(obj); \
-	  k_->nk.value_ = io_->value_; k_->nk.tt_ = io_->tt_; \
+/* copy a value into a key */
+#define setnodekey(L,node,obj) \
+	{ Node *n_=(node); const TValue *io_=(obj); \
+	  n_->u.key_val = io_->value_; n_->u.key_tt = io_->tt_; \
 	  (void)L; checkliveness(L,io_); }
 
 
-typedef struct Node {
-  TValue i_val;
-  TKey i_key;
+/* copy a key into a value */
+#define getnodekey(L,obj,node) \
+	{ TValue *io_=(obj); const Node *n_=(node); \
+	  io_->value_ = n_->u.key_val; io_->tt_ = n_->u.key_tt; \
+	  (void)L; checkliveness(L,io_); }
+
+#else
+
+typedef union Node {
+  struct NodeKey {
+    TValuefields;  /* fields for value */
+    int next;  /* for chaining (offset for next node) */
+    TValue key_tv;  /* key, with its tag boxed in */
+  } u;
+  TValue i_val;  /* direct access to node's value as a proper 'TValue' */
 } Node;
 
 
+#define setnodekey(L,node,obj) \
+	{ Node *n_=(node); const TValue *io_=(obj); \
+	  n_->u.key_tv = *io_; (void)L; checkliveness(L,io_); }
+
+
+#define getnodekey(L,obj,node) \
+	{ TValue *io_=(obj); const Node *n_=(node); \
+	  *io_ = n_->u.key_tv; (void)L; checkliveness(L,io_); }
+
+#endif
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -34,7 +34,7 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "ADD",
   "SUB",
   "MUL",
-  //"MOD",
+  "MOD",
   "POW",
   "DIV",
   "IDIV",
@@ -65,6 +65,22 @@ LUAI_DDEF const char *const luaP_opnames[NUM_OPCODES+1] = {
   "CLOSURE",
   "VARARG",
   "EXTRAARG",
+  "MOVE_MOVE",
+  "MOVE_CALL",
+  "LOADK_CALL",
+  "GETTABUP_GETTABLE",
+  "SETTABLE_FORLOOP",
+  "ADD_FORLOOP",
+  "MUL_MUL",
+  "SWITCH",
+  "ADD_II",
+  "ADD_FF",
+  "SUB_II",
+  "SUB_FF",
+  "MUL_II",
+  "MUL_FF",
+  "LT_II",
+  "LE_II",
   NULL
 };
 
@@ -120,5 +136,46 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, OpArgU, OpArgN, iABx)		/* OP_CLOSURE */
  ,opmode(0, 1, OpArgU, OpArgN, iABC)		/* OP_VARARG */
  ,opmode(0, 0, OpArgU, OpArgU, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVE_MOVE */
+ ,opmode(0, 1, OpArgR, OpArgN, iABC)		/* OP_MOVE_CALL */
+ ,opmode(0, 1, OpArgK, OpArgN, iABx)		/* OP_LOADK_CALL */
+ ,opmode(0, 1, OpArgU, OpArgK, iABC)		/* OP_GETTABUP_GETTABLE */
+ ,opmode(0, 0, OpArgK, OpArgK, iABC)		/* OP_SETTABLE_FORLOOP */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADD_FORLOOP */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MUL_MUL */
+ ,opmode(1, 0, OpArgU, OpArgK, iABC)		/* OP_SWITCH */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADD_II */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_ADD_FF */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUB_II */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_SUB_FF */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MUL_II */
+ ,opmode(0, 1, OpArgK, OpArgK, iABC)		/* OP_MUL_FF */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LT_II */
+ ,opmode(1, 0, OpArgK, OpArgK, iABC)		/* OP_LE_II */
+};
+
+
+LUAI_DDEF const lu_byte luaP_fusedops[NUM_FUSED][2] = {
+/*  first	   second		   superinstruction	*/
+  {OP_MOVE, OP_MOVE}			/* OP_MOVE_MOVE */
+ ,{OP_MOVE, OP_CALL}			/* OP_MOVE_CALL */
+ ,{OP_LOADK, OP_CALL}			/* OP_LOADK_CALL */
+ ,{OP_GETTABUP, OP_GETTABLE}		/* OP_GETTABUP_GETTABLE */
+ ,{OP_SETTABLE, OP_FORLOOP}		/* OP_SETTABLE_FORLOOP */
+ ,{OP_ADD, OP_FORLOOP}			/* OP_ADD_FORLOOP */
+ ,{OP_MUL, OP_MUL}			/* OP_MUL_MUL */
+};
+
+
+LUAI_DDEF const lu_byte luaP_quickops[NUM_OPCODES - FIRST_QUICK] = {
+/*  generic		   quickened	*/
+  OP_ADD		/* OP_ADD_II */
+ ,OP_ADD		/* OP_ADD_FF */
+ ,OP_SUB		/* OP_SUB_II */
+ ,OP_SUB		/* OP_SUB_FF */
+ ,OP_MUL		/* OP_MUL_II */
+ ,OP_MUL		/* OP_MUL_FF */
+ ,OP_LT			/* OP_LT_II */
+ ,OP_LE			/* OP_LE_II */
 };
 
@@ -228,11 +228,38 @@ OP_CLOSURE,/*	A Bx	R(A) := closure(KPROTO[Bx])			*/
 
 OP_VARARG,/*	A B	R(A), R(A+1), ..., R(A+B-2) = vararg		*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* superinstructions: the first opcode, then the next instruction (see luaK_fuse) */
+OP_MOVE_MOVE,/*	A B	R(A) := R(B); next MOVE				*/
+OP_MOVE_CALL,/*	A B	R(A) := R(B); next CALL				*/
+OP_LOADK_CALL,/*	A Bx	R(A) := Kst(Bx); next CALL			*/
+OP_GETTABUP_GETTABLE,/*	A B C	R(A) := UpValue[B][RK(C)]; next GETTABLE	*/
+OP_SETTABLE_FORLOOP,/*	A B C	R(A)[RK(B)] := RK(C); next FORLOOP		*/
+OP_ADD_FORLOOP,/*	A B C	R(A) := RK(B) + RK(C); next FORLOOP		*/
+OP_MUL_MUL,/*	A B C	R(A) := RK(B) * RK(C); next MUL			*/
+
+/* added after the ones above, so that those keep their numbers in binary chunks */
+OP_SWITCH,/*	A B C	if (R(A) == RK(C)) then pc++ else ... (see note) */
+
+/* quickened instructions: the opcode for the operand types seen last time */
+OP_ADD_II,/*	A B C	R(A) := RK(B) + RK(C), both integers		*/
+OP_ADD_FF,/*	A B C	R(A) := RK(B) + RK(C), both floats		*/
+OP_SUB_II,/*	A B C	R(A) := RK(B) - RK(C), both integers		*/
+OP_SUB_FF,/*	A B C	R(A) := RK(B) - RK(C), both floats		*/
+OP_MUL_II,/*	A B C	R(A) := RK(B) * RK(C), both integers		*/
+OP_MUL_FF,/*	A B C	R(A) := RK(B) * RK(C), both floats		*/
+OP_LT_II,/*	A B C	if ((RK(B) <  RK(C)) ~= A) then pc++, both integers */
+OP_LE_II/*	A B C	if ((RK(B) <= RK(C)) ~= A) then pc++, both integers */
 } OpCode;
 
 
-#define NUM_OPCODES	(cast(int, OP_EXTRAARG) + 1)
+#define NUM_OPCODES	(cast(int, OP_LE_II) + 1)
+
+#define FIRST_FUSED	OP_MOVE_MOVE
+#define NUM_FUSED	(cast(int, OP_MUL_MUL) - FIRST_FUSED + 1)
+
+#define FIRST_QUICK	OP_ADD_II
 
 
 
@@ -257,6 +284,24 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
+  (*) OP_SWITCH starts a chain of EQ tests of R(A) against integer and
+  string constants, each one followed by the jump to the next test taken
+  when it fails (OP_SWITCH is the first test, with the constant in C). It
+  goes straight to the code after the test that succeeds, or to where
+  the last jump goes, through dispatch table B of the function (see
+  'luaF_newswitches').
+
+  (*) A superinstruction does what its first opcode does and then goes
+  straight on to the next instruction, which has to be the second opcode
+  (or a superinstruction starting with it). The next instruction is left
+  as it is, so it can still be a jump target.
+
+  (*) The VM rewrites ADD, SUB, MUL, LT and LE in place to the quickened
+  opcode for the operand types they see. A quickened instruction checks
+  its types and goes back to the generic opcode when they do not match.
+  Quickened opcodes only exist in running code: they are not generated,
+  not dumped and not accepted in precompiled chunks.
+
 ===========================================================================*/
 
 
@@ -285,6 +330,21 @@ LUAI_DDEC const lu_byte luaP_opmodes[NUM_OPCODES];
 #define testTMode(m)	(luaP_opmodes[m] & (1 << 7))
 
 
+/* the first and the second opcode of each superinstruction */
+LUAI_DDEC const lu_byte luaP_fusedops[NUM_FUSED][2];
+
+/* the generic opcode of each quickened opcode */
+LUAI_DDEC const lu_byte luaP_quickops[NUM_OPCODES - FIRST_QUICK];
+
+#define isFused(m)	((m) >= FIRST_FUSED && (m) < FIRST_FUSED + NUM_FUSED)
+#define isQuick(m)	((m) >= FIRST_QUICK)
+#define getBaseOp(m)	(isFused(m) ? \
+	cast(OpCode, luaP_fusedops[(m) - FIRST_FUSED][0]) : \
+	isQuick(m) ? cast(OpCode, luaP_quickops[(m) - FIRST_QUICK]) : \
+	cast(OpCode, (m)))
+#define getFusedNext(m)	(cast(OpCode, luaP_fusedops[(m) - FIRST_FUSED][1]))
+
+
 LUAI_DDEC const char *const luaP_opnames[NUM_OPCODES+1];  /* opcode names */
 
 
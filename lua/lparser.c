@@ -34,6 +34,12 @@
 #define MAXVARS		200
 
 
+/* minimum number of tests of a local in an 'if' that make an OP_SWITCH */
+#if !defined(LUAI_MINSWITCH)
+#define LUAI_MINSWITCH		4
+#endif
+
+
 #define hasmultret(k)		((k) == VCALL || (k) == VVARARG)
 
 
@@ -172,15 +178,23 @@ static int registerlocalvar (LexState *ls, TString *varname) {
 }
 
 
-static void new_localvar (LexState *ls, TString *name) {
+/*
+** Create a new local variable; return its index in 'actvar.arr'.
+*/
+static int new_localvar (LexState *ls, TString *name) {
   FuncState *fs = ls->fs;
   Dyndata *dyd = ls->dyd;
+  Vardesc *var;
   int reg = registerlocalvar(ls, name);
   checklimit(fs, dyd->actvar.n + 1 - fs->firstlocal,
                   MAXVARS, "local variables");
   luaM_growvector(ls->L, dyd->actvar.arr, dyd->actvar.n + 1,
                   dyd->actvar.size, Vardesc, MAX_INT, "local variables");
-  dyd->actvar.arr[dyd->actvar.n++].idx = cast(short, reg);
+  var = &dyd->actvar.arr[dyd->actvar.n];
+  var->idx = cast(short, reg);
+  var->name = name;
+  var->kind = VDKREG;  /* default */
+  return dyd->actvar.n++;
 }
 
 
@@ -192,6 +206,11 @@ static void new_localvarliteral_ (LexState *ls, const char *name, size_t sz) {
 	new_localvarliteral_(ls, "" v, (sizeof(v)/sizeof(char))-1)
 
 
+static Vardesc *getlocalvardesc (FuncState *fs, int i) {
+  return &fs->ls->dyd->actvar.arr[fs->firstlocal + i];
+}
+
+
 static LocVar *getlocvar (FuncState *fs, int i) {
   int idx = fs->ls->dyd->actvar.arr[fs->firstlocal + i].idx;
   lua_assert(idx < fs->nlocvars);
@@ -208,10 +227,27 @@ static void adjustlocalvars (LexState *ls, int nvars) {
 }
 
 
+/*
+** An inlinable function whose every call was inlined needs no closure.
+*/
+static void dropclosure (FuncState *fs, Vardesc *var) {
+  Inline *in = &fs->ls->dyd->inl.arr[ivalue(&var->k)];
+  if (!in->used) {
+    Instruction *i = &fs->f->code[in->pc];
+    lua_assert(GET_OPCODE(*i) == OP_CLOSURE);
+    *i = CREATE_ABC(OP_LOADNIL, GETARG_A(*i), 0, 0);
+  }
+}
+
+
 static void removevars (FuncState *fs, int tolevel) {
   fs->ls->dyd->actvar.n -= (fs->nactvar - tolevel);
-  while (fs->nactvar > tolevel)
-    getlocvar(fs, --fs->nactvar)->endpc = fs->pc;
+  while (fs->nactvar > tolevel) {
+    Vardesc *var = getlocalvardesc(fs, --fs->nactvar);
+    if (var->kind == RDKINL)
+      dropclosure(fs, var);
+    getlocvar(fs, fs->nactvar)->endpc = fs->pc;
+  }
 }
 
 
@@ -235,6 +271,12 @@ static int newupvalue (FuncState *fs, TString *name, expdesc *v) {
     f->upvalues[oldsize++].name = NULL;
   f->upvalues[fs->nups].instack = (v->k == VLOCAL);
   f->upvalues[fs->nups].idx = cast_byte(v->u.info);
+  if (fs->prev == NULL)  /* environment of the main function? */
+    f->upvalues[fs->nups].kind = VDKREG;
+  else if (v->k == VLOCAL)
+    f->upvalues[fs->nups].kind = getlocalvardesc(fs->prev, v->u.info)->kind;
+  else
+    f->upvalues[fs->nups].kind = fs->prev->f->upvalues[v->u.info].kind;
   f->upvalues[fs->nups].name = name;
   luaC_objbarrier(fs->ls->L, f, name);
   return fs->nups++;
@@ -251,6 +293,47 @@ static int searchvar (FuncState *fs, TString *n) {
 }
 
 
+/*
+** Variable that name 'n' refers to in 'fs': its index in 'actvar.arr',
+** or -1 for a global.
+*/
+static int varid (FuncState *fs, TString *n) {
+  for (; fs != NULL; fs = fs->prev) {
+    int v = searchvar(fs, n);
+    if (v >= 0)
+      return fs->firstlocal + v;
+  }
+  return -1;
+}
+
+
+static void addfreevar (LexState *ls, TString *n, int id) {
+  Dyndata *dyd = ls->dyd;
+  luaM_growvector(ls->L, dyd->freevar.arr, dyd->freevar.n,
+                  dyd->freevar.size, Freevar, MAX_INT, "names");
+  dyd->freevar.arr[dyd->freevar.n].name = n;
+  dyd->freevar.arr[dyd->freevar.n++].id = id;
+}
+
+
+/*
+** While the body of a function that may be inlinable is read, keep
+** what each name it does not declare refers to where it is defined;
+** its calls are inlined only where all these names refer to the same
+** (see 'findinline').
+*/
+static void freename (LexState *ls, TString *n) {
+  FuncState *fs = ls->fs;
+  int id;
+  if (fs->prev != ls->dyd->tok.fs || searchvar(fs, n) >= 0)
+    return;  /* in a nested function (not inlinable) or its own local */
+  id = varid(fs->prev, n);
+  addfreevar(ls, n, id);
+  if (id < 0)  /* a global also depends on the environment */
+    addfreevar(ls, ls->envn, varid(fs->prev, ls->envn));
+}
+
+
 /*
   Mark block where variable at given level was defined
   (to emit close instructions later).
@@ -265,7 +348,8 @@ static void markupval (FuncState *fs, int level) {
 
 /*
   Find variable with given name 'n'. If it is an upvalue, add this
-  upvalue into all intermediate functions.
+  upvalue into all intermediate functions. A compile-time constant
+  needs no upvalue: its uses are its value.
 */
 static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
   if (fs == NULL)  /* no more levels? */
@@ -273,16 +357,23 @@ static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
   else {
     int v = searchvar(fs, n);  /* look up locals at current level */
     if (v >= 0) {  /* found? */
-      init_exp(var, VLOCAL, v);  /* variable is local */
-      if (!base)
-        markupval(fs, v);  /* local will be used as an upval */
+      Vardesc *vd = getlocalvardesc(fs, v);
+      if (vd->kind == RDKCTC)  /* compile-time constant? */
+        init_exp(var, VCONST, fs->firstlocal + v);
+      else {
+        if (vd->kind == RDKINL)  /* needs its closure after all */
+          fs->ls->dyd->inl.arr[ivalue(&vd->k)].used = 1;
+        init_exp(var, VLOCAL, v);  /* variable is local */
+        if (!base)
+          markupval(fs, v);  /* local will be used as an upval */
+      }
     }
     else {  /* not found as local at current level; try upvalues */
       int idx = searchupvalue(fs, n);  /* try existing upvalues */
       if (idx < 0) {  /* not found? */
         singlevaraux(fs->prev, n, var, 0);  /* try upper levels */
-        if (var->k == VVOID)  /* not found? */
-          return;  /* it is a global */
+        if (var->k == VVOID || var->k == VCONST)  /* global or constant? */
+          return;
         /* else was LOCAL or UPVAL */
         idx  = newupvalue(fs, n, var);  /* will be a new upvalue */
       }
@@ -295,6 +386,8 @@ static void singlevaraux (FuncState *fs, TString *n, expdesc *var, int base) {
 static void singlevar (LexState *ls, expdesc *var) {
   TString *varname = str_checkname(ls);
   FuncState *fs = ls->fs;
+  if (ls->dyd->tok.fs != NULL)
+    freename(ls, varname);
   singlevaraux(fs, varname, var, 1);
   if (var->k == VVOID) {  /* global name? */
     expdesc key;
@@ -553,6 +646,7 @@ static void close_func (LexState *ls) {
   Proto *f = fs->f;
   luaK_ret(fs, 0, 0);  /* final return */
   leaveblock(fs);
+  luaK_fuse(fs);
   luaM_reallocvector(L, f->code, f->sizecode, fs->pc, Instruction);
   f->sizecode = fs->pc;
   luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, fs->pc, int);
@@ -565,6 +659,8 @@ static void close_func (LexState *ls) {
   f->sizelocvars = fs->nlocvars;
   luaM_reallocvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
   f->sizeupvalues = fs->nups;
+  luaF_newicache(L, f);
+  luaF_newswitches(L, f);
   lua_assert(fs->bl == NULL);
   ls->fs = fs->prev;
   luaC_checkGC(L);
@@ -888,12 +984,134 @@ static void primaryexp (LexState *ls, expdesc *v) {
 }
 
 
-static void suffixedexp (LexState *ls, expdesc *v) {
+/*
+** The inlinable function that name 'n' refers to, if its free names
+** refer here to what they did in it and there are registers enough for
+** it; its index in 'inl', or -1.
+*/
+static int findinline (LexState *ls, TString *n) {
+  FuncState *fs = ls->fs;
+  Dyndata *dyd = ls->dyd;
+  Vardesc *var;
+  Inline *in;
+  int id, i;
+  if (dyd->inl.n == 0 || (id = varid(fs, n)) < 0)
+    return -1;
+  var = &dyd->actvar.arr[id];
+  if (var->kind != RDKINL)
+    return -1;
+  in = &dyd->inl.arr[ivalue(&var->k)];
+  if (fs->freereg + in->maxstack >= MAXVARS)
+    return -1;
+  for (i = 0; i < in->nfree; i++) {
+    Freevar *fv = &dyd->freevar.arr[in->free + i];
+    if (varid(fs, fv->name) != fv->id)
+      return -1;
+  }
+  return ivalue(&var->k);
+}
+
+
+static void reversevars (Vardesc *a, int from, int to) {
+  for (; from < to; from++, to--) {
+    Vardesc t = a[from];
+    a[from] = a[to];
+    a[to] = t;
+  }
+}
+
+
+/*
+** Move the variables declared from 'first' on, but not active yet (such
+** as the 'u' of 'local u = f(x)'), after the 'n' ones declared last.
+*/
+static void pendingvars (Dyndata *dyd, int first, int n) {
+  int last = dyd->actvar.n - 1;
+  reversevars(dyd->actvar.arr, first, last - n);
+  reversevars(dyd->actvar.arr, last - n + 1, last);
+  reversevars(dyd->actvar.arr, first, last);
+}
+
+
+/*
+** Call 'v' of inlinable function 'inl', after its '(': the arguments go
+** to the registers of its parameters, declared as locals above the
+** registers in use, and its expression is compiled again from its
+** tokens, in their scope, with its result left in the first of them.
+** Variables still pending in the statement of the call are kept after
+** these locals meanwhile. Inlined code gets the line of the call.
+*/
+static void inlinecall (LexState *ls, expdesc *v, int inl, int line) {
+  FuncState *fs = ls->fs;
+  Dyndata *dyd = ls->dyd;
+  int nactvar = fs->nactvar;
+  int base = fs->freereg;
+  int first = fs->firstlocal + nactvar;  /* first pending variable */
+  int npending, nparams, nargs, i;
+  const Token *tok;
+  const Token *replay;
+  Token next;
+  int linenumber, lastline;
+  expdesc args;
+  if (ls->t.token == ')')  /* arg list is empty? */
+    args.k = VVOID, nargs = 0;
+  else
+    nargs = explist(ls, &args);
+  check_match(ls, ')', '(', line);
+  nparams = dyd->inl.arr[inl].nparams;  /* arguments may move the arrays */
+  tok = dyd->tok.arr + dyd->inl.arr[inl].tok;
+  adjust_assign(ls, nparams, nargs, &args);
+  fs->freereg = base + nparams;  /* drop extra arguments */
+  npending = dyd->actvar.n - first;
+  for (i = nactvar; i < base; i++)
+    new_localvarliteral(ls, "(*temporary)");
+  for (i = 0; i < nparams; i++)
+    new_localvar(ls, tok[i].seminfo.ts);
+  pendingvars(dyd, first, base - nactvar + nparams);
+  adjustlocalvars(ls, base - nactvar + nparams);
+  lua_assert(ls->lookahead.token == TK_EOS);
+  next = ls->t;
+  replay = ls->replay;  /* inlined calls may nest */
+  linenumber = ls->linenumber;
+  lastline = ls->lastline;
+  ls->replay = tok + nparams;
+  ls->linenumber = line;
+  luaX_next(ls);
+  expr(ls, v);
+  check(ls, TK_EOS);
+  ls->replay = replay;
+  ls->t = next;
+  ls->linenumber = linenumber;
+  ls->lastline = lastline;
+  luaK_exp2reg(fs, v, base);
+  i = fs->nactvar - nactvar;  /* number of locals of the call */
+  removevars(fs, nactvar);
+  memmove(dyd->actvar.arr + first, dyd->actvar.arr + first + i,
+          npending * sizeof(Vardesc));
+  fs->freereg = base;
+  luaK_reserveregs(fs, 1);
+}
+
+
+static int suffixedexp (LexState *ls, expdesc *v) {
   /* suffixedexp ->
        primaryexp { '.' NAME | '[' exp ']' | ':' NAME funcargs | funcargs } */
   FuncState *fs = ls->fs;
   int line = ls->linenumber;
-  primaryexp(ls, v);
+  int inlined = 0;  /* is 'v' an inlined call? */
+  int inl = (ls->t.token == TK_NAME) ? findinline(ls, ls->t.seminfo.ts) : -1;
+  if (inl >= 0 && ls->lookahead.token == TK_EOS)  /* none yet? ('field') */
+    luaX_lookahead(ls);
+  if (inl >= 0 && ls->lookahead.token == '(') {
+    if (ls->dyd->tok.fs != NULL)
+      freename(ls, ls->t.seminfo.ts);
+    luaX_next(ls);  /* skip NAME */
+    luaX_next(ls);  /* skip '(' */
+    inlinecall(ls, v, inl, line);
+    inlined = 1;
+  }
+  else
+    primaryexp(ls, v);
   for (;;) {
     switch (ls->t.token) {
       case '.': {  /* fieldsel */
@@ -920,8 +1138,9 @@ static void suffixedexp (LexState *ls, expdesc *v) {
         funcargs(ls, v, line);
         break;
       }
-      default: return;
+      default: return inlined;
     }
+    inlined = 0;
   }
 }
 
@@ -1143,9 +1362,41 @@ static void check_conflict (LexState *ls, struct LHS_assign *lh, expdesc *v) {
 }
 
 
+/*
+** Raise an error if variable 'e' is a constant.
+*/
+static void check_readonly (LexState *ls, expdesc *e) {
+  FuncState *fs = ls->fs;
+  TString *varname = NULL;
+  switch (e->k) {
+    case VCONST: {
+      varname = ls->dyd->actvar.arr[e->u.info].name;
+      break;
+    }
+    case VLOCAL: {
+      Vardesc *var = getlocalvardesc(fs, e->u.info);
+      if (var->kind != VDKREG)
+        varname = var->name;
+      break;
+    }
+    case VUPVAL: {
+      Upvaldesc *up = &fs->f->upvalues[e->u.info];
+      if (up->kind != VDKREG)
+        varname = up->name;
+      break;
+    }
+    default: break;  /* other cases cannot be read-only */
+  }
+  if (varname)
+    semerror(ls, luaO_pushfstring(ls->L,
+                 "attempt to assign to const variable '%s'", getstr(varname)));
+}
+
+
 static void assignment (LexState *ls, struct LHS_assign *lh, int nvars) {
   expdesc e;
   check_condition(ls, vkisvar(lh->v.k), "syntax error");
+  check_readonly(ls, &lh->v);
   if (testnext(ls, ',')) {  /* assignment -> ',' suffixedexp assignment */
     struct LHS_assign nv;
     nv.prev = lh;
@@ -1381,49 +1632,194 @@ static void forstat (LexState *ls, int line) {
 }
 
 
-static void test_then_block (LexState *ls, int *escapelist) {
+/*
+** Code of a branch that never runs. It is parsed as usual and then
+** dropped, unless a 'goto' or 'break' in it is still pending (then it
+** stays, skipped by a jump).
+*/
+typedef struct DeadCode {
+  int pc;  /* where the dead code starts */
+  int ngt;  /* number of pending gotos before it */
+  short nlocvars;  /* number of local variables before it */
+} DeadCode;
+
+
+static void enterdead (FuncState *fs, DeadCode *dc) {
+  dc->pc = luaK_markcode(fs);
+  dc->ngt = fs->ls->dyd->gt.n;
+  dc->nlocvars = fs->nlocvars;
+}
+
+
+/* drop the dead code if possible; return whether it was dropped */
+static int leavedead (FuncState *fs, DeadCode *dc) {
+  if (fs->ls->dyd->gt.n != dc->ngt)  /* a 'goto' leaves it? */
+    return 0;
+  luaK_dropcode(fs, dc->pc);
+  fs->nlocvars = dc->nlocvars;  /* its variables are gone too */
+  return 1;
+}
+
+
+/*
+** Value of a condition that folded to a constant (0 or 1), or -1
+*/
+static int constcond (FuncState *fs, expdesc *e) {
+  luaK_dischargevars(fs, e);
+  if (e->t != NO_JUMP || e->f != NO_JUMP)
+    return -1;
+  switch (e->k) {
+    case VNIL: case VFALSE: return 0;
+    case VTRUE: case VK: case VKFLT: case VKINT: return 1;
+    default: return -1;
+  }
+}
+
+
+/*
+** If the condition 'v', coded from 'start' on, is nothing but an equality
+** of a local variable and an integer or string constant, the register of
+** the variable; -1 otherwise
+*/
+static int switchtest (FuncState *fs, expdesc *v, int start) {
+  Instruction i;
+  int b, c;
+  if (v->k != VJMP || v->t != NO_JUMP || v->f != NO_JUMP ||
+      v->u.info != start + 1 || fs->pc != start + 2)
+    return -1;
+  i = fs->f->code[start];
+  if (GET_OPCODE(i) != OP_EQ || GETARG_A(i) != 1)  /* not '==' */
+    return -1;
+  b = GETARG_B(i);
+  c = GETARG_C(i);
+  if (ISK(b)) {  /* constant first? */
+    int t = b; b = c; c = t;
+  }
+  if (ISK(b) || b >= fs->nactvar || !ISK(c) ||
+      !(ttisinteger(&fs->f->k[INDEXK(c)]) ||
+        ttisstring(&fs->f->k[INDEXK(c)])))
+    return -1;
+  return b;
+}
+
+
+/*
+** Returns 1 if the branch is always taken; the code of the following
+** branches is then up to the caller. Sets 'test' to the pc of the
+** condition if it can be a test of an OP_SWITCH (see 'switchtest'),
+** NO_JUMP otherwise.
+*/
+static int test_then_block (LexState *ls, int *escapelist, int *test) {
   /* test_then_block -> [IF | ELSEIF] cond THEN block */
   BlockCnt bl;
   FuncState *fs = ls->fs;
   expdesc v;
   int jf;  /* instruction to skip 'then' code (if condition is false) */
+  int c;  /* constant value of the condition */
+  int start;  /* pc of the condition */
   luaX_next(ls);  /* skip IF or ELSEIF */
+  start = fs->pc;
   expr(ls, &v);  /* read condition */
   checknext(ls, TK_THEN);
-  if (ls->t.token == TK_GOTO || ls->t.token == TK_BREAK) {
+  *test = NO_JUMP;
+  c = constcond(fs, &v);
+  if (c == 0) {  /* branch never taken? */
+    DeadCode dc;
+    enterdead(fs, &dc);
+    jf = luaK_jump(fs);  /* skips the block if it has to stay */
+    block(ls);
+    if (!leavedead(fs, &dc))
+      luaK_patchtohere(fs, jf);
+    return 0;
+  }
+  else if (c < 0 && (ls->t.token == TK_GOTO || ls->t.token == TK_BREAK)) {
     luaK_goiffalse(ls->fs, &v);  /* will jump to label if condition is true */
     enterblock(fs, &bl, 0);  /* must enter block before 'goto' */
     gotostat(ls, v.t);  /* handle goto/break */
     skipnoopstat(ls);  /* skip other no-op statements */
     if (block_follow(ls, 0)) {  /* 'goto' is the entire block? */
       leaveblock(fs);
-      return;  /* and that is it */
+      return 0;  /* and that is it */
     }
     else  /* must skip over 'then' part if condition is false */
       jf = luaK_jump(fs);
   }
   else {  /* regular case (not goto/break) */
+    if (switchtest(fs, &v, start) >= 0)
+      *test = start;
     luaK_goiftrue(ls->fs, &v);  /* skip over block if condition is false */
     enterblock(fs, &bl, 0);
     jf = v.f;
   }
   statlist(ls);  /* 'then' part */
   leaveblock(fs);
+  if (c == 1)  /* always taken? */
+    return 1;
   if (ls->t.token == TK_ELSE ||
       ls->t.token == TK_ELSEIF)  /* followed by 'else'/'elseif'? */
     luaK_concat(fs, escapelist, luaK_jump(fs));  /* must jump over it */
   luaK_patchtohere(fs, jf);
+  return 0;
 }
 
 
+/*
+** Branches after one that is always taken never run.
+*/
+static void deadbranches (LexState *ls, int *escapelist) {
+  FuncState *fs = ls->fs;
+  DeadCode dc;
+  int deadlist;  /* exit list of the dead branches */
+  int test;
+  enterdead(fs, &dc);
+  deadlist = luaK_jump(fs);  /* taken branch jumps over them if they stay */
+  while (ls->t.token == TK_ELSEIF)
+    test_then_block(ls, &deadlist, &test);
+  if (testnext(ls, TK_ELSE))
+    block(ls);
+  if (!leavedead(fs, &dc))
+    luaK_concat(fs, escapelist, deadlist);
+}
+
+
+/* the register that the equality at 'pc' tests (see 'switchtest') */
+static int testreg (FuncState *fs, int pc) {
+  Instruction i = fs->f->code[pc];
+  return ISK(GETARG_B(i)) ? GETARG_C(i) : GETARG_B(i);
+}
+
+
+/*
+** An 'if' whose first branches test the same local variable against
+** constants gets an OP_SWITCH in place of its first equality, which
+** goes straight to the right branch. The other tests and all jumps stay
+** as they are: they are what 'luaF_newswitches' builds the dispatch
+** table from.
+*/
 static void ifstat (LexState *ls, int line) {
   /* ifstat -> IF cond THEN block {ELSEIF cond THEN block} [ELSE block] END */
   FuncState *fs = ls->fs;
   int escapelist = NO_JUMP;  /* exit list for finished parts */
-  test_then_block(ls, &escapelist);  /* IF cond THEN block */
-  while (ls->t.token == TK_ELSEIF)
-    test_then_block(ls, &escapelist);  /* ELSEIF cond THEN block */
-  if (testnext(ls, TK_ELSE))
+  int head, test;  /* pcs of the first test and of the last one */
+  int chain;  /* true while branches test the local of the first one */
+  int ntests;  /* number of those leading tests */
+  int taken = test_then_block(ls, &escapelist, &head);  /* IF cond THEN block */
+  ntests = chain = (head != NO_JUMP);
+  while (!taken && ls->t.token == TK_ELSEIF) {
+    taken = test_then_block(ls, &escapelist, &test);  /* ELSEIF cond THEN block */
+    chain = chain && test != NO_JUMP && testreg(fs, test) == testreg(fs, head);
+    ntests += chain;
+  }
+  if (ntests >= LUAI_MINSWITCH) {
+    Instruction i = fs->f->code[head];
+    int key = ISK(GETARG_B(i)) ? GETARG_B(i) : GETARG_C(i);
+    fs->f->code[head] = CREATE_ABC(OP_SWITCH, testreg(fs, head), 0, key);
+  }
+  if (taken) {
+    if (ls->t.token == TK_ELSE || ls->t.token == TK_ELSEIF)
+      deadbranches(ls, &escapelist);
+  }
+  else if (testnext(ls, TK_ELSE))
     block(ls);  /* 'else' part */
   check_match(ls, TK_END, TK_IF, line);
   luaK_patchtohere(fs, escapelist);  /* patch escape list to 'if' end */
@@ -1441,21 +1837,163 @@ static void localfunc (LexState *ls) {
 }
 
 
+static int getlocalattribute (LexState *ls) {
+  /* ATTRIB -> ['<' NAME '>'] */
+  if (testnext(ls, '<')) {
+    const char *attr = getstr(str_checkname(ls));
+    checknext(ls, '>');
+    if (strcmp(attr, "const") == 0)
+      return RDKCONST;  /* read-only variable */
+    else
+      semerror(ls,
+        luaO_pushfstring(ls->L, "unknown attribute '%s'", attr));
+  }
+  return VDKREG;  /* regular variable */
+}
+
+
+/*
+** Whether 'e' is a closure of a function that can be inlined: a fixed
+** number of parameters, no nested functions, and a small body that
+** only returns one value (the parser checks its tokens next).
+*/
+static int inlinableproto (FuncState *fs, expdesc *e) {
+  Instruction i = fs->f->code[fs->pc - 1];  /* 'codeclosure' */
+  Proto *p;
+  int pc;
+  if (e->k != VNONRELOC || GET_OPCODE(i) != OP_CLOSURE ||
+      GETARG_A(i) != e->u.info)
+    return 0;
+  p = fs->f->p[GETARG_Bx(i)];
+  if (p->is_vararg || p->sizep > 0 || p->sizecode - 2 > LUAI_MAXINLINE)
+    return 0;
+  i = p->code[p->sizecode - 2];
+  if (GET_OPCODE(i) != OP_RETURN || GETARG_B(i) != 2)
+    return 0;
+  for (pc = 0; pc < p->sizecode - 2; pc++) {
+    OpCode op = GET_OPCODE(p->code[pc]);
+    if (op == OP_RETURN || op == OP_TAILCALL)
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Keep only the parameter names and the returned expression of the
+** tokens read from 'first', which must be those of a body
+** '(' [NAME {',' NAME}] ')' RETURN exp [';'] END, with a TK_EOS after
+** them. Returns the number of parameters, or -1 if the tokens do not
+** have this form.
+*/
+static int inlinetokens (Dyndata *dyd, int first) {
+  Token *t = dyd->tok.arr + first;
+  int n = dyd->tok.n - first;
+  int np = 0, i = 1, j;
+  if (n < 1 || t[0].token != '(')
+    return -1;
+  if (i < n && t[i].token == TK_NAME) {
+    for (;;) {
+      t[np++] = t[i++];
+      if (i + 1 < n && t[i].token == ',' && t[i + 1].token == TK_NAME)
+        i++;
+      else break;
+    }
+  }
+  if (i + 1 >= n || t[i].token != ')' || t[i + 1].token != TK_RETURN)
+    return -1;
+  i += 2;
+  for (j = i; j < n && t[j].token != ';' && t[j].token != TK_END; j++) ;
+  if (j == i || j == n)
+    return -1;
+  memmove(t + np, t + i, (j - i) * sizeof(Token));
+  t[np + j - i].token = TK_EOS;
+  dyd->tok.n = first + np + j - i + 1;
+  return np;
+}
+
+
+/*
+** Ends reading a function that may be inlinable, which began at token
+** 'first' and name 'firstfree'; returns its index in 'inl', or -1.
+*/
+static int newinline (LexState *ls, int first, int firstfree,
+                      int nexps, expdesc *e) {
+  FuncState *fs = ls->fs;
+  Dyndata *dyd = ls->dyd;
+  int complete = (dyd->tok.fs != NULL);  /* not too long? */
+  int nparams;
+  Inline *in;
+  dyd->tok.fs = NULL;  /* stop keeping tokens */
+  if (!complete || nexps != 1 || !inlinableproto(fs, e) ||
+      (nparams = inlinetokens(dyd, first)) < 0) {
+    dyd->tok.n = first;
+    dyd->freevar.n = firstfree;
+    return -1;
+  }
+  luaM_growvector(ls->L, dyd->inl.arr, dyd->inl.n, dyd->inl.size,
+                  Inline, MAX_INT, "inlinable functions");
+  in = &dyd->inl.arr[dyd->inl.n];
+  in->tok = first;
+  in->nparams = nparams;
+  in->free = firstfree;
+  in->nfree = dyd->freevar.n - firstfree;
+  in->pc = fs->pc - 1;
+  in->maxstack = fs->f->p[GETARG_Bx(fs->f->code[in->pc])]->maxstacksize;
+  in->used = 0;
+  return dyd->inl.n++;
+}
+
+
+/*
+** A constant initialized with a compile-time constant value (the last
+** variable of the list, with its own expression) is replaced by that
+** value wherever it is used. It still gets its register and initial
+** value, so that registers keep matching active variables.
+** A single constant initialized with a function that only returns an
+** expression has its calls inlined ('<const>' ensures they call that
+** function; it cannot call itself, as it is out of its own scope).
+*/
 static void localstat (LexState *ls) {
-  /* stat -> LOCAL NAME {',' NAME} ['=' explist] */
+  /* stat -> LOCAL NAME ATTRIB {',' NAME ATTRIB} ['=' explist] */
+  FuncState *fs = ls->fs;
+  Dyndata *dyd = ls->dyd;
+  Vardesc *var;  /* last variable */
+  int vidx;  /* index of last variable */
   int nvars = 0;
   int nexps;
+  int inl = -1;
   expdesc e;
   do {
-    new_localvar(ls, str_checkname(ls));
+    vidx = new_localvar(ls, str_checkname(ls));
+    dyd->actvar.arr[vidx].kind = cast_byte(getlocalattribute(ls));
     nvars++;
   } while (testnext(ls, ','));
-  if (testnext(ls, '='))
-    nexps = explist(ls, &e);
+  if (testnext(ls, '=')) {
+    if (nvars == 1 && dyd->actvar.arr[vidx].kind == RDKCONST &&
+        ls->t.token == TK_FUNCTION && dyd->tok.fs == NULL) {
+      int first = dyd->tok.n;
+      int firstfree = dyd->freevar.n;
+      dyd->tok.first = first;
+      dyd->tok.fs = fs;  /* keep the tokens of the function */
+      nexps = explist(ls, &e);
+      inl = newinline(ls, first, firstfree, nexps, &e);
+    }
+    else
+      nexps = explist(ls, &e);
+  }
   else {
     e.k = VVOID;
     nexps = 0;
   }
+  var = &dyd->actvar.arr[vidx];  /* 'explist' may move the array */
+  if (nvars == nexps && var->kind == RDKCONST &&
+      luaK_exp2const(fs, &e, &var->k))
+    var->kind = RDKCTC;  /* variable is a compile-time constant */
+  else if (inl >= 0) {
+    var->kind = RDKINL;
+    setivalue(&var->k, inl);
+  }
   adjust_assign(ls, nvars, nexps, &e);
   adjustlocalvars(ls, nvars);
 }
@@ -1481,6 +2019,7 @@ static void funcstat (LexState *ls, int line) {
   expdesc v, b;
   luaX_next(ls);  /* skip FUNCTION */
   ismethod = funcname(ls, &v);
+  check_readonly(ls, &v);
   body(ls, &b, ismethod, line);
   luaK_storevar(ls->fs, &v, &b);
   luaK_fixline(ls->fs, line);  /* definition "happens" in the first line */
@@ -1491,14 +2030,15 @@ static void exprstat (LexState *ls) {
   /* stat -> func | assignment */
   FuncState *fs = ls->fs;
   struct LHS_assign v;
-  suffixedexp(ls, &v.v);
+  int inlined = suffixedexp(ls, &v.v);
   if (ls->t.token == '=' || ls->t.token == ',') { /* stat -> assignment ? */
     v.prev = NULL;
     assignment(ls, &v, 1);
   }
   else {  /* stat -> func */
-    check_condition(ls, v.v.k == VCALL, "syntax error");
-    SETARG_C(getinstruction(fs, &v.v), 1);  /* call statement uses no results */
+    check_condition(ls, v.v.k == VCALL || inlined, "syntax error");
+    if (v.v.k == VCALL)
+      SETARG_C(getinstruction(fs, &v.v), 1);  /* call statement uses no results */
   }
 }
 
@@ -1641,6 +2181,8 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   lexstate.buff = buff;
   lexstate.dyd = dyd;
   dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+  dyd->tok.n = dyd->inl.n = dyd->freevar.n = 0;
+  dyd->tok.fs = NULL;
   luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
   lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
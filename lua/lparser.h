@@ -7,6 +7,7 @@
 #ifndef lparser_h
 #define lparser_h
 
+#include "llex.h"
 #include "llimits.h"
 #include "lobject.h"
 #include "lzio.h"
@@ -33,6 +34,8 @@ typedef enum {
   VKINT,  /* integer constant; nval = numerical integer value */
   VNONRELOC,  /* expression has its value in a fixed register;
                  info = result register */
+  VCONST,  /* compile-time constant variable;
+              info = absolute index in 'actvar.arr' */
   VLOCAL,  /* local variable; info = local register */
   VUPVAL,  /* upvalue variable; info = index of upvalue in 'upvalues' */
   VINDEXED,  /* indexed variable;
@@ -48,7 +51,7 @@ typedef enum {
 } expkind;
 
 
-#define vkisvar(k)	(VLOCAL <= (k) && (k) <= VINDEXED)
+#define vkisvar(k)	(VCONST <= (k) && (k) <= VINDEXED)
 #define vkisinreg(k)	((k) == VNONRELOC || (k) == VLOCAL)
 
 typedef struct expdesc {
@@ -68,9 +71,20 @@ typedef struct expdesc {
 } expdesc;
 
 
+/* kinds of variables */
+#define VDKREG		0   /* regular */
+#define RDKCONST	1   /* constant ('<const>') */
+#define RDKCTC		2   /* constant with a value known at compile time */
+#define RDKINL		3   /* constant function whose calls are inlined */
+
+
 /* description of active local variable */
 typedef struct Vardesc {
+  TValue k;  /* value of a compile-time constant (RDKCTC), or index of
+               the inlinable function in 'Dyndata.inl' (RDKINL) */
+  TString *name;  /* variable name */
   short idx;  /* variable index in stack */
+  lu_byte kind;
 } Vardesc;
 
 
@@ -91,6 +105,34 @@ typedef struct Labellist {
 } Labellist;
 
 
+/* maximum number of instructions of an inlinable function */
+#if !defined(LUAI_MAXINLINE)
+#define LUAI_MAXINLINE		12
+#endif
+
+/* maximum number of tokens read for a function that may be inlinable */
+#define MAXINLINETOKENS		(8 * LUAI_MAXINLINE)
+
+
+/* description of an inlinable function */
+typedef struct Inline {
+  int tok;  /* its parameters, then its returned expression, in 'tok' */
+  int nparams;
+  int free;  /* names it uses from outside, in 'freevar' */
+  int nfree;
+  int maxstack;  /* registers it needs */
+  int pc;  /* its OP_CLOSURE */
+  lu_byte used;  /* whether the variable is used other than in calls */
+} Inline;
+
+
+/* a name used by an inlinable function and what it refers to there */
+typedef struct Freevar {
+  TString *name;
+  int id;  /* index in 'actvar.arr' of the variable, -1 for a global */
+} Freevar;
+
+
 /* dynamic structures used by the parser */
 typedef struct Dyndata {
   struct {  /* list of active local variables */
@@ -100,6 +142,23 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  struct {  /* tokens kept for inlinable functions */
+    Token *arr;
+    int n;
+    int size;
+    int first;  /* first token of the function being read */
+    struct FuncState *fs;  /* function that defines it, NULL if none */
+  } tok;
+  struct {  /* inlinable functions */
+    Inline *arr;
+    int n;
+    int size;
+  } inl;
+  struct {  /* names used by inlinable functions */
+    Freevar *arr;
+    int n;
+    int size;
+  } freevar;
 } Dyndata;
 
 
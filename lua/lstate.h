@@ -53,6 +53,7 @@ struct lua_longjmp;  /* defined in ldo.c */
 /* kinds of Garbage Collection */
 #define KGC_NORMAL	0
 #define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
+#define KGC_GEN		2	/* generational collection */
 
 
 typedef struct stringtable {
@@ -143,6 +144,13 @@ typedef struct global_State {
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  int genminormul;  /* growth (%) before a minor generational collection */
+  int genmajormul;  /* growth (%) before a major generational collection */
+  lu_mem gclimit;  /* memory over which a deadline is ignored (0: none) */
+  lua_Clock gcclock;  /* clock timing the collector, or NULL */
+  lua_Integer gcdeadline;  /* when the current call has to end (0: none) */
+  lua_Integer gctime;  /* time spent collecting */
+  lua_Integer gcsteptime;  /* time the last step took */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
@@ -79,10 +79,15 @@
 
 #define isdummy(n)		((n) == dummynode)
 
+#if !LUA_NANBOX
 static const Node dummynode_ = {
-  {NILCONSTANT},  /* value */
-  {{NILCONSTANT, 0}}  /* key */
+  {NILCONSTANT, LUA_TNIL, 0, {NULL}}  /* value, key type, next, key */
 };
+#else
+static const Node dummynode_ = {
+  {NILCONSTANT, 0, {NILCONSTANT}}  /* value, next, key */
+};
+#endif
 
 
 /*
@@ -142,6 +147,22 @@ static Node *mainposition (const Table *t, const TValue *key) {
 }
 
 
+/* the main position of the key of node 'n' */
+static Node *mainpositionfromnode (const Table *t, const Node *n) {
+  TValue key;
+  getnodekey(cast(lua_State *, NULL), &key, n);
+  return mainposition(t, &key);
+}
+
+
+/* whether 'key' is the key of node 'n' */
+static int equalkey (const TValue *key, const Node *n) {
+  TValue k;
+  getnodekey(cast(lua_State *, NULL), &k, n);
+  return luaV_rawequalobj(&k, key);
+}
+
+
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
 ** the array part of the table, 0 otherwise.
@@ -172,9 +193,9 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
     Node *n = mainposition(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       /* key may be dead already, but it is ok to use it in 'next' */
-      if (luaV_rawequalobj(gkey(n), key) ||
-            (ttisdeadkey(gkey(n)) && iscollectable(key) &&
-             deadvalue(gkey(n)) == gcvalue(key))) {
+      if (equalkey(key, n) ||
+            (keyisdead(n) && iscollectable(key) &&
+             deadkey(n) == gcvalue(key))) {
         i = cast_int(n - gnode(t, 0));  /* key index in hash table */
         /* hash elements are numbered after array ones */
         return (i + 1) + t->sizearray;
@@ -199,7 +220,7 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
   }
   for (i -= t->sizearray; cast_int(i) < sizenode(t); i++) {  /* hash part */
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
-      setobj2s(L, key, gkey(gnode(t, i)));
+      getnodekey(L, key, gnode(t, i));
       setobj2s(L, key+1, gval(gnode(t, i)));
       return 1;
     }
@@ -292,7 +313,9 @@ static int numusehash (const Table *t, unsigned int *nums, unsigned int *pna) {
   while (i--) {
     Node *n = &t->node[i];
     if (!ttisnil(gval(n))) {
-      ause += countint(gkey(n), nums);
+      TValue k;
+      getnodekey(cast(lua_State *, NULL), &k, n);
+      ause += countint(&k, nums);
       totaluse++;
     }
   }
@@ -326,7 +349,7 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     for (i = 0; i < (int)size; i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
-      setnilvalue(wgkey(n));
+      setnilkey(n);
       setnilvalue(gval(n));
     }
   }
@@ -362,7 +385,9 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     if (!ttisnil(gval(old))) {
       /* doesn't need barrier/invalidate cache, as entry was
          already present in the table */
-      setobjt2t(L, luaH_set(L, t, gkey(old)), gval(old));
+      TValue k;
+      getnodekey(L, &k, old);
+      setobjt2t(L, luaH_set(L, t, &k), gval(old));
     }
   }
   if (!isdummy(nold))
@@ -427,7 +452,7 @@ void luaH_free (lua_State *L, Table *t) {
 static Node *getfreepos (Table *t) {
   while (t->lastfree > t->node) {
     t->lastfree--;
-    if (ttisnil(gkey(t->lastfree)))
+    if (keyisnil(t->lastfree))
       return t->lastfree;
   }
   return NULL;  /* could not find a free place */
@@ -465,7 +490,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       return luaH_set(L, t, key);  /* insert key into grown table */
     }
     lua_assert(!isdummy(f));
-    othern = mainposition(t, gkey(mp));
+    othern = mainpositionfromnode(t, mp);
     if (othern != mp) {  /* is colliding node out of its main position? */
       /* yes; move colliding node into free position */
       while (othern + gnext(othern) != mp)  /* find previous */
@@ -487,7 +512,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       mp = f;
     }
   }
-  setnodekey(L, &mp->i_key, key);
+  setnodekey(L, mp, key);
   luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
   return gval(mp);
@@ -504,7 +529,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   else {
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
-      if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
+      if (keyisinteger(n) && keyival(n) == key)
         return gval(n);  /* that's it */
       else {
         int nx = gnext(n);
@@ -524,8 +549,7 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
   Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
-    const TValue *k = gkey(n);
-    if (ttisshrstring(k) && eqshrstr(tsvalue(k), key))
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
@@ -537,6 +561,38 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 }
 
 
+/*
+** 'luaH_getshortstr' through the inline cache 'ic' of an instruction,
+** which holds the index of the node where the instruction found its key
+** the last time. That node is tried first; it is a hit if it lies in the
+** node array of 't' and holds 'key', whatever table the index came from,
+** so records built alike share it. On a miss the key is looked up as
+** usual and the cache is set to its node.
+*/
+const TValue *luaH_getcached (Table *t, TString *key, unsigned short *ic) {
+  Node *n;
+  lua_assert(key->tt == LUA_TSHRSTR);
+  if (*ic < sizenode(t)) {
+    n = gnode(t, *ic);
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
+      return gval(n);  /* hit */
+  }
+  n = hashstr(t, key);
+  for (;;) {  /* as in 'luaH_getshortstr' */
+    if (keyisshrstr(n) && eqshrstr(keystrval(n), key)) {
+      *ic = cast(unsigned short, n - t->node);  /* a large index only misses */
+      return gval(n);
+    }
+    else {
+      int nx = gnext(n);
+      if (nx == 0)
+        return luaO_nilobject;  /* not found */
+      n += nx;
+    }
+  }
+}
+
+
 /*
 ** "Generic" get version. (Not that generic: not valid for integers,
 ** which may be in array part, nor for floats with integral values.)
@@ -544,7 +600,7 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 static const TValue *getgeneric (Table *t, const TValue *key) {
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
-    if (luaV_rawequalobj(gkey(n), key))
+    if (equalkey(key, n))
       return gval(n);  /* that's it */
     else {
       int nx = gnext(n);
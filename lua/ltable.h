@@ -12,30 +12,64 @@
 
 #define gnode(t,i)	(&(t)->node[i])
 #define gval(n)		(&(n)->i_val)
-#define gnext(n)	((n)->i_key.nk.next)
+#define gnext(n)	((n)->u.next)
 
 
-/* 'const' to avoid wrong writings that can mess up field 'next' */ 
-#define gkey(n)		cast(const TValue*, (&(n)->i_key.tvk))
-
 /*
-** writable version of 'gkey'; allows updates to individual fields,
-** but not to the whole (which has incompatible type)
+** The key of a node is not a 'TValue' of its own (see Node in lobject.h):
+** it is read with these macros, or copied out with 'getnodekey'
 */
-#define wgkey(n)		(&(n)->i_key.nk)
+#if !LUA_NANBOX
+
+#define keytt(n)		((n)->u.key_tt)
+#define keyval(n)		((n)->u.key_val)
+
+#define keyisnil(n)		(keytt(n) == LUA_TNIL)
+#define keyisinteger(n)		(keytt(n) == LUA_TNUMINT)
+#define keyival(n)		(keyval(n).i)
+#define keyisshrstr(n)		(keytt(n) == ctb(LUA_TSHRSTR))
+#define keystrval(n)		(gco2ts(keyval(n).gc))
+#define keyiscollectable(n)	(keytt(n) & BIT_ISCOLLECTABLE)
+#define gckey(n)		(keyval(n).gc)
+#define keyisdead(n)		(keytt(n) == LUA_TDEADKEY)
+/* a dead key may keep its object, but cannot access its contents */
+#define deadkey(n)		cast(void *, keyval(n).gc)
+
+#define setnilkey(n)		(keytt(n) = LUA_TNIL)
+#define setdeadkey(n)		(keytt(n) = LUA_TDEADKEY)
+
+#else
+
+#define keytv(n)		(&(n)->u.key_tv)
+
+#define keyisnil(n)		ttisnil(keytv(n))
+#define keyisinteger(n)		ttisinteger(keytv(n))
+#define keyival(n)		ivalue(keytv(n))
+#define keyisshrstr(n)		ttisshrstring(keytv(n))
+#define keystrval(n)		tsvalue(keytv(n))
+#define keyiscollectable(n)	iscollectable(keytv(n))
+#define gckey(n)		gcvalue(keytv(n))
+#define keyisdead(n)		ttisdeadkey(keytv(n))
+#define deadkey(n)		deadvalue(keytv(n))
+
+#define setnilkey(n)		setnilvalue(keytv(n))
+#define setdeadkey(n)		setdeadvalue(keytv(n))
+
+#endif
 
 #define invalidateTMcache(t)	((t)->flags = 0)
 
 
-/* returns the key, given the value of a table entry */
-#define keyfromval(v) \
-  (gkey(cast(Node *, (void*) (cast(char *, (v)) - offsetof(Node, i_val)))))
+/* returns the node, given the value of a table entry */
+#define nodefromval(v)	cast(Node *, (v))
 
 
 LUAI_FUNC const TValue *luaH_getint (Table *t, lua_Integer key);
 LUAI_FUNC void luaH_setint (lua_State *L, Table *t, lua_Integer key,
                                                     TValue *value);
 LUAI_FUNC const TValue *luaH_getshortstr (Table *t, TString *key);
+LUAI_FUNC const TValue *luaH_getcached (Table *t, TString *key,
+                                        unsigned short *ic);
 LUAI_FUNC const TValue *luaH_getstr (Table *t, TString *key);
 LUAI_FUNC const TValue *luaH_get (Table *t, const TValue *key);
 LUAI_FUNC TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key);
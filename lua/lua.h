@@ -124,6 +124,12 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** Type for clocks that time the garbage collector (see 'lua_gcdeadline')
+*/
+typedef lua_Integer (*lua_Clock) (void);
+
+
 
 /*
 ** generic extra include file
@@ -307,9 +313,16 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCSETMAJORINC	8
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCSETLIMIT		12
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
+LUA_API void (lua_gcdeadline) (lua_State *L, lua_Clock clock,
+                               lua_Integer deadline);
+LUA_API lua_Integer (lua_gctime) (lua_State *L);
 
 
 /*
@@ -36,6 +36,20 @@
 /* #define LUA_32BITS */
 
 
+/*
+@@ LUA_NANBOX packs every value into 8 bytes, the size of a float, by
+** keeping all other values in the bits of a NaN (see lobject.h). This
+** halves the stack and the array part of tables on 64-bit machines.
+** Integers then have 32 bits, as they have to fit next to the tag, and
+** bytecode has to be compiled by a 'luac' built with the same option.
+** Integer arithmetic whose result needs more bits raises an error (see
+** 'checkedintop' in lvm.h), so this changes both the ABI and Lua itself.
+*/
+#if !defined(LUA_NANBOX)
+#define LUA_NANBOX	0
+#endif
+
+
 /*
 @@ LUA_USE_C89 controls the use of non-ISO-C89 features.
 ** Define it if you want Lua to avoid the use of a few C99 features
@@ -126,6 +140,13 @@
 #endif
 #define LUA_FLOAT_TYPE	LUA_FLOAT_FLOAT
 
+#elif LUA_NANBOX		/* }{ */
+/*
+** 32-bit integers, which fit into a NaN with a tag, and 'double'
+*/
+#define LUA_INT_TYPE	LUA_INT_INT
+#define LUA_FLOAT_TYPE	LUA_FLOAT_DOUBLE
+
 #elif defined(LUA_C89_NUMBERS)	/* }{ */
 /*
 ** largest types available for C89 ('long' and 'double')
@@ -680,6 +701,42 @@
 /* #define LUA_NOCVTS2N */
 
 
+/*
+@@ LUA_USE_JUMPTABLE makes the interpreter dispatch its instructions
+** through a table of label addresses (see ljumptab.h) instead of a
+** switch. It needs labels as values, a GCC extension that clang
+** supports too, so it is on only with those compilers by default.
+*/
+#if !defined(LUA_USE_JUMPTABLE)
+#if defined(__GNUC__)
+#define LUA_USE_JUMPTABLE	1
+#else
+#define LUA_USE_JUMPTABLE	0
+#endif
+#endif
+
+
+/*
+@@ LUA_USE_JIT compiles hot Lua functions to native code (see ljit.c).
+** It needs x86-64 and memory that can be made executable, so it is off
+** by default. The AArch64 backend has not been run yet and also needs
+** LUAI_JITAARCH64.
+*/
+#if !defined(LUA_USE_JIT)
+#define LUA_USE_JIT	0
+#endif
+
+
+/*
+@@ LUA_USE_AOT runs the scripts compiled to C by 'luac_ta -c' and linked
+** into the program as native code (see lnative.c). The generated file
+** defines the table of those scripts, so it is off by default.
+*/
+#if !defined(LUA_USE_AOT)
+#define LUA_USE_AOT	0
+#endif
+
+
 /*
 @@ LUA_USE_APICHECK turns on several consistency checks on the C API.
 ** Define it as a help when debugging C code.
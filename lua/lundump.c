@@ -25,7 +25,7 @@
 
 
 #if !defined(luai_verifycode)
-#define luai_verifycode(L,b,f)  /* empty */
+#define luai_verifycode(L,n,cl)  luaU_verify(L,n,cl)
 #endif
 
 
@@ -33,6 +33,7 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  int nlevels;  /* nesting of functions being loaded */
 } LoadState;
 
 
@@ -71,6 +72,15 @@ static int LoadInt (LoadState *S) {
 }
 
 
+/* number of elements of a vector */
+static int LoadCount (LoadState *S) {
+  int n = LoadInt(S);
+  if (n < 0)
+    error(S, "corrupted");
+  return n;
+}
+
+
 static lua_Number LoadNumber (LoadState *S) {
   lua_Number x;
   LoadVar(S, x);
@@ -105,7 +115,7 @@ static TString *LoadString (LoadState *S) {
 
 
 static void LoadCode (LoadState *S, Proto *f) {
-  int n = LoadInt(S);
+  int n = LoadCount(S);
   f->code = luaM_newvector(S->L, n, Instruction);
   f->sizecode = n;
   LoadVector(S, f->code, n);
@@ -117,7 +127,7 @@ static void LoadFunction(LoadState *S, Proto *f, TString *psource);
 
 static void LoadConstants (LoadState *S, Proto *f) {
   int i;
-  int n = LoadInt(S);
+  int n = LoadCount(S);
   f->k = luaM_newvector(S->L, n, TValue);
   f->sizek = n;
   for (i = 0; i < n; i++)
@@ -139,11 +149,15 @@ static void LoadConstants (LoadState *S, Proto *f) {
       setivalue(o, LoadInteger(S));
       break;
     case LUA_TSHRSTR:
-    case LUA_TLNGSTR:
-      setsvalue2n(S->L, o, LoadString(S));
+    case LUA_TLNGSTR: {
+      TString *ts = LoadString(S);
+      if (ts == NULL)
+        error(S, "corrupted");
+      setsvalue2n(S->L, o, ts);
       break;
+    }
     default:
-      lua_assert(0);
+      error(S, "corrupted");
     }
   }
 }
@@ -151,21 +165,25 @@ static void LoadConstants (LoadState *S, Proto *f) {
 
 static void LoadProtos (LoadState *S, Proto *f) {
   int i;
-  int n = LoadInt(S);
+  int n = LoadCount(S);
   f->p = luaM_newvector(S->L, n, Proto *);
   f->sizep = n;
   for (i = 0; i < n; i++)
     f->p[i] = NULL;
+  if (n > 0 && ++S->nlevels > LUAI_MAXCCALLS)  /* as in the parser */
+    error(S, "too deeply nested");
   for (i = 0; i < n; i++) {
     f->p[i] = luaF_newproto(S->L);
     LoadFunction(S, f->p[i], f->source);
   }
+  if (n > 0)
+    S->nlevels--;
 }
 
 
 static void LoadUpvalues (LoadState *S, Proto *f) {
   int i, n;
-  n = LoadInt(S);
+  n = LoadCount(S);
   f->upvalues = luaM_newvector(S->L, n, Upvaldesc);
   f->sizeupvalues = n;
   for (i = 0; i < n; i++)
@@ -179,11 +197,11 @@ static void LoadUpvalues (LoadState *S, Proto *f) {
 
 static void LoadDebug (LoadState *S, Proto *f) {
   int i, n;
-  n = LoadInt(S);
+  n = LoadCount(S);
   f->lineinfo = luaM_newvector(S->L, n, int);
   f->sizelineinfo = n;
   LoadVector(S, f->lineinfo, n);
-  n = LoadInt(S);
+  n = LoadCount(S);
   f->locvars = luaM_newvector(S->L, n, LocVar);
   f->sizelocvars = n;
   for (i = 0; i < n; i++)
@@ -193,7 +211,9 @@ static void LoadDebug (LoadState *S, Proto *f) {
     f->locvars[i].startpc = LoadInt(S);
     f->locvars[i].endpc = LoadInt(S);
   }
-  n = LoadInt(S);
+  n = LoadCount(S);
+  if (n > f->sizeupvalues)
+    error(S, "corrupted");
   for (i = 0; i < n; i++)
     f->upvalues[i].name = LoadString(S);
 }
@@ -252,6 +272,16 @@ static void checkHeader (LoadState *S) {
 }
 
 
+/* after the chunk has been verified, as they look at its code */
+static void newicaches (lua_State *L, Proto *f) {
+  int i;
+  luaF_newicache(L, f);
+  luaF_newswitches(L, f);
+  for (i = 0; i < f->sizep; i++)
+    newicaches(L, f->p[i]);
+}
+
+
 /*
 ** load precompiled chunk
 */
@@ -266,14 +296,15 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.nlevels = 0;
   checkHeader(&S);
   cl = luaF_newLclosure(L, LoadByte(&S));
   setclLvalue(L, L->top, cl);
   luaD_inctop(L);
   cl->p = luaF_newproto(L);
   LoadFunction(&S, cl->p, NULL);
-  lua_assert(cl->nupvalues == cl->p->sizeupvalues);
-  luai_verifycode(L, buff, cl->p);
+  luai_verifycode(L, S.name, cl);  /* also checks the upvalue count */
+  newicaches(L, cl->p);
   return cl;
 }
 
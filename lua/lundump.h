@@ -25,6 +25,10 @@
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 
+/* check the code of a loaded chunk; from lverify.c */
+LUAI_FUNC void luaU_verify (lua_State* L, const char* name,
+                            const LClosure* cl);
+
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
                          void* data, int strip);
@@ -0,0 +1,293 @@
+/*
+** static verifier for precompiled Lua chunks
+** See Copyright Notice in lua.h
+*/
+
+#define lverify_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lfunc.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lundump.h"
+
+
+/*
+** The VM trusts the code it runs: register, constant, upvalue and proto
+** operands are used as plain indices and the instruction after a test,
+** a LOADKX or a TFORCALL is taken for granted. luaU_verify checks all of
+** this for a function tree loaded by luaU_undump, so that a malformed
+** chunk is rejected by lua_load instead of corrupting the state. Every
+** instruction is checked in constant time against its neighbours, so
+** the cost is linear in the size of the chunk.
+*/
+
+
+typedef struct {
+  lua_State *L;
+  const char *name;
+} VerifyState;
+
+
+/* 'pc' is -1 for errors in the function itself */
+static l_noret error (VerifyState *V, const Proto *f, int pc,
+                      const char *why) {
+  if (pc < 0)
+    luaO_pushfstring(V->L, "%s: bad precompiled chunk (%s in function "
+                     "at line %d)", V->name, why, f->linedefined);
+  else
+    luaO_pushfstring(V->L, "%s: bad precompiled chunk (%s at instruction "
+                     "%d of function at line %d)", V->name, why, pc + 1,
+                     f->linedefined);
+  luaD_throw(V->L, LUA_ERRSYNTAX);
+}
+
+
+#define check(c,why)	((void)((c) || (error(V, f, pc, why), 0)))
+
+#define checkreg(r)	check((r) < f->maxstacksize, "register out of range")
+
+#define checkk(k)	check((k) < f->sizek, "constant out of range")
+
+#define checkupval(u)	check((u) < f->sizeupvalues, "upvalue out of range")
+
+
+static void checkrk (VerifyState *V, const Proto *f, int pc, int mode,
+                     int x) {
+  if (mode == OpArgR)
+    checkreg(x);
+  else if (mode == OpArgK) {
+    if (ISK(x))
+      checkk(INDEXK(x));
+    else
+      checkreg(x);
+  }
+}
+
+
+/*
+** jumps stay inside the code and never land on the extra argument
+** of the previous instruction
+*/
+static int checkjump (VerifyState *V, const Proto *f, int pc) {
+  int dest = pc + 1 + GETARG_sBx(f->code[pc]);
+  check(0 <= dest && dest < f->sizecode, "jump out of range");
+  check(GET_OPCODE(f->code[dest]) != OP_EXTRAARG, "jump to extra argument");
+  return dest;
+}
+
+
+/*
+** an instruction that leaves its results up to 'top' has to be followed
+** by one that takes its operands up to 'top'
+*/
+static void checkopen (VerifyState *V, const Proto *f, int pc) {
+  Instruction i = f->code[pc + 1];
+  switch (GET_OPCODE(i)) {
+    case OP_CALL: case OP_TAILCALL:
+    case OP_RETURN: case OP_SETLIST:
+      check(GETARG_B(i) == 0, "open results not consumed");
+      break;
+    default:
+      check(0, "open results not consumed");
+  }
+}
+
+
+/* the extra argument of LOADKX and SETLIST */
+static int checkextraarg (VerifyState *V, const Proto *f, int pc) {
+  check(GET_OPCODE(f->code[pc + 1]) == OP_EXTRAARG, "missing extra argument");
+  return GETARG_Ax(f->code[pc + 1]);
+}
+
+
+static void checkcode (VerifyState *V, const Proto *f) {
+  int pc = f->sizecode - 1;
+  check(pc >= 0 && GET_OPCODE(f->code[pc]) == OP_RETURN,
+        "code does not end with a return");
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int a = GETARG_A(i);
+    int b = GETARG_B(i);
+    int c = GETARG_C(i);
+    check(op < NUM_OPCODES && !isQuick(op), "invalid opcode");
+    if (isFused(op)) {  /* the VM runs the next instruction as the second op */
+      check(pc + 1 < f->sizecode &&
+            GET_OPCODE(f->code[pc + 1]) < NUM_OPCODES &&
+            getBaseOp(GET_OPCODE(f->code[pc + 1])) == getFusedNext(op),
+            "superinstruction without its second instruction");
+    }
+    /* operands as described by 'luaP_opmodes' */
+    switch (getOpMode(op)) {
+      case iABC:
+        checkrk(V, f, pc, getBMode(op), b);
+        checkrk(V, f, pc, getCMode(op), c);
+        break;
+      case iABx:
+        if (getBMode(op) == OpArgK)
+          checkk(GETARG_Bx(i));
+        break;
+      case iAsBx:
+        checkjump(V, f, pc);
+        break;
+      default:  /* iAx, extra arguments are skipped with their opcode */
+        check(0, "extra argument without instruction");
+    }
+    op = getBaseOp(op);  /* operands as for the first op */
+    switch (op) {  /* A is a register for all but these */
+      case OP_SETTABUP: case OP_JMP:
+      case OP_EQ: case OP_LT: case OP_LE:
+        break;
+      default:
+        checkreg(a);
+    }
+    if (testTMode(op))  /* the next instruction is the conditional jump */
+      check(GET_OPCODE(f->code[pc + 1]) == OP_JMP, "test without jump");
+    switch (op) {
+      case OP_LOADKX:
+        checkk(checkextraarg(V, f, pc));
+        pc++;  /* skip the extra argument */
+        break;
+      case OP_LOADBOOL:
+        if (c)
+          check(pc + 2 < f->sizecode, "skip out of range");
+        break;
+      case OP_LOADNIL:
+        checkreg(a + b);
+        break;
+      case OP_NEWTABLE:  /* sizes as encoded by luaO_int2fb, fit an int */
+        check((b >> 3) <= 28 && (c >> 3) <= 28, "table size out of range");
+        break;
+      case OP_GETUPVAL: case OP_SETUPVAL: case OP_GETTABUP:
+        checkupval(b);
+        break;
+      case OP_SETTABUP:
+        checkupval(a);
+        break;
+      case OP_SELF:
+        checkreg(a + 1);
+        break;
+      case OP_CONCAT:
+        check(b < c, "empty concatenation");
+        break;
+      case OP_JMP:  /* A - 1 is the level of the upvalues to close */
+        check(a - 1 <= f->maxstacksize, "register out of range");
+        break;
+      case OP_CALL:
+        if (b > 0)
+          checkreg(a + b - 1);
+        if (c == 0)
+          checkopen(V, f, pc);
+        else if (c > 1)
+          checkreg(a + c - 2);
+        break;
+      case OP_TAILCALL:
+        if (b > 0)
+          checkreg(a + b - 1);
+        checkopen(V, f, pc);
+        break;
+      case OP_RETURN:
+        if (b > 1)
+          checkreg(a + b - 2);
+        break;
+      case OP_FORPREP: case OP_FORLOOP: {
+        /* FORPREP jumps to its FORLOOP, which jumps back right after it */
+        int dest = checkjump(V, f, pc);
+        Instruction j;
+        checkreg(a + 3);
+        if (op == OP_FORPREP) {
+          j = f->code[dest];
+          check(GET_OPCODE(j) == OP_FORLOOP && GETARG_A(j) == a &&
+                dest + 1 + GETARG_sBx(j) == pc + 1, "unmatched numeric for");
+        }
+        else {
+          check(dest > 0, "unmatched numeric for");
+          j = f->code[dest - 1];
+          check(GET_OPCODE(j) == OP_FORPREP && GETARG_A(j) == a &&
+                dest + GETARG_sBx(j) == pc, "unmatched numeric for");
+        }
+        break;
+      }
+      case OP_TFORCALL:  /* the generator is called at A + 3 */
+        checkreg(a + 5);
+        checkreg(a + 2 + c);
+        check(GET_OPCODE(f->code[pc + 1]) == OP_TFORLOOP &&
+              GETARG_A(f->code[pc + 1]) == a + 2, "unmatched generic for");
+        break;
+      case OP_TFORLOOP:
+        checkreg(a + 1);
+        check(pc > 0 && GET_OPCODE(f->code[pc - 1]) == OP_TFORCALL &&
+              GETARG_A(f->code[pc - 1]) == a - 2, "unmatched generic for");
+        break;
+      case OP_SETLIST:
+        if (b > 0)
+          checkreg(a + b);
+        if (c == 0) {
+          checkextraarg(V, f, pc);
+          pc++;  /* skip the extra argument */
+        }
+        break;
+      case OP_CLOSURE:
+        check(GETARG_Bx(i) < f->sizep, "function out of range");
+        break;
+      case OP_SWITCH:  /* B is given at load time (see 'luaF_newswitches') */
+        check(ISK(c) && (ttisinteger(f->k + INDEXK(c)) ||
+                         ttisstring(f->k + INDEXK(c))), "bad switch constant");
+        break;
+      case OP_VARARG:
+        check(f->is_vararg, "vararg in function without varargs");
+        if (b == 0)
+          checkopen(V, f, pc);
+        else if (b > 1)
+          checkreg(a + b - 2);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+
+static void checkfunction (VerifyState *V, const Proto *f) {
+  int pc = -1;  /* not at an instruction, for 'check' */
+  int i;
+  check(f->numparams <= f->maxstacksize, "too many parameters");
+  check(f->sizeupvalues <= MAXUPVAL, "too many upvalues");
+  check(f->sizelineinfo == 0 || f->sizelineinfo == f->sizecode,
+        "bad line information");
+  for (i = 0; i < f->sizelocvars; i++)
+    check(f->locvars[i].varname != NULL, "local variable without name");
+  checkcode(V, f);
+  for (i = 0; i < f->sizep; i++) {
+    const Proto *p = f->p[i];
+    int j;
+    /* the upvalues of a closure come from the registers and upvalues of f */
+    for (j = 0; j < p->sizeupvalues; j++) {
+      if (p->upvalues[j].instack)
+        checkreg(p->upvalues[j].idx);
+      else
+        checkupval(p->upvalues[j].idx);
+    }
+    checkfunction(V, p);
+  }
+}
+
+
+void luaU_verify (lua_State *L, const char *name, const LClosure *cl) {
+  VerifyState V;
+  V.L = L;
+  V.name = name;
+  if (cl->nupvalues != cl->p->sizeupvalues) {
+    luaO_pushfstring(L, "%s: bad precompiled chunk (upvalue count)", name);
+    luaD_throw(L, LUA_ERRSYNTAX);
+  }
+  checkfunction(&V, cl->p);
+}
+
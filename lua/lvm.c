@@ -24,6 +24,8 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
+#include "lnative.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -557,7 +559,7 @@ lua_Integer luaV_div (lua_State *L, lua_Integer m, lua_Integer n) {
   if (l_castS2U(n) + 1u <= 1u) {  /* special cases: -1 or 0 */
     if (n == 0)
       luaG_runerror(L, "attempt to divide by zero");
-    return intop(-, 0, m);   /* n==-1; avoid overflow with 0x80000...//-1 */
+    return checkedintop(L, -, 0, m);   /* n==-1; avoid overflow with 0x80000...//-1 */
   }
   else {
     lua_Integer q = m / n;  /* perform C division */
@@ -568,6 +570,18 @@ lua_Integer luaV_div (lua_State *L, lua_Integer m, lua_Integer n) {
 }
 
 
+#if LUA_NANBOX
+/*
+** An integer operation whose result does not fit into the 32 bits of
+** integers (see 'checkedintop')
+*/
+lua_Integer luaV_intoverflow (lua_State *L) {
+  luaG_runerror(L, "integer overflow (integers have 32 bits with LUA_NANBOX)");
+  return 0;
+}
+#endif
+
+
 /*
 ** Integer modulus; return 'm % n'. (Assume that C '%' with
 ** negative operands follows C99 behavior. See previous comment
@@ -654,6 +668,63 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** closure of prototype 'p' in 'ra' for OP_CLOSURE, reusing the cached
+** one if it has the right upvalues
+*/
+void luaV_closure (lua_State *L, Proto *p, UpVal **encup, StkId base,
+                   StkId ra) {
+  LClosure *ncl = getcached(p, encup, base);  /* cached closure */
+  if (ncl == NULL)  /* no match? */
+    pushclosure(L, p, encup, base, ra);  /* create a new one */
+  else
+    setclLvalue(L, ra, ncl);  /* push cashed closure */
+}
+
+
+/*
+** prepare the numeric loop with control values at 'ra' for OP_FORPREP:
+** all of them integers or all floats, the index one step back
+*/
+void luaV_forprep (lua_State *L, StkId ra) {
+  TValue *init = ra;
+  TValue *plimit = ra + 1;
+  TValue *pstep = ra + 2;
+  lua_Integer ilimit;
+  int stopnow;
+  if (ttisinteger(init) && ttisinteger(pstep) &&
+      forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
+    /* all values are integer */
+    lua_Integer initv = (stopnow ? 0 : ivalue(init));
+    setivalue(plimit, ilimit);
+    setivalue(init, intop(-, initv, ivalue(pstep)));
+  }
+  else {  /* try making all values floats */
+    lua_Number ninit; lua_Number nlimit; lua_Number nstep;
+    if (!tonumber(plimit, &nlimit))
+      luaG_runerror(L, "'for' limit must be a number");
+    setfltvalue(plimit, nlimit);
+    if (!tonumber(pstep, &nstep))
+      luaG_runerror(L, "'for' step must be a number");
+    setfltvalue(pstep, nstep);
+    if (!tonumber(init, &ninit))
+      luaG_runerror(L, "'for' initial value must be a number");
+    setfltvalue(init, luai_numsub(L, ninit, nstep));
+  }
+}
+
+
+/*
+** the pc where OP_SWITCH 'i' of 'p' goes for the value 'ra', through its
+** dispatch table (see 'luaF_newswitches')
+*/
+int luaV_switch (const Proto *p, Instruction i, const TValue *ra) {
+  const Switchdesc *s = &p->switches[GETARG_B(i)];
+  const TValue *target = luaH_get(s->t, ra);
+  return ttisinteger(target) ? cast_int(ivalue(target)) : s->miss;
+}
+
+
 /*
 ** finish execution of an opcode interrupted by an yield
 */
@@ -661,7 +732,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->u.l.base;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = getBaseOp(GET_OPCODE(inst));
   switch (op) {  /* finish its execution */
     case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_IDIV:
     case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
@@ -770,6 +841,34 @@ void luaV_finishOp (lua_State *L) {
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/*
+** end the first half of a superinstruction by going straight on to the
+** code at 'lbl' for the next instruction, without dispatching it (unless
+** a hook wants to see it)
+*/
+#define vmfuse(lbl)	{ \
+  if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) { vmbreak; } \
+  i = *(ci->u.l.savedpc++); \
+  ra = RA(i); \
+  lua_assert(getBaseOp(GET_OPCODE(i)) == getFusedNext(GET_OPCODE(*(ci->u.l.savedpc - 2)))); \
+  goto lbl; }
+
+
+#if LUA_USE_NATIVE
+/*
+** go on in native code if the function of the frame has some (compiled
+** ahead of time or by the JIT); 'hot' tells whether to count the call or
+** loop iteration towards compiling it. Native code comes back here to
+** start the frame of a Lua function it calls.
+*/
+#define nativeenter(hot)	{ Proto *np = cl->p; \
+  if (np->native != NULL || ((hot) && luaJ_hot(L, np))) { \
+    if (luaN_execute(L, ci)) { ci = L->ci; goto newframe; } \
+    base = ci->u.l.base; } }
+#else
+#define nativeenter(hot)	((void)0)
+#endif
+
 
 /*
 ** copy of 'luaV_gettable', but protecting the call to potential
@@ -786,25 +885,105 @@ void luaV_finishOp (lua_State *L) {
     Protect(luaV_finishset(L,t,k,v,slot)); }
 
 
+/*
+** Same for accesses with a constant short string key, which look the key
+** up through the inline cache of the instruction (see 'luaF_newicache').
+** The instruction has to use them exactly when 'cachedaccess' gives it a
+** cache, as 'icache' is NULL in functions without such accesses.
+*/
+#define ICACHE()	(cl->p->icache + (ci->u.l.savedpc - cl->p->code - 1))
+
+/* the hit is checked here, without a call */
+#define icacheget(t,k)	(ic = ICACHE(), \
+  (*ic < sizenode(t) && keyisshrstr(gnode(t, *ic)) && \
+   keystrval(gnode(t, *ic)) == tsvalue(k)) \
+  ? gval(gnode(t, *ic)) : luaH_getcached(t, tsvalue(k), ic))
+
+#define iscached(x,k)	(ISK(x) && ttisshrstring(k))
+
+#define gettableCached(L,t,k,v)  { const TValue *slot; unsigned short *ic; \
+  if (luaV_fastget(L,t,k,slot,icacheget)) { setobj2s(L, v, slot); } \
+  else Protect(luaV_finishget(L,t,k,v,slot)); }
+
+#define settableCached(L,t,k,v) { const TValue *slot; unsigned short *ic; \
+  if (!luaV_fastset(L,t,k,slot,icacheget,v)) \
+    Protect(luaV_finishset(L,t,k,v,slot)); }
+
+
+/*
+** rewrite the running instruction to opcode 'o' (see the note on
+** quickened instructions in lopcodes.h); 'noquicken' is for the first
+** half of a superinstruction, which keeps its opcode
+*/
+#define quicken(o)	SET_OPCODE(cast(Instruction *, ci->u.l.savedpc)[-1], o)
+#define noquicken(o)	((void)0)
+
+
+/*
+** R(A) := RK(B) op RK(C), for OP_ADD, OP_SUB and OP_MUL. 'q' quickens
+** the instruction to 'qi' for two integers and to 'qf' for two floats.
+*/
+#define arithProtected(iop,fop,tm,q,qi,qf) { \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  lua_Number nb; lua_Number nc; \
+  if (ttisinteger(rb) && ttisinteger(rc)) { \
+    lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc); \
+    q(qi); \
+    setivalue(ra, checkedintop(L, iop, ib, ic)); \
+  } \
+  else if (ttisfloat(rb) && ttisfloat(rc)) { \
+    q(qf); \
+    setfltvalue(ra, fop(L, fltvalue(rb), fltvalue(rc))); \
+  } \
+  else if (tonumber(rb, &nb) && tonumber(rc, &nc)) { \
+    setfltvalue(ra, fop(L, nb, nc)); \
+  } \
+  else { Protect(luaT_trybinTM(L, rb, rc, ra, tm)); } }
+
+
+/*
+** the quickened arithmetic: the operation when both operands have the
+** expected type 'tt', otherwise back to the generic opcode 'o' at 'lbl'
+*/
+#define arithQuick(tt,set,get,op,o,lbl) { \
+  TValue *rb = RKB(i); \
+  TValue *rc = RKC(i); \
+  if (tt(rb) && tt(rc)) { set(ra, op(get(rb), get(rc))); vmbreak; } \
+  quicken(o); \
+  goto lbl; }
+
+#define iadd(a,b)	checkedintop(L, +, a, b)
+#define isub(a,b)	checkedintop(L, -, a, b)
+#define imul(a,b)	checkedintop(L, *, a, b)
+#define fadd(a,b)	luai_numadd(L, a, b)
+#define fsub(a,b)	luai_numsub(L, a, b)
+#define fmul(a,b)	luai_nummul(L, a, b)
+
+
 
 void luaV_execute (lua_State *L) {
   CallInfo *ci = L->ci;
   LClosure *cl;
   TValue *k;
   StkId base;
+#if LUA_USE_JUMPTABLE
+#include "ljumptab.h"
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
   cl = clLvalue(ci->func);  /* local reference to function's closure */
   k = cl->p->k;  /* local reference to function's constant table */
   base = ci->u.l.base;  /* local copy of function's base */
+  nativeenter(ci->u.l.savedpc == cl->p->code);  /* counts calls, not returns */
   /* main loop of interpreter */
   for (;;) {
     Instruction i;
     StkId ra;
     vmfetch();
     vmdispatch (GET_OPCODE(i)) {
-      vmcase(OP_MOVE) {
+      vmcase(OP_MOVE) l_move: {
         setobjs2s(L, ra, RB(i));
         vmbreak;
       }
@@ -840,20 +1019,29 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_GETTABUP) {
         TValue *upval = cl->upvals[GETARG_B(i)]->v;
         TValue *rc = RKC(i);
-        gettableProtected(L, upval, rc, ra);
+        if (iscached(GETARG_C(i), rc)) {
+          gettableCached(L, upval, rc, ra);
+        }
+        else gettableProtected(L, upval, rc, ra);
         vmbreak;
       }
-      vmcase(OP_GETTABLE) {
+      vmcase(OP_GETTABLE) l_gettable: {
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        gettableProtected(L, rb, rc, ra);
+        if (iscached(GETARG_C(i), rc)) {
+          gettableCached(L, rb, rc, ra);
+        }
+        else gettableProtected(L, rb, rc, ra);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
         TValue *upval = cl->upvals[GETARG_A(i)]->v;
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        settableProtected(L, upval, rb, rc);
+        if (iscached(GETARG_B(i), rb)) {
+          settableCached(L, upval, rb, rc);
+        }
+        else settableProtected(L, upval, rb, rc);
         vmbreak;
       }
       vmcase(OP_SETUPVAL) {
@@ -865,7 +1053,10 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_SETTABLE) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
-        settableProtected(L, ra, rb, rc);
+        if (iscached(GETARG_B(i), rb)) {
+          settableCached(L, ra, rb, rc);
+        }
+        else settableProtected(L, ra, rb, rc);
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -882,7 +1073,10 @@ void luaV_execute (lua_State *L) {
         const TValue *aux;
         StkId rb = RB(i);
         TValue *rc = RKC(i);
-        TString *key = tsvalue(rc);  /* key must be a string */
+        TString *key;
+        if (!ttisstring(rc))  /* not statically checked for binary chunks */
+          luaG_runerror(L, "string expected in SELF");
+        key = tsvalue(rc);  /* key must be a string */
         setobjs2s(L, ra + 1, rb);
         if (luaV_fastget(L, rb, key, aux, luaH_getstr)) {
           setobj2s(L, ra, aux);
@@ -890,46 +1084,16 @@ void luaV_execute (lua_State *L) {
         else Protect(luaV_finishget(L, rb, rc, ra, aux));
         vmbreak;
       }
-      vmcase(OP_ADD) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(+, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_numadd(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
+      vmcase(OP_ADD) l_add: {
+        arithProtected(+, luai_numadd, TM_ADD, quicken, OP_ADD_II, OP_ADD_FF);
         vmbreak;
       }
-      vmcase(OP_SUB) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(-, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_numsub(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SUB)); }
+      vmcase(OP_SUB) l_sub: {
+        arithProtected(-, luai_numsub, TM_SUB, quicken, OP_SUB_II, OP_SUB_FF);
         vmbreak;
       }
-      vmcase(OP_MUL) {
-        TValue *rb = RKB(i);
-        TValue *rc = RKC(i);
-        lua_Number nb; lua_Number nc;
-        if (ttisinteger(rb) && ttisinteger(rc)) {
-          lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
-          setivalue(ra, intop(*, ib, ic));
-        }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
-          setfltvalue(ra, luai_nummul(L, nb, nc));
-        }
-        else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_MUL)); }
+      vmcase(OP_MUL) l_mul: {
+        arithProtected(*, luai_nummul, TM_MUL, quicken, OP_MUL_II, OP_MUL_FF);
         vmbreak;
       }
       vmcase(OP_DIV) {  /* float division (always with floats) */
@@ -1043,7 +1207,7 @@ void luaV_execute (lua_State *L) {
         lua_Number nb;
         if (ttisinteger(rb)) {
           lua_Integer ib = ivalue(rb);
-          setivalue(ra, intop(-, 0, ib));
+          setivalue(ra, checkedintop(L, -, 0, ib));
         }
         else if (tonumber(rb, &nb)) {
           setfltvalue(ra, luai_numunm(L, nb));
@@ -1089,6 +1253,7 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sBx(i) < 0) nativeenter(1);  /* loop back edge */
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1102,7 +1267,9 @@ void luaV_execute (lua_State *L) {
         )
         vmbreak;
       }
-      vmcase(OP_LT) {
+      vmcase(OP_LT) l_lt: {
+        if (ttisinteger(RKB(i)) && ttisinteger(RKC(i)))
+          quicken(OP_LT_II);
         Protect(
           if (luaV_lessthan(L, RKB(i), RKC(i)) != GETARG_A(i))
             ci->u.l.savedpc++;
@@ -1111,7 +1278,9 @@ void luaV_execute (lua_State *L) {
         )
         vmbreak;
       }
-      vmcase(OP_LE) {
+      vmcase(OP_LE) l_le: {
+        if (ttisinteger(RKB(i)) && ttisinteger(RKC(i)))
+          quicken(OP_LE_II);
         Protect(
           if (luaV_lessequal(L, RKB(i), RKC(i)) != GETARG_A(i))
             ci->u.l.savedpc++;
@@ -1137,7 +1306,7 @@ void luaV_execute (lua_State *L) {
         }
         vmbreak;
       }
-      vmcase(OP_CALL) {
+      vmcase(OP_CALL) l_call: {
         int b = GETARG_B(i);
         int nresults = GETARG_C(i) - 1;
         if (b != 0) L->top = ra+b;  /* else previous instruction set top */
@@ -1197,7 +1366,7 @@ void luaV_execute (lua_State *L) {
           goto newframe;  /* restart luaV_execute over new Lua function */
         }
       }
-      vmcase(OP_FORLOOP) {
+      vmcase(OP_FORLOOP) l_forloop: {
         if (ttisinteger(ra)) {  /* integer loop? */
           lua_Integer step = ivalue(ra + 2);
           lua_Integer idx = intop(+, ivalue(ra), step); /* increment index */
@@ -1206,6 +1375,7 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgivalue(ra, idx);  /* update internal index... */
             setivalue(ra + 3, idx);  /* ...and external index */
+            nativeenter(1);
           }
         }
         else {  /* floating loop */
@@ -1217,35 +1387,13 @@ void luaV_execute (lua_State *L) {
             ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
             chgfltvalue(ra, idx);  /* update internal index... */
             setfltvalue(ra + 3, idx);  /* ...and external index */
+            nativeenter(1);
           }
         }
         vmbreak;
       }
       vmcase(OP_FORPREP) {
-        TValue *init = ra;
-        TValue *plimit = ra + 1;
-        TValue *pstep = ra + 2;
-        lua_Integer ilimit;
-        int stopnow;
-        if (ttisinteger(init) && ttisinteger(pstep) &&
-            forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
-          /* all values are integer */
-          lua_Integer initv = (stopnow ? 0 : ivalue(init));
-          setivalue(plimit, ilimit);
-          setivalue(init, intop(-, initv, ivalue(pstep)));
-        }
-        else {  /* try making all values floats */
-          lua_Number ninit; lua_Number nlimit; lua_Number nstep;
-          if (!tonumber(plimit, &nlimit))
-            luaG_runerror(L, "'for' limit must be a number");
-          setfltvalue(plimit, nlimit);
-          if (!tonumber(pstep, &nstep))
-            luaG_runerror(L, "'for' step must be a number");
-          setfltvalue(pstep, nstep);
-          if (!tonumber(init, &ninit))
-            luaG_runerror(L, "'for' initial value must be a number");
-          setfltvalue(init, luai_numsub(L, ninit, nstep));
-        }
+        luaV_forprep(L, ra);
         ci->u.l.savedpc += GETARG_sBx(i);
         vmbreak;
       }
@@ -1267,6 +1415,7 @@ void luaV_execute (lua_State *L) {
         if (!ttisnil(ra + 1)) {  /* continue loop? */
           setobjs2s(L, ra, ra + 1);  /* save control variable */
            ci->u.l.savedpc += GETARG_sBx(i);  /* jump back */
+           nativeenter(1);
         }
         vmbreak;
       }
@@ -1280,6 +1429,8 @@ void luaV_execute (lua_State *L) {
           lua_assert(GET_OPCODE(*ci->u.l.savedpc) == OP_EXTRAARG);
           c = GETARG_Ax(*ci->u.l.savedpc++);
         }
+        if (!ttistable(ra))  /* not statically checked for binary chunks */
+          luaG_runerror(L, "table expected in SETLIST");
         h = hvalue(ra);
         last = ((c-1)*LFIELDS_PER_FLUSH) + n;
         if (last > h->sizearray)  /* needs more space? */
@@ -1293,12 +1444,7 @@ void luaV_execute (lua_State *L) {
         vmbreak;
       }
       vmcase(OP_CLOSURE) {
-        Proto *p = cl->p->p[GETARG_Bx(i)];
-        LClosure *ncl = getcached(p, cl->upvals, base);  /* cached closure */
-        if (ncl == NULL)  /* no match? */
-          pushclosure(L, p, cl->upvals, base, ra);  /* create a new one */
-        else
-          setclLvalue(L, ra, ncl);  /* push cashed closure */
+        luaV_closure(L, cl->p->p[GETARG_Bx(i)], cl->upvals, base, ra);
         checkGC(L, ra + 1);
         vmbreak;
       }
@@ -1324,6 +1470,93 @@ void luaV_execute (lua_State *L) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_SWITCH) {
+        ci->u.l.savedpc = cl->p->code + luaV_switch(cl->p, i, ra);
+        vmbreak;
+      }
+      vmcase(OP_MOVE_MOVE) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(l_move);
+      }
+      vmcase(OP_MOVE_CALL) {
+        setobjs2s(L, ra, RB(i));
+        vmfuse(l_call);
+      }
+      vmcase(OP_LOADK_CALL) {
+        TValue *rb = k + GETARG_Bx(i);
+        setobj2s(L, ra, rb);
+        vmfuse(l_call);
+      }
+      vmcase(OP_GETTABUP_GETTABLE) {
+        TValue *upval = cl->upvals[GETARG_B(i)]->v;
+        TValue *rc = RKC(i);
+        if (iscached(GETARG_C(i), rc)) {
+          gettableCached(L, upval, rc, ra);
+        }
+        else gettableProtected(L, upval, rc, ra);
+        vmfuse(l_gettable);
+      }
+      vmcase(OP_SETTABLE_FORLOOP) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (iscached(GETARG_B(i), rb)) {
+          settableCached(L, ra, rb, rc);
+        }
+        else settableProtected(L, ra, rb, rc);
+        vmfuse(l_forloop);
+      }
+      vmcase(OP_ADD_FORLOOP) {
+        arithProtected(+, luai_numadd, TM_ADD, noquicken, 0, 0);
+        vmfuse(l_forloop);
+      }
+      vmcase(OP_MUL_MUL) {
+        arithProtected(*, luai_nummul, TM_MUL, noquicken, 0, 0);
+        vmfuse(l_mul);
+      }
+      vmcase(OP_ADD_II) {
+        arithQuick(ttisinteger, setivalue, ivalue, iadd, OP_ADD, l_add);
+      }
+      vmcase(OP_ADD_FF) {
+        arithQuick(ttisfloat, setfltvalue, fltvalue, fadd, OP_ADD, l_add);
+      }
+      vmcase(OP_SUB_II) {
+        arithQuick(ttisinteger, setivalue, ivalue, isub, OP_SUB, l_sub);
+      }
+      vmcase(OP_SUB_FF) {
+        arithQuick(ttisfloat, setfltvalue, fltvalue, fsub, OP_SUB, l_sub);
+      }
+      vmcase(OP_MUL_II) {
+        arithQuick(ttisinteger, setivalue, ivalue, imul, OP_MUL, l_mul);
+      }
+      vmcase(OP_MUL_FF) {
+        arithQuick(ttisfloat, setfltvalue, fltvalue, fmul, OP_MUL, l_mul);
+      }
+      vmcase(OP_LT_II) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (!(ttisinteger(rb) && ttisinteger(rc))) {
+          quicken(OP_LT);
+          goto l_lt;
+        }
+        if ((ivalue(rb) < ivalue(rc)) != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
+      vmcase(OP_LE_II) {
+        TValue *rb = RKB(i);
+        TValue *rc = RKC(i);
+        if (!(ttisinteger(rb) && ttisinteger(rc))) {
+          quicken(OP_LE);
+          goto l_le;
+        }
+        if ((ivalue(rb) <= ivalue(rc)) != GETARG_A(i))
+          ci->u.l.savedpc++;
+        else
+          donextjump(ci);
+        vmbreak;
+      }
     }
   }
 }
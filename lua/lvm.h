@@ -45,6 +45,24 @@
 
 #define intop(op,v1,v2) l_castU2S(l_castS2U(v1) op l_castS2U(v2))
 
+/*
+** With LUA_NANBOX integers only have 32 bits (see luaconf.h). An
+** addition, subtraction, multiplication or negation whose result needs
+** more bits then raises an error, instead of wrapping around where a
+** 64-bit integer would not have. 'intfits' tells whether the result of
+** 'op' fits, 'checkedintop' does the operation or raises the error.
+*/
+#if LUA_NANBOX
+#define intfits(op,v1,v2)	(intwide(op,v1,v2) >= LUA_MININTEGER && \
+                                 intwide(op,v1,v2) <= LUA_MAXINTEGER)
+#define intwide(op,v1,v2)	(cast(long long, v1) op cast(long long, v2))
+#define checkedintop(L,op,v1,v2) \
+	(intfits(op,v1,v2) ? intop(op,v1,v2) : luaV_intoverflow(L))
+#else
+#define intfits(op,v1,v2)	1
+#define checkedintop(L,op,v1,v2)	intop(op,v1,v2)
+#endif
+
 #define luaV_rawequalobj(t1,t2)		luaV_equalobj(NULL,t1,t2)
 
 
@@ -106,8 +124,15 @@ LUAI_FUNC void luaV_finishOp (lua_State *L);
 LUAI_FUNC void luaV_execute (lua_State *L);
 LUAI_FUNC void luaV_concat (lua_State *L, int total);
 LUAI_FUNC lua_Integer luaV_div (lua_State *L, lua_Integer x, lua_Integer y);
+#if LUA_NANBOX
+LUAI_FUNC lua_Integer luaV_intoverflow (lua_State *L);
+#endif
 LUAI_FUNC lua_Integer luaV_mod (lua_State *L, lua_Integer x, lua_Integer y);
 LUAI_FUNC lua_Integer luaV_shiftl (lua_Integer x, lua_Integer y);
 LUAI_FUNC void luaV_objlen (lua_State *L, StkId ra, const TValue *rb);
+LUAI_FUNC void luaV_closure (lua_State *L, Proto *p, UpVal **encup,
+                            StkId base, StkId ra);
+LUAI_FUNC void luaV_forprep (lua_State *L, StkId ra);
+LUAI_FUNC int luaV_switch (const Proto *p, Instruction i, const TValue *ra);
 
 #endif
@@ -0,0 +1,68 @@
+/**
+ * In-tree primitives behind the cryptographic operations of the mock TEE. SHA-256 is shared with the host
+ * (host/sha256.c), SHA-512, AES and GHASH live here.
+ */
+
+#ifndef MOCK_TEE_CRYPTO_H
+#define MOCK_TEE_CRYPTO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sha256.h"
+
+#define SHA512_DIGEST_SIZE	64
+#define SHA512_BLOCK_SIZE	128
+
+struct sha512_ctx {
+	uint64_t state[8];
+	uint64_t length;		/* bytes hashed so far */
+	uint8_t block[SHA512_BLOCK_SIZE];
+	size_t block_len;
+};
+
+void sha512_init(struct sha512_ctx *ctx);
+void sha512_update(struct sha512_ctx *ctx, const void *data, size_t len);
+void sha512_final(struct sha512_ctx *ctx, uint8_t digest[SHA512_DIGEST_SIZE]);
+
+#define AES_BLOCK_SIZE		16
+#define AES_MAX_ROUNDS		14
+
+struct aes_ctx {
+	uint32_t round_keys[4 * (AES_MAX_ROUNDS + 1)];
+	int rounds;
+};
+
+/**
+ * Expands an AES key for encryption.
+ *
+ * @param ctx            [out] The key schedule
+ * @param key            [in] The key
+ * @param key_len        [in] 16, 24 or 32
+ * @return 0 on success, -1 for an invalid key length
+ */
+int aes_set_key(struct aes_ctx *ctx, const uint8_t *key, size_t key_len);
+
+/* Encrypts a single block, in and out may overlap */
+void aes_encrypt_block(const struct aes_ctx *ctx, const uint8_t in[AES_BLOCK_SIZE], uint8_t out[AES_BLOCK_SIZE]);
+
+/* GHASH of AES-GCM, using 4 bit tables */
+struct ghash_ctx {
+	uint64_t hl[16], hh[16];	/* multiples of the hash key H */
+	uint8_t y[AES_BLOCK_SIZE];
+	uint8_t block[AES_BLOCK_SIZE];
+	size_t block_len;
+};
+
+/* Sets the hash key H = E(K, 0^128) and resets the state */
+void ghash_set_key(struct ghash_ctx *ctx, const uint8_t h[AES_BLOCK_SIZE]);
+void ghash_reset(struct ghash_ctx *ctx);
+void ghash_update(struct ghash_ctx *ctx, const void *data, size_t len);
+
+/* Zero pads the data hashed so far to a block boundary */
+void ghash_pad(struct ghash_ctx *ctx);
+
+/* Returns the hash of the (padded) data */
+void ghash_final(struct ghash_ctx *ctx, uint8_t out[AES_BLOCK_SIZE]);
+
+#endif /* MOCK_TEE_CRYPTO_H */
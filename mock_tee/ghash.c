@@ -0,0 +1,137 @@
+/**
+ * GHASH (NIST SP 800-38D), the universal hash of AES-GCM, see crypto.h. Multiplication in GF(2^128) uses Shoup's
+ * method with 4 bit tables.
+ */
+
+#include <string.h>
+
+#include "crypto.h"
+
+/* Reduction of the 4 bits shifted out per step */
+static const uint64_t last4[16] = {
+	0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+	0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+static uint64_t load_be64(const uint8_t *p){
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v = v << 8 | p[i];
+	return v;
+}
+
+static void store_be64(uint8_t *p, uint64_t v){
+	int i;
+
+	for (i = 7; i >= 0; i--, v >>= 8)
+		p[i] = (uint8_t)v;
+}
+
+void ghash_set_key(struct ghash_ctx *ctx, const uint8_t h[AES_BLOCK_SIZE]){
+
+	uint64_t vh = load_be64(h), vl = load_be64(h + 8);
+	uint32_t t;
+	int i, j;
+
+	/* hh/hl[i] = H * i, with the bits of i in GCM's reflected order */
+	ctx->hh[0] = ctx->hl[0] = 0;
+	ctx->hh[8] = vh;
+	ctx->hl[8] = vl;
+	for (i = 4; i > 0; i >>= 1){
+		t = (vl & 1) * 0xe1000000u;
+		vl = (vh << 63) | (vl >> 1);
+		vh = (vh >> 1) ^ ((uint64_t)t << 32);
+		ctx->hh[i] = vh;
+		ctx->hl[i] = vl;
+	}
+	for (i = 2; i <= 8; i *= 2){
+		for (j = 1; j < i; j++){
+			ctx->hh[i + j] = ctx->hh[i] ^ ctx->hh[j];
+			ctx->hl[i + j] = ctx->hl[i] ^ ctx->hl[j];
+		}
+	}
+
+	ghash_reset(ctx);
+}
+
+void ghash_reset(struct ghash_ctx *ctx){
+	memset(ctx->y, 0, sizeof(ctx->y));
+	ctx->block_len = 0;
+}
+
+/* y = (y ^ block) * H */
+static void ghash_block(struct ghash_ctx *ctx, const uint8_t *block){
+
+	uint8_t x[AES_BLOCK_SIZE];
+	uint64_t zh, zl;
+	uint8_t lo, hi, rem;
+	int i;
+
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		x[i] = ctx->y[i] ^ block[i];
+
+	lo = x[15] & 0xf;
+	zh = ctx->hh[lo];
+	zl = ctx->hl[lo];
+
+	for (i = 15; i >= 0; i--){
+		lo = x[i] & 0xf;
+		hi = x[i] >> 4;
+
+		if (i != 15){
+			rem = zl & 0xf;
+			zl = (zh << 60) | (zl >> 4);
+			zh = (zh >> 4) ^ (last4[rem] << 48);
+			zh ^= ctx->hh[lo];
+			zl ^= ctx->hl[lo];
+		}
+
+		rem = zl & 0xf;
+		zl = (zh << 60) | (zl >> 4);
+		zh = (zh >> 4) ^ (last4[rem] << 48);
+		zh ^= ctx->hh[hi];
+		zl ^= ctx->hl[hi];
+	}
+
+	store_be64(ctx->y, zh);
+	store_be64(ctx->y + 8, zl);
+}
+
+void ghash_update(struct ghash_ctx *ctx, const void *data, size_t len){
+
+	const uint8_t *p = data;
+	size_t n;
+
+	if (ctx->block_len){
+		n = AES_BLOCK_SIZE - ctx->block_len < len ? AES_BLOCK_SIZE - ctx->block_len : len;
+		memcpy(ctx->block + ctx->block_len, p, n);
+		ctx->block_len += n;
+		p += n;
+		len -= n;
+		if (ctx->block_len < AES_BLOCK_SIZE)
+			return;
+		ghash_block(ctx, ctx->block);
+		ctx->block_len = 0;
+	}
+
+	for (; len >= AES_BLOCK_SIZE; p += AES_BLOCK_SIZE, len -= AES_BLOCK_SIZE)
+		ghash_block(ctx, p);
+
+	memcpy(ctx->block, p, len);
+	ctx->block_len = len;
+}
+
+void ghash_pad(struct ghash_ctx *ctx){
+	if (!ctx->block_len)
+		return;
+	memset(ctx->block + ctx->block_len, 0, AES_BLOCK_SIZE - ctx->block_len);
+	ghash_block(ctx, ctx->block);
+	ctx->block_len = 0;
+}
+
+void ghash_final(struct ghash_ctx *ctx, uint8_t out[AES_BLOCK_SIZE]){
+	ghash_pad(ctx);
+	memcpy(out, ctx->y, AES_BLOCK_SIZE);
+}
@@ -0,0 +1,20 @@
+/**
+ * Compiler attribute shorthands TA code expects from the TA development kit
+ */
+
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#ifndef __maybe_unused
+#define __maybe_unused	__attribute__((unused))
+#endif
+
+#ifndef __noreturn
+#define __noreturn	__attribute__((noreturn))
+#endif
+
+#ifndef __unused
+#define __unused	__attribute__((unused))
+#endif
+
+#endif /* COMPILER_H */
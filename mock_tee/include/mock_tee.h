@@ -0,0 +1,56 @@
+/**
+ * In-process stand-in for OP-TEE, for running and benchmarking the Lua runtime on plain Linux.
+ *
+ * The mock is built as a libteec replacement (see LUA_TA_MOCK_TEE in CMakeLists.txt) that has the TA linked in.
+ * TEEC_InvokeCommand() copies temporary memory references through bounce buffers like the real libteec does, and
+ * then calls the TA entry points directly. Everything the TA needs from the TEE comes from the mock as well:
+ *
+ *  - TEE_Malloc() and the TA's malloc() share a heap that is capped like TA_DATA_SIZE caps the real TA heap
+ *  - persistent objects are files in a storage directory, named after the hex encoded object ID
+ *  - cryptography uses an in-tree implementation of SHA-2, HMAC, HKDF, AES-CTR and AES-GCM
+ *
+ * Configuration is read from the environment when the first context is initialized:
+ *
+ *  MOCK_TEE_STORAGE_DIR     directory of the persistent objects. Default: a fresh temporary directory
+ *                           that is removed when the process exits
+ *  MOCK_TEE_HEAP_SIZE       TA heap cap in bytes (default: TA_DATA_SIZE of the TA, 0 for no cap)
+ *  MOCK_TEE_SWITCH_NS       latency busy-waited on every transition between the normal and the secure world,
+ *                           i.e. twice per command (default: 0)
+ *  MOCK_TEE_LOG_LEVEL       TA log level, see trace.h (default: CFG_TEE_TA_LOG_LEVEL)
+ *
+ * All sessions share a single TA instance and commands are serialized, like for a single instance TA.
+ */
+
+#ifndef MOCK_TEE_H
+#define MOCK_TEE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MOCK_TEE_API	__attribute__((visibility("default")))
+
+struct mock_tee_config {
+	const char *storage_dir;	/* NULL for a temporary directory */
+	size_t heap_size;		/* 0 for no cap */
+	uint64_t switch_ns;
+	int log_level;
+};
+
+/**
+ * Overrides the configuration read from the environment. Has to be called before the first
+ * TEEC_InitializeContext(), later calls only change switch_ns and log_level.
+ *
+ * @param config         [in] The configuration
+ */
+MOCK_TEE_API void mock_tee_configure(const struct mock_tee_config *config);
+
+/* Returns the bytes currently allocated from the TA heap */
+MOCK_TEE_API size_t mock_tee_heap_used(void);
+
+/* Returns the largest number of bytes allocated from the TA heap at any time */
+MOCK_TEE_API size_t mock_tee_heap_peak(void);
+
+/* Returns the number of allocations that failed because of the heap cap */
+MOCK_TEE_API uint64_t mock_tee_heap_failures(void);
+
+#endif /* MOCK_TEE_H */
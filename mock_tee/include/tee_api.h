@@ -0,0 +1,10 @@
+/**
+ * OP-TEE's umbrella header for the internal core API, see tee_internal_api.h
+ */
+
+#ifndef TEE_API_H
+#define TEE_API_H
+
+#include <tee_internal_api.h>
+
+#endif /* TEE_API_H */
@@ -0,0 +1,117 @@
+/**
+ * Constants of the GlobalPlatform TEE internal core API (with the OP-TEE HKDF extension), see tee_internal_api.h
+ */
+
+#ifndef TEE_API_DEFINES_H
+#define TEE_API_DEFINES_H
+
+#define TEE_NUM_PARAMS			4
+
+#define TEE_SUCCESS			0x00000000
+#define TEE_ERROR_CORRUPT_OBJECT	0xF0100001
+#define TEE_ERROR_CORRUPT_OBJECT_2	0xF0100002
+#define TEE_ERROR_STORAGE_NOT_AVAILABLE	0xF0100003
+#define TEE_ERROR_GENERIC		0xFFFF0000
+#define TEE_ERROR_ACCESS_DENIED		0xFFFF0001
+#define TEE_ERROR_CANCEL		0xFFFF0002
+#define TEE_ERROR_ACCESS_CONFLICT	0xFFFF0003
+#define TEE_ERROR_EXCESS_DATA		0xFFFF0004
+#define TEE_ERROR_BAD_FORMAT		0xFFFF0005
+#define TEE_ERROR_BAD_PARAMETERS	0xFFFF0006
+#define TEE_ERROR_BAD_STATE		0xFFFF0007
+#define TEE_ERROR_ITEM_NOT_FOUND	0xFFFF0008
+#define TEE_ERROR_NOT_IMPLEMENTED	0xFFFF0009
+#define TEE_ERROR_NOT_SUPPORTED		0xFFFF000A
+#define TEE_ERROR_NO_DATA		0xFFFF000B
+#define TEE_ERROR_OUT_OF_MEMORY		0xFFFF000C
+#define TEE_ERROR_BUSY			0xFFFF000D
+#define TEE_ERROR_COMMUNICATION		0xFFFF000E
+#define TEE_ERROR_SECURITY		0xFFFF000F
+#define TEE_ERROR_SHORT_BUFFER		0xFFFF0010
+#define TEE_ERROR_EXTERNAL_CANCEL	0xFFFF0011
+#define TEE_ERROR_OVERFLOW		0xFFFF300F
+#define TEE_ERROR_TARGET_DEAD		0xFFFF3024
+#define TEE_ERROR_STORAGE_NO_SPACE	0xFFFF3041
+#define TEE_ERROR_MAC_INVALID		0xFFFF3071
+#define TEE_ERROR_SIGNATURE_INVALID	0xFFFF3072
+
+/* Parameter types */
+#define TEE_PARAM_TYPE_NONE		0
+#define TEE_PARAM_TYPE_VALUE_INPUT	1
+#define TEE_PARAM_TYPE_VALUE_OUTPUT	2
+#define TEE_PARAM_TYPE_VALUE_INOUT	3
+#define TEE_PARAM_TYPE_MEMREF_INPUT	5
+#define TEE_PARAM_TYPE_MEMREF_OUTPUT	6
+#define TEE_PARAM_TYPE_MEMREF_INOUT	7
+
+#define TEE_PARAM_TYPES(t0, t1, t2, t3) \
+	((t0) | ((t1) << 4) | ((t2) << 8) | ((t3) << 12))
+#define TEE_PARAM_TYPE_GET(t, i)	((((uint32_t)t) >> ((i) * 4)) & 0xF)
+
+/* Memory allocation hints */
+#define TEE_MALLOC_FILL_ZERO		0x00000000
+#define TEE_MALLOC_NO_FILL		0x00000001
+
+#define TEE_HANDLE_NULL			0
+
+/* Storage */
+#define TEE_STORAGE_PRIVATE		0x00000001
+#define TEE_OBJECT_ID_MAX_LEN		64
+#define TEE_DATA_MAX_POSITION		0xFFFFFFFF
+
+#define TEE_DATA_FLAG_ACCESS_READ	0x00000001
+#define TEE_DATA_FLAG_ACCESS_WRITE	0x00000002
+#define TEE_DATA_FLAG_ACCESS_WRITE_META	0x00000004
+#define TEE_DATA_FLAG_SHARE_READ	0x00000010
+#define TEE_DATA_FLAG_SHARE_WRITE	0x00000020
+#define TEE_DATA_FLAG_OVERWRITE		0x00000400
+
+#define TEE_HANDLE_FLAG_PERSISTENT	0x00010000
+#define TEE_HANDLE_FLAG_INITIALIZED	0x00020000
+#define TEE_HANDLE_FLAG_KEY_SET		0x00040000
+
+/* Operation modes */
+#define TEE_MODE_ENCRYPT		0
+#define TEE_MODE_DECRYPT		1
+#define TEE_MODE_SIGN			2
+#define TEE_MODE_VERIFY			3
+#define TEE_MODE_MAC			4
+#define TEE_MODE_DIGEST			5
+#define TEE_MODE_DERIVE			6
+
+/* Operation classes */
+#define TEE_OPERATION_CIPHER		1
+#define TEE_OPERATION_MAC		3
+#define TEE_OPERATION_AE		4
+#define TEE_OPERATION_DIGEST		5
+#define TEE_OPERATION_KEY_DERIVATION	8
+
+/* Algorithms */
+#define TEE_ALG_AES_ECB_NOPAD		0x10000010
+#define TEE_ALG_AES_CBC_NOPAD		0x10000110
+#define TEE_ALG_AES_CTR			0x10000210
+#define TEE_ALG_AES_GCM			0x40000810
+#define TEE_ALG_SHA256			0x50000004
+#define TEE_ALG_SHA512			0x50000006
+#define TEE_ALG_HMAC_SHA256		0x30000004
+#define TEE_ALG_HMAC_SHA512		0x30000006
+#define TEE_ALG_HKDF_SHA256_DERIVE_KEY	0x800040C0
+#define TEE_ALG_HKDF_SHA512_DERIVE_KEY	0x800060C0
+
+/* Object types */
+#define TEE_TYPE_AES			0xA0000010
+#define TEE_TYPE_HMAC_SHA256		0xA0000004
+#define TEE_TYPE_HMAC_SHA512		0xA0000006
+#define TEE_TYPE_GENERIC_SECRET		0xA0000000
+#define TEE_TYPE_DATA			0xA00000BF
+#define TEE_TYPE_HKDF_IKM		0xA10000C0
+
+/* Attributes, bit 29 marks value attributes */
+#define TEE_ATTR_BIT_VALUE		(1 << 29)
+#define TEE_ATTR_SECRET_VALUE		0xC0000000
+#define TEE_ATTR_HKDF_IKM		0xC00001C0
+#define TEE_ATTR_HKDF_SALT		0xD00002C0
+#define TEE_ATTR_HKDF_INFO		0xD00003C0
+#define TEE_ATTR_HKDF_OKM_LENGTH	0xF00004C0
+
+#endif /* TEE_API_DEFINES_H */
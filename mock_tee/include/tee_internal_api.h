@@ -0,0 +1,106 @@
+/**
+ * GlobalPlatform TEE internal core API as implemented by the in-process mock TEE (see mock_tee.h).
+ *
+ * Covers what the Lua runtime TA uses: memory, time, random numbers, persistent objects and the symmetric
+ * cryptography (digests, MACs, ciphers, AES-GCM, HKDF). Constants follow OP-TEE, so TA code builds unchanged.
+ */
+
+#ifndef TEE_INTERNAL_API_H
+#define TEE_INTERNAL_API_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <compiler.h>
+#include <tee_api_defines.h>
+#include <tee_api_types.h>
+#include <trace.h>
+
+/* TA entry points, implemented by the TA */
+TEE_Result TA_CreateEntryPoint(void);
+void TA_DestroyEntryPoint(void);
+TEE_Result TA_OpenSessionEntryPoint(uint32_t paramTypes, TEE_Param params[TEE_NUM_PARAMS], void **sessionContext);
+void TA_CloseSessionEntryPoint(void *sessionContext);
+TEE_Result TA_InvokeCommandEntryPoint(void *sessionContext, uint32_t commandID, uint32_t paramTypes,
+		TEE_Param params[TEE_NUM_PARAMS]);
+
+/* Panics */
+void TEE_Panic(TEE_Result panicCode) __noreturn;
+
+/* Memory, TEE_Malloc() and friends draw from the capped TA heap */
+void *TEE_Malloc(uint32_t size, uint32_t hint);
+void *TEE_Realloc(void *buffer, uint32_t newSize);
+void TEE_Free(void *buffer);
+void *TEE_MemMove(void *dest, const void *src, uint32_t size);
+int32_t TEE_MemCompare(const void *buffer1, const void *buffer2, uint32_t size);
+void *TEE_MemFill(void *buff, uint32_t x, uint32_t size);
+
+/* Time and random numbers */
+void TEE_GetSystemTime(TEE_Time *time);
+void TEE_GetREETime(TEE_Time *time);
+TEE_Result TEE_Wait(uint32_t timeout);
+void TEE_GenerateRandom(void *randomBuffer, uint32_t randomBufferLen);
+
+/* Transient objects */
+TEE_Result TEE_AllocateTransientObject(uint32_t objectType, uint32_t maxKeySize, TEE_ObjectHandle *object);
+void TEE_FreeTransientObject(TEE_ObjectHandle object);
+void TEE_ResetTransientObject(TEE_ObjectHandle object);
+TEE_Result TEE_PopulateTransientObject(TEE_ObjectHandle object, const TEE_Attribute *attrs, uint32_t attrCount);
+void TEE_InitRefAttribute(TEE_Attribute *attr, uint32_t attributeID, const void *buffer, uint32_t length);
+void TEE_InitValueAttribute(TEE_Attribute *attr, uint32_t attributeID, uint32_t a, uint32_t b);
+TEE_Result TEE_GetObjectBufferAttribute(TEE_ObjectHandle object, uint32_t attributeID, void *buffer, uint32_t *size);
+TEE_Result TEE_GetObjectInfo1(TEE_ObjectHandle object, TEE_ObjectInfo *objectInfo);
+void TEE_CloseObject(TEE_ObjectHandle object);
+
+/* Persistent objects */
+TEE_Result TEE_OpenPersistentObject(uint32_t storageID, const void *objectID, uint32_t objectIDLen,
+		uint32_t flags, TEE_ObjectHandle *object);
+TEE_Result TEE_CreatePersistentObject(uint32_t storageID, const void *objectID, uint32_t objectIDLen,
+		uint32_t flags, TEE_ObjectHandle attributes, const void *initialData, uint32_t initialDataLen,
+		TEE_ObjectHandle *object);
+TEE_Result TEE_CloseAndDeletePersistentObject1(TEE_ObjectHandle object);
+void TEE_CloseAndDeletePersistentObject(TEE_ObjectHandle object);
+TEE_Result TEE_RenamePersistentObject(TEE_ObjectHandle object, const void *newObjectID, uint32_t newObjectIDLen);
+TEE_Result TEE_ReadObjectData(TEE_ObjectHandle object, void *buffer, uint32_t size, uint32_t *count);
+TEE_Result TEE_WriteObjectData(TEE_ObjectHandle object, const void *buffer, uint32_t size);
+TEE_Result TEE_TruncateObjectData(TEE_ObjectHandle object, uint32_t size);
+TEE_Result TEE_SeekObjectData(TEE_ObjectHandle object, int32_t offset, TEE_Whence whence);
+
+/* Operations */
+TEE_Result TEE_AllocateOperation(TEE_OperationHandle *operation, uint32_t algorithm, uint32_t mode,
+		uint32_t maxKeySize);
+void TEE_FreeOperation(TEE_OperationHandle operation);
+void TEE_ResetOperation(TEE_OperationHandle operation);
+TEE_Result TEE_SetOperationKey(TEE_OperationHandle operation, TEE_ObjectHandle key);
+
+void TEE_DigestUpdate(TEE_OperationHandle operation, const void *chunk, uint32_t chunkSize);
+TEE_Result TEE_DigestDoFinal(TEE_OperationHandle operation, const void *chunk, uint32_t chunkLen,
+		void *hash, uint32_t *hashLen);
+
+void TEE_CipherInit(TEE_OperationHandle operation, const void *IV, uint32_t IVLen);
+TEE_Result TEE_CipherUpdate(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen);
+TEE_Result TEE_CipherDoFinal(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen);
+
+void TEE_MACInit(TEE_OperationHandle operation, const void *IV, uint32_t IVLen);
+void TEE_MACUpdate(TEE_OperationHandle operation, const void *chunk, uint32_t chunkSize);
+TEE_Result TEE_MACComputeFinal(TEE_OperationHandle operation, const void *message, uint32_t messageLen,
+		void *mac, uint32_t *macLen);
+TEE_Result TEE_MACCompareFinal(TEE_OperationHandle operation, const void *message, uint32_t messageLen,
+		const void *mac, uint32_t macLen);
+
+TEE_Result TEE_AEInit(TEE_OperationHandle operation, const void *nonce, uint32_t nonceLen, uint32_t tagLen,
+		uint32_t AADLen, uint32_t payloadLen);
+void TEE_AEUpdateAAD(TEE_OperationHandle operation, const void *AADdata, uint32_t AADdataLen);
+TEE_Result TEE_AEUpdate(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen);
+TEE_Result TEE_AEEncryptFinal(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen, void *tag, uint32_t *tagLen);
+TEE_Result TEE_AEDecryptFinal(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen, const void *tag, uint32_t tagLen);
+
+void TEE_DeriveKey(TEE_OperationHandle operation, const TEE_Attribute *params, uint32_t paramCount,
+		TEE_ObjectHandle derivedKey);
+
+#endif /* TEE_INTERNAL_API_H */
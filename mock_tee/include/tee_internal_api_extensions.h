@@ -0,0 +1,10 @@
+/**
+ * OP-TEE extensions of the internal core API. The mock has none beyond the HKDF constants in tee_api_defines.h.
+ */
+
+#ifndef TEE_INTERNAL_API_EXTENSIONS_H
+#define TEE_INTERNAL_API_EXTENSIONS_H
+
+#include <tee_internal_api.h>
+
+#endif /* TEE_INTERNAL_API_EXTENSIONS_H */
@@ -0,0 +1,24 @@
+/**
+ * TA logging macros. Messages go to stderr if their level is at most CFG_TEE_TA_LOG_LEVEL
+ * (overridable at run time with MOCK_TEE_LOG_LEVEL, see mock_tee.h). MSG() is always printed.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_MIN	1
+#define TRACE_ERROR	1
+#define TRACE_INFO	2
+#define TRACE_DEBUG	3
+#define TRACE_FLOW	4
+
+void mock_tee_trace(int level, const char *func, int line, const char *fmt, ...)
+	__attribute__((format(printf, 4, 5)));
+
+#define EMSG(...)	mock_tee_trace(TRACE_ERROR, __func__, __LINE__, __VA_ARGS__)
+#define IMSG(...)	mock_tee_trace(TRACE_INFO, __func__, __LINE__, __VA_ARGS__)
+#define DMSG(...)	mock_tee_trace(TRACE_DEBUG, __func__, __LINE__, __VA_ARGS__)
+#define FMSG(...)	mock_tee_trace(TRACE_FLOW, __func__, __LINE__, __VA_ARGS__)
+#define MSG(...)	mock_tee_trace(0, NULL, 0, __VA_ARGS__)
+
+#endif /* TRACE_H */
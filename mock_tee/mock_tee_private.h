@@ -0,0 +1,53 @@
+/**
+ * State shared between the parts of the mock TEE (see mock_tee.h)
+ */
+
+#ifndef MOCK_TEE_PRIVATE_H
+#define MOCK_TEE_PRIVATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <tee_internal_api.h>
+
+#include "mock_tee.h"
+#include "crypto.h"
+
+/*
+ * The library is linked with --wrap for malloc(), calloc(), realloc() and free(), so the allocations of the TA
+ * (and of the Lua interpreter inside it) are accounted to the capped TA heap. Memory of the mock TEE itself is
+ * not part of the TA heap and comes from the real allocator.
+ */
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+/* The active configuration, see mock_tee_configure() */
+extern struct mock_tee_config mock_tee_config;
+
+/* Reads the configuration from the environment and prepares the storage directory, only the first call does anything */
+void mock_tee_init(void);
+
+/* Busy-waits for the configured world switch latency */
+void mock_tee_world_switch(void);
+
+/* Returns the directory of the persistent objects */
+const char* mock_tee_storage_dir(void);
+
+/* Both transient and persistent objects */
+struct __TEE_ObjectHandle {
+	TEE_ObjectInfo info;
+
+	/* Transient objects: the secret value (or HKDF input keying material) */
+	uint8_t *secret;
+	uint32_t secret_len;
+
+	/* Persistent objects: the complete data stream is kept in memory and written through on every change */
+	char *path;
+	uint32_t flags;
+	uint8_t *data;
+	uint32_t capacity;
+};
+
+#endif /* MOCK_TEE_PRIVATE_H */
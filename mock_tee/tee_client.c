@@ -0,0 +1,291 @@
+/**
+ * GlobalPlatform TEE client API of the mock TEE (see mock_tee.h). Commands are passed to the entry points of the
+ * linked in TA, with temporary memory references copied through bounce buffers like the real libteec does.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tee_client_api.h>
+
+#include "mock_tee_private.h"
+#include "user_ta_header_defines.h"
+
+/* Serializes the TA entry points, see mock_tee.h */
+static pthread_mutex_t ta_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int ta_sessions;
+static uint32_t next_session_id = 1;
+
+static const TEEC_UUID ta_uuid = TA_UUID;
+
+
+MOCK_TEE_API TEEC_Result TEEC_InitializeContext(const char *name, TEEC_Context *context){
+
+	(void)name;
+	if (!context)
+		return TEEC_ERROR_BAD_PARAMETERS;
+
+	mock_tee_init();
+	context->fd = -1;
+	context->priv = NULL;
+	return TEEC_SUCCESS;
+}
+
+MOCK_TEE_API void TEEC_FinalizeContext(TEEC_Context *context){
+	(void)context;
+}
+
+/*
+ * Copies the parameters of a client operation to the TA parameters. Temporary memory references get bounce buffers
+ * allocated outside of the TA heap, input data is copied in.
+ */
+static TEEC_Result params_to_ta(TEEC_Operation *operation, uint32_t *types, TEE_Param *params){
+
+	uint32_t i, type;
+
+	*types = 0;
+	memset(params, 0, sizeof(TEE_Param) * TEE_NUM_PARAMS);
+	if (!operation)
+		return TEEC_SUCCESS;
+
+	for (i = 0; i < TEEC_CONFIG_PAYLOAD_REF_COUNT; i++){
+		TEEC_Parameter *p = &operation->params[i];
+
+		type = TEEC_PARAM_TYPE_GET(operation->paramTypes, i);
+		switch (type){
+		case TEEC_NONE:
+			break;
+
+		case TEEC_VALUE_INPUT:
+		case TEEC_VALUE_OUTPUT:
+		case TEEC_VALUE_INOUT:
+			params[i].value.a = p->value.a;
+			params[i].value.b = p->value.b;
+			break;
+
+		case TEEC_MEMREF_TEMP_INPUT:
+		case TEEC_MEMREF_TEMP_OUTPUT:
+		case TEEC_MEMREF_TEMP_INOUT:
+			if (p->tmpref.size > UINT32_MAX || (!p->tmpref.buffer && p->tmpref.size))
+				return TEEC_ERROR_BAD_PARAMETERS;
+			if (p->tmpref.buffer){
+				params[i].memref.buffer = __real_malloc(p->tmpref.size ? p->tmpref.size : 1);
+				if (!params[i].memref.buffer)
+					return TEEC_ERROR_OUT_OF_MEMORY;
+				if (type != TEEC_MEMREF_TEMP_OUTPUT)
+					memcpy(params[i].memref.buffer, p->tmpref.buffer, p->tmpref.size);
+				else
+					memset(params[i].memref.buffer, 0, p->tmpref.size);
+			}
+			params[i].memref.size = p->tmpref.size;
+			break;
+
+		default:
+			/* Registered shared memory is not supported */
+			return TEEC_ERROR_NOT_SUPPORTED;
+		}
+
+		/* The TEEC and TEE parameter type values are the same */
+		*types |= type << (i * 4);
+	}
+
+	return TEEC_SUCCESS;
+}
+
+/*
+ * Copies output values and output data back to the client operation, also on failures so the required size of
+ * short buffers gets reported. Frees the bounce buffers.
+ */
+static void params_from_ta(TEEC_Operation *operation, uint32_t types, TEE_Param *params, int copy){
+
+	uint32_t i, type;
+
+	for (i = 0; i < TEE_NUM_PARAMS; i++){
+		TEEC_Parameter *p = &operation->params[i];
+
+		type = TEE_PARAM_TYPE_GET(types, i);
+		switch (type){
+		case TEE_PARAM_TYPE_VALUE_OUTPUT:
+		case TEE_PARAM_TYPE_VALUE_INOUT:
+			if (copy){
+				p->value.a = params[i].value.a;
+				p->value.b = params[i].value.b;
+			}
+			break;
+
+		case TEE_PARAM_TYPE_MEMREF_OUTPUT:
+		case TEE_PARAM_TYPE_MEMREF_INOUT:
+			if (copy){
+				if (p->tmpref.buffer)
+					memcpy(p->tmpref.buffer, params[i].memref.buffer,
+					       params[i].memref.size < p->tmpref.size ? params[i].memref.size : p->tmpref.size);
+				p->tmpref.size = params[i].memref.size;
+			}
+			__real_free(params[i].memref.buffer);
+			break;
+
+		case TEE_PARAM_TYPE_MEMREF_INPUT:
+			__real_free(params[i].memref.buffer);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+MOCK_TEE_API TEEC_Result TEEC_OpenSession(TEEC_Context *context, TEEC_Session *session, const TEEC_UUID *destination,
+		uint32_t connectionMethod, const void *connectionData, TEEC_Operation *operation, uint32_t *returnOrigin){
+
+	TEE_Param params[TEE_NUM_PARAMS];
+	uint32_t types, origin = TEEC_ORIGIN_API;
+	void *sess_ctx = NULL;
+	TEEC_Result res;
+
+	(void)connectionMethod;
+	(void)connectionData;
+
+	if (!context || !session || !destination){
+		res = TEEC_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+	if (memcmp(destination, &ta_uuid, sizeof(ta_uuid))){
+		res = TEEC_ERROR_ITEM_NOT_FOUND;
+		origin = TEEC_ORIGIN_TEE;
+		goto out;
+	}
+
+	res = params_to_ta(operation, &types, params);
+	if (res != TEEC_SUCCESS){
+		if (operation)
+			params_from_ta(operation, types, params, 0);
+		goto out;
+	}
+
+	mock_tee_world_switch();
+	pthread_mutex_lock(&ta_lock);
+
+	/* The TA instance is created with the first session */
+	res = TEEC_SUCCESS;
+	if (!ta_sessions)
+		res = TA_CreateEntryPoint();
+	if (res == TEEC_SUCCESS){
+		res = TA_OpenSessionEntryPoint(types, params, &sess_ctx);
+		if (res == TEEC_SUCCESS){
+			ta_sessions++;
+			session->session_id = next_session_id++;
+		} else if (!ta_sessions){
+			TA_DestroyEntryPoint();
+		}
+	}
+
+	pthread_mutex_unlock(&ta_lock);
+	mock_tee_world_switch();
+
+	origin = TEEC_ORIGIN_TRUSTED_APP;
+	if (operation)
+		params_from_ta(operation, types, params, 1);
+
+	if (res == TEEC_SUCCESS){
+		session->ctx = context;
+		session->priv = sess_ctx;
+	}
+
+out:
+	if (returnOrigin)
+		*returnOrigin = origin;
+	return res;
+}
+
+MOCK_TEE_API void TEEC_CloseSession(TEEC_Session *session){
+
+	if (!session || !session->ctx)
+		return;
+
+	mock_tee_world_switch();
+	pthread_mutex_lock(&ta_lock);
+
+	TA_CloseSessionEntryPoint(session->priv);
+	if (!--ta_sessions)
+		TA_DestroyEntryPoint();
+
+	pthread_mutex_unlock(&ta_lock);
+	mock_tee_world_switch();
+
+	session->ctx = NULL;
+	session->priv = NULL;
+}
+
+MOCK_TEE_API TEEC_Result TEEC_InvokeCommand(TEEC_Session *session, uint32_t commandID, TEEC_Operation *operation,
+		uint32_t *returnOrigin){
+
+	TEE_Param params[TEE_NUM_PARAMS];
+	uint32_t types, origin = TEEC_ORIGIN_API;
+	TEEC_Result res;
+
+	if (!session || !session->ctx){
+		res = TEEC_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+
+	res = params_to_ta(operation, &types, params);
+	if (res != TEEC_SUCCESS){
+		if (operation)
+			params_from_ta(operation, types, params, 0);
+		goto out;
+	}
+
+	mock_tee_world_switch();
+	pthread_mutex_lock(&ta_lock);
+	res = TA_InvokeCommandEntryPoint(session->priv, commandID, types, params);
+	pthread_mutex_unlock(&ta_lock);
+	mock_tee_world_switch();
+
+	origin = TEEC_ORIGIN_TRUSTED_APP;
+	if (operation)
+		params_from_ta(operation, types, params, 1);
+
+out:
+	if (returnOrigin)
+		*returnOrigin = origin;
+	return res;
+}
+
+MOCK_TEE_API TEEC_Result TEEC_RegisterSharedMemory(TEEC_Context *context, TEEC_SharedMemory *sharedMem){
+
+	if (!context || !sharedMem)
+		return TEEC_ERROR_BAD_PARAMETERS;
+	sharedMem->alloced_size = sharedMem->size;
+	sharedMem->shadow_buffer = NULL;
+	sharedMem->buffer_allocated = 0;
+	return TEEC_SUCCESS;
+}
+
+MOCK_TEE_API TEEC_Result TEEC_AllocateSharedMemory(TEEC_Context *context, TEEC_SharedMemory *sharedMem){
+
+	if (!context || !sharedMem)
+		return TEEC_ERROR_BAD_PARAMETERS;
+	sharedMem->buffer = __real_calloc(1, sharedMem->size ? sharedMem->size : 1);
+	if (!sharedMem->buffer)
+		return TEEC_ERROR_OUT_OF_MEMORY;
+	sharedMem->alloced_size = sharedMem->size;
+	sharedMem->shadow_buffer = NULL;
+	sharedMem->buffer_allocated = 1;
+	return TEEC_SUCCESS;
+}
+
+MOCK_TEE_API void TEEC_ReleaseSharedMemory(TEEC_SharedMemory *sharedMemory){
+
+	if (!sharedMemory)
+		return;
+	if (sharedMemory->buffer_allocated)
+		__real_free(sharedMemory->buffer);
+	sharedMemory->buffer = NULL;
+	sharedMemory->size = 0;
+	sharedMemory->buffer_allocated = 0;
+}
+
+MOCK_TEE_API void TEEC_RequestCancellation(TEEC_Operation *operation){
+	(void)operation;
+}
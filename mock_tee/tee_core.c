@@ -0,0 +1,325 @@
+/**
+ * Configuration, TA heap, memory, time, random numbers and logging of the mock TEE (see mock_tee.h)
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock_tee_private.h"
+
+/* TA_DATA_SIZE, the heap of the real TA */
+#include "user_ta_header_defines.h"
+
+#ifndef CFG_TEE_TA_LOG_LEVEL
+#define CFG_TEE_TA_LOG_LEVEL	1
+#endif
+
+struct mock_tee_config mock_tee_config = {
+	.storage_dir = NULL,
+	.heap_size = TA_DATA_SIZE,
+	.switch_ns = 0,
+	.log_level = CFG_TEE_TA_LOG_LEVEL,
+};
+
+static int configured = 0;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/* Every TA heap block starts with its size, so frees can be accounted */
+#define HEAP_HEADER	16
+
+static size_t heap_used;
+static size_t heap_peak;
+static uint64_t heap_failures;
+
+
+MOCK_TEE_API void mock_tee_configure(const struct mock_tee_config *config){
+
+	mock_tee_config.switch_ns = config->switch_ns;
+	mock_tee_config.log_level = config->log_level;
+	if (configured)
+		return;
+	mock_tee_config.storage_dir = config->storage_dir;
+	mock_tee_config.heap_size = config->heap_size;
+	configured = 1;
+}
+
+MOCK_TEE_API size_t mock_tee_heap_used(void){
+	return __atomic_load_n(&heap_used, __ATOMIC_RELAXED);
+}
+
+MOCK_TEE_API size_t mock_tee_heap_peak(void){
+	return __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+}
+
+MOCK_TEE_API uint64_t mock_tee_heap_failures(void){
+	return __atomic_load_n(&heap_failures, __ATOMIC_RELAXED);
+}
+
+
+static void read_environment(void){
+
+	const char *s;
+
+	if (configured)
+		return;
+	configured = 1;
+
+	if ((s = getenv("MOCK_TEE_STORAGE_DIR")) && *s)
+		mock_tee_config.storage_dir = s;
+	if ((s = getenv("MOCK_TEE_HEAP_SIZE")) && *s)
+		mock_tee_config.heap_size = strtoull(s, NULL, 0);
+	if ((s = getenv("MOCK_TEE_SWITCH_NS")) && *s)
+		mock_tee_config.switch_ns = strtoull(s, NULL, 0);
+	if ((s = getenv("MOCK_TEE_LOG_LEVEL")) && *s)
+		mock_tee_config.log_level = atoi(s);
+}
+
+static void init(void){
+	read_environment();
+	mock_tee_storage_dir();
+}
+
+void mock_tee_init(void){
+	pthread_once(&init_once, init);
+}
+
+
+static uint64_t monotonic_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void mock_tee_world_switch(void){
+
+	uint64_t ns = mock_tee_config.switch_ns;
+	uint64_t end;
+
+	if (!ns)
+		return;
+
+	/* Spin instead of sleeping, the latencies of interest are far below the scheduler granularity */
+	end = monotonic_ns() + ns;
+	while (monotonic_ns() < end)
+		;
+}
+
+
+/*
+ * TA heap
+ */
+
+static void *heap_alloc(size_t size){
+
+	size_t cap = mock_tee_config.heap_size;
+	size_t used = __atomic_add_fetch(&heap_used, size, __ATOMIC_RELAXED);
+	size_t peak;
+	char *p;
+
+	if (cap && used > cap){
+		__atomic_sub_fetch(&heap_used, size, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&heap_failures, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	p = __real_malloc(HEAP_HEADER + size);
+	if (!p){
+		__atomic_sub_fetch(&heap_used, size, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	*(size_t*)p = size;
+
+	peak = __atomic_load_n(&heap_peak, __ATOMIC_RELAXED);
+	while (used > peak && !__atomic_compare_exchange_n(&heap_peak, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	return p + HEAP_HEADER;
+}
+
+static void heap_free(void *ptr){
+
+	char *p;
+
+	if (!ptr)
+		return;
+	p = (char*)ptr - HEAP_HEADER;
+	__atomic_sub_fetch(&heap_used, *(size_t*)p, __ATOMIC_RELAXED);
+	__real_free(p);
+}
+
+static void *heap_realloc(void *ptr, size_t size){
+
+	size_t old_size;
+	void *p;
+
+	if (!ptr)
+		return heap_alloc(size);
+	if (!size){
+		heap_free(ptr);
+		return NULL;
+	}
+
+	old_size = *(size_t*)((char*)ptr - HEAP_HEADER);
+	if (size <= old_size && size >= old_size / 2)
+		return ptr;
+
+	p = heap_alloc(size);
+	if (!p)
+		return NULL;
+	memcpy(p, ptr, size < old_size ? size : old_size);
+	heap_free(ptr);
+	return p;
+}
+
+void *__wrap_malloc(size_t size){
+	return heap_alloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size){
+
+	void *p;
+
+	if (size && nmemb > (size_t)-1 / size)
+		return NULL;
+	p = heap_alloc(nmemb * size);
+	if (p)
+		memset(p, 0, nmemb * size);
+	return p;
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+	return heap_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr){
+	heap_free(ptr);
+}
+
+
+/*
+ * Memory
+ */
+
+void *TEE_Malloc(uint32_t size, uint32_t hint){
+
+	void *p = heap_alloc(size);
+
+	if (p && !(hint & TEE_MALLOC_NO_FILL))
+		memset(p, 0, size);
+	return p;
+}
+
+void *TEE_Realloc(void *buffer, uint32_t newSize){
+	return heap_realloc(buffer, newSize);
+}
+
+void TEE_Free(void *buffer){
+	heap_free(buffer);
+}
+
+void *TEE_MemMove(void *dest, const void *src, uint32_t size){
+	return memmove(dest, src, size);
+}
+
+int32_t TEE_MemCompare(const void *buffer1, const void *buffer2, uint32_t size){
+
+	int r = memcmp(buffer1, buffer2, size);
+
+	return r < 0 ? -1 : r > 0;
+}
+
+void *TEE_MemFill(void *buff, uint32_t x, uint32_t size){
+	return memset(buff, (int)x, size);
+}
+
+
+/*
+ * Panics, time and random numbers
+ */
+
+void TEE_Panic(TEE_Result panicCode){
+	fprintf(stderr, "E/TA: TA panicked with code 0x%x\n", panicCode);
+	/* Not abort(), the TA build of Lua defines its own abort() that panics */
+	raise(SIGABRT);
+	_exit(128 + SIGABRT);
+}
+
+void TEE_GetSystemTime(TEE_Time *time){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	time->seconds = ts.tv_sec;
+	time->millis = ts.tv_nsec / 1000000;
+}
+
+void TEE_GetREETime(TEE_Time *time){
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	time->seconds = ts.tv_sec;
+	time->millis = ts.tv_nsec / 1000000;
+}
+
+TEE_Result TEE_Wait(uint32_t timeout){
+
+	struct timespec ts = { timeout / 1000, (timeout % 1000) * 1000000l };
+
+	while (nanosleep(&ts, &ts) && errno == EINTR)
+		;
+	return TEE_SUCCESS;
+}
+
+void TEE_GenerateRandom(void *randomBuffer, uint32_t randomBufferLen){
+
+	uint8_t *p = randomBuffer;
+
+	while (randomBufferLen > 0){
+		ssize_t n = getrandom(p, randomBufferLen, 0);
+
+		if (n < 0){
+			if (errno == EINTR)
+				continue;
+			TEE_Panic(TEE_ERROR_GENERIC);
+		}
+		p += n;
+		randomBufferLen -= n;
+	}
+}
+
+
+/*
+ * Logging
+ */
+
+void mock_tee_trace(int level, const char *func, int line, const char *fmt, ...){
+
+	static const char prefix[] = "MEIDF";
+	char msg[512];
+	va_list ap;
+	size_t len;
+
+	if (level > mock_tee_config.log_level)
+		return;
+
+	va_start(ap, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+
+	/* Like OP-TEE, every message ends up on its own line */
+	len = strlen(msg);
+	if (func)
+		fprintf(stderr, "%c/TA: %s:%d %s%s", prefix[level], func, line, msg, len && msg[len-1] == '\n' ? "" : "\n");
+	else
+		fprintf(stderr, "%s%s", msg, len && msg[len-1] == '\n' ? "" : "\n");
+}
@@ -0,0 +1,698 @@
+/**
+ * Transient objects and cryptographic operations of the mock TEE (see mock_tee.h): SHA-256/512 digests,
+ * HMAC-SHA256/512, HKDF-SHA256/512 key derivation, AES-CTR and AES-GCM.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock_tee_private.h"
+
+#define MAX_DIGEST_SIZE		SHA512_DIGEST_SIZE
+#define MAX_BLOCK_SIZE		SHA512_BLOCK_SIZE
+
+union hash_ctx {
+	struct sha256_ctx sha256;
+	struct sha512_ctx sha512;
+};
+
+struct hash_ops {
+	size_t digest_size;
+	size_t block_size;
+	void (*init)(union hash_ctx *ctx);
+	void (*update)(union hash_ctx *ctx, const void *data, size_t len);
+	void (*final)(union hash_ctx *ctx, uint8_t *digest);
+};
+
+static void sha256_init_ctx(union hash_ctx *ctx){ sha256_init(&ctx->sha256); }
+static void sha256_update_ctx(union hash_ctx *ctx, const void *data, size_t len){ sha256_update(&ctx->sha256, data, len); }
+static void sha256_final_ctx(union hash_ctx *ctx, uint8_t *digest){ sha256_final(&ctx->sha256, digest); }
+static void sha512_init_ctx(union hash_ctx *ctx){ sha512_init(&ctx->sha512); }
+static void sha512_update_ctx(union hash_ctx *ctx, const void *data, size_t len){ sha512_update(&ctx->sha512, data, len); }
+static void sha512_final_ctx(union hash_ctx *ctx, uint8_t *digest){ sha512_final(&ctx->sha512, digest); }
+
+static const struct hash_ops sha256_ops = {
+	SHA256_DIGEST_SIZE, 64, sha256_init_ctx, sha256_update_ctx, sha256_final_ctx
+};
+static const struct hash_ops sha512_ops = {
+	SHA512_DIGEST_SIZE, SHA512_BLOCK_SIZE, sha512_init_ctx, sha512_update_ctx, sha512_final_ctx
+};
+
+struct __TEE_OperationHandle {
+	uint32_t algorithm;
+	uint32_t mode;
+	uint32_t op_class;
+	uint32_t max_key_size;
+	int key_set;
+	const struct hash_ops *hash;
+
+	/* Digests and the inner hash of HMAC */
+	union hash_ctx ctx;
+
+	/* HMAC: the key padded to the block size and xor-ed with the outer pad */
+	uint8_t hmac_opad[MAX_BLOCK_SIZE];
+	uint8_t hmac_ipad[MAX_BLOCK_SIZE];
+
+	/* HKDF: the input keying material */
+	uint8_t *ikm;
+	uint32_t ikm_len;
+
+	/* AES-CTR and AES-GCM: the counter block and the unused rest of the current key stream block */
+	struct aes_ctx aes;
+	uint8_t counter[AES_BLOCK_SIZE];
+	uint8_t stream[AES_BLOCK_SIZE];
+	size_t stream_used;
+
+	/* AES-GCM */
+	struct ghash_ctx ghash;
+	uint8_t j0[AES_BLOCK_SIZE];
+	uint64_t aad_len;
+	uint64_t text_len;
+	uint32_t tag_len;
+};
+
+
+/*
+ * Transient objects
+ */
+
+TEE_Result TEE_AllocateTransientObject(uint32_t objectType, uint32_t maxKeySize, TEE_ObjectHandle *object){
+
+	TEE_ObjectHandle obj;
+
+	switch (objectType){
+	case TEE_TYPE_AES:
+		if (maxKeySize != 128 && maxKeySize != 192 && maxKeySize != 256)
+			return TEE_ERROR_NOT_SUPPORTED;
+		break;
+	case TEE_TYPE_HMAC_SHA256:
+	case TEE_TYPE_HMAC_SHA512:
+	case TEE_TYPE_GENERIC_SECRET:
+	case TEE_TYPE_HKDF_IKM:
+		break;
+	default:
+		return TEE_ERROR_NOT_SUPPORTED;
+	}
+
+	obj = __real_calloc(1, sizeof(*obj));
+	if (!obj)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	obj->info.objectType = objectType;
+	obj->info.maxKeySize = maxKeySize;
+
+	*object = obj;
+	return TEE_SUCCESS;
+}
+
+void TEE_ResetTransientObject(TEE_ObjectHandle object){
+
+	if (object == TEE_HANDLE_NULL || object->path)
+		return;
+	if (object->secret){
+		memset(object->secret, 0, object->secret_len);
+		__real_free(object->secret);
+	}
+	object->secret = NULL;
+	object->secret_len = 0;
+	object->info.keySize = 0;
+	object->info.handleFlags &= ~TEE_HANDLE_FLAG_INITIALIZED;
+}
+
+/* Stores the secret of a transient object */
+static TEE_Result set_secret(TEE_ObjectHandle object, const void *secret, uint32_t len){
+
+	uint8_t *p;
+
+	if (len * 8 > object->info.maxKeySize)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	p = __real_malloc(len ? len : 1);
+	if (!p)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	memcpy(p, secret, len);
+
+	TEE_ResetTransientObject(object);
+	object->secret = p;
+	object->secret_len = len;
+	object->info.keySize = len * 8;
+	object->info.handleFlags |= TEE_HANDLE_FLAG_INITIALIZED;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_PopulateTransientObject(TEE_ObjectHandle object, const TEE_Attribute *attrs, uint32_t attrCount){
+
+	uint32_t expected = object->info.objectType == TEE_TYPE_HKDF_IKM ? TEE_ATTR_HKDF_IKM : TEE_ATTR_SECRET_VALUE;
+	uint32_t i;
+
+	if (object->info.handleFlags & TEE_HANDLE_FLAG_INITIALIZED)
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+
+	for (i = 0; i < attrCount; i++){
+		if (attrs[i].attributeID == expected)
+			return set_secret(object, attrs[i].content.ref.buffer, attrs[i].content.ref.length);
+	}
+	return TEE_ERROR_BAD_PARAMETERS;
+}
+
+void TEE_InitRefAttribute(TEE_Attribute *attr, uint32_t attributeID, const void *buffer, uint32_t length){
+	attr->attributeID = attributeID;
+	attr->content.ref.buffer = (void*)buffer;
+	attr->content.ref.length = length;
+}
+
+void TEE_InitValueAttribute(TEE_Attribute *attr, uint32_t attributeID, uint32_t a, uint32_t b){
+	attr->attributeID = attributeID;
+	attr->content.value.a = a;
+	attr->content.value.b = b;
+}
+
+TEE_Result TEE_GetObjectBufferAttribute(TEE_ObjectHandle object, uint32_t attributeID, void *buffer, uint32_t *size){
+
+	if (!(object->info.handleFlags & TEE_HANDLE_FLAG_INITIALIZED) || !object->secret ||
+			(attributeID != TEE_ATTR_SECRET_VALUE && attributeID != TEE_ATTR_HKDF_IKM))
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	if (*size < object->secret_len){
+		*size = object->secret_len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+	memcpy(buffer, object->secret, object->secret_len);
+	*size = object->secret_len;
+	return TEE_SUCCESS;
+}
+
+
+/*
+ * Operations
+ */
+
+TEE_Result TEE_AllocateOperation(TEE_OperationHandle *operation, uint32_t algorithm, uint32_t mode,
+		uint32_t maxKeySize){
+
+	TEE_OperationHandle op;
+	uint32_t op_class;
+	const struct hash_ops *hash = NULL;
+
+	switch (algorithm){
+	case TEE_ALG_SHA256:
+		op_class = TEE_OPERATION_DIGEST; hash = &sha256_ops; break;
+	case TEE_ALG_SHA512:
+		op_class = TEE_OPERATION_DIGEST; hash = &sha512_ops; break;
+	case TEE_ALG_HMAC_SHA256:
+		op_class = TEE_OPERATION_MAC; hash = &sha256_ops; break;
+	case TEE_ALG_HMAC_SHA512:
+		op_class = TEE_OPERATION_MAC; hash = &sha512_ops; break;
+	case TEE_ALG_HKDF_SHA256_DERIVE_KEY:
+		op_class = TEE_OPERATION_KEY_DERIVATION; hash = &sha256_ops; break;
+	case TEE_ALG_HKDF_SHA512_DERIVE_KEY:
+		op_class = TEE_OPERATION_KEY_DERIVATION; hash = &sha512_ops; break;
+	case TEE_ALG_AES_CTR:
+		op_class = TEE_OPERATION_CIPHER; break;
+	case TEE_ALG_AES_GCM:
+		op_class = TEE_OPERATION_AE; break;
+	default:
+		return TEE_ERROR_NOT_SUPPORTED;
+	}
+
+	op = __real_calloc(1, sizeof(*op));
+	if (!op)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	op->algorithm = algorithm;
+	op->mode = mode;
+	op->op_class = op_class;
+	op->max_key_size = maxKeySize;
+	op->hash = hash;
+	if (op_class == TEE_OPERATION_DIGEST)
+		hash->init(&op->ctx);
+
+	*operation = op;
+	return TEE_SUCCESS;
+}
+
+void TEE_FreeOperation(TEE_OperationHandle operation){
+
+	if (operation == TEE_HANDLE_NULL)
+		return;
+	__real_free(operation->ikm);
+	memset(operation, 0, sizeof(*operation));
+	__real_free(operation);
+}
+
+void TEE_ResetOperation(TEE_OperationHandle operation){
+	if (operation->op_class == TEE_OPERATION_DIGEST)
+		operation->hash->init(&operation->ctx);
+	operation->stream_used = AES_BLOCK_SIZE;
+}
+
+TEE_Result TEE_SetOperationKey(TEE_OperationHandle operation, TEE_ObjectHandle key){
+
+	const struct hash_ops *hash = operation->hash;
+	uint8_t block[MAX_BLOCK_SIZE];
+	size_t i;
+
+	if (key == TEE_HANDLE_NULL){
+		operation->key_set = 0;
+		return TEE_SUCCESS;
+	}
+	if (!key->secret || key->info.keySize > operation->max_key_size)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	switch (operation->op_class){
+	case TEE_OPERATION_MAC:
+		/* Keys longer than a block are hashed first */
+		memset(block, 0, sizeof(block));
+		if (key->secret_len > hash->block_size){
+			hash->init(&operation->ctx);
+			hash->update(&operation->ctx, key->secret, key->secret_len);
+			hash->final(&operation->ctx, block);
+		} else {
+			memcpy(block, key->secret, key->secret_len);
+		}
+		for (i = 0; i < hash->block_size; i++){
+			operation->hmac_ipad[i] = block[i] ^ 0x36;
+			operation->hmac_opad[i] = block[i] ^ 0x5c;
+		}
+		memset(block, 0, sizeof(block));
+		break;
+
+	case TEE_OPERATION_KEY_DERIVATION:
+		__real_free(operation->ikm);
+		operation->ikm = __real_malloc(key->secret_len ? key->secret_len : 1);
+		if (!operation->ikm)
+			return TEE_ERROR_OUT_OF_MEMORY;
+		memcpy(operation->ikm, key->secret, key->secret_len);
+		operation->ikm_len = key->secret_len;
+		break;
+
+	case TEE_OPERATION_CIPHER:
+		if (aes_set_key(&operation->aes, key->secret, key->secret_len))
+			return TEE_ERROR_BAD_PARAMETERS;
+		break;
+
+	case TEE_OPERATION_AE:
+		if (aes_set_key(&operation->aes, key->secret, key->secret_len))
+			return TEE_ERROR_BAD_PARAMETERS;
+		memset(block, 0, AES_BLOCK_SIZE);
+		aes_encrypt_block(&operation->aes, block, block);
+		ghash_set_key(&operation->ghash, block);
+		memset(block, 0, AES_BLOCK_SIZE);
+		break;
+
+	default:
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	operation->key_set = 1;
+	return TEE_SUCCESS;
+}
+
+
+/* Digests */
+
+void TEE_DigestUpdate(TEE_OperationHandle operation, const void *chunk, uint32_t chunkSize){
+	operation->hash->update(&operation->ctx, chunk, chunkSize);
+}
+
+TEE_Result TEE_DigestDoFinal(TEE_OperationHandle operation, const void *chunk, uint32_t chunkLen,
+		void *hash, uint32_t *hashLen){
+
+	const struct hash_ops *ops = operation->hash;
+
+	if (operation->op_class != TEE_OPERATION_DIGEST)
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+	if (*hashLen < ops->digest_size){
+		*hashLen = ops->digest_size;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	if (chunkLen)
+		ops->update(&operation->ctx, chunk, chunkLen);
+	ops->final(&operation->ctx, hash);
+	*hashLen = ops->digest_size;
+
+	/* The operation is ready for the next digest */
+	ops->init(&operation->ctx);
+	return TEE_SUCCESS;
+}
+
+
+/* HMAC */
+
+static void hmac_start(TEE_OperationHandle operation, const uint8_t *ipad){
+	operation->hash->init(&operation->ctx);
+	operation->hash->update(&operation->ctx, ipad, operation->hash->block_size);
+}
+
+static void hmac_finish(TEE_OperationHandle operation, const uint8_t *opad, uint8_t *mac){
+
+	const struct hash_ops *hash = operation->hash;
+	uint8_t inner[MAX_DIGEST_SIZE];
+
+	hash->final(&operation->ctx, inner);
+	hash->init(&operation->ctx);
+	hash->update(&operation->ctx, opad, hash->block_size);
+	hash->update(&operation->ctx, inner, hash->digest_size);
+	hash->final(&operation->ctx, mac);
+}
+
+void TEE_MACInit(TEE_OperationHandle operation, const void *IV, uint32_t IVLen){
+	(void)IV;
+	(void)IVLen;
+	if (operation->op_class != TEE_OPERATION_MAC || !operation->key_set)
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+	hmac_start(operation, operation->hmac_ipad);
+}
+
+void TEE_MACUpdate(TEE_OperationHandle operation, const void *chunk, uint32_t chunkSize){
+	operation->hash->update(&operation->ctx, chunk, chunkSize);
+}
+
+TEE_Result TEE_MACComputeFinal(TEE_OperationHandle operation, const void *message, uint32_t messageLen,
+		void *mac, uint32_t *macLen){
+
+	const struct hash_ops *hash = operation->hash;
+
+	if (*macLen < hash->digest_size){
+		*macLen = hash->digest_size;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+	if (messageLen)
+		hash->update(&operation->ctx, message, messageLen);
+	hmac_finish(operation, operation->hmac_opad, mac);
+	*macLen = hash->digest_size;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_MACCompareFinal(TEE_OperationHandle operation, const void *message, uint32_t messageLen,
+		const void *mac, uint32_t macLen){
+
+	uint8_t computed[MAX_DIGEST_SIZE];
+	uint32_t len = sizeof(computed);
+	uint8_t diff = 0;
+	uint32_t i;
+
+	TEE_MACComputeFinal(operation, message, messageLen, computed, &len);
+	if (macLen != len)
+		return TEE_ERROR_MAC_INVALID;
+	for (i = 0; i < len; i++)
+		diff |= computed[i] ^ ((const uint8_t*)mac)[i];
+	return diff ? TEE_ERROR_MAC_INVALID : TEE_SUCCESS;
+}
+
+
+/* HKDF (RFC 5869) */
+
+static void hmac_oneshot(const struct hash_ops *hash, const uint8_t *key, size_t key_len,
+		const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len, const uint8_t *c, size_t c_len, uint8_t *out){
+
+	uint8_t block[MAX_BLOCK_SIZE];
+	uint8_t inner[MAX_DIGEST_SIZE];
+	union hash_ctx ctx;
+	size_t i;
+
+	memset(block, 0, sizeof(block));
+	if (key_len > hash->block_size){
+		hash->init(&ctx);
+		hash->update(&ctx, key, key_len);
+		hash->final(&ctx, block);
+	} else {
+		memcpy(block, key, key_len);
+	}
+
+	for (i = 0; i < hash->block_size; i++)
+		block[i] ^= 0x36;
+	hash->init(&ctx);
+	hash->update(&ctx, block, hash->block_size);
+	hash->update(&ctx, a, a_len);
+	hash->update(&ctx, b, b_len);
+	hash->update(&ctx, c, c_len);
+	hash->final(&ctx, inner);
+
+	for (i = 0; i < hash->block_size; i++)
+		block[i] ^= 0x36 ^ 0x5c;
+	hash->init(&ctx);
+	hash->update(&ctx, block, hash->block_size);
+	hash->update(&ctx, inner, hash->digest_size);
+	hash->final(&ctx, out);
+
+	memset(block, 0, sizeof(block));
+}
+
+void TEE_DeriveKey(TEE_OperationHandle operation, const TEE_Attribute *params, uint32_t paramCount,
+		TEE_ObjectHandle derivedKey){
+
+	const struct hash_ops *hash = operation->hash;
+	static const uint8_t zeros[MAX_DIGEST_SIZE];
+	const uint8_t *salt = zeros, *info = NULL;
+	size_t salt_len = hash->digest_size, info_len = 0, okm_len = 0, done;
+	uint8_t prk[MAX_DIGEST_SIZE], t[MAX_DIGEST_SIZE];
+	uint8_t *okm;
+	uint8_t counter;
+	uint32_t i;
+
+	if (operation->op_class != TEE_OPERATION_KEY_DERIVATION || !operation->key_set)
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+
+	for (i = 0; i < paramCount; i++){
+		switch (params[i].attributeID){
+		case TEE_ATTR_HKDF_SALT:
+			salt = params[i].content.ref.buffer;
+			salt_len = params[i].content.ref.length;
+			break;
+		case TEE_ATTR_HKDF_INFO:
+			info = params[i].content.ref.buffer;
+			info_len = params[i].content.ref.length;
+			break;
+		case TEE_ATTR_HKDF_OKM_LENGTH:
+			okm_len = params[i].content.value.a;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (!okm_len || okm_len > 255 * hash->digest_size || okm_len * 8 > derivedKey->info.maxKeySize)
+		TEE_Panic(TEE_ERROR_BAD_PARAMETERS);
+
+	okm = __real_malloc(okm_len);
+	if (!okm)
+		TEE_Panic(TEE_ERROR_OUT_OF_MEMORY);
+
+	/* Extract */
+	hmac_oneshot(hash, salt, salt_len, operation->ikm, operation->ikm_len, NULL, 0, NULL, 0, prk);
+
+	/* Expand */
+	for (done = 0, counter = 1; done < okm_len; counter++){
+		size_t n = okm_len - done < hash->digest_size ? okm_len - done : hash->digest_size;
+
+		hmac_oneshot(hash, prk, hash->digest_size, done ? t : NULL, done ? hash->digest_size : 0,
+				info, info_len, &counter, 1, t);
+		memcpy(okm + done, t, n);
+		done += n;
+	}
+
+	TEE_ResetTransientObject(derivedKey);
+	if (set_secret(derivedKey, okm, okm_len) != TEE_SUCCESS)
+		TEE_Panic(TEE_ERROR_BAD_PARAMETERS);
+
+	memset(okm, 0, okm_len);
+	memset(prk, 0, sizeof(prk));
+	__real_free(okm);
+}
+
+
+/* AES-CTR */
+
+/* XORs the key stream into the data, full_counter selects a 128 bit counter (CTR) or a 32 bit one (GCM) */
+static void ctr_crypt(TEE_OperationHandle operation, const uint8_t *in, uint8_t *out, size_t len, int full_counter){
+
+	int j, last = full_counter ? 0 : AES_BLOCK_SIZE - 4;
+	size_t i;
+
+	for (i = 0; i < len; i++){
+		if (operation->stream_used == AES_BLOCK_SIZE){
+			aes_encrypt_block(&operation->aes, operation->counter, operation->stream);
+			/* big endian counter */
+			for (j = AES_BLOCK_SIZE - 1; j >= last && ++operation->counter[j] == 0; j--)
+				;
+			operation->stream_used = 0;
+		}
+		out[i] = in[i] ^ operation->stream[operation->stream_used++];
+	}
+}
+
+void TEE_CipherInit(TEE_OperationHandle operation, const void *IV, uint32_t IVLen){
+
+	if (operation->op_class != TEE_OPERATION_CIPHER || !operation->key_set || IVLen != AES_BLOCK_SIZE)
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+
+	memcpy(operation->counter, IV, AES_BLOCK_SIZE);
+	operation->stream_used = AES_BLOCK_SIZE;
+}
+
+TEE_Result TEE_CipherUpdate(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen){
+
+	if (*destLen < srcLen){
+		*destLen = srcLen;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+
+	ctr_crypt(operation, srcData, destData, srcLen, 1);
+	*destLen = srcLen;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_CipherDoFinal(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen){
+	return TEE_CipherUpdate(operation, srcData, srcLen, destData, destLen);
+}
+
+
+/* AES-GCM (NIST SP 800-38D) */
+
+/* Closes the AAD part of the GHASH input, the text starts on a block boundary */
+static void gcm_start_text(TEE_OperationHandle operation){
+	if (!operation->text_len)
+		ghash_pad(&operation->ghash);
+}
+
+TEE_Result TEE_AEInit(TEE_OperationHandle operation, const void *nonce, uint32_t nonceLen, uint32_t tagLen,
+		uint32_t AADLen, uint32_t payloadLen){
+
+	uint8_t lengths[AES_BLOCK_SIZE];
+	int i;
+
+	(void)AADLen;
+	(void)payloadLen;
+
+	if (operation->op_class != TEE_OPERATION_AE || !operation->key_set)
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+	if (tagLen < 96 || tagLen > 128 || tagLen % 8 || !nonceLen)
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	/* J0 is the nonce with a 32 bit counter of 1 for 96 bit nonces, and the GHASH of the nonce otherwise */
+	if (nonceLen == 12){
+		memcpy(operation->j0, nonce, 12);
+		memset(operation->j0 + 12, 0, 4);
+		operation->j0[15] = 1;
+	} else {
+		memset(lengths, 0, sizeof(lengths));
+		for (i = 0; i < 8; i++)
+			lengths[15 - i] = (uint8_t)(((uint64_t)nonceLen * 8) >> (i * 8));
+		ghash_reset(&operation->ghash);
+		ghash_update(&operation->ghash, nonce, nonceLen);
+		ghash_pad(&operation->ghash);
+		ghash_update(&operation->ghash, lengths, sizeof(lengths));
+		ghash_final(&operation->ghash, operation->j0);
+	}
+
+	memcpy(operation->counter, operation->j0, AES_BLOCK_SIZE);
+	for (i = AES_BLOCK_SIZE - 1; i >= AES_BLOCK_SIZE - 4 && ++operation->counter[i] == 0; i--)
+		;
+	operation->stream_used = AES_BLOCK_SIZE;
+
+	ghash_reset(&operation->ghash);
+	operation->aad_len = 0;
+	operation->text_len = 0;
+	operation->tag_len = tagLen / 8;
+	return TEE_SUCCESS;
+}
+
+void TEE_AEUpdateAAD(TEE_OperationHandle operation, const void *AADdata, uint32_t AADdataLen){
+	if (operation->text_len)
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+	ghash_update(&operation->ghash, AADdata, AADdataLen);
+	operation->aad_len += AADdataLen;
+}
+
+TEE_Result TEE_AEUpdate(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen){
+
+	if (*destLen < srcLen){
+		*destLen = srcLen;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+	if (!srcLen){
+		*destLen = 0;
+		return TEE_SUCCESS;
+	}
+
+	gcm_start_text(operation);
+	/* GHASH always covers the ciphertext */
+	if (operation->mode == TEE_MODE_DECRYPT)
+		ghash_update(&operation->ghash, srcData, srcLen);
+	ctr_crypt(operation, srcData, destData, srcLen, 0);
+	if (operation->mode == TEE_MODE_ENCRYPT)
+		ghash_update(&operation->ghash, destData, srcLen);
+
+	operation->text_len += srcLen;
+	*destLen = srcLen;
+	return TEE_SUCCESS;
+}
+
+/* Computes the full 16 byte tag of the data processed so far */
+static void gcm_tag(TEE_OperationHandle operation, uint8_t *tag){
+
+	uint8_t lengths[AES_BLOCK_SIZE];
+	uint8_t s[AES_BLOCK_SIZE];
+	int i;
+
+	gcm_start_text(operation);
+	ghash_pad(&operation->ghash);
+	for (i = 0; i < 8; i++){
+		lengths[7 - i] = (uint8_t)((operation->aad_len * 8) >> (i * 8));
+		lengths[15 - i] = (uint8_t)((operation->text_len * 8) >> (i * 8));
+	}
+	ghash_update(&operation->ghash, lengths, sizeof(lengths));
+	ghash_final(&operation->ghash, s);
+
+	aes_encrypt_block(&operation->aes, operation->j0, tag);
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		tag[i] ^= s[i];
+}
+
+TEE_Result TEE_AEEncryptFinal(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen, void *tag, uint32_t *tagLen){
+
+	uint8_t full_tag[AES_BLOCK_SIZE];
+	TEE_Result res;
+
+	if (*tagLen < operation->tag_len){
+		*tagLen = operation->tag_len;
+		return TEE_ERROR_SHORT_BUFFER;
+	}
+	res = TEE_AEUpdate(operation, srcData, srcLen, destData, destLen);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	gcm_tag(operation, full_tag);
+	memcpy(tag, full_tag, operation->tag_len);
+	*tagLen = operation->tag_len;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_AEDecryptFinal(TEE_OperationHandle operation, const void *srcData, uint32_t srcLen,
+		void *destData, uint32_t *destLen, const void *tag, uint32_t tagLen){
+
+	uint8_t full_tag[AES_BLOCK_SIZE];
+	uint8_t diff = 0;
+	uint32_t i;
+	TEE_Result res;
+
+	res = TEE_AEUpdate(operation, srcData, srcLen, destData, destLen);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	gcm_tag(operation, full_tag);
+	if (tagLen != operation->tag_len)
+		return TEE_ERROR_MAC_INVALID;
+	for (i = 0; i < tagLen; i++)
+		diff |= full_tag[i] ^ ((const uint8_t*)tag)[i];
+	if (diff){
+		/* The plaintext of the final call is not released for a bad tag */
+		memset(destData, 0, srcLen);
+		return TEE_ERROR_MAC_INVALID;
+	}
+	return TEE_SUCCESS;
+}
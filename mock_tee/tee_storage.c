@@ -0,0 +1,408 @@
+/**
+ * Persistent objects of the mock TEE (see mock_tee.h), stored as one file per object. Files are replaced through
+ * a rename, so every change of an object is atomic like in the real secure storage.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mock_tee_private.h"
+
+static char *storage_dir = NULL;
+
+
+/* Removes the temporary storage directory on exit */
+static void remove_storage(void){
+
+	DIR *dir = opendir(storage_dir);
+	struct dirent *ent;
+	char path[4096];
+
+	if (dir){
+		while ((ent = readdir(dir)) != NULL){
+			if (ent->d_name[0] == '.')
+				continue;
+			snprintf(path, sizeof(path), "%s/%s", storage_dir, ent->d_name);
+			unlink(path);
+		}
+		closedir(dir);
+	}
+	rmdir(storage_dir);
+}
+
+const char* mock_tee_storage_dir(void){
+
+	const char *tmp;
+	size_t len;
+
+	if (storage_dir)
+		return storage_dir;
+
+	if (mock_tee_config.storage_dir){
+		mkdir(mock_tee_config.storage_dir, 0700);
+		storage_dir = strdup(mock_tee_config.storage_dir);
+		return storage_dir;
+	}
+
+	tmp = getenv("TMPDIR");
+	if (!tmp || !*tmp)
+		tmp = "/tmp";
+	len = strlen(tmp) + sizeof("/mock_tee.XXXXXX");
+	storage_dir = __real_malloc(len);
+	snprintf(storage_dir, len, "%s/mock_tee.XXXXXX", tmp);
+	if (!mkdtemp(storage_dir)){
+		perror("mock TEE storage");
+		abort();
+	}
+	atexit(remove_storage);
+
+	return storage_dir;
+}
+
+
+/* Returns the file of an object, the object ID is hex encoded as it may contain any bytes */
+static char* object_path(const void *id, uint32_t id_len){
+
+	static const char hex[] = "0123456789abcdef";
+	const char *dir = mock_tee_storage_dir();
+	size_t dir_len = strlen(dir);
+	const uint8_t *p = id;
+	char *path = __real_malloc(dir_len + 1 + 2 * id_len + 1);
+	char *q;
+	uint32_t i;
+
+	if (!path)
+		return NULL;
+
+	memcpy(path, dir, dir_len);
+	q = path + dir_len;
+	*q++ = '/';
+	for (i = 0; i < id_len; i++){
+		*q++ = hex[p[i] >> 4];
+		*q++ = hex[p[i] & 0xf];
+	}
+	*q = '\0';
+	return path;
+}
+
+/* Atomically replaces the file of an object with the given data */
+static TEE_Result write_file(const char *path, const void *data, size_t len){
+
+	size_t tmp_len = strlen(path) + sizeof(".tmp");
+	char *tmp = __real_malloc(tmp_len);
+	const char *p = data;
+	int fd;
+
+	if (!tmp)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	snprintf(tmp, tmp_len, "%s.tmp", path);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		goto err;
+
+	while (len > 0){
+		ssize_t n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0){
+			close(fd);
+			unlink(tmp);
+			goto err;
+		}
+		p += n;
+		len -= n;
+	}
+
+	if (close(fd) || rename(tmp, path)){
+		unlink(tmp);
+		goto err;
+	}
+
+	__real_free(tmp);
+	return TEE_SUCCESS;
+
+err:
+	__real_free(tmp);
+	return errno == ENOSPC ? TEE_ERROR_STORAGE_NO_SPACE : TEE_ERROR_STORAGE_NOT_AVAILABLE;
+}
+
+/* Makes sure the in-memory data stream can hold size bytes */
+static TEE_Result reserve(TEE_ObjectHandle object, uint32_t size){
+
+	uint8_t *data;
+	uint32_t capacity;
+
+	if (size <= object->capacity)
+		return TEE_SUCCESS;
+
+	capacity = object->capacity ? object->capacity : 64;
+	while (capacity < size)
+		capacity = capacity > TEE_DATA_MAX_POSITION / 2 ? TEE_DATA_MAX_POSITION : capacity * 2;
+
+	data = __real_realloc(object->data, capacity);
+	if (!data)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	object->data = data;
+	object->capacity = capacity;
+	return TEE_SUCCESS;
+}
+
+static TEE_ObjectHandle new_object(char *path, uint32_t flags){
+
+	TEE_ObjectHandle object = __real_calloc(1, sizeof(*object));
+
+	if (!object)
+		return NULL;
+	object->path = path;
+	object->flags = flags;
+	object->info.objectType = TEE_TYPE_DATA;
+	object->info.handleFlags = TEE_HANDLE_FLAG_PERSISTENT | TEE_HANDLE_FLAG_INITIALIZED | flags;
+	return object;
+}
+
+static void free_object(TEE_ObjectHandle object){
+	__real_free(object->path);
+	__real_free(object->data);
+	__real_free(object->secret);
+	__real_free(object);
+}
+
+
+TEE_Result TEE_OpenPersistentObject(uint32_t storageID, const void *objectID, uint32_t objectIDLen,
+		uint32_t flags, TEE_ObjectHandle *object){
+
+	TEE_ObjectHandle obj;
+	struct stat st;
+	char *path;
+	int fd;
+
+	*object = TEE_HANDLE_NULL;
+	if (storageID != TEE_STORAGE_PRIVATE || objectIDLen > TEE_OBJECT_ID_MAX_LEN)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	path = object_path(objectID, objectIDLen);
+	if (!path)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0){
+		__real_free(path);
+		return errno == ENOENT ? TEE_ERROR_ITEM_NOT_FOUND : TEE_ERROR_STORAGE_NOT_AVAILABLE;
+	}
+
+	obj = new_object(path, flags);
+	if (!obj || fstat(fd, &st) || reserve(obj, st.st_size) != TEE_SUCCESS)
+		goto err;
+
+	obj->info.dataSize = st.st_size;
+	if (st.st_size && read(fd, obj->data, st.st_size) != st.st_size)
+		goto err;
+	close(fd);
+
+	*object = obj;
+	return TEE_SUCCESS;
+
+err:
+	close(fd);
+	if (obj)
+		free_object(obj);
+	else
+		__real_free(path);
+	return TEE_ERROR_CORRUPT_OBJECT;
+}
+
+TEE_Result TEE_CreatePersistentObject(uint32_t storageID, const void *objectID, uint32_t objectIDLen,
+		uint32_t flags, TEE_ObjectHandle attributes, const void *initialData, uint32_t initialDataLen,
+		TEE_ObjectHandle *object){
+
+	TEE_ObjectHandle obj;
+	TEE_Result res;
+	char *path;
+
+	if (object)
+		*object = TEE_HANDLE_NULL;
+	if (storageID != TEE_STORAGE_PRIVATE || objectIDLen > TEE_OBJECT_ID_MAX_LEN)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	path = object_path(objectID, objectIDLen);
+	if (!path)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	if (!(flags & TEE_DATA_FLAG_OVERWRITE) && access(path, F_OK) == 0){
+		__real_free(path);
+		return TEE_ERROR_ACCESS_CONFLICT;
+	}
+
+	obj = new_object(path, flags);
+	if (!obj){
+		__real_free(path);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+
+	if (attributes != TEE_HANDLE_NULL && attributes->secret){
+		obj->secret = __real_malloc(attributes->secret_len);
+		if (obj->secret){
+			memcpy(obj->secret, attributes->secret, attributes->secret_len);
+			obj->secret_len = attributes->secret_len;
+		}
+	}
+
+	res = reserve(obj, initialDataLen);
+	if (res == TEE_SUCCESS){
+		if (initialDataLen)
+			memcpy(obj->data, initialData, initialDataLen);
+		obj->info.dataSize = initialDataLen;
+		res = write_file(path, initialData, initialDataLen);
+	}
+
+	if (res != TEE_SUCCESS || !object){
+		free_object(obj);
+		return res;
+	}
+
+	*object = obj;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_CloseAndDeletePersistentObject1(TEE_ObjectHandle object){
+
+	if (object == TEE_HANDLE_NULL)
+		return TEE_SUCCESS;
+	if (!object->path || !(object->flags & TEE_DATA_FLAG_ACCESS_WRITE_META))
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+
+	unlink(object->path);
+	free_object(object);
+	return TEE_SUCCESS;
+}
+
+void TEE_CloseAndDeletePersistentObject(TEE_ObjectHandle object){
+	TEE_CloseAndDeletePersistentObject1(object);
+}
+
+TEE_Result TEE_RenamePersistentObject(TEE_ObjectHandle object, const void *newObjectID, uint32_t newObjectIDLen){
+
+	char *path;
+
+	if (!object->path || !(object->flags & TEE_DATA_FLAG_ACCESS_WRITE_META))
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+	if (newObjectIDLen > TEE_OBJECT_ID_MAX_LEN)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	path = object_path(newObjectID, newObjectIDLen);
+	if (!path)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	if (access(path, F_OK) == 0){
+		__real_free(path);
+		return TEE_ERROR_ACCESS_CONFLICT;
+	}
+	if (rename(object->path, path)){
+		__real_free(path);
+		return TEE_ERROR_STORAGE_NOT_AVAILABLE;
+	}
+
+	__real_free(object->path);
+	object->path = path;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_ReadObjectData(TEE_ObjectHandle object, void *buffer, uint32_t size, uint32_t *count){
+
+	uint32_t pos = object->info.dataPosition;
+	uint32_t n = 0;
+
+	if (!object->path || !(object->flags & TEE_DATA_FLAG_ACCESS_READ))
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+
+	if (pos < object->info.dataSize)
+		n = object->info.dataSize - pos < size ? object->info.dataSize - pos : size;
+	if (n)
+		memcpy(buffer, object->data + pos, n);
+
+	object->info.dataPosition += n;
+	*count = n;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_WriteObjectData(TEE_ObjectHandle object, const void *buffer, uint32_t size){
+
+	uint32_t pos = object->info.dataPosition;
+	TEE_Result res;
+
+	if (!object->path || !(object->flags & TEE_DATA_FLAG_ACCESS_WRITE))
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+	if (size > TEE_DATA_MAX_POSITION - pos)
+		return TEE_ERROR_OVERFLOW;
+
+	res = reserve(object, pos + size);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* Writing past the end fills the gap with zeros */
+	if (pos > object->info.dataSize)
+		memset(object->data + object->info.dataSize, 0, pos - object->info.dataSize);
+	memcpy(object->data + pos, buffer, size);
+	if (pos + size > object->info.dataSize)
+		object->info.dataSize = pos + size;
+	object->info.dataPosition = pos + size;
+
+	return write_file(object->path, object->data, object->info.dataSize);
+}
+
+TEE_Result TEE_TruncateObjectData(TEE_ObjectHandle object, uint32_t size){
+
+	TEE_Result res;
+
+	if (!object->path || !(object->flags & TEE_DATA_FLAG_ACCESS_WRITE))
+		TEE_Panic(TEE_ERROR_BAD_STATE);
+
+	res = reserve(object, size);
+	if (res != TEE_SUCCESS)
+		return res;
+	if (size > object->info.dataSize)
+		memset(object->data + object->info.dataSize, 0, size - object->info.dataSize);
+	object->info.dataSize = size;
+
+	return write_file(object->path, object->data, object->info.dataSize);
+}
+
+TEE_Result TEE_SeekObjectData(TEE_ObjectHandle object, int32_t offset, TEE_Whence whence){
+
+	int64_t pos;
+
+	switch (whence){
+	case TEE_DATA_SEEK_SET: pos = offset; break;
+	case TEE_DATA_SEEK_CUR: pos = (int64_t)object->info.dataPosition + offset; break;
+	case TEE_DATA_SEEK_END: pos = (int64_t)object->info.dataSize + offset; break;
+	default: return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	if (pos < 0)
+		pos = 0;
+	if (pos > TEE_DATA_MAX_POSITION)
+		return TEE_ERROR_OVERFLOW;
+	object->info.dataPosition = (uint32_t)pos;
+	return TEE_SUCCESS;
+}
+
+TEE_Result TEE_GetObjectInfo1(TEE_ObjectHandle object, TEE_ObjectInfo *objectInfo){
+	*objectInfo = object->info;
+	return TEE_SUCCESS;
+}
+
+void TEE_CloseObject(TEE_ObjectHandle object){
+	if (object != TEE_HANDLE_NULL)
+		free_object(object);
+}
+
+void TEE_FreeTransientObject(TEE_ObjectHandle object){
+	if (object != TEE_HANDLE_NULL && !object->path)
+		free_object(object);
+}
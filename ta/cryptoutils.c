@@ -20,245 +20,654 @@
 #define AES_BLOCK_SIZE		16
 
 
-/*
- * Function taken from https://github.com/linaro-swg/optee_examples/blob/master/hotp/ta/hotp_ta.c
- */
-TEE_Result hmac_sha512(const uint8_t *key, const size_t keylen,
-			    const uint8_t *in, const size_t inlen,
-			    uint8_t *out, uint32_t *outlen)
+TEE_Result sha256_digest(const uint8_t *in, const size_t inlen, uint8_t *out)
 {
-	TEE_Attribute attr = { 0 };
-	TEE_ObjectHandle key_handle = TEE_HANDLE_NULL;
 	TEE_OperationHandle op_handle = TEE_HANDLE_NULL;
-	TEE_Result res = TEE_SUCCESS;
+	TEE_Result res;
+	uint32_t outlen = 32;
 
-	if (!in || !out || !outlen)
+	if (!in || !out)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	/*
-	 * 1. Allocate cryptographic (operation) handle for the HMAC operation.
-	 *    Note that the expected size here is in bits (and therefore times
-	 *    8)!
-	 */
-	res = TEE_AllocateOperation(&op_handle, TEE_ALG_HMAC_SHA512, TEE_MODE_MAC,
-				    keylen * 8);
+	res = TEE_AllocateOperation(&op_handle, TEE_ALG_SHA256, TEE_MODE_DIGEST, 0);
 	if (res != TEE_SUCCESS) {
 		EMSG("0x%08x", res);
-		goto exit;
+		return res;
 	}
 
-	/*
-	 * 2. Allocate a container (key handle) for the HMAC attributes. Note
-	 *    that the expected size here is in bits (and therefore times 8)!
-	 */
-	res = TEE_AllocateTransientObject(TEE_TYPE_HMAC_SHA512, keylen * 8,
-					  &key_handle);
-	if (res != TEE_SUCCESS) {
+	res = TEE_DigestDoFinal(op_handle, in, inlen, out, &outlen);
+	if (res != TEE_SUCCESS)
 		EMSG("0x%08x", res);
-		goto exit;
-	}
 
-	/*
-	 * 3. Initialize the attributes, i.e., point to the actual HMAC key.
-	 *    Here, the expected size is in bytes and not bits as above!
-	 */
-	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, keylen);
+	TEE_FreeOperation(op_handle);
+	return res;
+}
 
-	/* 4. Populate/assign the attributes with the key object */
-	res = TEE_PopulateTransientObject(key_handle, &attr, 1);
-	if (res != TEE_SUCCESS) {
-		EMSG("0x%08x", res);
-		goto exit;
-	}
 
-	/* 5. Associate the key (object) with the operation */
-	res = TEE_SetOperationKey(op_handle, key_handle);
-	if (res != TEE_SUCCESS) {
-		EMSG("0x%08x", res);
-		goto exit;
-	}
 
-	/* 6. Do the HMAC operations */
-	TEE_MACInit(op_handle, NULL, 0);
-	TEE_MACUpdate(op_handle, in, inlen);
-	res = TEE_MACComputeFinal(op_handle, NULL, 0, out, outlen);
-exit:
-	if (op_handle != TEE_HANDLE_NULL)
-		TEE_FreeOperation(op_handle);
+/* Layout of encrypted scripts, see cryptoutils.h */
+#define SALT_SIZE		16
+#define MAC_SIZE		64
+#define NONCE_SIZE		8
+#define HEADER_SIZE		(SALT_SIZE + MAC_SIZE + NONCE_SIZE)
+
+#define V2_MAGIC_SIZE		4
+#define V2_NONCE_SIZE		12
+#define V2_TAG_SIZE		16
+#define V2_HEADER_SIZE		(V2_MAGIC_SIZE + SALT_SIZE + V2_NONCE_SIZE + V2_TAG_SIZE)
+/* The magic, salt and nonce are authenticated as additional data */
+#define V2_AAD_SIZE		(V2_MAGIC_SIZE + SALT_SIZE + V2_NONCE_SIZE)
+
+#define V3_NONCE_SIZE		8
+/* The GCM nonce of a chunk is the nonce of the header followed by the chunk index */
+#define V3_CHUNK_NONCE_SIZE	(V3_NONCE_SIZE + 4)
+#define V3_TAG_SIZE		16
+/* The whole header is authenticated as additional data of every chunk */
+#define V3_HEADER_SIZE		(V2_MAGIC_SIZE + SALT_SIZE + V3_NONCE_SIZE + 4 + 4)
+
+static const uint8_t v2_magic[V2_MAGIC_SIZE] = LUATA_V2_MAGIC;
+static const uint8_t v3_magic[V2_MAGIC_SIZE] = LUATA_V3_MAGIC;
+
+#define BUNDLE_NONCE_SIZE	12
+#define BUNDLE_TAG_SIZE		16
+#define BUNDLE_HEADER_SIZE	(V2_MAGIC_SIZE + SALT_SIZE + BUNDLE_NONCE_SIZE + 4)
+#define BUNDLE_ENTRY_SIZE	(LUATA_BUNDLE_NAME_MAX + 4 + 4)
+/* The key cache slots tell the bundle key apart from the script formats by this version */
+#define BUNDLE_VERSION		4
+
+static const uint8_t bundle_magic[V2_MAGIC_SIZE] = LUATA_BUNDLE_MAGIC;
+
+/* HKDF info per format version, so no two versions share keys. v1 uses none. */
+static const char *const hkdf_info[] = { NULL, NULL, "luata v2", "luata v3", "luata bundle" };
+
+/* Number of salts whose derived keys are kept per session */
+#define KEY_CACHE_SLOTS		8
+
+/*
+ * The keys derived for one salt, already set on their operations. A hit in the cache skips the key derivation
+ * and all key setup, the operations only have to be reinitialized.
+ */
+struct key_cache_slot {
+	int version;			/* 0 for an empty slot */
+	uint8_t salt[SALT_SIZE];
+	TEE_OperationHandle hmac_op;	/* v1 */
+	TEE_OperationHandle aes_op;	/* v1 */
+	TEE_OperationHandle gcm_op;	/* v2, v3, bundles */
+};
+
+struct crypto_ctx {
+	TEE_ObjectHandle master_key;
+	TEE_OperationHandle hkdf_op;
+
+	/* Scratch objects, only hold key material while a cache slot is filled */
+	TEE_ObjectHandle okm_key;
+	TEE_ObjectHandle hmac_key;
+	TEE_ObjectHandle aes_key;
+
+	struct key_cache_slot slots[KEY_CACHE_SLOTS];
+	unsigned int next_slot;
+};
+
+
+TEE_Result crypto_ctx_alloc(struct crypto_ctx **ctx_out)
+{
+	TEE_Result res;
+	TEE_Attribute master_attr;
+	struct crypto_ctx *ctx;
+	unsigned char master_key[KEY_LEN / 8] = SYM_KEY;
+	int i;
+
+	ctx = TEE_Malloc(sizeof(*ctx), TEE_MALLOC_FILL_ZERO);
+	if (!ctx)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	/* HKDF with the master key, used for every salt that misses the cache */
+	res = TEE_AllocateOperation(&ctx->hkdf_op, TEE_ALG_HKDF_SHA512_DERIVE_KEY, TEE_MODE_DERIVE, KEY_LEN);
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	res = TEE_AllocateTransientObject(TEE_TYPE_HKDF_IKM, KEY_LEN, &ctx->master_key);
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	TEE_InitRefAttribute(&master_attr, TEE_ATTR_HKDF_IKM, master_key, KEY_LEN/8);
+	res = TEE_PopulateTransientObject(ctx->master_key, &master_attr, 1);
+	TEE_MemFill(master_key, 0, sizeof(master_key));
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	res = TEE_SetOperationKey(ctx->hkdf_op, ctx->master_key);
+	if (res != TEE_SUCCESS)
+		goto err;
 
-	/* It is OK to call this when key_handle is TEE_HANDLE_NULL */
-	TEE_FreeTransientObject(key_handle);
+	res = TEE_AllocateTransientObject(TEE_TYPE_GENERIC_SECRET, KEY_LEN*2, &ctx->okm_key);
+	if (res != TEE_SUCCESS)
+		goto err;
+	res = TEE_AllocateTransientObject(TEE_TYPE_HMAC_SHA512, KEY_LEN, &ctx->hmac_key);
+	if (res != TEE_SUCCESS)
+		goto err;
+	res = TEE_AllocateTransientObject(TEE_TYPE_AES, KEY_LEN, &ctx->aes_key);
+	if (res != TEE_SUCCESS)
+		goto err;
+
+	for (i = 0; i < KEY_CACHE_SLOTS; i++){
+		res = TEE_AllocateOperation(&ctx->slots[i].hmac_op, TEE_ALG_HMAC_SHA512, TEE_MODE_MAC, KEY_LEN);
+		if (res != TEE_SUCCESS)
+			goto err;
+		res = TEE_AllocateOperation(&ctx->slots[i].aes_op, TEE_ALG_AES_CTR, TEE_MODE_DECRYPT, KEY_LEN);
+		if (res != TEE_SUCCESS)
+			goto err;
+		res = TEE_AllocateOperation(&ctx->slots[i].gcm_op, TEE_ALG_AES_GCM, TEE_MODE_DECRYPT, KEY_LEN);
+		if (res != TEE_SUCCESS)
+			goto err;
+	}
+
+	*ctx_out = ctx;
+	return TEE_SUCCESS;
 
+err:
+	EMSG("cannot set up the crypto context 0x%08x", res);
+	crypto_ctx_free(ctx);
 	return res;
 }
 
+void crypto_ctx_free(struct crypto_ctx *ctx)
+{
+	int i;
+
+	if (!ctx)
+		return;
+
+	for (i = 0; i < KEY_CACHE_SLOTS; i++){
+		if (ctx->slots[i].hmac_op != TEE_HANDLE_NULL)
+			TEE_FreeOperation(ctx->slots[i].hmac_op);
+		if (ctx->slots[i].aes_op != TEE_HANDLE_NULL)
+			TEE_FreeOperation(ctx->slots[i].aes_op);
+		if (ctx->slots[i].gcm_op != TEE_HANDLE_NULL)
+			TEE_FreeOperation(ctx->slots[i].gcm_op);
+	}
+	if (ctx->hkdf_op != TEE_HANDLE_NULL)
+		TEE_FreeOperation(ctx->hkdf_op);
+
+	/* It is OK to call this with TEE_HANDLE_NULL */
+	TEE_FreeTransientObject(ctx->master_key);
+	TEE_FreeTransientObject(ctx->okm_key);
+	TEE_FreeTransientObject(ctx->hmac_key);
+	TEE_FreeTransientObject(ctx->aes_key);
 
+	TEE_MemFill(ctx, 0, sizeof(*ctx));
+	TEE_Free(ctx);
+}
 
-// TODO tidy up this functions and take better care of error handeling
-TEE_Result verify_and_decrypt_script(uint8_t *buffer, const size_t bufferlen, uint8_t *out, uint32_t *outlen)
+/* Sets a key on one of the operations of a slot, the scratch object is wiped again by the caller */
+static TEE_Result set_slot_key(TEE_ObjectHandle scratch, TEE_OperationHandle op, const uint8_t *key)
 {
-
 	TEE_Result res;
+	TEE_Attribute attr;
 
-	TEE_OperationHandle hkdf_op_handle = TEE_HANDLE_NULL;
-	TEE_ObjectHandle master_handle = TEE_HANDLE_NULL;
-	TEE_ObjectHandle hkdf_result_handle = TEE_HANDLE_NULL;
-	TEE_Attribute master_attr;
-	TEE_Attribute hkdf_attrs[2];
+	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, KEY_LEN/8);
+	TEE_ResetTransientObject(scratch);
+	res = TEE_PopulateTransientObject(scratch, &attr, 1);
+	if (res != TEE_SUCCESS)
+		return res;
+	TEE_ResetOperation(op);
+	return TEE_SetOperationKey(op, scratch);
+}
 
-	uint8_t okm_buffer[KEY_LEN/4] = {0};
-	size_t okm_len = KEY_LEN/4;
+/*
+ * Derives the keys of a format version for a salt with HKDF and sets them on the operations of the slot.
+ * v1 derives [AES key (32 Bytes)][HMAC key (32 Bytes)], the others a single AES-GCM key with their own HKDF info.
+ */
+static TEE_Result fill_slot(struct crypto_ctx *ctx, struct key_cache_slot *slot, int version, const uint8_t *salt)
+{
+	TEE_Result res;
+	TEE_Attribute attrs[3];
+	uint8_t okm[KEY_LEN/4];
+	uint32_t okm_len = sizeof(okm);
+	uint32_t attr_count = 2;
+
+	slot->version = 0;
+
+	TEE_InitValueAttribute(&attrs[0], TEE_ATTR_HKDF_OKM_LENGTH, version == 1 ? KEY_LEN/4 : KEY_LEN/8, 0);
+	TEE_InitRefAttribute(&attrs[1], TEE_ATTR_HKDF_SALT, salt, SALT_SIZE);
+	if (hkdf_info[version])
+		TEE_InitRefAttribute(&attrs[attr_count++], TEE_ATTR_HKDF_INFO, hkdf_info[version],
+				     strlen(hkdf_info[version]));
+
+	TEE_ResetTransientObject(ctx->okm_key);
+	TEE_DeriveKey(ctx->hkdf_op, attrs, attr_count, ctx->okm_key);
+	res = TEE_GetObjectBufferAttribute(ctx->okm_key, TEE_ATTR_SECRET_VALUE, okm, &okm_len);
+	TEE_ResetTransientObject(ctx->okm_key);
+	if (res != TEE_SUCCESS)
+		goto exit;
 
-	
-	TEE_OperationHandle aes_op_handle = TEE_HANDLE_NULL;
-	TEE_ObjectHandle aes_key_handle= TEE_HANDLE_NULL;
-	TEE_Attribute aes_attr;
+	if (version == 1){
+		res = set_slot_key(ctx->hmac_key, slot->hmac_op, okm + KEY_LEN/8);
+		if (res == TEE_SUCCESS)
+			res = set_slot_key(ctx->aes_key, slot->aes_op, okm);
+	} else {
+		res = set_slot_key(ctx->aes_key, slot->gcm_op, okm);
+	}
+	if (res != TEE_SUCCESS)
+		goto exit;
 
-	unsigned char master_key[KEY_LEN / 8] = SYM_KEY;
+	TEE_MemMove(slot->salt, salt, SALT_SIZE);
+	slot->version = version;
 
-	size_t salt_sz = 16; 
-	unsigned char salt[16];
-	size_t mac_sz = 64; 
-	unsigned char mac[64];
-	
-	uint8_t mac_cmp_buffer[64] = {0};
-	size_t mac_cmp_len = mac_sz;
+exit:
+	/* The keys now only live inside the operations */
+	TEE_ResetTransientObject(ctx->hmac_key);
+	TEE_ResetTransientObject(ctx->aes_key);
+	TEE_MemFill(okm, 0, sizeof(okm));
+	if (res != TEE_SUCCESS)
+		EMSG("key setup failed 0x%08x", res);
+	return res;
+}
 
-	// iv = nonce + counter https://en.wikipedia.org/wiki/Block_cipher_mode_of_operation#/media/File:CTR_encryption_2.svg
-	size_t nonce_sz = 8;
-	size_t iv_sz = 16;
-	unsigned char iv[16];
-	
+/* Returns the cache slot holding the keys for a salt, deriving them if they are not cached yet */
+static struct key_cache_slot* lookup_slot(struct crypto_ctx *ctx, int version, const uint8_t *salt)
+{
+	struct key_cache_slot *slot;
+	int i;
 
-	/*extract salt (HKDF) and mac (HMAC) from the buffer*/
-	TEE_MemMove(salt,buffer, salt_sz);
-	TEE_MemMove(mac,buffer+salt_sz, mac_sz);
+	for (i = 0; i < KEY_CACHE_SLOTS; i++){
+		slot = &ctx->slots[i];
+		if (slot->version == version && !TEE_MemCompare(slot->salt, salt, SALT_SIZE))
+			return slot;
+	}
 
-	/*fill the first nonce_sz byte of the iv with the attached value*/
-	TEE_MemMove(iv,buffer+salt_sz+mac_sz, nonce_sz);
+	/* Round robin replacement, every script gets its own salt so the working set is the number of scripts */
+	slot = &ctx->slots[ctx->next_slot];
+	ctx->next_slot = (ctx->next_slot + 1) % KEY_CACHE_SLOTS;
+	if (fill_slot(ctx, slot, version, salt) != TEE_SUCCESS)
+		return NULL;
+	return slot;
+}
 
+/* v1: encrypt-then-MAC, one pass over the data for HMAC-SHA512 and one for AES-CTR */
+static TEE_Result decrypt_v1(struct crypto_ctx *ctx, uint8_t *buffer, const size_t bufferlen,
+		uint8_t *out, uint32_t *outlen)
+{
+	TEE_Result res;
+	struct key_cache_slot *slot;
+	/* iv = nonce + counter https://en.wikipedia.org/wiki/Block_cipher_mode_of_operation#/media/File:CTR_encryption_2.svg */
+	uint8_t iv[AES_BLOCK_SIZE] = {0};
 
-	/* HKDF to derive the two needed keys from the master key*/
+	if (bufferlen < HEADER_SIZE || bufferlen - HEADER_SIZE > UINT32_MAX)
+		return TEE_ERROR_BAD_PARAMETERS;
 
-	res = TEE_AllocateOperation(&hkdf_op_handle,
-				    TEE_ALG_HKDF_SHA512_DERIVE_KEY,
-				    TEE_MODE_DERIVE,
-				    KEY_LEN);
+	slot = lookup_slot(ctx, 1, buffer);
+	if (!slot)
+		return TEE_ERROR_GENERIC;
 
+	/* Check the attached MAC over nonce + payload */
+	TEE_MACInit(slot->hmac_op, NULL, 0);
+	res = TEE_MACCompareFinal(slot->hmac_op, buffer + SALT_SIZE + MAC_SIZE, bufferlen - (SALT_SIZE + MAC_SIZE),
+				  buffer + SALT_SIZE, MAC_SIZE);
 	if (res != TEE_SUCCESS) {
-		EMSG("Failed to allocate operation");
-		hkdf_op_handle = TEE_HANDLE_NULL;
-		return 1;
+		EMSG("MAC did not match the data");
+		return res;
 	}
 
-	TEE_AllocateTransientObject(TEE_TYPE_HKDF_IKM,
-					  KEY_LEN,
-	 				  &master_handle);
+	/* Decryption, the first NONCE_SIZE bytes of the iv are the attached nonce */
+	TEE_MemMove(iv, buffer + SALT_SIZE + MAC_SIZE, NONCE_SIZE);
+	TEE_CipherInit(slot->aes_op, iv, sizeof(iv));
+	res = TEE_CipherDoFinal(slot->aes_op, buffer + HEADER_SIZE, bufferlen - HEADER_SIZE, out, outlen);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_CipherDoFinal failed 0x%08x", res);
+		TEE_ResetOperation(slot->aes_op);
+	}
 
+	return res;
+}
 
-	TEE_InitRefAttribute(&master_attr, TEE_ATTR_HKDF_IKM, master_key, KEY_LEN/8);
-	
-	TEE_ResetTransientObject(master_handle);
-	res = TEE_PopulateTransientObject(master_handle, &master_attr, 1);
+/* v2: AES-GCM, verification and decryption in a single pass */
+static TEE_Result decrypt_v2(struct crypto_ctx *ctx, uint8_t *buffer, const size_t bufferlen,
+		uint8_t *out, uint32_t *outlen)
+{
+	TEE_Result res;
+	struct key_cache_slot *slot;
+	const uint8_t *salt = buffer + V2_MAGIC_SIZE;
+	const uint8_t *nonce = salt + SALT_SIZE;
+	const uint8_t *tag = nonce + V2_NONCE_SIZE;
+
+	if (bufferlen < V2_HEADER_SIZE || bufferlen - V2_HEADER_SIZE > UINT32_MAX)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	slot = lookup_slot(ctx, 2, salt);
+	if (!slot)
+		return TEE_ERROR_GENERIC;
+
+	res = TEE_AEInit(slot->gcm_op, nonce, V2_NONCE_SIZE, V2_TAG_SIZE * 8, V2_AAD_SIZE, bufferlen - V2_HEADER_SIZE);
 	if (res != TEE_SUCCESS) {
-	 	EMSG("TEE_PopulateTransientObject failed, %x", res);
-	 	return res;
+		EMSG("TEE_AEInit failed 0x%08x", res);
+		return res;
 	}
-	
-	
-	res = TEE_SetOperationKey(hkdf_op_handle, master_handle);
+	TEE_AEUpdateAAD(slot->gcm_op, buffer, V2_AAD_SIZE);
+	res = TEE_AEDecryptFinal(slot->gcm_op, buffer + V2_HEADER_SIZE, bufferlen - V2_HEADER_SIZE, out, outlen,
+				 tag, V2_TAG_SIZE);
 	if (res != TEE_SUCCESS) {
-	 	EMSG("TEE_SetOperationKey failed %x", res);
-	 	return res;
+		if (res == TEE_ERROR_MAC_INVALID)
+			EMSG("tag did not match the data");
+		else
+			EMSG("TEE_AEDecryptFinal failed 0x%08x", res);
+		TEE_ResetOperation(slot->gcm_op);
 	}
 
-	TEE_InitValueAttribute(&hkdf_attrs[0], TEE_ATTR_HKDF_OKM_LENGTH, KEY_LEN/4, 0);
-	TEE_InitRefAttribute(&hkdf_attrs[1], TEE_ATTR_HKDF_SALT, salt, 16);
-	
-	res = TEE_AllocateTransientObject(TEE_TYPE_GENERIC_SECRET,
-					  KEY_LEN*2,
-	 				  &hkdf_result_handle);
-
-	
-	TEE_DeriveKey(hkdf_op_handle, hkdf_attrs, 2, hkdf_result_handle);
-	
-	TEE_GetObjectBufferAttribute(hkdf_result_handle, TEE_ATTR_SECRET_VALUE, okm_buffer, &okm_len);
+	return res;
+}
 
+/* v3: the chunks are streamed into the output one after the other */
+static TEE_Result decrypt_v3(struct crypto_ctx *ctx, uint8_t *buffer, const size_t bufferlen,
+		uint8_t *out, uint32_t *outlen)
+{
+	TEE_Result res;
+	struct luata_stream *stream;
+	const uint8_t *chunk;
+	uint32_t chunklen;
+	uint32_t written = 0;
 
-	/* Generate HMAC over nonce + payload*/
-	
-	hmac_sha512(okm_buffer+32, 32,
-			    buffer + salt_sz + mac_sz, bufferlen - (salt_sz + mac_sz),
-			    mac_cmp_buffer, &mac_cmp_len);
+	res = luata_stream_open(ctx, buffer, bufferlen, &stream);
+	if (res != TEE_SUCCESS)
+		return res;
 
+	while ((res = luata_stream_read(stream, &chunk, &chunklen)) == TEE_SUCCESS && chunklen){
+		if (chunklen > *outlen - written){
+			res = TEE_ERROR_SHORT_BUFFER;
+			break;
+		}
+		TEE_MemMove(out + written, chunk, chunklen);
+		written += chunklen;
+	}
+	luata_stream_close(stream);
 
-	/* Check if the generated hash matches the attached MAC */
-	res = TEE_MemCompare(mac, mac_cmp_buffer, mac_cmp_len);
-	if (res != TEE_SUCCESS) {
-		EMSG("MAC did not match the data");
-		goto err;
+	if (res != TEE_SUCCESS){
+		TEE_MemFill(out, 0, written);
+		return res;
 	}
+	*outlen = written;
+	return TEE_SUCCESS;
+}
+
+TEE_Result verify_and_decrypt_script(struct crypto_ctx *ctx, uint8_t *buffer, const size_t bufferlen,
+		uint8_t *out, uint32_t *outlen)
+{
+	/* v1 has no header, it starts with a random salt */
+	if (bufferlen >= V2_MAGIC_SIZE && !TEE_MemCompare(buffer, v2_magic, V2_MAGIC_SIZE))
+		return decrypt_v2(ctx, buffer, bufferlen, out, outlen);
+	if (luata_is_chunked(buffer, bufferlen))
+		return decrypt_v3(ctx, buffer, bufferlen, out, outlen);
+	return decrypt_v1(ctx, buffer, bufferlen, out, outlen);
+}
 
-	/* Decryption */
-	
-	res = TEE_AllocateOperation(&aes_op_handle,
-				    TEE_ALG_AES_CTR,
-				    TEE_MODE_DECRYPT,
-				    KEY_LEN);
 
-	if (res != TEE_SUCCESS) {
-		EMSG("Failed to allocate operation");
-		aes_op_handle = TEE_HANDLE_NULL;
-		goto err;
+struct luata_stream {
+	struct key_cache_slot *slot;
+	uint8_t header[V3_HEADER_SIZE];	/* private copy, the payload may change under us */
+	const uint8_t *next;		/* next sealed chunk in the payload */
+	uint32_t chunk_size;
+	uint32_t remaining;		/* plaintext bytes in the chunks not read yet */
+	uint32_t index;
+	uint32_t chunks;
+	TEE_Result res;			/* sticky error */
+	uint8_t *sealed;		/* the current chunk and its tag, copied out of the payload */
+	uint8_t *plain;
+};
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+int luata_is_chunked(const uint8_t *buffer, size_t bufferlen)
+{
+	return bufferlen >= V2_MAGIC_SIZE && !TEE_MemCompare(buffer, v3_magic, V2_MAGIC_SIZE);
+}
+
+TEE_Result luata_stream_open(struct crypto_ctx *ctx, const uint8_t *buffer, size_t bufferlen,
+		struct luata_stream **stream_out)
+{
+	struct luata_stream *stream;
+	uint64_t expected;
+	uint32_t total;
+
+	if (bufferlen < V3_HEADER_SIZE)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	stream = TEE_Malloc(sizeof(*stream), TEE_MALLOC_FILL_ZERO);
+	if (!stream)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	TEE_MemMove(stream->header, buffer, V3_HEADER_SIZE);
+	stream->next = buffer + V3_HEADER_SIZE;
+
+	stream->chunk_size = get_be32(stream->header + V2_MAGIC_SIZE + SALT_SIZE + V3_NONCE_SIZE);
+	total = get_be32(stream->header + V2_MAGIC_SIZE + SALT_SIZE + V3_NONCE_SIZE + 4);
+	stream->remaining = total;
+	stream->chunks = total ? (total - 1) / (stream->chunk_size ? stream->chunk_size : 1) + 1 : 1;
+
+	/* Reject a payload that cannot hold the announced chunks before any work is done */
+	expected = V3_HEADER_SIZE + (uint64_t)total + (uint64_t)stream->chunks * V3_TAG_SIZE;
+	if (TEE_MemCompare(stream->header, v3_magic, V2_MAGIC_SIZE) || !stream->chunk_size ||
+			stream->chunk_size > LUATA_MAX_CHUNK_SIZE || expected != bufferlen){
+		EMSG("malformed chunked script");
+		luata_stream_close(stream);
+		return TEE_ERROR_BAD_FORMAT;
 	}
 
+	stream->sealed = TEE_Malloc(stream->chunk_size + V3_TAG_SIZE, TEE_MALLOC_NO_FILL);
+	stream->plain = TEE_Malloc(stream->chunk_size, TEE_MALLOC_NO_FILL);
+	if (!stream->sealed || !stream->plain){
+		luata_stream_close(stream);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
 
-	res = TEE_AllocateTransientObject(TEE_TYPE_AES,
-					  KEY_LEN,
-					  &aes_key_handle);
+	stream->slot = lookup_slot(ctx, 3, stream->header + V2_MAGIC_SIZE);
+	if (!stream->slot){
+		luata_stream_close(stream);
+		return TEE_ERROR_GENERIC;
+	}
 
-	if (res != TEE_SUCCESS) {
-		EMSG("Failed to allocate transient object");
-		aes_key_handle = TEE_HANDLE_NULL;
-		goto err;
-	}	
+	*stream_out = stream;
+	return TEE_SUCCESS;
+}
 
-	TEE_InitRefAttribute(&aes_attr, TEE_ATTR_SECRET_VALUE, okm_buffer, KEY_LEN/8);
-	TEE_ResetTransientObject(aes_key_handle);
-	res = TEE_PopulateTransientObject(aes_key_handle, &aes_attr, 1);
-	if (res != TEE_SUCCESS) {
-		EMSG("TEE_PopulateTransientObject failed, %x", res);
+TEE_Result luata_stream_read(struct luata_stream *stream, const uint8_t **chunk, uint32_t *chunklen)
+{
+	TEE_OperationHandle op = stream->slot->gcm_op;
+	uint8_t nonce[V3_CHUNK_NONCE_SIZE];
+	uint32_t len, outlen;
+	TEE_Result res;
+
+	*chunk = stream->plain;
+	*chunklen = 0;
+	if (stream->res != TEE_SUCCESS || stream->index == stream->chunks)
+		return stream->res;
+
+	len = stream->remaining < stream->chunk_size ? stream->remaining : stream->chunk_size;
+	TEE_MemMove(stream->sealed, stream->next, len + V3_TAG_SIZE);
+
+	TEE_MemMove(nonce, stream->header + V2_MAGIC_SIZE + SALT_SIZE, V3_NONCE_SIZE);
+	nonce[V3_NONCE_SIZE] = stream->index >> 24;
+	nonce[V3_NONCE_SIZE + 1] = stream->index >> 16;
+	nonce[V3_NONCE_SIZE + 2] = stream->index >> 8;
+	nonce[V3_NONCE_SIZE + 3] = stream->index;
+
+	res = TEE_AEInit(op, nonce, sizeof(nonce), V3_TAG_SIZE * 8, V3_HEADER_SIZE, len);
+	if (res == TEE_SUCCESS){
+		TEE_AEUpdateAAD(op, stream->header, V3_HEADER_SIZE);
+		outlen = stream->chunk_size;
+		res = TEE_AEDecryptFinal(op, stream->sealed, len, stream->plain, &outlen, stream->sealed + len, V3_TAG_SIZE);
+	}
+	if (res != TEE_SUCCESS){
+		if (res == TEE_ERROR_MAC_INVALID)
+			EMSG("tag of chunk %" PRIu32 " did not match the data", stream->index);
+		else
+			EMSG("chunk %" PRIu32 " failed 0x%08x", stream->index, res);
+		TEE_ResetOperation(op);
+		stream->res = res;
 		return res;
 	}
 
-	
-	res = TEE_SetOperationKey(aes_op_handle, aes_key_handle);
-	if (res != TEE_SUCCESS) {
-		EMSG("TEE_SetOperationKey failed %x", res);
-		goto err;
+	stream->next += len + V3_TAG_SIZE;
+	stream->remaining -= len;
+	stream->index++;
+	*chunklen = outlen;
+	return TEE_SUCCESS;
+}
+
+TEE_Result luata_stream_finish(struct luata_stream *stream)
+{
+	const uint8_t *chunk;
+	uint32_t chunklen;
+
+	while (stream->res == TEE_SUCCESS && stream->index < stream->chunks)
+		luata_stream_read(stream, &chunk, &chunklen);
+	return stream->res;
+}
+
+void luata_stream_close(struct luata_stream *stream)
+{
+	if (!stream)
+		return;
+
+	if (stream->plain){
+		TEE_MemFill(stream->plain, 0, stream->chunk_size);
+		TEE_Free(stream->plain);
 	}
+	TEE_Free(stream->sealed);
+	TEE_Free(stream);
+}
 
 
-	TEE_CipherInit(aes_op_handle, iv, iv_sz);
-	
-	res = TEE_CipherUpdate(aes_op_handle, buffer+salt_sz+mac_sz+nonce_sz, bufferlen-(salt_sz+mac_sz+nonce_sz), out, outlen);
-	if (res != TEE_SUCCESS) {
-		EMSG("TEE_CipherUpdate failed 0x%08x", res);
-		return res;
+int luata_is_bundle(const uint8_t *buffer, size_t bufferlen)
+{
+	return bufferlen >= V2_MAGIC_SIZE && !TEE_MemCompare(buffer, bundle_magic, V2_MAGIC_SIZE);
+}
+
+/*
+ * Checks the header and the index of a bundle, sealed (followed by a tag of trailer bytes) or opened (no trailer).
+ * Yields the size of header and index and the size of the scripts.
+ */
+static TEE_Result check_bundle(const uint8_t *buffer, size_t bufferlen, size_t trailer,
+		size_t *index_end, size_t *scripts_len)
+{
+	const uint8_t *entry;
+	uint64_t end;
+	uint32_t count, i;
+
+	if (bufferlen < BUNDLE_HEADER_SIZE + trailer || !luata_is_bundle(buffer, bufferlen))
+		goto bad;
+
+	count = get_be32(buffer + BUNDLE_HEADER_SIZE - 4);
+	end = BUNDLE_HEADER_SIZE + (uint64_t)count * BUNDLE_ENTRY_SIZE;
+	if (end > bufferlen - trailer)
+		goto bad;
+	*index_end = end;
+	*scripts_len = bufferlen - trailer - end;
+
+	for (i = 0; i < count; i++){
+		entry = buffer + BUNDLE_HEADER_SIZE + (size_t)i * BUNDLE_ENTRY_SIZE;
+		if (!entry[0] || entry[LUATA_BUNDLE_NAME_MAX - 1])
+			goto bad;
+		if ((uint64_t)get_be32(entry + LUATA_BUNDLE_NAME_MAX) + get_be32(entry + LUATA_BUNDLE_NAME_MAX + 4) >
+				*scripts_len)
+			goto bad;
+		/* Sorted, so lookups can bisect, and without duplicates */
+		if (i && TEE_MemCompare(entry - BUNDLE_ENTRY_SIZE, entry, LUATA_BUNDLE_NAME_MAX) >= 0)
+			goto bad;
 	}
-	
 	return TEE_SUCCESS;
-	
 
-err:
-	if (aes_op_handle != TEE_HANDLE_NULL)
-		TEE_FreeOperation(aes_op_handle);
-	aes_op_handle = TEE_HANDLE_NULL;
+bad:
+	EMSG("malformed app bundle");
+	return TEE_ERROR_BAD_FORMAT;
+}
 
-	if (aes_key_handle != TEE_HANDLE_NULL)
-		TEE_FreeTransientObject(aes_key_handle);
-	aes_key_handle = TEE_HANDLE_NULL;
+TEE_Result verify_and_open_bundle(struct crypto_ctx *ctx, const uint8_t *buffer, size_t bufferlen,
+		uint8_t *out, uint32_t *outlen)
+{
+	TEE_Result res;
+	struct key_cache_slot *slot;
+	size_t index_end, scripts_len;
+	uint32_t plain_len;
 
-	return res;
+	res = check_bundle(buffer, bufferlen, BUNDLE_TAG_SIZE, &index_end, &scripts_len);
+	if (res != TEE_SUCCESS)
+		return res;
+	if (bufferlen - BUNDLE_TAG_SIZE > UINT32_MAX)
+		return TEE_ERROR_BAD_PARAMETERS;
+	if (*outlen < bufferlen - BUNDLE_TAG_SIZE)
+		return TEE_ERROR_SHORT_BUFFER;
+
+	slot = lookup_slot(ctx, BUNDLE_VERSION, buffer + V2_MAGIC_SIZE);
+	if (!slot)
+		return TEE_ERROR_GENERIC;
 
-}
\ No newline at end of file
+	/* Header and index are authenticated along with the scripts, the index that was checked is the one signed */
+	res = TEE_AEInit(slot->gcm_op, buffer + V2_MAGIC_SIZE + SALT_SIZE, BUNDLE_NONCE_SIZE, BUNDLE_TAG_SIZE * 8,
+			 index_end, scripts_len);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_AEInit failed 0x%08x", res);
+		return res;
+	}
+	TEE_AEUpdateAAD(slot->gcm_op, buffer, index_end);
+	plain_len = *outlen - index_end;
+	res = TEE_AEDecryptFinal(slot->gcm_op, buffer + index_end + BUNDLE_TAG_SIZE, scripts_len, out + index_end,
+				 &plain_len, buffer + index_end, BUNDLE_TAG_SIZE);
+	if (res != TEE_SUCCESS) {
+		if (res == TEE_ERROR_MAC_INVALID)
+			EMSG("tag did not match the bundle");
+		else
+			EMSG("TEE_AEDecryptFinal failed 0x%08x", res);
+		TEE_ResetOperation(slot->gcm_op);
+		TEE_MemFill(out + index_end, 0, scripts_len);
+		return res;
+	}
+
+	TEE_MemMove(out, buffer, index_end);
+	*outlen = index_end + plain_len;
+	return TEE_SUCCESS;
+}
+
+TEE_Result luata_bundle_find(const uint8_t *bundle, size_t bundlelen, const char *name, size_t name_len,
+		const uint8_t **script, uint32_t *script_len)
+{
+	char key[LUATA_BUNDLE_NAME_MAX] = { 0 };
+	const uint8_t *entry;
+	uint32_t count, lo = 0, hi, mid, offset, size;
+	size_t index_end;
+	int cmp;
+
+	if (!name_len || name_len >= LUATA_BUNDLE_NAME_MAX)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+	TEE_MemMove(key, name, name_len);
+
+	/* The bundle was checked when it was opened, only what a lookup touches is checked again */
+	if (bundlelen < BUNDLE_HEADER_SIZE)
+		return TEE_ERROR_BAD_FORMAT;
+	count = get_be32(bundle + BUNDLE_HEADER_SIZE - 4);
+	if (count > (bundlelen - BUNDLE_HEADER_SIZE) / BUNDLE_ENTRY_SIZE)
+		return TEE_ERROR_BAD_FORMAT;
+	index_end = BUNDLE_HEADER_SIZE + (size_t)count * BUNDLE_ENTRY_SIZE;
+
+	hi = count;
+	while (lo < hi){
+		mid = lo + (hi - lo) / 2;
+		entry = bundle + BUNDLE_HEADER_SIZE + (size_t)mid * BUNDLE_ENTRY_SIZE;
+		cmp = TEE_MemCompare(entry, key, LUATA_BUNDLE_NAME_MAX);
+		if (cmp < 0){
+			lo = mid + 1;
+		} else if (cmp > 0){
+			hi = mid;
+		} else {
+			offset = get_be32(entry + LUATA_BUNDLE_NAME_MAX);
+			size = get_be32(entry + LUATA_BUNDLE_NAME_MAX + 4);
+			if ((uint64_t)offset + size > bundlelen - index_end)
+				return TEE_ERROR_BAD_FORMAT;
+			*script = bundle + index_end + offset;
+			*script_len = size;
+			return TEE_SUCCESS;
+		}
+	}
+	return TEE_ERROR_ITEM_NOT_FOUND;
+}
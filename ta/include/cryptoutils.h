@@ -10,27 +10,173 @@
 
 
 /**
- * Function taken from https://github.com/linaro-swg/optee_examples/blob/master/hotp/ta/hotp_ta.c
- *  HMAC a block of memory to produce the authentication
- * 
- *  @param key       The secret key
- *  @param keylen    The length of the secret key (bytes)
- *  @param in        The data to HMAC
- *  @param inlen     The length of the data to HMAC (bytes)
- *  @param out       [out] Destination of the authentication tag
- *  @param outlen    [in/out] Max size and resulting size of authentication tag
- */
-TEE_Result hmac_sha512(const uint8_t *key, const size_t keylen,
-			    const uint8_t *in, const size_t inlen,
-			    uint8_t *out, uint32_t *outlen);
-
-/**
- *  Check the mac of the payload and decrypt it using keys generated with hkdf, generating a plaintext lua script
- *  @param buffer        The read file buffer: [salt (16 Bytes)][mac (64 Bytes)][nonce (8 Byte)][aes encrypted lua script]
+ *  Compute the SHA-256 digest of a block of memory
+ *
+ *  @param in        The data to hash
+ *  @param inlen     The length of the data to hash (bytes)
+ *  @param out       [out] Destination of the 32 byte digest
+ */
+TEE_Result sha256_digest(const uint8_t *in, const size_t inlen, uint8_t *out);
+
+/*
+ * Per session state for verify_and_decrypt_script(): the operation handles and key objects are allocated once,
+ * and the keys derived for the most recently used salts are kept set on their operations.
+ */
+struct crypto_ctx;
+
+/**
+ *  Allocate a crypto context
+ *
+ *  @param ctx       [out] The new context, to be freed with crypto_ctx_free()
+ */
+TEE_Result crypto_ctx_alloc(struct crypto_ctx **ctx);
+
+/**
+ *  Free a crypto context and wipe the key material it holds
+ *
+ *  @param ctx       The context, may be NULL
+ */
+void crypto_ctx_free(struct crypto_ctx *ctx);
+
+/*
+ * Encrypted scripts (.luata) come in two formats, both keyed with HKDF-SHA512 from the master key and a per file salt:
+ *
+ *  v1: [salt (16 Bytes)][mac (64 Bytes)][nonce (8 Bytes)][aes encrypted lua script]
+ *      AES-256-CTR with the iv [nonce][64 bit counter from 0], then HMAC-SHA512 over nonce + ciphertext.
+ *      HKDF yields [AES key (32 Bytes)][HMAC key (32 Bytes)].
+ *
+ *  v2: [magic "LTA\2" (4 Bytes)][salt (16 Bytes)][nonce (12 Bytes)][tag (16 Bytes)][aes encrypted lua script]
+ *      AES-256-GCM with magic, salt and nonce as additional authenticated data. HKDF with the info "luata v2"
+ *      yields the AES key.
+ *
+ *  v3: [magic "LTA\3" (4 Bytes)][salt (16 Bytes)][nonce (8 Bytes)][chunk size (4 Bytes)][script length (4 Bytes)]
+ *      followed by the chunks [aes encrypted chunk][tag (16 Bytes)]
+ *      The script is split into chunks of chunk size bytes, the last one may be shorter, an empty script is a single
+ *      empty chunk. Each chunk is sealed on its own with AES-256-GCM, using the nonce [nonce][32 bit chunk index] and
+ *      the 36 byte header as additional authenticated data. HKDF with the info "luata v3" yields the AES key.
+ *      Both sizes are big endian. Binding the index and the header (and so the total length) into every tag keeps
+ *      chunks from being reordered, dropped or truncated, while every chunk can be used as soon as its tag checked out.
+ *
+ * v1 has no header, a v1 file whose random salt starts with a magic (a chance of 2^-31) has to be encrypted again.
+ */
+#define LUATA_V2_MAGIC	{ 'L', 'T', 'A', 2 }
+#define LUATA_V3_MAGIC	{ 'L', 'T', 'A', 3 }
+
+/* Largest chunk size the TA accepts for v3, bounds the memory a stream needs */
+#define LUATA_MAX_CHUNK_SIZE	(64 * 1024)
+
+/*
+ * An app bundle (.luatb) packs all TA scripts of an application into one container with a single key derivation and
+ * a single tag:
+ *
+ *  [magic "LTB\1" (4 Bytes)][salt (16 Bytes)][nonce (12 Bytes)][script count (4 Bytes)]
+ *  [index, per script: [name (48 Bytes)][offset (4 Bytes)][size (4 Bytes)]][tag (16 Bytes)][aes encrypted scripts]
+ *
+ * The scripts are concatenated and sealed as one AES-256-GCM message, with header and index as additional
+ * authenticated data. HKDF with the info "luata bundle" yields the AES key. Names are NUL terminated and zero padded,
+ * the index is sorted by name (bytewise, strictly ascending) and offsets are relative to the first script. All
+ * numbers are big endian.
+ *
+ * Opening a bundle yields the same layout without the tag and with the scripts in plaintext. Scripts are looked up
+ * in an opened bundle by name, without any further cryptography.
+ */
+#define LUATA_BUNDLE_MAGIC	{ 'L', 'T', 'B', 1 }
+#define LUATA_BUNDLE_NAME_MAX	48
+
+/**
+ *  Check the mac (v1) or tags (v2, v3) of the payload and decrypt it using keys generated with hkdf, generating a
+ *  plaintext lua script
+ *  @param ctx           The crypto context of the session
+ *  @param buffer        The read file buffer in the v1, v2 or v3 format, see above
  *  @param bufferlen     The length of the buffer
  *  @param out           [out] Destination of the plaintext lua script
  *  @param outlen        [in/out] Max size and resulting size of plaintext script
  */
-TEE_Result verify_and_decrypt_script(uint8_t *payload, const size_t payloadlen, uint8_t *out, uint32_t *outlen);
+TEE_Result verify_and_decrypt_script(struct crypto_ctx *ctx, uint8_t *payload, const size_t payloadlen,
+		uint8_t *out, uint32_t *outlen);
+
+/**
+ *  Check whether a payload is an app bundle
+ *
+ *  @param buffer        The payload
+ *  @param bufferlen     The length of the payload
+ */
+int luata_is_bundle(const uint8_t *buffer, size_t bufferlen);
+
+/**
+ *  Check the index and the tag of an app bundle and decrypt its scripts, generating the opened bundle
+ *
+ *  @param ctx           The crypto context of the session
+ *  @param buffer        The bundle, see above. Read more than once, so it must not be shared memory
+ *  @param bufferlen     The length of the bundle
+ *  @param out           [out] Destination of the opened bundle
+ *  @param outlen        [in/out] Max size and resulting size of the opened bundle, which is 16 bytes shorter
+ */
+TEE_Result verify_and_open_bundle(struct crypto_ctx *ctx, const uint8_t *buffer, size_t bufferlen,
+		uint8_t *out, uint32_t *outlen);
+
+/**
+ *  Look up a script in an opened bundle
+ *
+ *  @param bundle        The opened bundle
+ *  @param bundlelen     The length of the opened bundle
+ *  @param name          The name of the script, not NUL terminated
+ *  @param name_len      The length of the name
+ *  @param script        [out] The script, points into the bundle
+ *  @param script_len    [out] The length of the script
+ *  @return TEE_ERROR_ITEM_NOT_FOUND if the bundle has no script with that name
+ */
+TEE_Result luata_bundle_find(const uint8_t *bundle, size_t bundlelen, const char *name, size_t name_len,
+		const uint8_t **script, uint32_t *script_len);
+
+/*
+ * Chunk by chunk verification and decryption of a v3 script, so a script can be consumed while it is decrypted
+ * and a tampered chunk stops the consumer before it has seen anything unauthenticated.
+ */
+struct luata_stream;
+
+/**
+ *  Check whether a payload is in the chunked v3 format
+ *
+ *  @param buffer        The payload
+ *  @param bufferlen     The length of the payload
+ */
+int luata_is_chunked(const uint8_t *buffer, size_t bufferlen);
+
+/**
+ *  Start reading a v3 script. The header is copied and checked against the length of the payload, the chunks are
+ *  read from the payload exactly once, as they are requested. The payload may therefore be shared memory.
+ *
+ *  @param ctx           The crypto context of the session, has to outlive the stream
+ *  @param buffer        The payload in the v3 format, has to stay mapped until the stream is closed
+ *  @param bufferlen     The length of the payload
+ *  @param stream        [out] The new stream, to be freed with luata_stream_close()
+ */
+TEE_Result luata_stream_open(struct crypto_ctx *ctx, const uint8_t *buffer, size_t bufferlen,
+		struct luata_stream **stream);
+
+/**
+ *  Verify and decrypt the next chunk. After a failure the stream stays failed and returns the same error.
+ *
+ *  @param stream        The stream
+ *  @param chunk         [out] The plaintext of the chunk, valid until the next call
+ *  @param chunklen      [out] The length of the plaintext, 0 after the last chunk
+ */
+TEE_Result luata_stream_read(struct luata_stream *stream, const uint8_t **chunk, uint32_t *chunklen);
+
+/**
+ *  Verify the chunks that were not read yet, so the complete payload is known to be authentic. Returns the error
+ *  of the stream if it failed before.
+ *
+ *  @param stream        The stream
+ */
+TEE_Result luata_stream_finish(struct luata_stream *stream);
+
+/**
+ *  Free a stream and wipe the plaintext it holds
+ *
+ *  @param stream        The stream, may be NULL
+ */
+void luata_stream_close(struct luata_stream *stream);
 
-#endif
\ No newline at end of file
+#endif
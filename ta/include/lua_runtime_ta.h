@@ -25,6 +25,8 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdint.h>
+
 #include "lua.h"
 
 #include "lprefix.h"
@@ -51,9 +53,10 @@
 /*
  * TA_RUN_LUA_SCRIPT - Runs the input lua script inside the TA and fills the params with the output value
  * param[0] (memref) input buffer containing the encrypted (or plaintext) lua script
- * param[1] (value)  related to lua arguments, see lua_arguments.h for further details 
+ * param[1] (value)  related to lua arguments, see lua_arguments.h for further details. The returned type is
+ * 					 LUA_TYPE_ERROR if the script raised an error, with the message as the return value
  * param[2] (value)  a: A flag to indicate if the input data is plaintext or encrypted+signed 
- * 					 b: unused
+ * 					 b: Request flags (LUA_TA_FLAG_*)
  * param[3] (memref) related to lua arguments, see lua_arguments.h for further details 
  */
 #define TA_RUN_LUA_SCRIPT		1
@@ -62,8 +65,9 @@
 /*
  * TA_RUN_SAVED_LUA_SCRIPT - Runs a lua script already present inside the TA and fills the params with the output value
  * param[0] (memref) input buffer containing the name of the lua script
- * param[1] (value)  related to lua arguments, see lua_arguments.h for further details 
- * param[2] unused
+ * param[1] (value)  related to lua arguments, see lua_arguments.h for further details, as for TA_RUN_LUA_SCRIPT
+ * param[2] (value)  a: unused
+ * 					 b: Request flags (LUA_TA_FLAG_*)
  * param[3] (memref) related to lua arguments, see lua_arguments.h for further details 
  */
 #define TA_RUN_SAVED_LUA_SCRIPT		2
@@ -78,29 +82,152 @@
  */
 #define TA_SAVE_LUA_SCRIPT		3
 
-/* Currently not working*/
-#define TA	4
+/*
+ * TA_RUN_NATIVE_LOOP - Runs a native C loop without involving the Lua interpreter, used as a baseline for benchmarks
+ * param[0] unused
+ * param[1] (value)  a: The number of loop iterations (0 measures the bare round trip to the TA)
+ * 					 b: The result of the loop
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_RUN_NATIVE_LOOP	4
+
+/*
+ * TA_GET_MANIFEST - Returns the manifest of the scripts saved with TA_SAVE_LUA_SCRIPTS
+ * param[0] (memref) output buffer receiving an array of struct lua_ta_manifest_entry. Its size is set to the size
+ * 					 of the manifest (0 if there is none), TEE_ERROR_SHORT_BUFFER is returned if it does not fit
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_GET_MANIFEST		5
+
+/*
+ * TA_SAVE_LUA_SCRIPTS - Saves the changed scripts of an application in the secure storage together with its new manifest.
+ * Scripts in the old manifest which are missing from the new one are deleted. Every entry of the new manifest that
+ * is not sent along has to match the old manifest.
+ * param[0] (memref) input buffer containing the changed scripts, each a struct lua_ta_manifest_entry directly
+ * 					 followed by entry.size bytes of encrypted (or plaintext) lua script. May be empty.
+ * param[1] (memref) input buffer containing the complete new manifest (array of struct lua_ta_manifest_entry)
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SAVE_LUA_SCRIPTS		6
+
+/*
+ * TA_SAVE_APP_BUNDLE - Saves the app bundle of an application (see cryptoutils.h) in the secure storage. The bundle is
+ * verified and decrypted once, its scripts are then run by name with TA_RUN_SAVED_LUA_SCRIPT and internal_TA_call
+ * without any further cryptography. The bundle replaces the scripts saved with TA_SAVE_LUA_SCRIPTS, the new manifest
+ * has the single entry LUA_TA_APP_BUNDLE_ID describing the bundle as sent.
+ * param[0] (memref) input buffer containing the app bundle
+ * param[1] unused
+ * param[2] unused
+ * param[3] unused
+ */
+#define TA_SAVE_APP_BUNDLE		7
 
 /* flag values to indicate wether a passed lua script needs to be decrypted before running */
 #define LUA_MODE_PLAINTEXT	0
 #define LUA_MODE_ENCRYPTED	1
 
+/*
+ * Request flags for TA_RUN_LUA_SCRIPT and TA_RUN_SAVED_LUA_SCRIPT (param[2].value.b)
+ *
+ * LUA_TA_FLAG_STATS: Report how long each phase of the call took. The TA appends a struct lua_ta_phase_stats to the
+ * returned data in param[3], 8 byte aligned after the string return value (or at the start of the buffer for number
+ * return values), so that it always ends at the returned param[3] size.
+ */
+#define LUA_TA_FLAG_STATS	(1 << 0)
+
+/*
+ * LUA_TA_GC_TARGET(us): A latency target for the call in microseconds, counted from when the TA gets it, in the upper
+ * bits of the request flags (at most LUA_TA_GC_TARGET_MAX, 0 for none). The garbage collector then only works while it
+ * can do so without running past the target, unless the Lua heap grows over LUA_TA_GC_LIMIT. As every call gets a new
+ * Lua state, the work it leaves is never done: it goes away with the state.
+ */
+#define LUA_TA_GC_TARGET_SHIFT	8
+#define LUA_TA_GC_TARGET_MAX	((1u << (32 - LUA_TA_GC_TARGET_SHIFT)) - 1)
+#define LUA_TA_GC_TARGET(us)	((uint32_t)(us) << LUA_TA_GC_TARGET_SHIFT)
+
+/* The Lua heap size in KB over which the collector ignores the latency target (half of TA_DATA_SIZE) */
+#define LUA_TA_GC_LIMIT		512
+
+/* The phases of a call into the TA, as reported with LUA_TA_FLAG_STATS */
+#define LUA_TA_PHASE_COPY_IN		0	/* copying the script (or its name) out of shared memory */
+#define LUA_TA_PHASE_STORAGE_READ	1	/* reading a saved script from the secure storage */
+#define LUA_TA_PHASE_DECRYPT		2	/* key derivation, MAC verification and decryption */
+#define LUA_TA_PHASE_STATE_CREATE	3	/* luaL_newstate */
+#define LUA_TA_PHASE_OPENLIBS		4	/* luaL_openlibs and registering the TA functions */
+#define LUA_TA_PHASE_LOAD		5	/* luaL_loadbuffer (lexing and parsing or undumping) */
+#define LUA_TA_PHASE_ARGS_IN		6	/* converting the input argument onto the Lua stack */
+#define LUA_TA_PHASE_PCALL		7	/* running the script, including nested internal_TA_call()s */
+#define LUA_TA_PHASE_ARGS_OUT		8	/* converting the return value into the params */
+#define LUA_TA_PHASE_CLOSE		9	/* lua_close */
+#define LUA_TA_PHASE_GC			10	/* the garbage collector, taken out of the phases above it ran in */
+#define LUA_TA_PHASE_COUNT		11
+
+#define LUA_TA_STATS_MAGIC	0x4c545053	/* "LTPS" */
+
+struct lua_ta_phase_stats {
+	uint32_t magic;
+	uint32_t phase_count;
+	uint64_t phase_ns[LUA_TA_PHASE_COUNT];
+};
+
+/*
+ * The manifest describes the scripts saved with TA_SAVE_LUA_SCRIPTS, so the rich OS side only has to send the ones that
+ * changed. It is kept in the secure storage under LUA_TA_MANIFEST_ID, which cannot collide with a script name as those
+ * never contain a '.'. Saving a single script with TA_SAVE_LUA_SCRIPT drops the manifest.
+ *
+ * An app bundle is kept opened under LUA_TA_APP_BUNDLE_ID. Saved scripts are looked up in the bundle first, saving
+ * scripts with TA_SAVE_LUA_SCRIPT or TA_SAVE_LUA_SCRIPTS drops it.
+ */
+#define LUA_TA_MANIFEST_ID		".manifest"
+#define LUA_TA_APP_BUNDLE_ID		".bundle"
+#define LUA_TA_SCRIPT_NAME_MAX		48
+#define LUA_TA_DIGEST_SIZE		32
+
+struct lua_ta_manifest_entry {
+	char name[LUA_TA_SCRIPT_NAME_MAX];	/* NUL terminated, zero padded */
+	uint32_t encrypted;			/* LUA_MODE_PLAINTEXT or LUA_MODE_ENCRYPTED */
+	uint32_t size;				/* the size of the script as sent */
+	uint8_t digest[LUA_TA_DIGEST_SIZE];	/* SHA-256 of the script as sent */
+};
+
 
 #ifdef TRUSTED_APP_BUILD
 
 #include <tee_internal_api.h>
 #include <tee_internal_api_extensions.h>
 
+/* see cryptoutils.h */
+struct crypto_ctx;
+struct luata_stream;
+
+/* see lua/laot.h */
+struct lua_AotScript;
 
 /* Entry function for TA_SAVE_LUA_SCRIPT*/
-TEE_Result save_lua_script(uint32_t param_types, TEE_Param params[4]);
+TEE_Result save_lua_script(struct crypto_ctx *crypto, uint32_t param_types, TEE_Param params[4]);
 
 /* Entry function for TA_RUN_LUA_SCRIPT*/
-TEE_Result run_lua_script(uint32_t param_types, TEE_Param params[4]);
+TEE_Result run_lua_script(struct crypto_ctx *crypto, uint32_t param_types, TEE_Param params[4]);
 
 /* Entry function for TA_RUN_SAVED_LUA_SCRIPT*/
 TEE_Result run_saved_lua_script_entry(uint32_t param_types, TEE_Param params[4]);
 
+/* Entry function for TA_RUN_NATIVE_LOOP*/
+TEE_Result run_native_loop(uint32_t param_types, TEE_Param params[4]);
+
+/* Entry function for TA_GET_MANIFEST*/
+TEE_Result get_manifest(uint32_t param_types, TEE_Param params[4]);
+
+/* Entry function for TA_SAVE_LUA_SCRIPTS*/
+TEE_Result save_lua_scripts(struct crypto_ctx *crypto, uint32_t param_types, TEE_Param params[4]);
+
+/* Entry function for TA_SAVE_APP_BUNDLE*/
+TEE_Result save_app_bundle(struct crypto_ctx *crypto, uint32_t param_types, TEE_Param params[4]);
+
 
 /**
  * Calls another Lua script from inside a Lua script running in the TA. Only called by Lua scripts.
@@ -112,15 +239,20 @@ int internal_TA_call(lua_State *L);
 
 /**
  * Runs a Lua script with the given argument and gets the return value from the stack.
+ * Fails only if a chunked script does not authenticate, the output is not set then.
  *
- * @param script        [in] The Lua script to be run
+ * @param script        [in] The Lua script to be run, unused if stream or aot is set
  * @param script_len    [in] The length of the Lua script 
+ * @param stream        [in] A chunked encrypted script to decrypt while it is loaded, or NULL
+ * @param aot           [in] A script compiled into the TA (see luac_ta -c), or NULL
+ * @param mode          [in] The load mode, "bt" to allow binary chunks (only for authenticated scripts) or "t"
  * @param input         [in] A pointer to the input argument
  * @param input_type    [in] An integer flag indicating the type of the input argument  
  * @param output  		[out] A pointer to the pointer which will point to the return value 
  * @param output_type  	[out] An integer flag indicating the type of the return value
  */
-void call_lua(char* script, size_t script_len, void* input, int input_type, void** output, int* output_type);
+TEE_Result call_lua(char* script, size_t script_len, struct luata_stream *stream, const struct lua_AotScript *aot,
+		const char *mode, void* input, int input_type, void** output, int* output_type);
 
 
 /**
@@ -0,0 +1,75 @@
+/**
+ * Timestamps for the per phase latency breakdown of TA calls (see LUA_TA_FLAG_STATS in lua_runtime_ta.h).
+ *
+ * On ARM the generic timer's virtual counter is read directly, which is cheap and has sub-microsecond resolution.
+ * Building with -DLUA_TA_PHASE_TIMER_SYSTIME (or on other architectures) falls back to TEE_GetSystemTime(),
+ * which only has millisecond resolution but does not require the counter to be accessible from user mode.
+ * The mock TEE (MOCK_TEE) runs the TA as a plain Linux process and uses CLOCK_MONOTONIC.
+ */
+
+#ifndef PHASE_TIMER_H
+#define PHASE_TIMER_H
+
+#include <stdint.h>
+#include <tee_internal_api.h>
+
+#if (defined(__aarch64__) || defined(__arm__)) && !defined(LUA_TA_PHASE_TIMER_SYSTIME)
+
+static inline uint64_t phase_timer_ticks(void){
+	uint64_t ticks;
+#if defined(__aarch64__)
+	__asm__ volatile("isb; mrs %0, cntvct_el0" : "=r" (ticks));
+#else
+	__asm__ volatile("isb; mrrc p15, 1, %Q0, %R0, c14" : "=r" (ticks));
+#endif
+	return ticks;
+}
+
+static inline uint64_t phase_timer_freq(void){
+	uint64_t freq;
+#if defined(__aarch64__)
+	__asm__ volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+#else
+	uint32_t freq32;
+	__asm__ volatile("mrc p15, 0, %0, c14, c0, 0" : "=r" (freq32));
+	freq = freq32;
+#endif
+	return freq;
+}
+
+/* Returns a monotonic timestamp in ns */
+static inline uint64_t phase_timer_now_ns(void){
+	uint64_t ticks = phase_timer_ticks();
+	uint64_t freq = phase_timer_freq();
+
+	if (!freq)
+		return 0;
+	/* split to avoid overflowing ticks * 10^9 */
+	return (ticks / freq) * 1000000000ull + (ticks % freq) * 1000000000ull / freq;
+}
+
+#elif defined(MOCK_TEE)
+
+#include <time.h>
+
+/* Returns a monotonic timestamp in ns */
+static inline uint64_t phase_timer_now_ns(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#else
+
+/* Returns a monotonic timestamp in ns */
+static inline uint64_t phase_timer_now_ns(void){
+	TEE_Time t;
+
+	TEE_GetSystemTime(&t);
+	return (uint64_t)t.seconds * 1000000000ull + (uint64_t)t.millis * 1000000ull;
+}
+
+#endif
+
+#endif /* PHASE_TIMER_H */
@@ -0,0 +1,49 @@
+/**
+ * tee.crypto, the cryptography of the TEE Internal Core API for Lua scripts running in the TA.
+ *
+ *  tee.crypto.random(n)                            n random bytes from TEE_GenerateRandom()
+ *  tee.crypto.digest(alg, data)                    the digest of data, alg is "sha256" or "sha512"
+ *  tee.crypto.mac(alg, key, data)                  the HMAC of data
+ *  tee.crypto.new_digest(alg)                      a digest handle, see below
+ *  tee.crypto.new_mac(alg, key)                    an HMAC handle
+ *  tee.crypto.new_cipher(alg, mode, key [, iv [, aad]])
+ *                                                  a cipher handle, alg is "aes-ctr" or "aes-gcm", mode "encrypt"
+ *                                                  or "decrypt"
+ *
+ *  digest:update(data)                             adds data, returns the handle
+ *  digest:final([data])                            adds data and returns the digest
+ *  mac:update(data), mac:final([data])             as for digests
+ *  mac:verify(mac [, data])                        adds data and compares the HMAC in constant time
+ *  cipher:init([iv [, aad]])                       starts a message, the iv is the nonce for GCM
+ *  cipher:update(data)                             returns the output for data
+ *  cipher:final([data [, tag]])                    returns the rest of the output. GCM encryption returns the
+ *                                                  16 byte tag as a second value, GCM decryption checks the tag
+ *                                                  and returns nil and an error message if it does not match
+ *
+ * Data, keys and outputs are Lua strings. Inputs are passed to the TEE without being copied, outputs are written
+ * straight into the string buffer of the state. A handle keeps its operation and key for its whole life, final()
+ * makes it ready for the next message, so a handle created once is reused without setting up the key again.
+ * The operations are freed with the handle, at the latest when the state is closed. The one-shot digest() keeps one
+ * operation per algorithm for the state.
+ *
+ * Data passed to GCM decryption in update() is returned before its tag is checked, use a single final() call to only
+ * get authenticated plaintext.
+ */
+
+#ifndef TEE_CRYPTOLIB_H
+#define TEE_CRYPTOLIB_H
+
+#include "lua.h"
+
+#define LUA_TEECRYPTOLIBNAME	"crypto"
+
+/* Pushes the tee.crypto table */
+int luaopen_tee_crypto(lua_State *L);
+
+/*
+ * Pushes the table tee. Most scripts never use it, so tee.crypto is only opened when it is first looked up, which
+ * keeps the library out of the cost of creating a state for every call.
+ */
+int luaopen_tee(lua_State *L);
+
+#endif /* TEE_CRYPTOLIB_H */
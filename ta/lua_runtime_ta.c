@@ -41,11 +41,311 @@
 #include "lprefix.h"
 #include "lauxlib.h"
 #include "lualib.h"
+#include "laot.h"
 
 #include "cryptoutils.h"
 #include "lua_arguments.h"
+#include "phase_timer.h"
+#include "tee_cryptolib.h"
 
 
+/* Per session state, assigned to the session context in TA_OpenSessionEntryPoint() */
+struct lua_ta_session {
+	struct crypto_ctx *crypto;
+};
+
+/* Phase statistics of the call currently being handled, NULL if they were not requested by the client */
+static struct lua_ta_phase_stats *phase_stats = NULL;
+
+#define PHASE_START	-1
+
+/*
+ * Adds the time since the last mark to the given phase and returns the new mark.
+ * Costs a single branch if no statistics were requested. Use PHASE_START to take the first mark.
+ */
+static uint64_t phase_mark(int phase, uint64_t since){
+
+	uint64_t now;
+
+	if (!phase_stats)
+		return 0;
+
+	now = phase_timer_now_ns();
+	if (phase != PHASE_START)
+		phase_stats->phase_ns[phase] += now - since;
+	return now;
+}
+
+/* Starts collecting phase statistics for the current call if the client asked for them */
+static void phase_stats_begin(struct lua_ta_phase_stats *stats, uint32_t flags){
+
+	phase_stats = NULL;
+	if (!(flags & LUA_TA_FLAG_STATS))
+		return;
+
+	TEE_MemFill(stats, 0, sizeof(*stats));
+	stats->magic = LUA_TA_STATS_MAGIC;
+	stats->phase_count = LUA_TA_PHASE_COUNT;
+	phase_stats = stats;
+}
+
+/*
+ * Like phase_mark() for a phase that runs Lua code in L, but the time the collector took in it goes to
+ * LUA_TA_PHASE_GC. *gc_seen is the collector time of L accounted so far.
+ */
+static uint64_t phase_mark_lua(lua_State *L, int phase, uint64_t since, lua_Integer *gc_seen){
+
+	uint64_t now = phase_mark(phase, since);
+	lua_Integer gc;
+
+	if (!phase_stats)
+		return now;
+
+	/* unsigned, as a 32-bit lua_Integer clock wraps around */
+	gc = (lua_Integer)((lua_Unsigned)lua_gctime(L) - (lua_Unsigned)*gc_seen);
+	phase_stats->phase_ns[phase] -= gc;
+	phase_stats->phase_ns[LUA_TA_PHASE_GC] += gc;
+	*gc_seen = lua_gctime(L);
+	return now;
+}
+
+/*
+ * Appends the collected statistics to the returned data in params[3] (see LUA_TA_FLAG_STATS).
+ * capacity is the size of the params[3] buffer as passed in by the client.
+ */
+static void phase_stats_end(TEE_Param params[4], size_t capacity){
+
+	size_t offset = 0;
+
+	if (!phase_stats)
+		return;
+
+	if (params[1].value.a != LUA_TYPE_NUMBER)
+		offset = (params[3].memref.size + 7) & ~(size_t)7;
+
+	if (offset + sizeof(*phase_stats) <= capacity){
+		TEE_MemMove((char*)params[3].memref.buffer + offset, phase_stats, sizeof(*phase_stats));
+		params[3].memref.size = offset + sizeof(*phase_stats);
+	}
+
+	phase_stats = NULL;
+}
+
+
+/*
+ * When the call currently being handled has to end for its latency target (see LUA_TA_GC_TARGET), 0 if it has none.
+ * Nested internal_TA_call()s keep the target of the outer call.
+ */
+static uint64_t gc_deadline = 0;
+
+/* Takes the latency target of the call from its request flags */
+static void gc_deadline_begin(uint32_t flags){
+
+	uint32_t target = flags >> LUA_TA_GC_TARGET_SHIFT;
+
+	gc_deadline = target ? phase_timer_now_ns() + target * 1000ull : 0;
+}
+
+/* The clock of the collector */
+static lua_Integer gc_clock(void){
+	return (lua_Integer)phase_timer_now_ns();
+}
+
+
+/* Deletes an object from the secure storage, if it exists */
+static void delete_object(const char *id, size_t id_sz){
+
+	TEE_ObjectHandle object;
+
+	if (TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE, (void*)id, id_sz,
+				TEE_DATA_FLAG_ACCESS_WRITE_META, &object) == TEE_SUCCESS)
+		TEE_CloseAndDeletePersistentObject1(object);
+}
+
+/*
+ * Creates (or replaces) an object in the secure storage. The data is passed as the initial data of the object,
+ * so the storage either keeps the old or gets the complete new object.
+ */
+static TEE_Result write_object(const char *id, size_t id_sz, const void *data, size_t data_sz){
+
+	TEE_ObjectHandle object;
+	TEE_Result res;
+
+	res = TEE_CreatePersistentObject(TEE_STORAGE_PRIVATE,
+					(void*)id, id_sz,
+					TEE_DATA_FLAG_ACCESS_READ |
+					TEE_DATA_FLAG_ACCESS_WRITE |
+					TEE_DATA_FLAG_ACCESS_WRITE_META |
+					TEE_DATA_FLAG_OVERWRITE,
+					TEE_HANDLE_NULL,
+					data, data_sz,
+					&object);
+	if (res != TEE_SUCCESS) {
+		EMSG("TEE_CreatePersistentObject failed 0x%08x", res);
+		return res;
+	}
+	TEE_CloseObject(object);
+	return TEE_SUCCESS;
+}
+
+/* Reads the manifest from the secure storage. *entries is NULL and *count 0 if there is none. */
+static TEE_Result read_manifest(struct lua_ta_manifest_entry **entries, uint32_t *count){
+
+	TEE_ObjectHandle object;
+	TEE_ObjectInfo object_info;
+	TEE_Result res;
+	uint32_t read_bytes;
+
+	*entries = NULL;
+	*count = 0;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+					LUA_TA_MANIFEST_ID, strlen(LUA_TA_MANIFEST_ID),
+					TEE_DATA_FLAG_ACCESS_READ |
+					TEE_DATA_FLAG_SHARE_READ,
+					&object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND)
+		return TEE_SUCCESS;
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_GetObjectInfo1(object, &object_info);
+	if (res != TEE_SUCCESS)
+		goto exit;
+
+	if (object_info.dataSize % sizeof(**entries) || !object_info.dataSize)
+		goto exit;	/* not a manifest written by us, treat it as missing */
+
+	*entries = TEE_Malloc(object_info.dataSize, 0);
+	if (!*entries){
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto exit;
+	}
+
+	res = TEE_ReadObjectData(object, *entries, object_info.dataSize, &read_bytes);
+	if (res != TEE_SUCCESS || read_bytes != object_info.dataSize){
+		TEE_Free(*entries);
+		*entries = NULL;
+		goto exit;
+	}
+	*count = object_info.dataSize / sizeof(**entries);
+
+exit:
+	TEE_CloseObject(object);
+	return res;
+}
+
+/* Returns the index of the entry with the given name, or -1 */
+static int find_manifest_entry(const struct lua_ta_manifest_entry *entries, uint32_t count, const char *name){
+
+	uint32_t i;
+
+	for (i = 0; i < count; i++){
+		if (!strncmp(entries[i].name, name, LUA_TA_SCRIPT_NAME_MAX))
+			return i;
+	}
+	return -1;
+}
+
+
+/*
+ * The opened app bundle, read from the secure storage by the first lookup and kept for the lifetime of the TA
+ * instance. Scripts in it are run without touching the storage again.
+ */
+static uint8_t *app_bundle = NULL;
+static size_t app_bundle_sz = 0;
+static int app_bundle_loaded = 0;	/* app_bundle matches the storage, it is NULL if there is no bundle */
+
+/* Replaces the cached bundle, NULL for none */
+static void set_app_bundle(uint8_t *bundle, size_t bundle_sz){
+
+	if (app_bundle){
+		TEE_MemFill(app_bundle, 0, app_bundle_sz);
+		TEE_Free(app_bundle);
+	}
+	app_bundle = bundle;
+	app_bundle_sz = bundle_sz;
+	app_bundle_loaded = 1;
+}
+
+/* Deletes the bundle from the secure storage and from the cache */
+static void drop_app_bundle(void){
+
+	delete_object(LUA_TA_APP_BUNDLE_ID, strlen(LUA_TA_APP_BUNDLE_ID));
+	set_app_bundle(NULL, 0);
+}
+
+/* Looks up a script in the app bundle, reading the bundle first if that was not done yet */
+static TEE_Result find_in_app_bundle(const char *name, size_t name_sz, const uint8_t **script, uint32_t *script_len){
+
+	TEE_ObjectHandle object;
+	TEE_ObjectInfo object_info;
+	TEE_Result res;
+	uint32_t read_bytes;
+	uint8_t *data;
+
+	if (app_bundle_loaded)
+		goto find;
+
+	res = TEE_OpenPersistentObject(TEE_STORAGE_PRIVATE,
+					LUA_TA_APP_BUNDLE_ID, strlen(LUA_TA_APP_BUNDLE_ID),
+					TEE_DATA_FLAG_ACCESS_READ |
+					TEE_DATA_FLAG_SHARE_READ,
+					&object);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND){
+		set_app_bundle(NULL, 0);
+		goto find;
+	}
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = TEE_GetObjectInfo1(object, &object_info);
+	if (res != TEE_SUCCESS)
+		goto exit;
+
+	data = TEE_Malloc(object_info.dataSize ? object_info.dataSize : 1, TEE_MALLOC_NO_FILL);
+	if (!data){
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto exit;
+	}
+
+	res = TEE_ReadObjectData(object, data, object_info.dataSize, &read_bytes);
+	if (res == TEE_SUCCESS && read_bytes != object_info.dataSize)
+		res = TEE_ERROR_CORRUPT_OBJECT;
+	if (res != TEE_SUCCESS){
+		EMSG("cannot read the app bundle 0x%08x", res);
+		TEE_Free(data);
+		goto exit;
+	}
+	TEE_CloseObject(object);
+	set_app_bundle(data, read_bytes);
+
+find:
+	if (!app_bundle)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+	return luata_bundle_find(app_bundle, app_bundle_sz, name, name_sz, script, script_len);
+
+exit:
+	TEE_CloseObject(object);
+	return res;
+}
+
+
+/*
+ * Binary chunks are only loaded out of authenticated containers (mode "bt"), everything that comes in as plaintext has
+ * to be source code (mode "t"). Saved scripts may be binary, because plaintext ones are checked when they are saved.
+ */
+static int is_binary_chunk(const char *script, size_t script_len){
+	return script_len && script[0] == LUA_SIGNATURE[0];
+}
+
+/* Frees a value returned by call_lua() */
+static void free_lua_value(void *value, int type){
+
+	if (type != LUA_TYPE_NUMBER)
+		TEE_Free(*(char**)value);
+	TEE_Free(value);
+}
 
 
 void MSG_LUA_ERROR(lua_State *L, char *msg){
@@ -59,46 +359,153 @@ int internal_TA_call(lua_State *L) {
 	int lua_arg_type;
 	void* lua_ret; 
 	int lua_ret_type;
+	TEE_Result res;
+
+	/* Nested calls are accounted to the pcall phase of the outer call */
+	struct lua_ta_phase_stats *outer_stats = phase_stats;
 
 	char* script_name = luaL_checkstring(L, 1); 
 	
 	args_from_stack(L, 2, &lua_arg, &lua_arg_type);
 	
-	run_saved_lua_script(script_name, strlen(script_name),lua_arg, lua_arg_type, &lua_ret, &lua_ret_type);
-	
+	phase_stats = NULL;
+	res = run_saved_lua_script(script_name, strlen(script_name),lua_arg, lua_arg_type, &lua_ret, &lua_ret_type);
+	phase_stats = outer_stats;
+
+	/* The argument holder points into this state, only the holder itself was allocated */
+	TEE_Free(lua_arg);
+	if (res != TEE_SUCCESS)
+		return luaL_error(L, "cannot run saved script %s (%I)", script_name, (lua_Integer)res);
+
+	/* An error of the called script is raised again in the caller */
+	if (lua_ret_type == LUA_TYPE_ERROR){
+		lua_pushstring(L, *(char**)lua_ret);
+		free_lua_value(lua_ret, lua_ret_type);
+		return lua_error(L);
+	}
+
 	stack_from_args(L, lua_ret, lua_ret_type);	
+	free_lua_value(lua_ret, lua_ret_type);
 
 	return 1;  /* number of results */
 }
 
-void call_lua(char* script, size_t script_len, void* input, int input_type, void** output, int* output_type){
+/* lua_Reader for chunked encrypted scripts, the parser only ever sees chunks whose tag checked out */
+static const char* stream_reader(lua_State *L, void *data, size_t *size){
+
+	const uint8_t *chunk;
+	uint32_t chunklen;
+	TEE_Result res;
+	uint64_t t = phase_mark(PHASE_START, 0);
+
+	res = luata_stream_read(data, &chunk, &chunklen);
+	phase_mark(LUA_TA_PHASE_DECRYPT, t);
+	if (res != TEE_SUCCESS)
+		luaL_error(L, "chunk rejected (%I)", (lua_Integer)res);
+
+	*size = chunklen;
+	return (const char*)chunk;
+}
+
+TEE_Result call_lua(char* script, size_t script_len, struct luata_stream *stream, const struct lua_AotScript *aot,
+		const char *mode, void* input, int input_type, void** output, int* output_type){
+
+	TEE_Result res;
+	int status;
+	uint64_t decrypt_ns = phase_stats ? phase_stats->phase_ns[LUA_TA_PHASE_DECRYPT] : 0;
+	lua_Integer gc_seen = 0;
+	uint64_t t = phase_mark(PHASE_START, 0);
+
+#if !LUA_USE_AOT
+	(void)aot;
+#endif
 
 	lua_State *L = luaL_newstate();  /* create Lua state */
   	if (L == NULL) {
     	MSG("cannot create state: not enough memory");
 	}
 
+	/* The collector is only timed if the client wants its time or gave a latency target */
+	lua_gc(L, LUA_GCSETLIMIT, LUA_TA_GC_LIMIT);
+	if (phase_stats || gc_deadline)
+		lua_gcdeadline(L, gc_clock, (lua_Integer)gc_deadline);
+	t = phase_mark(LUA_TA_PHASE_STATE_CREATE, t);
+
 	luaL_openlibs(L);
 
 	/* Register the function for calling interal Lua scripts with the state */
 	lua_pushcfunction(L, internal_TA_call);
     lua_setglobal(L, "internal_TA_call");
-	
-	/* Load the lua script from the buffer */
-	luaL_loadbuffer(L, script, script_len, "lua_script"); 
-	
-	/* Push argument on the stack */
-	stack_from_args(L, input, input_type);
 
-    if (lua_pcall(L, 1, 1, 0)){            
-		MSG_LUA_ERROR(L, "lua_pcall() failed"); 
-		printf("%s", script);
+	/* The TEE services for scripts, in the global table tee */
+	luaopen_tee(L);
+	lua_setglobal(L, "tee");
+	t = phase_mark_lua(L, LUA_TA_PHASE_OPENLIBS, t, &gc_seen);
+	
+	/* Load the lua script from the buffer, or decrypt and parse a chunked script one chunk at a time */
+	if (stream){
+		status = lua_load(L, stream_reader, stream, "lua_script", mode);
+
+		/* The reader accounted its time to decrypt, the rest is load */
+		t = phase_mark_lua(L, LUA_TA_PHASE_LOAD, t, &gc_seen);
+		if (phase_stats)
+			phase_stats->phase_ns[LUA_TA_PHASE_LOAD] -= phase_stats->phase_ns[LUA_TA_PHASE_DECRYPT] - decrypt_ns;
+
+		/* Nothing runs before every chunk is authenticated, also those a binary chunk did not need */
+		res = luata_stream_finish(stream);
+		t = phase_mark(LUA_TA_PHASE_DECRYPT, t);
+		if (res != TEE_SUCCESS){
+			lua_close(L);
+			return res;
+		}
+#if LUA_USE_AOT
+	} else if (aot){
+		/* Part of the TA binary, so its bytecode is trusted like the TA itself */
+		status = lua_aotload(L, aot);
+		t = phase_mark_lua(L, LUA_TA_PHASE_LOAD, t, &gc_seen);
+#endif
+	} else {
+		status = luaL_loadbufferx(L, script, script_len, "lua_script", mode);
+		t = phase_mark_lua(L, LUA_TA_PHASE_LOAD, t, &gc_seen);
+	}
+	if (status != LUA_OK)
+		MSG_LUA_ERROR(L, "lua_load() failed");
+	else {
+		/* Push argument on the stack */
+		stack_from_args(L, input, input_type);
+		t = phase_mark_lua(L, LUA_TA_PHASE_ARGS_IN, t, &gc_seen);
+
+		status = lua_pcall(L, 1, 1, 0);
+		if (status != LUA_OK){
+			MSG_LUA_ERROR(L, "lua_pcall() failed");
+			if (script)
+				printf("%.*s", (int)script_len, script);
+		}
+		t = phase_mark_lua(L, LUA_TA_PHASE_PCALL, t, &gc_seen);
 	}
-		
-	/* Return value of operation */
+
+	/* Return value of operation, or the message of the error as LUA_TYPE_ERROR */
+	if (status != LUA_OK && lua_type(L, -1) != LUA_TSTRING)
+		luaL_tolstring(L, -1, NULL);
 	args_from_stack(L, -1 ,output, output_type);
+	if (status != LUA_OK)
+		*output_type = LUA_TYPE_ERROR;
+	if (*output_type != LUA_TYPE_NUMBER){
+		/* Strings are owned by the state, copy them before it is closed */
+		char *ret = *(char**)*output;
+		size_t ret_sz = strlen(ret) + 1;
+		char *copy = TEE_Malloc(ret_sz, TEE_MALLOC_NO_FILL);
+
+		if (!copy)
+			TEE_Panic(TEE_ERROR_OUT_OF_MEMORY);
+		TEE_MemMove(copy, ret, ret_sz);
+		*(char**)*output = copy;
+	}
+	t = phase_mark_lua(L, LUA_TA_PHASE_ARGS_OUT, t, &gc_seen);
 	
     lua_close(L); 
+	phase_mark(LUA_TA_PHASE_CLOSE, t);
+	return TEE_SUCCESS;
 }
 
 /*
@@ -114,7 +521,10 @@ TEE_Result TA_CreateEntryPoint(void)
  * Called when the instance of the TA is destroyed if the TA has not
  * crashed or panicked. This is the last call in the TA.
  */
-void TA_DestroyEntryPoint(void){}
+void TA_DestroyEntryPoint(void)
+{
+	set_app_bundle(NULL, 0);
+}
 
 /*
  * Called when a new session is opened to the TA. *sess_ctx can be updated
@@ -124,8 +534,11 @@ void TA_DestroyEntryPoint(void){}
  */
 TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
 		TEE_Param __maybe_unused params[4],
-		void __maybe_unused **sess_ctx)
+		void **sess_ctx)
 {
+	struct lua_ta_session *session;
+	TEE_Result res;
+
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_NONE,
 						   TEE_PARAM_TYPE_NONE,
 						   TEE_PARAM_TYPE_NONE,
@@ -136,9 +549,19 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
 
 	/* Unused parameters */
 	(void)&params;
-	(void)&sess_ctx;
-	
 
+	session = TEE_Malloc(sizeof(*session), TEE_MALLOC_FILL_ZERO);
+	if (!session)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	/* The crypto operations are set up once per session instead of for every encrypted script */
+	res = crypto_ctx_alloc(&session->crypto);
+	if (res != TEE_SUCCESS){
+		TEE_Free(session);
+		return res;
+	}
+
+	*sess_ctx = session;
 
 	/* If return value != TEE_SUCCESS the session will not be created. */
 	return TEE_SUCCESS;
@@ -148,19 +571,26 @@ TEE_Result TA_OpenSessionEntryPoint(uint32_t param_types,
  * Called when a session is closed, sess_ctx hold the value that was
  * assigned by TA_OpenSessionEntryPoint().
  */
-void TA_CloseSessionEntryPoint(void __maybe_unused *sess_ctx)
+void TA_CloseSessionEntryPoint(void *sess_ctx)
 {
-	(void)&sess_ctx;
+	struct lua_ta_session *session = sess_ctx;
+
+	crypto_ctx_free(session->crypto);
+	TEE_Free(session);
 }
 
 
-TEE_Result run_lua_script(uint32_t param_types,
+TEE_Result run_lua_script(struct crypto_ctx *crypto, uint32_t param_types,
 	TEE_Param params[4])
 {	
 
 	TEE_Result res;
 	char* script;
 	uint32_t script_len;
+	struct luata_stream *stream = NULL;
+	struct lua_ta_phase_stats stats;
+	size_t capacity;
+	uint64_t t;
 
 	/* local buffer to temporarily copy the shared buffer from the client side. Makes sure shared memory is only read once */
 	size_t buffer_size;
@@ -175,17 +605,48 @@ TEE_Result run_lua_script(uint32_t param_types,
 	if (param_types != exp_param_types)
 		return TEE_ERROR_BAD_PARAMETERS;
 
+	capacity = params[3].memref.size;
+	phase_stats_begin(&stats, params[2].value.b);
+	gc_deadline_begin(params[2].value.b);
+	t = phase_mark(PHASE_START, 0);
+
 	buffer_size = params[0].memref.size;
-	local_buffer = TEE_Malloc(buffer_size, 0);
-	TEE_MemMove(local_buffer, params[0].memref.buffer, buffer_size); 
 
-	script = local_buffer;
-	script_len = buffer_size;
+	/*
+	 * Chunked scripts are not copied as a whole, the stream copies one chunk at a time out of shared memory
+	 * and the parser consumes each chunk as soon as it is authenticated
+	 */
+	if (params[2].value.a && luata_is_chunked(params[0].memref.buffer, buffer_size)){
+		res = luata_stream_open(crypto, params[0].memref.buffer, buffer_size, &stream);
+		t = phase_mark(LUA_TA_PHASE_DECRYPT, t);
+		if (res != TEE_SUCCESS){
+			phase_stats = NULL;
+			return res;
+		}
+		local_buffer = NULL;
+		script = NULL;
+		script_len = 0;
+	} else {
+		local_buffer = TEE_Malloc(buffer_size, 0);
+		TEE_MemMove(local_buffer, params[0].memref.buffer, buffer_size); 
+
+		script = local_buffer;
+		script_len = buffer_size;
+		t = phase_mark(LUA_TA_PHASE_COPY_IN, t);
+	}
 
 	/* If the buffer is not a plaintext lua script, verify and decypher the buffer first*/
-	if(params[2].value.a){
-		script = TEE_Malloc(script_len, 0);
-		verify_and_decrypt_script(local_buffer, buffer_size , script, &script_len);
+	if(params[2].value.a && !stream){
+		script = TEE_Malloc(script_len ? script_len : 1, TEE_MALLOC_NO_FILL);
+		res = script ? verify_and_decrypt_script(crypto, (uint8_t*)local_buffer, buffer_size, (uint8_t*)script, &script_len)
+			     : TEE_ERROR_OUT_OF_MEMORY;
+		t = phase_mark(LUA_TA_PHASE_DECRYPT, t);
+		if (res != TEE_SUCCESS){
+			TEE_Free(script);
+			TEE_Free(local_buffer);
+			phase_stats = NULL;
+			return res;
+		}
 	}
 
 	void* lua_arg;
@@ -193,19 +654,31 @@ TEE_Result run_lua_script(uint32_t param_types,
 
 	args_from_params_ta(&lua_arg, params);
 
-	call_lua(script, script_len, lua_arg, params[1].value.a, &lua_ret, &params[1].value.a);
+	res = call_lua(script, script_len, stream, NULL, params[2].value.a ? "bt" : "t", lua_arg, params[1].value.a, &lua_ret,
+		       &params[1].value.a);
+	luata_stream_close(stream);
+	if (res != TEE_SUCCESS){
+		phase_stats = NULL;
+		return res;
+	}
 
+	t = phase_mark(PHASE_START, 0);
 	params_from_args_ta(lua_ret, params[1].value.a, params);
+	free_lua_value(lua_ret, params[1].value.a);
+	phase_mark(LUA_TA_PHASE_ARGS_OUT, t);
 	
-	if(params[2].value.a){
+	if(params[2].value.a && !stream){
 		TEE_Free(script);	
 	}
+	TEE_Free(local_buffer);
+
+	phase_stats_end(params, capacity);
 	
 	return TEE_SUCCESS;
 }
 
 
-TEE_Result save_lua_script(uint32_t param_types,
+TEE_Result save_lua_script(struct crypto_ctx *crypto, uint32_t param_types,
 	TEE_Param params[4])
 {	
 
@@ -221,7 +694,7 @@ TEE_Result save_lua_script(uint32_t param_types,
 	char *script_name;
 	size_t script_name_sz;
 	char *data;
-	size_t data_sz;
+	uint32_t data_sz;
 	uint32_t obj_data_flag;
 
 	/* local buffer to temporarily copy the shared buffer from the client side. Makes sure shared memory is only read once */
@@ -239,6 +712,10 @@ TEE_Result save_lua_script(uint32_t param_types,
 
 	buffer_size = params[1].memref.size;
 	local_buffer = TEE_Malloc(buffer_size, 0);
+	if (!local_buffer){
+		TEE_Free(script_name);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
 	TEE_MemMove(local_buffer, params[1].memref.buffer, buffer_size); 
 
 	data = local_buffer;
@@ -246,11 +723,28 @@ TEE_Result save_lua_script(uint32_t param_types,
 
 	/* if the buffer is not a plaintext lua script, verify and decypher the buffer first*/
 	if(params[2].value.a){
-		data = TEE_Malloc(data_sz, 0);
-		verify_and_decrypt_script(local_buffer, buffer_size, data, &data_sz);
+		data = TEE_Malloc(data_sz ? data_sz : 1, TEE_MALLOC_NO_FILL);
+		res = data ? verify_and_decrypt_script(crypto, (uint8_t*)local_buffer, buffer_size, (uint8_t*)data, &data_sz)
+			   : TEE_ERROR_OUT_OF_MEMORY;
+		TEE_Free(local_buffer);
+		local_buffer = NULL;
+		if (res != TEE_SUCCESS){
+			TEE_Free(data);
+			TEE_Free(script_name);
+			return res;
+		}
+	} else if (is_binary_chunk(data, data_sz)){
+		EMSG("binary chunks have to be encrypted");
+		TEE_Free(local_buffer);
+		TEE_Free(script_name);
+		return TEE_ERROR_SECURITY;
 	}
 
 
+	/* The saved script no longer matches the manifest, the next provisioning has to send everything again */
+	delete_object(LUA_TA_MANIFEST_ID, strlen(LUA_TA_MANIFEST_ID));
+	drop_app_bundle();
+
 	/*
 	 * Create object in secure storage and fill with data
 	 */
@@ -268,6 +762,7 @@ TEE_Result save_lua_script(uint32_t param_types,
 					&object);
 	if (res != TEE_SUCCESS) {
 		EMSG("TEE_CreatePersistentObject failed 0x%08x", res);
+		TEE_Free(data);
 		TEE_Free(script_name);
 		return res;
 	}
@@ -280,6 +775,7 @@ TEE_Result save_lua_script(uint32_t param_types,
 	} else {
 		TEE_CloseObject(object);
 	}
+	TEE_Free(data);
 	TEE_Free(script_name);
 	
 
@@ -287,6 +783,262 @@ TEE_Result save_lua_script(uint32_t param_types,
 }
 
 
+TEE_Result get_manifest(uint32_t param_types,
+	TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_OUTPUT,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE
+						   );
+
+	struct lua_ta_manifest_entry *entries;
+	uint32_t count;
+	size_t size;
+	TEE_Result res;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	res = read_manifest(&entries, &count);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	size = count * sizeof(*entries);
+	if (size > params[0].memref.size){
+		res = TEE_ERROR_SHORT_BUFFER;
+	} else if (size) {
+		TEE_MemMove(params[0].memref.buffer, entries, size);
+	}
+	params[0].memref.size = size;
+
+	TEE_Free(entries);
+	return res;
+}
+
+
+TEE_Result save_lua_scripts(struct crypto_ctx *crypto, uint32_t param_types,
+	TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						   TEE_PARAM_TYPE_MEMREF_INPUT,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE
+						   );
+
+	struct lua_ta_manifest_entry entry;
+	struct lua_ta_manifest_entry *manifest = NULL;
+	struct lua_ta_manifest_entry *old_manifest = NULL;
+	uint32_t count, old_count = 0;
+	uint8_t *sent = NULL;
+	char *bundle = NULL;
+	size_t bundle_sz, manifest_sz, offset;
+	uint8_t digest[LUA_TA_DIGEST_SIZE];
+	char *script;
+	uint32_t script_len;
+	TEE_Result res;
+	uint32_t i;
+	int index;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* Copy both buffers, so shared memory is only read once */
+	bundle_sz = params[0].memref.size;
+	manifest_sz = params[1].memref.size;
+	if (manifest_sz % sizeof(*manifest))
+		return TEE_ERROR_BAD_PARAMETERS;
+	count = manifest_sz / sizeof(*manifest);
+
+	bundle = TEE_Malloc(bundle_sz ? bundle_sz : 1, 0);
+	manifest = TEE_Malloc(manifest_sz ? manifest_sz : 1, 0);
+	sent = TEE_Malloc(count ? count : 1, TEE_MALLOC_FILL_ZERO);
+	if (!bundle || !manifest || !sent){
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto exit;
+	}
+	TEE_MemMove(bundle, params[0].memref.buffer, bundle_sz);
+	TEE_MemMove(manifest, params[1].memref.buffer, manifest_sz);
+
+	res = TEE_ERROR_BAD_PARAMETERS;
+	for (i = 0; i < count; i++){
+		if (!manifest[i].name[0] || manifest[i].name[0] == '.' || manifest[i].name[LUA_TA_SCRIPT_NAME_MAX - 1] != '\0'){
+			EMSG("invalid script name in manifest");
+			goto exit;
+		}
+	}
+
+	/* Check that every sent script matches its manifest entry */
+	for (offset = 0; offset < bundle_sz; offset += sizeof(entry) + entry.size){
+		if (bundle_sz - offset < sizeof(entry))
+			goto exit;
+		TEE_MemMove(&entry, bundle + offset, sizeof(entry));
+		if (entry.size > bundle_sz - offset - sizeof(entry))
+			goto exit;
+
+		index = find_manifest_entry(manifest, count, entry.name);
+		if (index < 0 || TEE_MemCompare(&manifest[index], &entry, sizeof(entry))){
+			EMSG("sent script %.*s does not match the manifest", LUA_TA_SCRIPT_NAME_MAX, entry.name);
+			goto exit;
+		}
+
+		res = sha256_digest((uint8_t*)bundle + offset + sizeof(entry), entry.size, digest);
+		if (res != TEE_SUCCESS)
+			goto exit;
+		res = TEE_ERROR_BAD_PARAMETERS;
+		if (TEE_MemCompare(digest, entry.digest, sizeof(digest))){
+			EMSG("digest mismatch for %s", entry.name);
+			goto exit;
+		}
+		if (!entry.encrypted && is_binary_chunk(bundle + offset + sizeof(entry), entry.size)){
+			EMSG("binary chunk %s has to be encrypted", entry.name);
+			res = TEE_ERROR_SECURITY;
+			goto exit;
+		}
+		sent[index] = 1;
+	}
+
+	res = read_manifest(&old_manifest, &old_count);
+	if (res != TEE_SUCCESS)
+		goto exit;
+
+	/* Scripts that were not sent have to be stored already */
+	res = TEE_ERROR_BAD_PARAMETERS;
+	for (i = 0; i < count; i++){
+		if (sent[i])
+			continue;
+		index = find_manifest_entry(old_manifest, old_count, manifest[i].name);
+		if (index < 0 || TEE_MemCompare(&old_manifest[index], &manifest[i], sizeof(entry))){
+			EMSG("script %s was neither sent nor saved before", manifest[i].name);
+			goto exit;
+		}
+	}
+
+	/*
+	 * Drop the manifest while the scripts are replaced and write the new one last. Each object is replaced
+	 * atomically, so an interrupted save at worst makes the next provisioning send all scripts again.
+	 */
+	delete_object(LUA_TA_MANIFEST_ID, strlen(LUA_TA_MANIFEST_ID));
+	drop_app_bundle();
+
+	for (offset = 0; offset < bundle_sz; offset += sizeof(entry) + entry.size){
+		TEE_MemMove(&entry, bundle + offset, sizeof(entry));
+
+		script = bundle + offset + sizeof(entry);
+		script_len = entry.size;
+
+		/* Scripts are stored in plaintext, verify and decypher encrypted ones first */
+		if (entry.encrypted){
+			script = TEE_Malloc(entry.size ? entry.size : 1, 0);
+			if (!script){
+				res = TEE_ERROR_OUT_OF_MEMORY;
+				goto exit;
+			}
+			res = verify_and_decrypt_script(crypto, (uint8_t*)bundle + offset + sizeof(entry), entry.size, (uint8_t*)script, &script_len);
+			if (res != TEE_SUCCESS){
+				EMSG("cannot decrypt %s", entry.name);
+				TEE_Free(script);
+				goto exit;
+			}
+		}
+
+		res = write_object(entry.name, strlen(entry.name), script, script_len);
+		if (entry.encrypted)
+			TEE_Free(script);
+		if (res != TEE_SUCCESS)
+			goto exit;
+	}
+
+	/* Delete the scripts that are no longer part of the application */
+	for (i = 0; i < old_count; i++){
+		if (old_manifest[i].name[LUA_TA_SCRIPT_NAME_MAX - 1] == '\0' &&
+				find_manifest_entry(manifest, count, old_manifest[i].name) < 0)
+			delete_object(old_manifest[i].name, strlen(old_manifest[i].name));
+	}
+
+	res = count ? write_object(LUA_TA_MANIFEST_ID, strlen(LUA_TA_MANIFEST_ID), manifest, manifest_sz) : TEE_SUCCESS;
+
+exit:
+	TEE_Free(old_manifest);
+	TEE_Free(sent);
+	TEE_Free(manifest);
+	TEE_Free(bundle);
+	return res;
+}
+
+
+TEE_Result save_app_bundle(struct crypto_ctx *crypto, uint32_t param_types,
+	TEE_Param params[4])
+{
+	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_MEMREF_INPUT,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_NONE
+						   );
+
+	struct lua_ta_manifest_entry entry;
+	struct lua_ta_manifest_entry *old_manifest = NULL;
+	uint32_t old_count = 0, opened_sz, i;
+	uint8_t *sealed, *opened;
+	size_t sealed_sz;
+	TEE_Result res;
+
+	if (param_types != exp_param_types)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	/* The index is checked before it is authenticated, so copy the bundle out of shared memory first */
+	sealed_sz = params[0].memref.size;
+	sealed = TEE_Malloc(sealed_sz ? sealed_sz : 1, TEE_MALLOC_NO_FILL);
+	opened = TEE_Malloc(sealed_sz ? sealed_sz : 1, TEE_MALLOC_NO_FILL);
+	if (!sealed || !opened){
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto exit;
+	}
+	TEE_MemMove(sealed, params[0].memref.buffer, sealed_sz);
+
+	opened_sz = sealed_sz;
+	res = verify_and_open_bundle(crypto, sealed, sealed_sz, opened, &opened_sz);
+	if (res != TEE_SUCCESS)
+		goto exit;
+
+	/* The manifest describes the bundle as sent, so an unchanged bundle is not sent again */
+	TEE_MemFill(&entry, 0, sizeof(entry));
+	TEE_MemMove(entry.name, LUA_TA_APP_BUNDLE_ID, strlen(LUA_TA_APP_BUNDLE_ID));
+	entry.encrypted = LUA_MODE_ENCRYPTED;
+	entry.size = sealed_sz;
+	res = sha256_digest(sealed, sealed_sz, entry.digest);
+	if (res != TEE_SUCCESS)
+		goto exit;
+
+	res = read_manifest(&old_manifest, &old_count);
+	if (res != TEE_SUCCESS)
+		goto exit;
+
+	/* As in save_lua_scripts(), the manifest is dropped while the storage changes and written last */
+	delete_object(LUA_TA_MANIFEST_ID, strlen(LUA_TA_MANIFEST_ID));
+
+	res = write_object(LUA_TA_APP_BUNDLE_ID, strlen(LUA_TA_APP_BUNDLE_ID), opened, opened_sz);
+	if (res != TEE_SUCCESS)
+		goto exit;
+	set_app_bundle(opened, opened_sz);
+	opened = NULL;
+
+	/* The scripts saved one by one before are replaced by the bundle */
+	for (i = 0; i < old_count; i++){
+		if (old_manifest[i].name[0] != '.' && old_manifest[i].name[LUA_TA_SCRIPT_NAME_MAX - 1] == '\0')
+			delete_object(old_manifest[i].name, strlen(old_manifest[i].name));
+	}
+
+	res = write_object(LUA_TA_MANIFEST_ID, strlen(LUA_TA_MANIFEST_ID), &entry, sizeof(entry));
+
+exit:
+	TEE_Free(old_manifest);
+	TEE_Free(opened);
+	TEE_Free(sealed);
+	return res;
+}
+
+
 TEE_Result run_saved_lua_script_entry(uint32_t param_types,
 	TEE_Param params[4])
 {	
@@ -300,27 +1052,46 @@ TEE_Result run_saved_lua_script_entry(uint32_t param_types,
 	TEE_Result res;
 	char *script_name;
 	size_t script_name_sz;
+	struct lua_ta_phase_stats stats;
+	size_t capacity;
+	uint64_t t;
 
 	if (param_types != exp_param_types)
 		return TEE_ERROR_BAD_PARAMETERS;
 
+	capacity = params[3].memref.size;
+	phase_stats_begin(&stats, params[2].value.b);
+	gc_deadline_begin(params[2].value.b);
+	t = phase_mark(PHASE_START, 0);
+
 	/* Get script name from parameters */
 	script_name_sz = params[0].memref.size;
 	script_name = TEE_Malloc(script_name_sz, 0);
-	if (!script_name)
+	if (!script_name){
+		phase_stats = NULL;
 		return TEE_ERROR_OUT_OF_MEMORY;
+	}
 	TEE_MemMove(script_name, params[0].memref.buffer, script_name_sz);
+	phase_mark(LUA_TA_PHASE_COPY_IN, t);
 
 	void* lua_arg;
 	void* lua_ret;
 
 	args_from_params_ta(&lua_arg, params);
 
-	run_saved_lua_script(script_name, script_name_sz, lua_arg, params[1].value.a, &lua_ret, &params[1].value.a);
+	res = run_saved_lua_script(script_name, script_name_sz, lua_arg, params[1].value.a, &lua_ret, &params[1].value.a);
+	TEE_Free(script_name);
+	if (res != TEE_SUCCESS){
+		phase_stats = NULL;
+		return res;
+	}
 
+	t = phase_mark(PHASE_START, 0);
 	params_from_args_ta(lua_ret, params[1].value.a, params);
+	free_lua_value(lua_ret, params[1].value.a);
+	phase_mark(LUA_TA_PHASE_ARGS_OUT, t);
 
-	TEE_Free(script_name);
+	phase_stats_end(params, capacity);
 	return TEE_SUCCESS;
 
 exit:
@@ -337,6 +1108,26 @@ TEE_Result run_saved_lua_script(char* script_name, size_t script_name_sz, void*
 	uint32_t read_bytes;
 	char *data;
 	size_t data_sz;
+	const uint8_t *script;
+	uint32_t script_len;
+	uint64_t t = phase_mark(PHASE_START, 0);
+
+#if LUA_USE_AOT
+	/* Scripts compiled into the TA come first, they run as native code */
+	const lua_AotScript *aot = lua_aotfind(script_name, script_name_sz);
+
+	if (aot)
+		return call_lua(NULL, 0, NULL, aot, "b", input, input_type, output, output_type);
+#endif
+
+	/* Scripts of the app bundle are run straight out of the cached bundle */
+	res = find_in_app_bundle(script_name, script_name_sz, &script, &script_len);
+	if (res == TEE_SUCCESS){
+		phase_mark(LUA_TA_PHASE_STORAGE_READ, t);
+		return call_lua((char*)script, script_len, NULL, NULL, "bt", input, input_type, output, output_type);
+	}
+	if (res != TEE_ERROR_ITEM_NOT_FOUND)
+		return res;
 
 	/*
 	 * Check the object exist and can be dumped into output buffer
@@ -358,28 +1149,34 @@ TEE_Result run_saved_lua_script(char* script_name, size_t script_name_sz, void*
 		goto exit;
 	}
 
-	data = (char*) TEE_Malloc(object_info.dataSize, TEE_MALLOC_FILL_ZERO);
-
+	data = (char*) TEE_Malloc(object_info.dataSize ? object_info.dataSize : 1, TEE_MALLOC_NO_FILL);
+	if (!data) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto exit;
+	}
 
 	res = TEE_ReadObjectData(object, data, object_info.dataSize,
 				 &read_bytes);
+	TEE_CloseObject(object);
 	if (res != TEE_SUCCESS || read_bytes != object_info.dataSize) {
 		EMSG("TEE_ReadObjectData failed 0x%08x, read %" PRIu32 " over %u",
 				res, read_bytes, object_info.dataSize);
-		goto exit;
+		TEE_Free(data);
+		return res != TEE_SUCCESS ? res : TEE_ERROR_CORRUPT_OBJECT;
 	}
+	phase_mark(LUA_TA_PHASE_STORAGE_READ, t);
 	
-	call_lua(data, read_bytes, input, input_type, output, output_type);
+	res = call_lua(data, read_bytes, NULL, NULL, "bt", input, input_type, output, output_type);
 
-	return TEE_SUCCESS;
+	TEE_Free(data);
+	return res;
 
 exit:
 	TEE_CloseObject(object);
 	return res;
 }
 
-/* TODO redo for benchmarking and comparison */
-TEE_Result run_ta(uint32_t param_types,
+TEE_Result run_native_loop(uint32_t param_types,
 	TEE_Param params[4])
 {	
 	uint32_t exp_param_types = TEE_PARAM_TYPES(TEE_PARAM_TYPE_NONE, 
@@ -391,8 +1188,8 @@ TEE_Result run_ta(uint32_t param_types,
 	if (param_types != exp_param_types)
 		return TEE_ERROR_BAD_PARAMETERS;
 	
-	int a = params[1].value.a;
-	for(int i = 0; i<10000000; i++){
+	uint32_t a = 0;
+	for(uint32_t i = 0; i < params[1].value.a; i++){
 		a = a + 1;
 		asm("");
 	}
@@ -408,20 +1205,27 @@ TEE_Result run_ta(uint32_t param_types,
  * assigned by TA_OpenSessionEntryPoint(). The rest of the paramters
  * comes from normal world.
  */
-TEE_Result TA_InvokeCommandEntryPoint(void __maybe_unused *sess_ctx,
+TEE_Result TA_InvokeCommandEntryPoint(void *sess_ctx,
 			uint32_t cmd_id,
 			uint32_t param_types, TEE_Param params[4])
 {
-	(void)&sess_ctx;
+	struct lua_ta_session *session = sess_ctx;
+
 	switch (cmd_id) {
 	case TA_RUN_LUA_SCRIPT:
-		return run_lua_script(param_types, params);
+		return run_lua_script(session->crypto, param_types, params);
 	case TA_RUN_SAVED_LUA_SCRIPT:
 		return run_saved_lua_script_entry(param_types, params);
 	case TA_SAVE_LUA_SCRIPT:
-		return save_lua_script(param_types, params);
-	case TA:
-		return run_ta(param_types, params);
+		return save_lua_script(session->crypto, param_types, params);
+	case TA_RUN_NATIVE_LOOP:
+		return run_native_loop(param_types, params);
+	case TA_GET_MANIFEST:
+		return get_manifest(param_types, params);
+	case TA_SAVE_LUA_SCRIPTS:
+		return save_lua_scripts(session->crypto, param_types, params);
+	case TA_SAVE_APP_BUNDLE:
+		return save_app_bundle(session->crypto, param_types, params);
 	default:
 		return TEE_ERROR_BAD_PARAMETERS;
 	}
@@ -5,5 +5,32 @@ srcs-y += $(wildcard ./*.c)
 srcs-y += $(wildcard ../lua/*.c)
 srcs-y += $(wildcard ../lua/extensions/*.c)
 
+# The Lua interpreter dispatches through a jump table with GCC and clang (see lua/ljumptab.h),
+# build with CFG_LUA_JUMPTABLE=n to fall back to the switch
+ifeq ($(CFG_LUA_JUMPTABLE),n)
+cflags-y += -DLUA_USE_JUMPTABLE=0
+else ifneq ($(COMPILER),clang)
+# GCC only keeps a dispatch jump per instruction with cross jumping off, and does not copy them at all
+# at -Os, so the interpreter loop is built for speed (about 9 KB more code than at -Os with the switch)
+cflags-../lua/lvm.c-y += -O2 -fno-crossjumping
+endif
+
+# CFG_LUA_NANBOX=y NaN-boxes Lua values into 8 bytes instead of 16, with 32 bit integers (see lua/lobject.h).
+# Binary chunks and CFG_LUA_AOT scripts must then come from a luac_ta built with LUA_NANBOX=y.
+ifeq ($(CFG_LUA_NANBOX),y)
+cflags-y += -DLUA_NANBOX=1
+endif
+
+# CFG_LUA_AOT lists Lua scripts (relative to ta/) to compile to C with luac_ta -c and build into the TA, where
+# they run as native code when they are run by name (see host/luac_ta.c). LUAC_TA is the luac_ta of the build machine.
+ifneq ($(CFG_LUA_AOT),)
+LUAC_TA ?= ../host/luac_ta
+cflags-y += -DLUA_USE_AOT=1
+gensrcs-y += lua_aot
+produce-lua_aot = lua_aot_scripts.c
+depends-lua_aot = $(CFG_LUA_AOT)
+recipe-lua_aot = $(LUAC_TA) -c -m $(if $(filter ta_arm64,$(sm)),64,32) -o $(sub-dir-out)/lua_aot_scripts.c $(CFG_LUA_AOT)
+endif
+
 # To remove a certain compiler flag, add a line like this
 #cflags-template_ta.c-y += -Wno-strict-prototypes
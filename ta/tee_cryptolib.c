@@ -0,0 +1,571 @@
+/**
+ * Implementation of tee.crypto, see tee_cryptolib.h
+ */
+
+#include <tee_internal_api.h>
+#include <tee_internal_api_extensions.h>
+
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "tee_cryptolib.h"
+
+#define DIGEST_META	"tee.crypto.digest"
+#define MAC_META	"tee.crypto.mac"
+#define CIPHER_META	"tee.crypto.cipher"
+#define CACHE_META	"tee.crypto.cache"
+
+#define AES_BLOCK_SIZE	16
+#define GCM_TAG_SIZE	16
+
+/* Lengths are 32 bit in the TEE API, block ciphers may return a buffered block on top of the data */
+#define MAX_DATA_SIZE	(UINT32_MAX - AES_BLOCK_SIZE)
+
+struct hash_alg {
+	uint32_t digest_alg;
+	uint32_t mac_alg;
+	uint32_t mac_key_type;
+	uint32_t size;				/* of the digest */
+	uint32_t min_key_size, max_key_size;	/* of HMAC keys in bytes, as the TEE API allows them */
+};
+
+static const char *const hash_names[] = { "sha256", "sha512", NULL };
+static const struct hash_alg hash_algs[] = {
+	{ TEE_ALG_SHA256, TEE_ALG_HMAC_SHA256, TEE_TYPE_HMAC_SHA256, 32, 24, 128 },
+	{ TEE_ALG_SHA512, TEE_ALG_HMAC_SHA512, TEE_TYPE_HMAC_SHA512, 64, 32, 128 },
+};
+#define HASH_ALG_COUNT	(sizeof(hash_algs) / sizeof(hash_algs[0]))
+
+struct cipher_alg {
+	uint32_t alg;
+	uint32_t iv_size;	/* unused for AE, which takes a nonce of any size */
+	int ae;
+};
+
+static const char *const cipher_names[] = { "aes-ctr", "aes-gcm", NULL };
+static const struct cipher_alg cipher_algs[] = {
+	{ TEE_ALG_AES_CTR, AES_BLOCK_SIZE, 0 },
+	{ TEE_ALG_AES_GCM, 0, 1 },
+};
+
+static const char *const mode_names[] = { "encrypt", "decrypt", NULL };
+
+/* A digest, MAC or cipher handle */
+typedef struct {
+	TEE_OperationHandle op;
+	int alg;		/* index into hash_algs or cipher_algs */
+	uint32_t mode;		/* TEE_MODE_ENCRYPT or TEE_MODE_DECRYPT for ciphers */
+	int active;		/* a MAC or cipher message was started and not finished yet */
+} CryptoHandle;
+
+/* The operations of the one-shot digest(), the upvalue of the library functions */
+typedef struct {
+	TEE_OperationHandle digest_ops[HASH_ALG_COUNT];
+} CryptoCache;
+
+
+static int crypto_error(lua_State *L, const char *what, TEE_Result res){
+	return luaL_error(L, "%s failed (%I)", what, (lua_Integer)res);
+}
+
+static const uint8_t* check_data(lua_State *L, int arg, uint32_t *len){
+
+	size_t l;
+	const char *s = luaL_checklstring(L, arg, &l);
+
+	luaL_argcheck(L, l <= MAX_DATA_SIZE, arg, "data too long");
+	*len = (uint32_t)l;
+	return (const uint8_t*)s;
+}
+
+static const uint8_t* opt_data(lua_State *L, int arg, uint32_t *len){
+
+	if (lua_isnoneornil(L, arg)){
+		*len = 0;
+		return (const uint8_t*)"";
+	}
+	return check_data(L, arg, len);
+}
+
+/* Sets a key on an operation, the operation keeps its own copy */
+static TEE_Result set_key(TEE_OperationHandle op, uint32_t type, const char *key, size_t keylen){
+
+	TEE_ObjectHandle object;
+	TEE_Attribute attr;
+	TEE_Result res;
+
+	res = TEE_AllocateTransientObject(type, keylen * 8, &object);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	TEE_InitRefAttribute(&attr, TEE_ATTR_SECRET_VALUE, key, keylen);
+	res = TEE_PopulateTransientObject(object, &attr, 1);
+	if (res == TEE_SUCCESS)
+		res = TEE_SetOperationKey(op, object);
+
+	TEE_FreeTransientObject(object);
+	return res;
+}
+
+
+static int handle_gc(lua_State *L){
+
+	CryptoHandle *h = lua_touserdata(L, 1);
+
+	if (h->op != TEE_HANDLE_NULL){
+		TEE_FreeOperation(h->op);
+		h->op = TEE_HANDLE_NULL;
+	}
+	return 0;
+}
+
+/* Pushes a new handle without an operation, so the operation is freed with it whatever fails later */
+static CryptoHandle* new_handle(lua_State *L, const char *meta, const luaL_Reg *methods, int alg){
+
+	CryptoHandle *h = lua_newuserdata(L, sizeof(*h));
+
+	memset(h, 0, sizeof(*h));
+	h->op = TEE_HANDLE_NULL;
+	h->alg = alg;
+
+	/* The metatables are only built by the first handle of a type in a state */
+	if (luaL_newmetatable(L, meta)){
+		luaL_setfuncs(L, methods, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, handle_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	return h;
+}
+
+static void allocate_op(lua_State *L, CryptoHandle *h, uint32_t alg, uint32_t mode, uint32_t max_key_bits){
+
+	TEE_Result res = TEE_AllocateOperation(&h->op, alg, mode, max_key_bits);
+
+	if (res != TEE_SUCCESS){
+		h->op = TEE_HANDLE_NULL;
+		crypto_error(L, "TEE_AllocateOperation", res);
+	}
+}
+
+
+/*
+ * Digests
+ */
+
+static int push_digest(lua_State *L, TEE_OperationHandle op, int alg, const uint8_t *data, uint32_t len){
+
+	luaL_Buffer b;
+	uint32_t outlen = hash_algs[alg].size;
+	char *out = luaL_buffinitsize(L, &b, outlen);
+	TEE_Result res;
+
+	res = TEE_DigestDoFinal(op, data, len, out, &outlen);
+	if (res != TEE_SUCCESS)
+		return crypto_error(L, "TEE_DigestDoFinal", res);
+	luaL_pushresultsize(&b, outlen);
+	return 1;
+}
+
+static int digest_update(lua_State *L){
+
+	CryptoHandle *h = luaL_checkudata(L, 1, DIGEST_META);
+	uint32_t len;
+	const uint8_t *data = check_data(L, 2, &len);
+
+	TEE_DigestUpdate(h->op, data, len);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int digest_final(lua_State *L){
+
+	CryptoHandle *h = luaL_checkudata(L, 1, DIGEST_META);
+	uint32_t len;
+	const uint8_t *data = opt_data(L, 2, &len);
+
+	return push_digest(L, h->op, h->alg, data, len);
+}
+
+static const luaL_Reg digest_methods[] = {
+	{"update", digest_update},
+	{"final", digest_final},
+	{NULL, NULL}
+};
+
+static int crypto_new_digest(lua_State *L){
+
+	int alg = luaL_checkoption(L, 1, NULL, hash_names);
+	CryptoHandle *h = new_handle(L, DIGEST_META, digest_methods, alg);
+
+	allocate_op(L, h, hash_algs[alg].digest_alg, TEE_MODE_DIGEST, 0);
+	return 1;
+}
+
+static int crypto_digest(lua_State *L){
+
+	CryptoCache *cache = lua_touserdata(L, lua_upvalueindex(1));
+	int alg = luaL_checkoption(L, 1, NULL, hash_names);
+	uint32_t len;
+	const uint8_t *data = check_data(L, 2, &len);
+	TEE_Result res;
+
+	if (cache->digest_ops[alg] == TEE_HANDLE_NULL){
+		res = TEE_AllocateOperation(&cache->digest_ops[alg], hash_algs[alg].digest_alg, TEE_MODE_DIGEST, 0);
+		if (res != TEE_SUCCESS){
+			cache->digest_ops[alg] = TEE_HANDLE_NULL;
+			return crypto_error(L, "TEE_AllocateOperation", res);
+		}
+	}
+	return push_digest(L, cache->digest_ops[alg], alg, data, len);
+}
+
+
+/*
+ * HMAC
+ */
+
+static void mac_start(CryptoHandle *h){
+	if (!h->active){
+		TEE_MACInit(h->op, NULL, 0);
+		h->active = 1;
+	}
+}
+
+static int push_mac(lua_State *L, CryptoHandle *h, const uint8_t *data, uint32_t len){
+
+	luaL_Buffer b;
+	uint32_t outlen = hash_algs[h->alg].size;
+	char *out = luaL_buffinitsize(L, &b, outlen);
+	TEE_Result res;
+
+	mac_start(h);
+	res = TEE_MACComputeFinal(h->op, data, len, out, &outlen);
+	h->active = 0;
+	if (res != TEE_SUCCESS)
+		return crypto_error(L, "TEE_MACComputeFinal", res);
+	luaL_pushresultsize(&b, outlen);
+	return 1;
+}
+
+static int mac_update(lua_State *L){
+
+	CryptoHandle *h = luaL_checkudata(L, 1, MAC_META);
+	uint32_t len;
+	const uint8_t *data = check_data(L, 2, &len);
+
+	mac_start(h);
+	TEE_MACUpdate(h->op, data, len);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int mac_final(lua_State *L){
+
+	CryptoHandle *h = luaL_checkudata(L, 1, MAC_META);
+	uint32_t len;
+	const uint8_t *data = opt_data(L, 2, &len);
+
+	return push_mac(L, h, data, len);
+}
+
+static int mac_verify(lua_State *L){
+
+	CryptoHandle *h = luaL_checkudata(L, 1, MAC_META);
+	uint32_t maclen, len;
+	const uint8_t *mac = check_data(L, 2, &maclen);
+	const uint8_t *data = opt_data(L, 3, &len);
+	TEE_Result res;
+
+	mac_start(h);
+	res = TEE_MACCompareFinal(h->op, data, len, mac, maclen);
+	h->active = 0;
+	if (res != TEE_SUCCESS && res != TEE_ERROR_MAC_INVALID)
+		return crypto_error(L, "TEE_MACCompareFinal", res);
+	lua_pushboolean(L, res == TEE_SUCCESS);
+	return 1;
+}
+
+static const luaL_Reg mac_methods[] = {
+	{"update", mac_update},
+	{"final", mac_final},
+	{"verify", mac_verify},
+	{NULL, NULL}
+};
+
+/* Pushes an HMAC handle for the algorithm and key at the given arguments */
+static CryptoHandle* new_mac(lua_State *L, int alg_arg, int key_arg){
+
+	int alg = luaL_checkoption(L, alg_arg, NULL, hash_names);
+	const struct hash_alg *a = &hash_algs[alg];
+	size_t keylen;
+	const char *key = luaL_checklstring(L, key_arg, &keylen);
+	CryptoHandle *h;
+	TEE_Result res;
+
+	luaL_argcheck(L, keylen >= a->min_key_size && keylen <= a->max_key_size, key_arg, "invalid key size");
+
+	h = new_handle(L, MAC_META, mac_methods, alg);
+	allocate_op(L, h, a->mac_alg, TEE_MODE_MAC, keylen * 8);
+	res = set_key(h->op, a->mac_key_type, key, keylen);
+	if (res != TEE_SUCCESS)
+		crypto_error(L, "setting the key", res);
+	return h;
+}
+
+static int crypto_new_mac(lua_State *L){
+	new_mac(L, 1, 2);
+	return 1;
+}
+
+static int crypto_mac(lua_State *L){
+
+	uint32_t len;
+	const uint8_t *data = check_data(L, 3, &len);
+	CryptoHandle *h = new_mac(L, 1, 2);
+
+	push_mac(L, h, data, len);
+
+	/* Not kept for another call, the key changes from call to call */
+	TEE_FreeOperation(h->op);
+	h->op = TEE_HANDLE_NULL;
+	return 1;
+}
+
+
+/*
+ * Ciphers
+ */
+
+/* Starts a message with the iv (or GCM nonce) and additional data at the given arguments */
+static void cipher_start(lua_State *L, CryptoHandle *h, int iv_arg, int aad_arg){
+
+	const struct cipher_alg *a = &cipher_algs[h->alg];
+	uint32_t ivlen, aadlen;
+	const uint8_t *iv = opt_data(L, iv_arg, &ivlen);
+	const uint8_t *aad = opt_data(L, aad_arg, &aadlen);
+	TEE_Result res;
+
+	if (a->ae)
+		luaL_argcheck(L, ivlen > 0, iv_arg, "nonce expected");
+	else {
+		luaL_argcheck(L, ivlen == a->iv_size, iv_arg, "invalid iv size");
+		luaL_argcheck(L, !aadlen, aad_arg, "additional data needs aes-gcm");
+	}
+
+	/* A message that was not finished is dropped */
+	TEE_ResetOperation(h->op);
+	h->active = 0;
+
+	if (a->ae){
+		res = TEE_AEInit(h->op, iv, ivlen, GCM_TAG_SIZE * 8, aadlen, 0);
+		if (res != TEE_SUCCESS)
+			crypto_error(L, "TEE_AEInit", res);
+		if (aadlen)
+			TEE_AEUpdateAAD(h->op, aad, aadlen);
+	} else {
+		TEE_CipherInit(h->op, ivlen ? iv : NULL, ivlen);
+	}
+	h->active = 1;
+}
+
+static CryptoHandle* check_active_cipher(lua_State *L){
+
+	CryptoHandle *h = luaL_checkudata(L, 1, CIPHER_META);
+
+	if (!h->active)
+		luaL_error(L, "cipher not initialized");
+	return h;
+}
+
+static int cipher_init(lua_State *L){
+
+	CryptoHandle *h = luaL_checkudata(L, 1, CIPHER_META);
+
+	cipher_start(L, h, 2, 3);
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int cipher_update(lua_State *L){
+
+	CryptoHandle *h = check_active_cipher(L);
+	uint32_t len;
+	const uint8_t *data = check_data(L, 2, &len);
+	luaL_Buffer b;
+	uint32_t outlen = len + AES_BLOCK_SIZE;
+	char *out = luaL_buffinitsize(L, &b, outlen);
+	TEE_Result res;
+
+	if (cipher_algs[h->alg].ae)
+		res = TEE_AEUpdate(h->op, data, len, out, &outlen);
+	else
+		res = TEE_CipherUpdate(h->op, data, len, out, &outlen);
+	if (res != TEE_SUCCESS){
+		h->active = 0;
+		return crypto_error(L, "cipher update", res);
+	}
+	luaL_pushresultsize(&b, outlen);
+	return 1;
+}
+
+static int cipher_final(lua_State *L){
+
+	CryptoHandle *h = check_active_cipher(L);
+	uint32_t len, taglen = GCM_TAG_SIZE;
+	const uint8_t *data = opt_data(L, 2, &len);
+	const uint8_t *expected_tag = NULL;
+	uint8_t tag[GCM_TAG_SIZE];
+	luaL_Buffer b;
+	uint32_t outlen = len + AES_BLOCK_SIZE;
+	char *out;
+	TEE_Result res;
+
+	if (cipher_algs[h->alg].ae && h->mode == TEE_MODE_DECRYPT){
+		expected_tag = check_data(L, 3, &taglen);
+		luaL_argcheck(L, taglen == GCM_TAG_SIZE, 3, "invalid tag size");
+	}
+
+	/* The handle is ready for the next init(), whatever the outcome */
+	h->active = 0;
+	out = luaL_buffinitsize(L, &b, outlen);
+
+	if (!cipher_algs[h->alg].ae)
+		res = TEE_CipherDoFinal(h->op, data, len, out, &outlen);
+	else if (h->mode == TEE_MODE_ENCRYPT)
+		res = TEE_AEEncryptFinal(h->op, data, len, out, &outlen, tag, &taglen);
+	else
+		res = TEE_AEDecryptFinal(h->op, data, len, out, &outlen, expected_tag, taglen);
+
+	if (res == TEE_ERROR_MAC_INVALID){
+		lua_pushnil(L);
+		lua_pushliteral(L, "authentication failed");
+		return 2;
+	}
+	if (res != TEE_SUCCESS)
+		return crypto_error(L, "cipher final", res);
+
+	luaL_pushresultsize(&b, outlen);
+	if (cipher_algs[h->alg].ae && h->mode == TEE_MODE_ENCRYPT){
+		lua_pushlstring(L, (const char*)tag, taglen);
+		return 2;
+	}
+	return 1;
+}
+
+static const luaL_Reg cipher_methods[] = {
+	{"init", cipher_init},
+	{"update", cipher_update},
+	{"final", cipher_final},
+	{NULL, NULL}
+};
+
+static int crypto_new_cipher(lua_State *L){
+
+	int alg = luaL_checkoption(L, 1, NULL, cipher_names);
+	int mode = luaL_checkoption(L, 2, NULL, mode_names);
+	size_t keylen;
+	const char *key = luaL_checklstring(L, 3, &keylen);
+	CryptoHandle *h;
+	TEE_Result res;
+
+	luaL_argcheck(L, keylen == 16 || keylen == 24 || keylen == 32, 3, "invalid key size");
+
+	/* The handle goes above the optional arguments */
+	lua_settop(L, 5);
+	h = new_handle(L, CIPHER_META, cipher_methods, alg);
+	h->mode = mode ? TEE_MODE_DECRYPT : TEE_MODE_ENCRYPT;
+	allocate_op(L, h, cipher_algs[alg].alg, h->mode, keylen * 8);
+	res = set_key(h->op, TEE_TYPE_AES, key, keylen);
+	if (res != TEE_SUCCESS)
+		return crypto_error(L, "setting the key", res);
+
+	/* Ciphers start right away if they got an iv */
+	if (!lua_isnoneornil(L, 4))
+		cipher_start(L, h, 4, 5);
+	return 1;
+}
+
+
+static int crypto_random(lua_State *L){
+
+	lua_Integer n = luaL_checkinteger(L, 1);
+	luaL_Buffer b;
+	char *out;
+
+	luaL_argcheck(L, 0 <= n && n <= MAX_DATA_SIZE, 1, "out of range");
+	out = luaL_buffinitsize(L, &b, (size_t)n);
+	TEE_GenerateRandom(out, (uint32_t)n);
+	luaL_pushresultsize(&b, (size_t)n);
+	return 1;
+}
+
+
+static int cache_gc(lua_State *L){
+
+	CryptoCache *cache = lua_touserdata(L, 1);
+	size_t i;
+
+	for (i = 0; i < HASH_ALG_COUNT; i++){
+		if (cache->digest_ops[i] != TEE_HANDLE_NULL)
+			TEE_FreeOperation(cache->digest_ops[i]);
+		cache->digest_ops[i] = TEE_HANDLE_NULL;
+	}
+	return 0;
+}
+
+static const luaL_Reg crypto_funcs[] = {
+	{"random", crypto_random},
+	{"digest", crypto_digest},
+	{"mac", crypto_mac},
+	{"new_digest", crypto_new_digest},
+	{"new_mac", crypto_new_mac},
+	{"new_cipher", crypto_new_cipher},
+	{NULL, NULL}
+};
+
+int luaopen_tee_crypto(lua_State *L){
+
+	CryptoCache *cache;
+
+	luaL_newlibtable(L, crypto_funcs);
+
+	cache = lua_newuserdata(L, sizeof(*cache));
+	memset(cache, 0, sizeof(*cache));
+	if (luaL_newmetatable(L, CACHE_META)){
+		lua_pushcfunction(L, cache_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+
+	luaL_setfuncs(L, crypto_funcs, 1);
+	return 1;
+}
+
+
+/* __index of the table tee, opens a library on its first use and keeps it in the table */
+static int tee_index(lua_State *L){
+
+	const char *name = lua_tostring(L, 2);
+
+	if (!name || strcmp(name, LUA_TEECRYPTOLIBNAME))
+		return 0;
+	luaopen_tee_crypto(L);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, 1, LUA_TEECRYPTOLIBNAME);
+	return 1;
+}
+
+int luaopen_tee(lua_State *L){
+
+	lua_createtable(L, 0, 1);
+	lua_createtable(L, 0, 1);
+	lua_pushcfunction(L, tee_index);
+	lua_setfield(L, -2, "__index");
+	lua_setmetatable(L, -2);
+	return 1;
+}
@@ -0,0 +1,82 @@
+-- Regression scripts for the compiler and the VM, run in the TA. Each returns "ok" or raises an error.
+
+-- The verifier (lverify.c) is checked here: load in the TA only takes source, precompiled chunks reach it
+-- only from encrypted containers. The host interpreter undumps with the same code.
+
+-- Positions in a stripped chunk of the main function (see lundump.c), 'isz' is the size of an int
+local function layout(chunk)
+  local isz = chunk:byte(13)
+  local f = 18 + chunk:byte(16) + chunk:byte(17) + 1  -- after the header and the number of upvalues
+  local maxstack = f + 1 + 2 * isz + 2  -- after source, line numbers, numparams and is_vararg
+  return {isz = isz, maxstack = maxstack, sizecode = maxstack + 1, code = maxstack + 1 + isz}
+end
+
+local function getinstr(chunk, l, n)
+  local p = l.code + 4 * (n - 1)
+  local b1, b2, b3, b4 = chunk:byte(p, p + 3)
+  return b1 | (b2 << 8) | (b3 << 16) | (b4 << 24)
+end
+
+local function setinstr(chunk, l, n, i)
+  local p = l.code + 4 * (n - 1)
+  local bytes = string.char(i & 0xff, (i >> 8) & 0xff, (i >> 16) & 0xff, (i >> 24) & 0xff)
+  return chunk:sub(1, p - 1) .. bytes .. chunk:sub(p + 4)
+end
+
+local function sizecode(chunk, l)
+  local n = 0
+  for k = l.sizecode + l.isz - 1, l.sizecode, -1 do n = (n << 8) | chunk:byte(k) end
+  return n
+end
+
+local function rejected(chunk, why)
+  local f, err = load(chunk, "=chunk", "b")
+  assert(f == nil, "accepted a chunk with " .. why)
+  assert(string.find(err, why, 1, true), err)
+end
+
+do
+  -- a well-formed chunk loads and runs
+  local chunk = string.dump(function() local x = 40 return x + 2 end, true)
+  assert(load(chunk, "=chunk", "b")() == 42)
+
+  -- registers beyond the frame
+  local l = layout(chunk)
+  rejected(chunk:sub(1, l.maxstack - 1) .. "\0" .. chunk:sub(l.maxstack + 1), "register out of range")
+
+  -- an opcode that does not exist
+  rejected(setinstr(chunk, l, 1, getinstr(chunk, l, 1) | 0x3f), "invalid opcode")
+
+  -- code running off its end
+  local n = sizecode(chunk, l)
+  rejected(setinstr(chunk, l, n, getinstr(chunk, l, 1)), "code does not end with a return")
+
+  -- a constant index beyond the constants (the LOADK of 40)
+  rejected(setinstr(chunk, l, 1, (getinstr(chunk, l, 1) & 0x3fff) | (200 << 14)), "constant out of range")
+
+  -- a jump out of the function (the back edge of the loop)
+  chunk = string.dump(function() while true do end end, true)
+  l = layout(chunk)
+  rejected(setinstr(chunk, l, 1, (getinstr(chunk, l, 1) & 0x3fff) | (0x3ffff << 14)), "jump out of range")
+
+  -- a truncated chunk
+  chunk = string.dump(function(a) return a end, true)
+  rejected(chunk:sub(1, #chunk - 3), "truncated")
+
+  -- functions quickened by running them are dumped with the generic opcodes
+  local function add(a, b) return a + b end
+  for i = 1, 10 do assert(add(i, 1) == i + 1) end
+  local again = load(string.dump(add, true), "=chunk", "b")
+  assert(again(1, 2) == 3 and again(1.5, 2.0) == 3.5)
+end
+
+local scripts = {"inline", "crypto", "integers", "fused", "icache", "quick", "const", "switch"}
+
+for _, name in ipairs(scripts) do
+  local result = TA_call(name, 0)
+  if result ~= "ok" then
+    error(name .. " returned " .. tostring(result))
+  end
+end
+
+return "ok"
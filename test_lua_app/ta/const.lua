@@ -0,0 +1,92 @@
+-- Compile-time constants (see localstat and test_then_block in lparser.c): folded expressions and conditions,
+-- branches that never run, and the compile errors
+
+local N <const> = 10
+local H <const> = 0.5
+local S <const> = "abc"
+local DEBUG <const> = false
+local NONE <const> = nil
+local A <const>, B <const> = 1, 2  -- read-only, only B is folded
+local T <const> = {}
+
+-- folded values keep their types
+assert(N * 2 == 20 and math.type(N * 2) == "integer")
+assert(H + H == 1.0 and math.type(H + H) == "float")
+assert(N // 4 == 2 and N / 4 == 2.5 and -N == -10)
+assert(S .. "d" == "abcd" and #S == 3)
+assert(A + B == 3 and NONE == nil)
+local function f() return N + 1 end
+assert(f() == 11)
+
+-- divisions by zero are left to run time
+local Z <const> = 0
+assert(not pcall(function() return N // Z end))
+assert(N / Z == 1 / 0)
+
+-- branches on constant conditions
+local taken = {}
+if DEBUG then error("dead if") end
+if not DEBUG then taken[#taken + 1] = 1 else error("dead else") end
+if N > 5 then taken[#taken + 1] = 2 elseif error("dead elseif") then error("dead") else error("dead else") end
+if NONE then error("dead nil") elseif S == "abc" then taken[#taken + 1] = 3 end
+if N < 5 then error("dead") elseif H then taken[#taken + 1] = 4 else error("dead else") end
+assert(#taken == 4 and taken[4] == 4)
+
+-- the branches that never run are dropped (the functions are compiled on one line, as dumps keep line numbers)
+local function code(body)
+  local src = "local N <const> = 10 local DEBUG <const> = false return function() " .. body .. " end"
+  return string.dump(load(src)(), true)
+end
+assert(code("if DEBUG then return 1 end return 1") == code("return 1"))
+assert(code("if N > 5 then return 1 elseif DEBUG then return 1 else return 1 end") == code("do return 1 end"))
+assert(code("local d = DEBUG if d then return 1 end return 1") ~= code("local d = DEBUG return 1"))
+
+-- locals and functions declared in a dropped branch
+if DEBUG then
+  local p, q = 1, 2
+  local function g() return p + q end
+  error(g())
+end
+local c = 3
+assert(c == 3)
+
+-- dead branches that a 'break' or a 'goto' leaves stay in the code
+local n = 0
+for i = 1, 3 do
+  if DEBUG then break end
+  n = n + 1
+end
+assert(n == 3)
+n = 0
+for i = 1, 3 do
+  if N == 10 then n = n + 1 elseif DEBUG then break else break end
+end
+assert(n == 3)
+if DEBUG then
+  goto skip
+end
+n = 4
+::skip::
+assert(n == 4)
+
+-- a constant may be shadowed, the table behind one may change
+do
+  local N = 1
+  N = N + 1
+  assert(N == 2)
+end
+assert(N == 10)
+T.x = 1
+assert(T.x == 1)
+
+-- assignments to constants do not compile
+local function rejected(src, msg)
+  local fn, err = load(src)
+  assert(fn == nil and string.find(err, msg, 1, true), tostring(err))
+end
+rejected("local x <const> = 1; x = 2", "attempt to assign to const variable 'x'")
+rejected("local x <const> = 1; return function() x = 2 end", "attempt to assign to const variable 'x'")
+rejected("local t <const> = {}; t = {}", "attempt to assign to const variable 't'")
+rejected("local x <close> = 1", "unknown attribute 'close'")
+
+return "ok"
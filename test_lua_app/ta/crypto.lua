@@ -0,0 +1,32 @@
+-- tee.crypto ciphers (see tee_cryptolib.c)
+
+local crypto = tee.crypto
+local key = string.rep("k", 16)
+local iv = string.rep("i", 16)
+local message = "a message that is not a multiple of the block size"
+
+-- Modes without padding are not offered, they panic the TA on a partial block
+for _, alg in ipairs({"aes-ecb", "aes-cbc"}) do
+  assert(not pcall(crypto.new_cipher, alg, "encrypt", key, iv))
+end
+
+-- CTR in one go and in pieces
+local enc = crypto.new_cipher("aes-ctr", "encrypt", key, iv)
+local ct = enc:final(message)
+assert(#ct == #message and ct ~= message)
+enc:init(iv)
+assert(enc:update(message:sub(1, 5)) .. enc:update(message:sub(6, 20)) .. enc:final(message:sub(21)) == ct)
+local dec = crypto.new_cipher("aes-ctr", "decrypt", key, iv)
+assert(dec:final(ct) == message)
+
+-- GCM with additional data, and a tag that does not match
+enc = crypto.new_cipher("aes-gcm", "encrypt", key, "nonce", "header")
+local gct, tag = enc:final(message)
+assert(#tag == 16)
+dec = crypto.new_cipher("aes-gcm", "decrypt", key, "nonce", "header")
+assert(dec:final(gct, tag) == message)
+dec:init("nonce", "other header")
+local pt, err = dec:final(gct, tag)
+assert(pt == nil and err == "authentication failed")
+
+return "ok"
@@ -0,0 +1,90 @@
+-- Superinstructions (see luaK_fuse in lcode.c): each pair with the operand types changing, metamethods, errors
+-- raised by the second instruction and jumps to the second instruction
+
+local function fails(f, msg)
+  local ok, err = pcall(f)
+  assert(not ok and string.find(err, msg, 1, true), tostring(err))
+end
+
+local V
+V = setmetatable({}, {
+  __add = function(a, b) return V end,
+  __mul = function(a, b) return V end,
+})
+
+-- MOVE_MOVE and MOVE_CALL
+local function id(...) return ... end
+local function swap(a, b)
+  a, b = b, a
+  return a, b
+end
+local a, b = swap(1, 2)
+assert(a == 2 and b == 1)
+a, b = swap("x", nil)
+assert(a == nil and b == "x")
+local x, y = 3, 4
+assert(id(x) == 3 and select("#", id(x, y)) == 2)
+local function callnum(v) local h = 5; h(v) end
+fails(callnum, "attempt to call a number value (local 'h')")
+
+-- LOADK_CALL
+assert(id("k") == "k" and id(1.5) == 1.5)
+fails(function() local h; h("k") end, "attempt to call a nil value (local 'h')")
+
+-- GETTABUP_GETTABLE
+assert(string.format("%d", 7) == "7")
+lib = setmetatable({}, {__index = function(t, k) return k .. "!" end})
+assert(lib.foo == "foo!")
+lib = {foo = 1}
+assert(lib.foo == 1)
+lib = nil
+fails(function() return lib.foo end, "attempt to index a nil value (global 'lib')")
+
+-- SETTABLE_FORLOOP, with a constant key, a register key, through __newindex and a loop that does not run
+local function fill(t, n)
+  for i = 1, n do t[i] = i end
+  return t
+end
+local function last(t, n)
+  for i = 1, n do t.last = i end
+  return t
+end
+assert(#fill({}, 5) == 5)
+assert(last({}, 5).last == 5)
+assert(last({}, 0).last == nil)
+assert(next(fill({}, 0)) == nil)
+local seen = {}
+local proxy = setmetatable({}, {__newindex = function(t, k, v) seen[#seen + 1] = k end})
+fill(proxy, 3)
+last(proxy, 2)
+assert(#seen == 5 and seen[3] == 3 and seen[4] == "last" and rawget(proxy, "last") == nil)
+local function fillf(t)
+  for i = 0.5, 2.5 do t[i] = true end
+  return t
+end
+local f = fillf({})
+assert(f[0.5] and f[1.5] and f[2.5] and f[3.5] == nil)
+fails(function() fill(nil, 1) end, "attempt to index a nil value (local 't')")
+
+-- ADD_FORLOOP, with the sum changing type
+local function sum(s, n)
+  for i = 1, n do s = s + i end
+  return s
+end
+assert(sum(0, 10) == 55 and math.type(sum(0, 10)) == "integer")
+assert(sum(0.5, 10) == 55.5)
+assert(sum(0, 0) == 0)
+assert(sum(V, 3) == V)
+assert(sum(10, 4) == 20)
+fails(function() sum(nil, 1) end, "attempt to perform arithmetic on a nil value (local 's')")
+
+-- MUL_MUL, with the first and the second product changing type
+local function mul3(a, b, c) return a * b * c end
+assert(mul3(2, 3, 4) == 24 and math.type(mul3(2, 3, 4)) == "integer")
+assert(mul3(2.0, 3, 4) == 24.0 and math.type(mul3(2, 3, 4.0)) == "float")
+assert(mul3(2, 3, 4) == 24)
+assert(mul3(V, 3, 4) == V and mul3(2, 3, V) == V)
+assert(mul3("2", 3, 4) == 24)
+fails(function() mul3(2, 3, nil) end, "attempt to perform arithmetic on a nil value (local 'c')")
+
+return "ok"
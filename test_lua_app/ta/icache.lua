@@ -0,0 +1,69 @@
+-- Inline caches of constant-key accesses (see luaH_getcached in ltable.c): the same instruction on tables of
+-- other shapes, across rehashes and removed keys, and falling back to the metamethods
+
+local function get(t) return t.x end
+local function set(t, v) t.x = v end
+
+-- hits, then misses on tables with the key at another node or without it
+local a = {x = 1}
+local b = {p = 1, q = 2, r = 3, x = 4}
+local c = {p = 1}
+for i = 1, 3 do
+  assert(get(a) == 1 and get(b) == 4 and get(c) == nil)
+end
+
+-- the table growing and rehashing around the cached node
+local t = {x = 0}
+for i = 1, 100 do
+  t["k" .. i] = i
+  set(t, i)
+  assert(get(t) == i)
+end
+for i = 1, 100 do t["k" .. i] = nil end
+assert(get(t) == 100)
+
+-- a removed key, before and after a collection has marked its node dead
+set(t, nil)
+assert(get(t) == nil)
+collectgarbage()
+assert(get(t) == nil)
+set(t, 5)
+assert(get(t) == 5 and rawget(t, "x") == 5)
+
+-- the metamethods are called when the cached node has no value
+local log = {}
+local mt = {
+  __index = function(_, k) return "default " .. k end,
+  __newindex = function(tt, k, v) log[#log + 1] = k; rawset(tt, k, v) end,
+}
+local p = setmetatable({x = 1}, mt)
+assert(get(p) == 1)
+set(p, 2)
+assert(#log == 0 and get(p) == 2)
+set(p, nil)
+assert(#log == 0 and get(p) == "default x")
+set(p, 3)
+assert(#log == 1 and log[1] == "x" and get(p) == 3)
+local q = setmetatable({}, {__index = {x = "inherited"}})
+assert(get(q) == "inherited")
+rawset(q, "x", "own")
+assert(get(q) == "own")
+
+-- not a table
+local ok, err = pcall(get, 1)
+assert(not ok and string.find(err, "attempt to index a number value", 1, true))
+assert(get("str") == nil)
+
+-- globals go through the cache of _ENV
+local function getg() return cachedglobal end
+cachedglobal = 1
+assert(getg() == 1)
+for i = 1, 100 do _ENV["g" .. i] = i end
+assert(getg() == 1)
+cachedglobal = nil
+assert(getg() == nil)
+for i = 1, 100 do _ENV["g" .. i] = nil end
+cachedglobal = 2
+assert(getg() == 2)
+
+return "ok"
@@ -0,0 +1,32 @@
+-- Calls of inlined <const> functions in statements that still have locals pending (see inlinecall in lparser.c)
+
+local k <const> = function(a) return a + 1 end
+local pair <const> = function(a) return {a, a} end
+local seven <const> = function() return 7 end
+
+local u = k(1)
+assert(u == 2)
+
+local v, w = k(1), k(2)
+assert(v == 2 and w == 3)
+
+local t = {k(1)}
+assert(t[1] == 2)
+
+t = {x = k(1)}
+assert(t.x == 2)
+
+local s = 0
+for i = k(0), k(2) do s = s * 10 + i end
+assert(s == 123)
+
+t = pair(3)
+assert(t[1] == 3 and t[2] == 3)
+
+local p, q, r = 5, k(k(1)), k(u + w)
+assert(p == 5 and q == 3 and r == 6)
+
+local z = seven()
+assert(z == 7)
+
+return "ok"
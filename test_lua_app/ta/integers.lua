@@ -0,0 +1,56 @@
+-- Integer arithmetic with 64-bit integers, and with the 32-bit ones of LUA_NANBOX, which raise an error where a
+-- 64-bit result would not fit instead of wrapping around (see checkedintop in lvm.h)
+
+local wide = math.maxinteger > 2147483647
+
+-- The kernel of benchmark_lua_app/ta/compute.lua
+local function kernel(n)
+  local sum = 0
+  for i = 1, n do
+    local sq = i * i
+    sum = sum + (sq - (sq // 7) * 7)
+  end
+  return sum
+end
+
+-- Results that fit into 32 bits are the same in both builds
+assert(kernel(46340) == 92680)
+assert(46340 * 46340 == 2147395600)
+assert(-2147483647 - 1 == -2147483648)
+assert(math.type(2147483647) == "integer")
+assert(7 // -1 == -7 and -7 // 2 == -4)
+
+local function add(a, b) return a + b end
+local function sub(a, b) return a - b end
+local function mul(a, b) return a * b end
+local function unm(a) return -a end
+local function idiv(a, b) return a // b end
+
+local max32, min32 = 2147483647, -2147483647 - 1
+
+if wide then
+  assert(kernel(100000) == 200003)
+  assert(mul(46341, 46341) == 2147488281)
+  assert(add(max32, 1) == 2147483648)
+  assert(sub(min32, 1) == -2147483649)
+  assert(unm(min32) == 2147483648)
+  assert(idiv(min32, -1) == 2147483648)
+  assert(math.maxinteger + 1 == math.mininteger)  -- 64-bit integers still wrap around
+else
+  local function overflows(f, ...)
+    local ok, err = pcall(f, ...)
+    return not ok and err:find("integer overflow", 1, true) ~= nil
+  end
+  assert(math.maxinteger == max32)
+  assert(overflows(kernel, 100000))
+  assert(overflows(mul, 46341, 46341))
+  assert(overflows(add, max32, 1))
+  assert(overflows(sub, min32, 1))
+  assert(overflows(unm, min32))
+  assert(overflows(idiv, min32, -1))
+  -- Constants are not folded when they would overflow, the error is raised when the code runs
+  assert(overflows(load("return 2147483647 + 1")))
+  assert(overflows(load("return 65536 * 65536")))
+end
+
+return "ok"
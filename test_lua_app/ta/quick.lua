@@ -0,0 +1,66 @@
+-- Quickened arithmetic and comparisons (see the note in lopcodes.h): each instruction is quickened to the types
+-- it sees first, then runs with other types and goes back to the generic opcode
+
+local function fails(f, msg)
+  local ok, err = pcall(f)
+  assert(not ok and string.find(err, msg, 1, true), tostring(err))
+end
+
+local function add(a, b) return a + b end
+local function sub(a, b) return a - b end
+local function mul(a, b) return a * b end
+local function addk(a) return a + 1 end
+local function lt(a, b) return a < b end
+local function le(a, b) return a <= b end
+
+local V
+V = setmetatable({}, {
+  __add = function() return "add" end,
+  __sub = function() return "sub" end,
+  __mul = function() return "mul" end,
+  __lt = function() return true end,
+  __le = function() return false end,
+})
+
+local function same(x, y)
+  return x == y and math.type(x) == math.type(y)
+end
+
+for round = 1, 2 do
+  -- integers, floats, mixed, strings, metamethods and integers again
+  assert(same(add(2, 3), 5) and same(sub(2, 3), -1) and same(mul(2, 3), 6) and same(addk(2), 3))
+  assert(same(add(2.5, 3.0), 5.5) and same(sub(2.5, 3.0), -0.5) and same(mul(2.5, 2.0), 5.0))
+  assert(same(addk(2.5), 3.5))
+  assert(same(add(2, 3.0), 5.0) and same(sub(2.0, 3), -1.0) and same(mul(2, 0.5), 1.0))
+  assert(add("2", 3) == 5 and sub(2, "3") == -1 and mul("2", "3") == 6)
+  assert(add(V, 1) == "add" and sub(1, V) == "sub" and mul(V, V) == "mul" and addk(V) == "add")
+  assert(same(add(2, 3), 5) and same(sub(2, 3), -1) and same(mul(2, 3), 6) and same(addk(2), 3))
+
+  assert(lt(1, 2) and not lt(2, 1) and le(2, 2) and not le(3, 2))
+  assert(lt(1, 1.5) and not lt(1.5, 1) and le(1.0, 1) and not le(1, 0.5))
+  assert(lt(-0.0, 1) and le(0, -0.0))
+  assert(lt("a", "b") and not lt("b", "a") and le("a", "a"))
+  assert(lt(V, V) and not le(V, V))
+  assert(lt(1, 2) and not lt(2, 1) and le(2, 2) and not le(3, 2))
+end
+
+-- errors after the instruction was quickened
+assert(add(1, 1) == 2 and lt(1, 2))
+fails(function() add(1, nil) end, "attempt to perform arithmetic on a nil value (local 'b')")
+fails(function() addk({}) end, "attempt to perform arithmetic on a table value (local 'a')")
+fails(function() lt(1, "2") end, "attempt to compare number with string")
+fails(function() le(nil, 1) end, "attempt to compare nil with number")
+
+-- the types changing at every iteration of a hot loop
+local values = {1, 2.5, 3, 4.5}
+local s, n, below = 0, 0, 0
+for i = 1, 400 do
+  local v = values[(i & 3) + 1]
+  s = s + v
+  n = n * 1 + v - v
+  if v < 3 then below = below + 1 end
+  if 2 <= v then below = below + 0 end
+end
+assert(s == 1100.0 and math.type(s) == "float" and n == 0 and below == 200)
+
+return "ok"
@@ -0,0 +1,90 @@
+-- if/elseif chains dispatched through OP_SWITCH (see ifstat in lparser.c and newswitch in lfunc.c): integer and
+-- string keys, float values, the miss path and chains that end before the last branch
+
+local LONG = string.rep("long string key ", 4)  -- not a short string
+
+local function int(x)
+  if x == 1 then return "one"
+  elseif x == 2 then return "two"
+  elseif 3 == x then return "three"
+  elseif x == -4 then return "minus four"
+  elseif x == 2 then return "second two"
+  elseif x == 0 then return "zero"
+  elseif x == math.maxinteger then return "max"
+  else return "miss" end
+end
+
+assert(int(1) == "one" and int(2) == "two" and int(3) == "three" and int(-4) == "minus four")
+assert(int(0) == "zero" and int(math.maxinteger) == "max")
+-- float values equal to an integer key
+assert(int(2.0) == "two" and int(-4.0) == "minus four" and int(-0.0) == "zero")
+-- misses
+assert(int(5) == "miss" and int(2.5) == "miss" and int(0 / 0) == "miss" and int(1 / 0) == "miss")
+assert(int("1") == "miss" and int(nil) == "miss" and int(true) == "miss" and int({}) == "miss")
+assert(int(setmetatable({}, {__eq = function() return true end})) == "miss")
+
+local function str(s)
+  local r = "none"  -- no else: a miss falls through
+  if s == "a" then r = "A"
+  elseif s == "b" then r = "B"
+  elseif s == "" then r = "empty"
+  elseif s == "long string key long string key long string key long string key " then r = "long"
+  elseif s == "a" then r = "second A"
+  end
+  return r
+end
+
+assert(str("a") == "A" and str("b") == "B" and str("") == "empty" and str(LONG) == "long")
+assert(str(string.rep("long string key ", 4)) == "long" and str("a" .. "") == "A")
+assert(str("c") == "none" and str(1) == "none" and str(nil) == "none" and str(LONG .. " ") == "none")
+
+-- integer and string keys in one chain, and a float constant that ends the chain
+local function mixed(x)
+  if x == 1 then return 1
+  elseif x == "1" then return "1"
+  elseif x == 2 then return 2
+  elseif x == "2" then return "2"
+  elseif x == 2.5 then return 2.5
+  elseif x == 3 then return 3
+  end
+  return "miss"
+end
+
+assert(mixed(1) == 1 and mixed("1") == "1" and mixed(2.0) == 2 and mixed("2") == "2")
+assert(mixed(2.5) == 2.5 and mixed(3) == 3 and mixed(3.0) == 3 and mixed(4) == "miss")
+
+-- the chain ends at a test of another variable or a compound condition: those still run in order
+local function partial(x, y)
+  if x == 1 then return "one"
+  elseif x == 2 then return "two"
+  elseif x == 3 then return "three"
+  elseif x == 4 then return "four"
+  elseif y == 5 then return "y"
+  elseif x == 5 and y then return "five"
+  elseif x == 6 then return "six"
+  else return "miss" end
+end
+
+assert(partial(4, 5) == "four" and partial(1, 5) == "one" and partial(9, 5) == "y")
+assert(partial(5, true) == "five" and partial(5, false) == "miss" and partial(6) == "six" and partial(7) == "miss")
+
+-- in a hot loop, with a 'break' after the chain and nested chains
+local counts = {0, 0, 0, 0, 0}
+for i = 1, 400 do
+  local k = (i & 7) + 1
+  if k == 1 then counts[1] = counts[1] + 1
+  elseif k == 2 then counts[2] = counts[2] + 1
+  elseif k == 3 then
+    local s = (i & 8) == 0 and "x" or "y"
+    if s == "x" then counts[3] = counts[3] + 1
+    elseif s == "y" then counts[3] = counts[3] + 2
+    elseif s == "z" then error("z")
+    elseif s == "w" then error("w")
+    end
+  elseif k == 4 then counts[4] = counts[4] + 1
+  elseif k == 9 then break
+  else counts[5] = counts[5] + 1 end
+end
+assert(counts[1] == 50 and counts[2] == 50 and counts[3] == 75 and counts[4] == 50 and counts[5] == 200)
+
+return "ok"